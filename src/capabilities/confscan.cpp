@@ -35,6 +35,7 @@
 
 #include "src/core/fileiterator.h"
 
+#include "src/core/energycache.h"
 #include "src/core/energycalculator.h"
 
 #include "src/tools/general.h"
@@ -222,6 +223,7 @@ void ConfScan::LoadControlJson()
     m_useorders = Json2KeyWord<int>(m_defaults, "UseOrders");
     m_MaxHTopoDiff = Json2KeyWord<int>(m_defaults, "MaxHTopoDiff");
     m_threads = m_defaults["threads"].get<int>();
+    m_processes = Json2KeyWord<int>(m_defaults, "processes");
     m_RMSDmethod = Json2KeyWord<std::string>(m_defaults, "RMSDMethod");
     if (m_RMSDmethod == "molalign") {
         fmt::print(fg(fmt::color::green) | fmt::emphasis::bold, "\nPlease cite the follow research report!\nJ. Chem. Inf. Model. 2023, 63, 4, 1157–1165 - DOI: 10.1021/acs.jcim.2c01187\n\n");
@@ -265,6 +267,37 @@ void ConfScan::LoadControlJson()
         m_useorders = 10;
 }
 
+std::vector<Molecule*> ConfScan::ReadMolecules(const std::string& filename, std::vector<double>& energies)
+{
+    std::vector<Molecule*> molecules;
+    std::vector<Molecule> missing;
+    std::vector<int> index;
+    FileIterator file(filename);
+    while (!file.AtEnd()) {
+        Molecule* mol = new Molecule(file.Next());
+        if (std::abs(mol->Energy()) < 1e-5 || m_method.compare("") != 0) {
+            missing.push_back(*mol);
+            index.push_back(molecules.size());
+        }
+        energies.push_back(mol->Energy());
+        molecules.push_back(mol);
+    }
+    /* all missing energies in one parallel batch instead of a new calculator per structure */
+    if (missing.size()) {
+        if (m_method == "")
+            m_method = "gfn2";
+        json controller = m_controller;
+        controller["processes"] = m_processes;
+        controller["energy_cache"] = Json2KeyWord<bool>(m_defaults, "energy_cache");
+        controller["energy_cache_file"] = Json2KeyWord<std::string>(m_defaults, "energy_cache_file");
+        EnergyCalculator interface(m_method, controller);
+        const std::vector<double> calculated = interface.CalculateEnergies(missing, m_threads);
+        for (int i = 0; i < index.size(); ++i)
+            energies[index[i]] = calculated[i];
+    }
+    return molecules;
+}
+
 bool ConfScan::openFile()
 {
     bool xyzfile = std::string(m_filename).find(".xyz") != std::string::npos || std::string(m_filename).find(".trj") != std::string::npos;
@@ -274,21 +307,9 @@ bool ConfScan::openFile()
 
     int molecule = 0;
     PersistentDiagram diagram(m_defaults);
-    FileIterator file(m_filename);
-    while (!file.AtEnd()) {
-        Molecule* mol = new Molecule(file.Next());
-        double energy = mol->Energy();
-        if (std::abs(energy) < 1e-5 || m_method.compare("") != 0) {
-            // XTBInterface interface; // As long as xtb leaks, we have to put it heare
-            if (m_method == "")
-                m_method = "gfn2";
-            EnergyCalculator interface(m_method, m_controller);
-            // I might not leak really, but was unable to clear everything
-
-            interface.setMolecule(mol);
-            energy = interface.CalculateEnergy(false);
-        }
-        m_ordered_list.insert(std::pair<double, int>(energy, molecule));
+    std::vector<double> energies;
+    for (Molecule* mol : ReadMolecules(m_filename, energies)) {
+        m_ordered_list.insert(std::pair<double, int>(energies[molecule], molecule));
         molecule++;
         if (m_noname)
             mol->setName(NamePattern(molecule));
@@ -308,23 +329,11 @@ bool ConfScan::openFile()
         if (xyzfile == false)
             throw 1;
 
-        int molecule = 0;
-
-        FileIterator file(m_prev_accepted);
-        while (!file.AtEnd()) {
-            Molecule* mol = new Molecule(file.Next());
-            double energy = mol->Energy();
-            if (std::abs(energy) < 1e-5 || m_method.compare("") != 0) {
-                // XTBInterface interface; // As long as xtb leaks, we have to put it heare
-                if (m_method == "")
-                    m_method = "gfn2";
-                EnergyCalculator interface(m_method, m_controller);
-                // I might not leak really, but was unable to clear everything
-
-                interface.setMolecule(mol);
-                energy = interface.CalculateEnergy(false);
-            }
-            min_energy = std::min(min_energy, energy);
+        std::vector<double> accepted_energies;
+        const std::vector<Molecule*> accepted = ReadMolecules(m_prev_accepted, accepted_energies);
+        for (int i = 0; i < accepted.size(); ++i) {
+            Molecule* mol = accepted[i];
+            min_energy = std::min(min_energy, accepted_energies[i]);
             mol->CalculateRotationalConstants();
 
             diagram.setDimension(2);
@@ -1255,6 +1264,8 @@ void ConfScan::Finalise()
             molecule->appendXYZFile(m_threshold_filename);
     }
     std::cout << m_stored_structures.size() << " structures were kept - of " << m_molecules.size() - m_fail << " total!" << std::endl;
+    EnergyCache::Instance().Flush();
+    EnergyCache::Instance().PrintStatistics();
 }
 
 bool ConfScan::AddRules(const std::vector<int>& rules)
@@ -68,6 +68,9 @@ static const json ConfScanJson = {
     { "RMSDMethod", "hybrid" },
     { "MaxHTopoDiff", -1 },
     { "threads", 1 },
+    { "processes", 0 },
+    { "energy_cache", false },
+    { "energy_cache_file", "" },
     { "RMSDElement", 7 },
     { "accepted", "" },
     { "method", "" },
@@ -306,6 +309,9 @@ private:
 
     bool openFile();
 
+    /*! \brief All structures of filename with their energies, missing energies (or all with a method given) are calculated in parallel */
+    std::vector<Molecule*> ReadMolecules(const std::string& filename, std::vector<double>& energies);
+
     std::vector<std::vector<int>> m_reorder_rules;
 
     void PrintStatus(const std::string& info = "");
@@ -354,7 +360,7 @@ private:
     int m_looseThresh = 7, m_tightThresh = 3;
     std::string m_RMSDmethod = "hybrid";
     int m_MaxHTopoDiff = -1;
-    int m_threads = 1;
+    int m_threads = 1, m_processes = 0;
     int m_RMSDElement = 7;
     int m_molaligntol = 10;
 
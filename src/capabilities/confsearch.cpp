@@ -96,6 +96,8 @@ void ConfSearch::start()
         nlohmann::json opt = CurcumaOptJson;
         opt["gfn"] = m_gfn;
         opt["threads"] = m_threads;
+        opt["energy_cache"] = m_energy_cache;
+        opt["energy_cache_file"] = m_energy_cache_file;
         PerformOptimisation(std::string("fff"), opt);
 
         nlohmann::json scan = ConfSearchJson;
@@ -103,6 +105,8 @@ void ConfSearch::start()
         scan["fewerFile"] = true;
         scan["threads"] = m_threads;
         scan["gfn"] = m_gfn;
+        scan["energy_cache"] = m_energy_cache;
+        scan["energy_cache_file"] = m_energy_cache_file;
 
         PerformFilter(std::string("fff"), scan);
         /*
@@ -222,4 +226,6 @@ void ConfSearch::LoadControlJson()
     m_repeat = Json2KeyWord<int>(m_defaults, "repeat");
     m_rmsd = Json2KeyWord<double>(m_defaults, "rmsd");
     m_threads = Json2KeyWord<int>(m_defaults, "threads");
+    m_energy_cache = Json2KeyWord<bool>(m_defaults, "energy_cache");
+    m_energy_cache_file = Json2KeyWord<std::string>(m_defaults, "energy_cache_file");
 }
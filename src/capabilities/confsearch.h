@@ -42,7 +42,9 @@ static const nlohmann::json ConfSearchJson{
     { "repeat", 5 },
     { "time", 1e4 }, // 10 ps
     { "rmsd", 1.25 },
-    { "threads", 1 }
+    { "threads", 1 },
+    { "energy_cache", false },
+    { "energy_cache_file", "" }
 };
 
 class Molecule;
@@ -82,8 +84,8 @@ private:
     virtual void LoadControlJson() override;
 
     StringList m_error_list;
-    std::string m_filename, m_basename;
-    bool m_silent = true;
+    std::string m_filename, m_basename, m_energy_cache_file;
+    bool m_silent = true, m_energy_cache = false;
 
     std::vector<Molecule*> m_in_stack, m_final_stack;
     int m_gfn = 44, m_spin = 0, m_charge = 0, m_repeat = 5, m_threads = 1;
@@ -20,6 +20,7 @@
 #include "src/capabilities/rmsd.h"
 
 #include "src/core/elements.h"
+#include "src/core/energycache.h"
 #include "src/core/energycalculator.h"
 #include "src/core/fileiterator.h"
 #include "src/core/global.h"
@@ -105,6 +106,8 @@ void CurcumaOpt::start()
     else {
         ProcessMoleculesSerial(m_molecules);
     }
+    EnergyCache::Instance().Flush();
+    EnergyCache::Instance().PrintStatistics();
 }
 
 void CurcumaOpt::ProcessMoleculesSerial(const std::vector<Molecule>& molecules)
@@ -123,7 +126,6 @@ void CurcumaOpt::ProcessMoleculesSerial(const std::vector<Molecule>& molecules)
         auto start = std::chrono::system_clock::now();
         interface.updateGeometry(iter->Coords());
         double energy = interface.CalculateEnergy(true, true);
-        std::cout << "dipole?" << std::endl;
 #ifdef USE_TBLITE
         if (method.compare("gfn2") == 0) {
             std::vector<double> dipole = interface.Dipole();
@@ -145,6 +147,12 @@ void CurcumaOpt::ProcessMoleculesSerial(const std::vector<Molecule>& molecules)
 
 void CurcumaOpt::ProcessMolecules(const std::vector<Molecule>& molecules)
 {
+    /* only the reentrant methods gain from the batch, the others keep one SPThread per structure with
+     * the verbose output of the method, the timing and the gfn2 dipole */
+    if (m_singlepoint && EnergyCalculator::ThreadSafe(m_method)) {
+        ProcessSinglePoints(molecules);
+        return;
+    }
     int threads = m_threads;
 
     CxxThreadPool* pool = new CxxThreadPool;
@@ -202,6 +210,31 @@ void CurcumaOpt::ProcessMolecules(const std::vector<Molecule>& molecules)
     delete pool;
 }
 
+void CurcumaOpt::ProcessSinglePoints(const std::vector<Molecule>& molecules)
+{
+    auto start = std::chrono::system_clock::now();
+    EnergyCalculator interface(m_method, m_defaults);
+    const std::vector<double> energies = interface.CalculateEnergies(molecules, m_threads);
+    auto end = std::chrono::system_clock::now();
+
+    std::vector<Molecule> results;
+    for (int i = 0; i < molecules.size(); ++i) {
+        if (molecules[i].AtomCount() == 0)
+            continue;
+        Molecule molecule(molecules[i]);
+        molecule.setEnergy(energies[i]);
+        std::cout << fmt::format("Single Point Energy = {0} Eh\n", energies[i]);
+        if (m_hessian) {
+            Hessian hess(m_method, m_defaults, m_threads);
+            hess.setMolecule(molecule);
+            hess.CalculateHessian(true);
+        }
+        results.push_back(molecule);
+    }
+    std::cout << fmt::format("{0} single points in {1} secs\n", results.size(), std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() / 1000.0);
+    m_molecules = results;
+}
+
 void CurcumaOpt::clear()
 {
     m_molecules.clear();
@@ -224,12 +257,14 @@ double CurcumaOpt::SinglePoint(const Molecule* initial, const json& controller,
 
     EnergyCalculator interface(method, controller);
     interface.setMolecule(*initial);
+    interface.setEnergyCache(true);
 
     double energy = interface.CalculateEnergy(true, true);
     std::cout << "dipole1" << std::endl;
 
 #ifdef USE_TBLITE
-    if (method.compare("gfn2") == 0) {
+    /* no dipole if the energy came from the cache */
+    if (method.compare("gfn2") == 0 && interface.Dipole().size() == 3) {
         std::vector<double> dipole = interface.Dipole();
         std::cout << std::endl
                   << std::endl
@@ -274,6 +309,8 @@ Molecule CurcumaOpt::LBFGSOptimise(const Molecule* initial, const json& controll
 
     EnergyCalculator interface(method, controller);
     interface.setMolecule(*initial);
+    /* screening controllers may ask for single precision, the final optimisation always runs in double */
+    interface.setSinglePrecision(false);
 
     double final_energy = interface.CalculateEnergy(true);
 
@@ -472,6 +509,8 @@ Molecule CurcumaOpt::LBFGSOptimise(const Molecule* initial, const json& controll
         }
         previous.setEnergy(final_energy);
         previous.setGeometry(geometry);
+        /* a later filter or single point of the same structure finds the energy in the cache */
+        interface.CacheEnergy(previous, final_energy);
     }
     return previous;
 }
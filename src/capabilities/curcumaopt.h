@@ -36,6 +36,9 @@ static json CurcumaOptJson{
     { "ConvCount", 11 },
     { "GradNorm", 0.001 },
     { "Threads", 1 },
+    { "processes", 0 },
+    { "energy_cache", false },
+    { "energy_cache_file", "" },
     { "Charge", 0 },
     { "Spin", 0 },
     { "SinglePoint", false },
@@ -150,6 +153,9 @@ private:
     void ProcessMolecules(const std::vector<Molecule>& molecule);
     void ProcessMoleculesSerial(const std::vector<Molecule>& molecule);
 
+    /*! \brief Energies of all molecules with the calculator pool of EnergyCalculator::CalculateEnergies */
+    void ProcessSinglePoints(const std::vector<Molecule>& molecules);
+
     std::string m_filename, m_basename = "curcuma_job";
     std::string m_method = "UFF";
     Molecule m_molecule;
@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include "src/core/geometry_kernels.h"
 #include "src/core/global.h"
 #include "src/core/molecule.h"
 
@@ -38,7 +39,7 @@ inline Eigen::Matrix3d BestFitRotation(const Geometry& reference, const Geometry
      * https://github.com/oleg-alexandrov/projects/blob/e7b1eb7a4d83d41af563c24859072e4ddd9b730b/eigen/Kabsch.cpp
      */
 
-    Eigen::MatrixXd Cov = reference.transpose() * target;
+    Eigen::MatrixXd Cov = GeometryKernels::Covariance(reference, target);
     Eigen::JacobiSVD<Eigen::MatrixXd> svd(Cov, Eigen::ComputeThinU | Eigen::ComputeThinV);
 
     double d = (svd.matrixV() * svd.matrixU().transpose()).determinant();
@@ -58,7 +59,7 @@ inline Eigen::Matrix3d BestFitRotation(const Molecule& reference, const Molecule
 
 inline Geometry applyRotation(const Geometry& geometry, const Eigen::Matrix3d& rotation)
 {
-    return geometry * rotation;
+    return GeometryKernels::Rotate(geometry, rotation);
 }
 
 inline Geometry getAligned(const Geometry& reference, const Geometry& target, int factor)
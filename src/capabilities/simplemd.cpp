@@ -98,6 +98,7 @@ void SimpleMD::LoadControlJson()
         };
         m_rattle_tolerance = Json2KeyWord<double>(m_defaults, "rattle_tolerance");
 
+        m_rattle = true;
         std::cout << "Using rattle to constrained bonds!" << std::endl;
     } else {
         m_integrator = [=](double* coord, double* grad) {
@@ -125,6 +126,8 @@ bool SimpleMD::Initialise()
     }
     if (m_molecule.AtomCount() == 0)
         return false;
+    /* dT may come from the restart file as well */
+    m_dt2 = m_timestep * m_timestep;
 
     if (!m_restart) {
         std::ofstream result_file;
@@ -145,6 +148,21 @@ bool SimpleMD::Initialise()
     }
 
     m_gradient = std::vector<double>(3 * m_natoms, 0);
+    m_fast_gradient = std::vector<double>(3 * m_natoms, 0);
+    m_slow_gradient = std::vector<double>(3 * m_natoms, 0);
+    /* respa may come from the restart file, so the integrator is picked after it was read */
+    if (m_respa > 1 && m_rattle) {
+        std::cout << "Multiple time steps are not combined with rattle, respa is ignored!" << std::endl;
+        m_respa = 1;
+    } else if (m_respa > 1 && !m_interface->HasForceGroups()) {
+        std::cout << "Multiple time steps need a method with separate bonded and nonbonded forces (UFF), continuing with Verlet!" << std::endl;
+        m_respa = 1;
+    } else if (m_respa > 1) {
+        std::cout << "Using r-RESPA, nonbonded forces are updated every " << m_respa << " steps!" << std::endl;
+        m_integrator = [=](double* coord, double* grad) {
+            this->Respa(coord, grad);
+        };
+    }
 
     if(m_opt)
     {
@@ -202,6 +220,14 @@ bool SimpleMD::Initialise()
     m_molecule.setSpin(m_spin);
     m_interface->setMolecule(m_molecule);
 
+    if (m_molecule.isPeriodic()) {
+        /* constraints are applied to plain coordinate differences, so constrained atoms stay unwrapped */
+        m_wrap = !m_rattle;
+        std::cout << "Periodic cell " << m_molecule.Cell().toString() << (m_wrap ? ", atoms are wrapped into the cell" : ", atoms are not wrapped with rattle") << std::endl;
+        if (m_centered)
+            std::cout << "Rotation can not be removed in a periodic cell, only the translation is removed!" << std::endl;
+    }
+
     if (m_writeUnique) {
         json rmsdtraj = RMSDTrajJson;
         rmsdtraj["writeUnique"] = true;
@@ -394,10 +420,10 @@ bool SimpleMD::LoadRestartInformation(const json& state)
     } catch (json::type_error& e) {
     }
     if (geometry.size()) {
-        m_current_geometry = Tools::String2DoubleVec(geometry);
+        m_current_geometry = Tools::String2DoubleVec(geometry, "|");
     }
     if (velocities.size()) {
-        m_velocities = Tools::String2DoubleVec(velocities);
+        m_velocities = Tools::String2DoubleVec(velocities, "|");
     }
     m_restart = geometry.size() && velocities.size();
 
@@ -427,6 +453,7 @@ void SimpleMD::start()
     } else {
         std::cout << "No Thermostat applied\n"
                   << std::endl;
+        ThermostatFunction = []() {};
     }
 
 #ifdef GCC
@@ -455,8 +482,12 @@ void SimpleMD::start()
     m_Epot = Gradient(coord, gradient);
     m_Ekin = EKin();
     m_Etot = m_Epot + m_Ekin;
+    m_respa_ready = false;
 
+    /* m_step counts time steps of dt, with respa one pass of the loop integrates m_respa of them. dump, print,
+     * centered and writerestart are due once the step they ask for was reached in the last pass */
     int m_step = 0;
+    auto due = [&m_step, this](int every) { return m_step % every < m_respa; };
 
     PrintStatus();
 
@@ -465,7 +496,7 @@ void SimpleMD::start()
             TriggerWriteRestart();
             return;
         }
-        if (m_step % m_dumb == 0) {
+        if (due(m_dumb)) {
             bool write = WriteGeometry();
             if (write) {
                 states.push_back(WriteRestartInformation());
@@ -486,16 +517,22 @@ void SimpleMD::start()
                     coord[i] = m_current_geometry[i];
                 }
                 Gradient(coord, gradient);
+                m_respa_ready = false;
                 m_Ekin = EKin();
                 m_Etot = m_Epot + m_Ekin;
                 m_current_rescue++;
                 PrintStatus();
             }
         }
-        if (m_centered && m_step % m_centered == 0 && m_step >= m_centered) {
-            RemoveRotation(m_velocities);
+        if (m_centered && due(m_centered) && m_step >= m_centered) {
+            if (m_molecule.isPeriodic())
+                RemoveTranslation(m_velocities);
+            else
+                RemoveRotation(m_velocities);
         }
         m_integrator(coord, gradient);
+        if (m_wrap)
+            WrapCoordinates(coord);
         if (m_unstable) {
             PrintStatus();
             fmt::print(fg(fmt::color::salmon) | fmt::emphasis::bold, "Simulation got unstable, exiting!\n");
@@ -506,12 +543,12 @@ void SimpleMD::start()
         }
         ThermostatFunction();
         m_Ekin = EKin();
-        if (m_writerestart > -1 && m_step % m_writerestart == 0) {
+        if (m_writerestart > 0 && due(m_writerestart)) {
             std::ofstream restart_file("curcuma_step_" + std::to_string(m_step) + ".json");
             nlohmann::json restart;
             restart_file << WriteRestartInformation() << std::endl;
         }
-        if ((m_step && m_step % m_print == 0)) {
+        if ((m_step && due(m_print))) {
             m_Etot = m_Epot + m_Ekin;
             PrintStatus();
         }
@@ -526,8 +563,8 @@ void SimpleMD::start()
             fmt::print(fg(fmt::color::salmon) | fmt::emphasis::bold, "Nothing really helps");
             break;
         }
-        m_step++;
-        m_currentStep += m_timestep;
+        m_step += m_respa;
+        m_currentStep += m_timestep * m_respa;
     }
     if (m_thermostat.compare("csvr") == 0)
         std::cout << "Exchange with heat bath " << m_Ekin_exchange << "Eh" << std::endl;
@@ -574,7 +611,7 @@ void SimpleMD::Verlet(double* coord, double* grad)
         m_velocities[3 * i + 1] -= 0.5 * m_timestep * grad[3 * i + 1] * m_rmass[3 * i + 1];
         m_velocities[3 * i + 2] -= 0.5 * m_timestep * grad[3 * i + 2] * m_rmass[3 * i + 2];
 
-        ekin += m_mass[i] * (m_velocities[3 * i] * m_velocities[3 * i] + m_velocities[3 * i + 1] * m_velocities[3 * i + 1] + m_velocities[3 * i + 2] * m_velocities[3 * i + 2]);
+        ekin += m_mass[3 * i] * (m_velocities[3 * i] * m_velocities[3 * i] + m_velocities[3 * i + 1] * m_velocities[3 * i + 1] + m_velocities[3 * i + 2] * m_velocities[3 * i + 2]);
         m_gradient[3 * i + 0] = grad[3 * i + 0];
         m_gradient[3 * i + 1] = grad[3 * i + 1];
         m_gradient[3 * i + 2] = grad[3 * i + 2];
@@ -585,6 +622,46 @@ void SimpleMD::Verlet(double* coord, double* grad)
     m_T = T;
 }
 
+void SimpleMD::Respa(double* coord, double* grad)
+{
+    /* r-RESPA, Tuckerman, Berne, Martyna, J. Chem. Phys. 97, 1990 (1992) - DOI: 10.1063/1.463137
+     * The slow forces kick the velocities at both ends of an outer step of m_respa * m_timestep,
+     * the fast forces drive m_respa velocity Verlet steps of m_timestep in between. */
+    const double outer = m_timestep * m_respa;
+    if (!m_respa_ready) {
+        m_fast_energy = Gradient(m_current_geometry.data(), m_fast_gradient.data(), FastForces);
+        m_slow_energy = Gradient(m_current_geometry.data(), m_slow_gradient.data(), SlowForces);
+        m_respa_ready = true;
+    }
+    for (int i = 0; i < 3 * m_natoms; ++i)
+        m_velocities[i] -= 0.5 * outer * m_slow_gradient[i] * m_rmass[i];
+
+    for (int step = 0; step < m_respa; ++step) {
+        for (int i = 0; i < 3 * m_natoms; ++i) {
+            m_velocities[i] -= 0.5 * m_timestep * m_fast_gradient[i] * m_rmass[i];
+            coord[i] = m_current_geometry[i] + m_timestep * m_velocities[i];
+            m_current_geometry[i] = coord[i];
+        }
+        m_fast_energy = Gradient(coord, m_fast_gradient.data(), FastForces);
+        for (int i = 0; i < 3 * m_natoms; ++i)
+            m_velocities[i] -= 0.5 * m_timestep * m_fast_gradient[i] * m_rmass[i];
+    }
+
+    m_slow_energy = Gradient(coord, m_slow_gradient.data(), SlowForces);
+    double ekin = 0.0;
+    for (int i = 0; i < 3 * m_natoms; ++i) {
+        m_velocities[i] -= 0.5 * outer * m_slow_gradient[i] * m_rmass[i];
+        grad[i] = m_fast_gradient[i] + m_slow_gradient[i];
+        m_gradient[i] = grad[i];
+        ekin += m_mass[i] * m_velocities[i] * m_velocities[i];
+    }
+    m_Epot = m_fast_energy + m_slow_energy;
+    ekin *= 0.5;
+    double T = 2.0 * ekin / (kb * 3 * m_natoms);
+    m_unstable = T > 100 * m_T;
+    m_T = T;
+}
+
 void SimpleMD::Rattle(double* coord, double* grad)
 {
     /* this part was adopted from
@@ -686,7 +763,7 @@ void SimpleMD::Rattle(double* coord, double* grad)
     }
 
     for (int i = 0; i < m_natoms; ++i) {
-        ekin += m_mass[i] * (m_velocities[3 * i] * m_velocities[3 * i] + m_velocities[3 * i + 1] * m_velocities[3 * i + 1] + m_velocities[3 * i + 2] * m_velocities[3 * i + 2]);
+        ekin += m_mass[3 * i] * (m_velocities[3 * i] * m_velocities[3 * i] + m_velocities[3 * i + 1] * m_velocities[3 * i + 1] + m_velocities[3 * i + 2] * m_velocities[3 * i + 2]);
     }
     ekin *= 0.5;
     double T = 2.0 * ekin / (kb * 3 * m_natoms);
@@ -767,6 +844,36 @@ void SimpleMD::RemoveRotation(std::vector<double>& velo)
     }
 }
 
+void SimpleMD::RemoveTranslation(std::vector<double>& velo)
+{
+    double mass = 0;
+    Position rlm = { 0, 0, 0 };
+    for (int i = 0; i < m_natoms; ++i) {
+        mass += m_mass[3 * i];
+        rlm(0) += m_mass[3 * i] * velo[3 * i + 0];
+        rlm(1) += m_mass[3 * i] * velo[3 * i + 1];
+        rlm(2) += m_mass[3 * i] * velo[3 * i + 2];
+    }
+    for (int i = 0; i < m_natoms; ++i) {
+        velo[3 * i + 0] -= rlm(0) / mass;
+        velo[3 * i + 1] -= rlm(1) / mass;
+        velo[3 * i + 2] -= rlm(2) / mass;
+    }
+}
+
+void SimpleMD::WrapCoordinates(double* coord)
+{
+    /* forces and energies do not change under lattice translations, the stored gradients stay valid */
+    const UnitCell& cell = m_molecule.Cell();
+    for (int i = 0; i < m_natoms; ++i) {
+        const Eigen::Vector3d wrapped = cell.Wrap(Eigen::Vector3d(coord[3 * i + 0], coord[3 * i + 1], coord[3 * i + 2]));
+        for (int c = 0; c < 3; ++c) {
+            coord[3 * i + c] = wrapped(c);
+            m_current_geometry[3 * i + c] = wrapped(c);
+        }
+    }
+}
+
 void SimpleMD::PrintStatus() const
 {
     auto unix_timestamp = std::chrono::seconds(std::time(NULL));
@@ -823,12 +930,20 @@ double SimpleMD::Gradient(const double* coord, double* grad)
     return Energy;
 }
 
+double SimpleMD::Gradient(const double* coord, double* grad, int group)
+{
+    m_interface->setForceGroup(group);
+    const double energy = Gradient(coord, grad);
+    m_interface->setForceGroup(AllForces);
+    return energy;
+}
+
 double SimpleMD::EKin()
 {
     double ekin = 0;
 
     for (int i = 0; i < m_natoms; ++i) {
-        ekin += m_mass[i] * (m_velocities[3 * i] * m_velocities[3 * i] + m_velocities[3 * i + 1] * m_velocities[3 * i + 1] + m_velocities[3 * i + 2] * m_velocities[3 * i + 2]);
+        ekin += m_mass[3 * i] * (m_velocities[3 * i] * m_velocities[3 * i] + m_velocities[3 * i + 1] * m_velocities[3 * i + 1] + m_velocities[3 * i + 2] * m_velocities[3 * i + 2]);
     }
     ekin *= 0.5;
     m_T = 2.0 * ekin / (kb * 3 * m_natoms);
@@ -884,7 +999,7 @@ bool SimpleMD::WriteGeometry()
 
 void SimpleMD::Berendson()
 {
-    double lambda = sqrt(1 + (m_timestep * (m_T0 - m_T)) / (m_T * m_coupling));
+    double lambda = sqrt(1 + (m_timestep * m_respa * (m_T0 - m_T)) / (m_T * m_coupling));
     for (int i = 0; i < 3 * m_natoms; ++i) {
         m_velocities[i] *= lambda;
     }
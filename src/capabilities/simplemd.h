@@ -87,6 +87,10 @@ public:
 
     std::vector<Molecule*> UniqueMolecules() const { return m_unique_structures; }
 
+    /*! \brief Potential and kinetic energy after the last step */
+    double Epot() const { return m_Epot; }
+    double Ekin() const { return m_Ekin; }
+
 private:
     std::function<void(void)> ThermostatFunction;
     void PrintStatus() const;
@@ -115,14 +119,20 @@ private:
     void InitVelocities(double scaling = 1.0);
 
     double Gradient(const double* coord, double* grad);
+    double Gradient(const double* coord, double* grad, int group);
 
     void PrintMatrix(const double* matrix);
 
     bool WriteGeometry();
     void Verlet(double* coord, double* grad);
     void Rattle(double* coord, double* grad);
+    void Respa(double* coord, double* grad);
 
     void RemoveRotation(std::vector<double>& velo);
+    void RemoveTranslation(std::vector<double>& velo);
+
+    /*! \brief Shift every atom that left the periodic cell back by whole lattice vectors */
+    void WrapCoordinates(double* coord);
 
     double EKin();
     void Berendson();
@@ -145,6 +155,9 @@ private:
     double m_x0 = 0, m_y0 = 0, m_z0 = 0;
     double m_Ekin_exchange = 0.0;
     std::vector<double> m_current_geometry, m_mass, m_velocities, m_gradient, m_rmass;
+    std::vector<double> m_fast_gradient, m_slow_gradient;
+    double m_fast_energy = 0, m_slow_energy = 0;
+    bool m_respa_ready = false, m_rattle = false, m_wrap = false;
     std::vector<int> m_atomtype;
     Molecule m_molecule;
     bool m_initialised = false, m_restart = false, m_writeUnique = true, m_opt = false, m_rescue = false, m_writeXYZ = true, m_writeinit = false, m_norestart = false;
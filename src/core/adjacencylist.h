@@ -0,0 +1,89 @@
+/*
+ * <Compressed sparse row storage for bonds and exclusions. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+/*! \brief All neighbours of all atoms in one flat array, the neighbours of atom i are
+ * m_index[m_offset[i]] ... m_index[m_offset[i + 1] - 1], sorted and without duplicates */
+class AdjacencyList {
+public:
+    class Row {
+    public:
+        Row(const int* begin, const int* end)
+            : m_begin(begin)
+            , m_end(end)
+        {
+        }
+        inline const int* begin() const { return m_begin; }
+        inline const int* end() const { return m_end; }
+        inline int size() const { return m_end - m_begin; }
+        inline bool empty() const { return m_begin == m_end; }
+        inline int operator[](int i) const { return m_begin[i]; }
+
+    private:
+        const int *m_begin, *m_end;
+    };
+
+    AdjacencyList() = default;
+
+    /*! \brief Build the rows from (row, column) entries, the entries are sorted in place */
+    void Build(int rows, std::vector<std::pair<int, int>>& entries)
+    {
+        std::sort(entries.begin(), entries.end());
+        entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+
+        m_offset.assign(rows + 1, 0);
+        m_index.resize(entries.size());
+        for (std::size_t e = 0; e < entries.size(); ++e) {
+            m_offset[entries[e].first + 1]++;
+            m_index[e] = entries[e].second;
+        }
+        for (int i = 0; i < rows; ++i)
+            m_offset[i + 1] += m_offset[i];
+    }
+
+    /*! \brief Take over rows that are already in compressed form */
+    void Assign(std::vector<int> offset, std::vector<int> index)
+    {
+        m_offset = std::move(offset);
+        m_index = std::move(index);
+    }
+
+    inline const std::vector<int>& Offsets() const { return m_offset; }
+    inline const std::vector<int>& Indices() const { return m_index; }
+
+    inline bool operator==(const AdjacencyList& other) const { return m_offset == other.m_offset && m_index == other.m_index; }
+
+    inline int Rows() const { return m_offset.empty() ? 0 : m_offset.size() - 1; }
+    inline int Entries() const { return m_index.size(); }
+
+    inline Row operator[](int i) const { return Row(m_index.data() + m_offset[i], m_index.data() + m_offset[i + 1]); }
+
+    inline bool Contains(int i, int j) const
+    {
+        return std::binary_search(m_index.begin() + m_offset[i], m_index.begin() + m_offset[i + 1], j);
+    }
+
+private:
+    std::vector<int> m_offset, m_index;
+};
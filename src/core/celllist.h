@@ -0,0 +1,199 @@
+/*
+ * <Linked cell grid for short-ranged pair searches. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "src/core/global.h"
+#include "src/core/unitcell.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <Eigen/Dense>
+
+/*! \brief Cubic cell grid, every atom is sorted into a cell with edge length >= cutoff,
+ * pairs within the cutoff are therefore found in the same or in adjacent cells.
+ * With a periodic cell the grid is laid over the fractional coordinates, neighbouring grid cells
+ * wrap around and distances are minimum images, the cutoff has to stay below half of the cell width */
+class CellList {
+public:
+    CellList() = default;
+
+    void Build(const Matrix& geometry, double cutoff, const UnitCell& cell = UnitCell())
+    {
+        if (cell.isPeriodic())
+            return BuildPeriodic(geometry, cutoff, cell);
+        m_periodic = false;
+        m_cutoff = cutoff;
+        const int atoms = geometry.rows();
+        m_head.clear();
+        m_next.assign(atoms, -1);
+        if (atoms == 0 || cutoff <= 0)
+            return;
+
+        m_min = geometry.colwise().minCoeff().transpose();
+        Eigen::Vector3d extent = geometry.colwise().maxCoeff().transpose() - m_min;
+
+        /* keep the grid sparse enough for dilute systems, a few atoms per cell are fine */
+        double edge = cutoff;
+        const double max_cells = std::max(27.0, 2.0 * atoms);
+        while ((std::floor(extent(0) / edge) + 1) * (std::floor(extent(1) / edge) + 1) * (std::floor(extent(2) / edge) + 1) > max_cells)
+            edge *= 1.26;
+        m_edge = edge;
+        for (int i = 0; i < 3; ++i)
+            m_cells[i] = int(std::floor(extent(i) / m_edge)) + 1;
+
+        m_head.assign(m_cells[0] * m_cells[1] * m_cells[2], -1);
+        for (int atom = 0; atom < atoms; ++atom) {
+            int c = Cell(geometry(atom, 0), geometry(atom, 1), geometry(atom, 2));
+            m_next[atom] = m_head[c];
+            m_head[c] = atom;
+        }
+    }
+
+    /*! \brief Call f(i, j, r2) for every pair i < j with a distance below the cutoff */
+    template <class Function>
+    void ForEachPair(const Matrix& geometry, Function&& f) const
+    {
+        if (m_head.empty())
+            return;
+        if (m_periodic)
+            return ForEachPeriodicPair(geometry, f);
+        const double cutoff2 = m_cutoff * m_cutoff;
+        for (int x = 0; x < m_cells[0]; ++x)
+            for (int y = 0; y < m_cells[1]; ++y)
+                for (int z = 0; z < m_cells[2]; ++z) {
+                    const int c = Index(x, y, z);
+                    for (int i = m_head[c]; i != -1; i = m_next[i]) {
+                        for (int dx = -1; dx <= 1; ++dx)
+                            for (int dy = -1; dy <= 1; ++dy)
+                                for (int dz = -1; dz <= 1; ++dz) {
+                                    const int nx = x + dx, ny = y + dy, nz = z + dz;
+                                    if (nx < 0 || ny < 0 || nz < 0 || nx >= m_cells[0] || ny >= m_cells[1] || nz >= m_cells[2])
+                                        continue;
+                                    for (int j = m_head[Index(nx, ny, nz)]; j != -1; j = m_next[j]) {
+                                        if (j <= i)
+                                            continue;
+                                        const double r2 = (geometry.row(i) - geometry.row(j)).squaredNorm();
+                                        if (r2 < cutoff2)
+                                            f(i, j, r2);
+                                    }
+                                }
+                    }
+                }
+    }
+
+    inline double Cutoff() const { return m_cutoff; }
+
+private:
+    void BuildPeriodic(const Matrix& geometry, double cutoff, const UnitCell& cell)
+    {
+        m_periodic = true;
+        m_cell = cell;
+        m_cutoff = cutoff;
+        const int atoms = geometry.rows();
+        m_head.clear();
+        m_next.assign(atoms, -1);
+        if (atoms == 0 || cutoff <= 0)
+            return;
+
+        /* the faces of one grid cell are at least cutoff apart */
+        for (int i = 0; i < 3; ++i)
+            m_cells[i] = std::max(1, int(std::floor(cell.Width(i) / cutoff)));
+        const double max_cells = std::max(27.0, 2.0 * atoms);
+        while (double(m_cells[0]) * m_cells[1] * m_cells[2] > max_cells) {
+            int* largest = std::max_element(m_cells, m_cells + 3);
+            *largest = std::max(1, *largest / 2);
+        }
+
+        m_head.assign(m_cells[0] * m_cells[1] * m_cells[2], -1);
+        for (int atom = 0; atom < atoms; ++atom) {
+            const Eigen::Vector3d s = cell.Fractional(geometry.row(atom).transpose());
+            int index[3];
+            for (int i = 0; i < 3; ++i) {
+                const double wrapped = s(i) - std::floor(s(i));
+                index[i] = std::min(int(wrapped * m_cells[i]), m_cells[i] - 1);
+            }
+            const int c = Index(index[0], index[1], index[2]);
+            m_next[atom] = m_head[c];
+            m_head[c] = atom;
+        }
+    }
+
+    template <class Function>
+    void ForEachPeriodicPair(const Matrix& geometry, Function&& f) const
+    {
+        const double cutoff2 = m_cutoff * m_cutoff;
+        /* with less than three grid cells along a direction the wrapped neighbours coincide, every cell is visited once */
+        auto neighbours = [this](int dimension, int position, int* list) {
+            const int n = m_cells[dimension];
+            if (n < 3) {
+                for (int i = 0; i < n; ++i)
+                    list[i] = i;
+                return n;
+            }
+            list[0] = (position + n - 1) % n;
+            list[1] = position;
+            list[2] = (position + 1) % n;
+            return 3;
+        };
+        int nx[3], ny[3], nz[3];
+        for (int x = 0; x < m_cells[0]; ++x)
+            for (int y = 0; y < m_cells[1]; ++y)
+                for (int z = 0; z < m_cells[2]; ++z) {
+                    const int c = Index(x, y, z);
+                    const int sx = neighbours(0, x, nx), sy = neighbours(1, y, ny), sz = neighbours(2, z, nz);
+                    for (int i = m_head[c]; i != -1; i = m_next[i]) {
+                        for (int a = 0; a < sx; ++a)
+                            for (int b = 0; b < sy; ++b)
+                                for (int d = 0; d < sz; ++d) {
+                                    for (int j = m_head[Index(nx[a], ny[b], nz[d])]; j != -1; j = m_next[j]) {
+                                        if (j <= i)
+                                            continue;
+                                        double dx = geometry(i, 0) - geometry(j, 0);
+                                        double dy = geometry(i, 1) - geometry(j, 1);
+                                        double dz = geometry(i, 2) - geometry(j, 2);
+                                        m_cell.MinimumImage(dx, dy, dz);
+                                        const double r2 = dx * dx + dy * dy + dz * dz;
+                                        if (r2 < cutoff2)
+                                            f(i, j, r2);
+                                    }
+                                }
+                    }
+                }
+    }
+
+    inline int Index(int x, int y, int z) const { return (x * m_cells[1] + y) * m_cells[2] + z; }
+
+    inline int Cell(double x, double y, double z) const
+    {
+        int cx = std::min(int((x - m_min(0)) / m_edge), m_cells[0] - 1);
+        int cy = std::min(int((y - m_min(1)) / m_edge), m_cells[1] - 1);
+        int cz = std::min(int((z - m_min(2)) / m_edge), m_cells[2] - 1);
+        return Index(cx, cy, cz);
+    }
+
+    double m_cutoff = 0, m_edge = 1;
+    int m_cells[3] = { 1, 1, 1 };
+    Eigen::Vector3d m_min;
+    UnitCell m_cell;
+    bool m_periodic = false;
+    std::vector<int> m_head, m_next;
+};
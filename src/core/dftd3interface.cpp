@@ -24,6 +24,7 @@
 
 #include "src/core/molecule.h"
 
+#include <algorithm>
 #include <iostream>
 #include <math.h>
 #include <stdio.h>
@@ -48,47 +49,57 @@ DFTD3Interface::DFTD3Interface(const json& controller)
     m_functional = parameter["d_func"];
 
     m_error = dftd3_new_error();
+    LoadParameter();
 }
 
 DFTD3Interface::~DFTD3Interface()
 {
-    dftd3_delete_model(&m_disp);
-    dftd3_delete_structure(&m_mol);
+    clear();
+    if (m_param)
+        dftd3_delete_param(&m_param);
     dftd3_delete_error(&m_error);
-    delete m_coord;
-    delete m_attyp;
 }
 
 void DFTD3Interface::PrintParameter() const
 {
     std::cout << m_d3_s6 << " " << m_d3_s8 << " " << m_d3_s9 << " " << m_d3_a1 << " " << m_d3_a2 << " " << m_d3_alp << std::endl;
 }
-/*
+
+/* explicit parameters win over the ones of the functional, the damping is created once and kept for all calculations */
 void DFTD3Interface::LoadParameter()
 {
-    dftd3_delete_param(&m_param);
-    char *cstr = new char[m_functional.length() + 1];
-    strcpy(cstr, m_functional.c_str());
-    if(m_damping.compare("bj") == 0)
-    {
-        m_param = dftd3_load_zero_damping(m_error, cstr, m_atm);
-    }else if(m_damping.compare("zero") == 0)
-    {
-        m_param = dftd3_load_rational_damping(m_error, cstr, m_atm);
-    }else if(m_damping.compare("bjm") == 0)
-    {
-        m_param = dftd3_load_mrational_damping(m_error, cstr, m_atm);
-    }else if(m_damping.compare("zerom") == 0)
-    {
-        m_param = dftd3_load_mzero_damping(m_error, cstr, m_atm);
-    }else if(m_damping.compare("op") == 0)
-    {
-        m_param = dftd3_load_optimizedpower_damping(m_error, cstr, m_atm);
+    if (m_param)
+        dftd3_delete_param(&m_param);
+    if (m_d3_a1 > 1e-8 || m_d3_a2 > 1e-8 || m_d3_s6 > 1e-8 || m_d3_s8 > 1e-8 || m_d3_s9 > 1e-8) {
+        if (m_damping.compare("bj") == 0) {
+            m_param = dftd3_new_rational_damping(m_error, m_d3_s6, m_d3_s8, m_d3_s9, m_d3_a1, m_d3_a2, m_d3_alp);
+        } else if (m_damping.compare("zero") == 0) {
+            m_param = dftd3_new_zero_damping(m_error, m_d3_s6, m_d3_s8, m_d3_s9, m_d3_a1, m_d3_a2, m_d3_alp);
+        } else if (m_damping.compare("bjm") == 0) {
+            m_param = dftd3_new_mrational_damping(m_error, m_d3_s6, m_d3_s8, m_d3_s9, m_d3_a1, m_d3_a2, m_d3_alp);
+        } else if (m_damping.compare("zerom") == 0) {
+            m_param = dftd3_new_mzero_damping(m_error, m_d3_s6, m_d3_s8, m_d3_s9, m_d3_a1, m_d3_a2, m_d3_alp, m_bet);
+        } else if (m_damping.compare("op") == 0) {
+            m_param = dftd3_new_optimizedpower_damping(m_error, m_d3_s6, m_d3_s8, m_d3_s9, m_d3_a1, m_d3_a2, m_d3_alp, m_bet);
+        }
+    } else {
+        std::vector<char> functional(m_functional.begin(), m_functional.end());
+        functional.push_back('\0');
+        char* cstr = functional.data();
+        if (m_damping.compare("bj") == 0) {
+            m_param = dftd3_load_rational_damping(m_error, cstr, m_atm);
+        } else if (m_damping.compare("zero") == 0) {
+            m_param = dftd3_load_zero_damping(m_error, cstr, m_atm);
+        } else if (m_damping.compare("bjm") == 0) {
+            m_param = dftd3_load_mrational_damping(m_error, cstr, m_atm);
+        } else if (m_damping.compare("zerom") == 0) {
+            m_param = dftd3_load_mzero_damping(m_error, cstr, m_atm);
+        } else if (m_damping.compare("op") == 0) {
+            m_param = dftd3_load_optimizedpower_damping(m_error, cstr, m_atm);
+        }
     }
-    delete [] cstr;
-    PrintParameter();
 }
-*/
+
 void DFTD3Interface::UpdateParameters(const json& controller)
 {
     json parameter = MergeJson(DFTD3Settings, controller);
@@ -101,21 +112,17 @@ void DFTD3Interface::UpdateParameters(const json& controller)
 
     m_d3_s9 = parameter["d_s9"];
 
+    LoadParameter();
     PrintParameter();
 }
 
 bool DFTD3Interface::InitialiseMolecule(const std::vector<int>& atomtypes)
 {
-    m_attyp = new int[atomtypes.size()];
-    m_coord = new double[3 * atomtypes.size()];
-    for (int i = 0; i < atomtypes.size(); ++i) {
-        m_coord[3 * i + 0] = 0 / au;
-        m_coord[3 * i + 1] = 0 / au;
-        m_coord[3 * i + 2] = 0 / au;
-        m_attyp[i] = atomtypes[i];
-    }
+    clear();
+    m_attyp = atomtypes;
+    m_coord.assign(3 * atomtypes.size(), 0.0);
 
-    m_mol = dftd3_new_structure(m_error, atomtypes.size(), m_attyp, m_coord, NULL, NULL);
+    m_mol = dftd3_new_structure(m_error, atomtypes.size(), m_attyp.data(), m_coord.data(), NULL, NULL);
     m_disp = dftd3_new_d3_model(m_error, m_mol);
 
     return true;
@@ -128,51 +135,26 @@ void DFTD3Interface::UpdateAtom(int index, double x, double y, double z)
     m_coord[3 * index + 2] = z / au;
 }
 
+void DFTD3Interface::UpdateGeometry(const double* coord)
+{
+    std::copy(coord, coord + m_coord.size(), m_coord.begin());
+}
+
 double DFTD3Interface::DFTD3Calculation(double* grad)
 {
     double energy = 0;
     double sigma[9];
-    dftd3_param param;
 
-    if (m_d3_a1 > 1e-8 || m_d3_a2 > 1e-8 || m_d3_s6 > 1e-8 || m_d3_s8 > 1e-8 || m_d3_s9 > 1e-8) {
-        if (m_damping.compare("bj")) {
-            param = dftd3_new_rational_damping(m_error, m_d3_s6, m_d3_s8, m_d3_s9, m_d3_a1, m_d3_a2, m_d3_alp);
-        } else if (m_damping.compare("zero")) {
-            param = dftd3_new_zero_damping(m_error, m_d3_s6, m_d3_s8, m_d3_s9, m_d3_a1, m_d3_a2, m_d3_alp);
-        } else if (m_damping.compare("bjm")) {
-            param = dftd3_new_mrational_damping(m_error, m_d3_s6, m_d3_s8, m_d3_s9, m_d3_a1, m_d3_a2, m_d3_alp);
-        } else if (m_damping.compare("zerom")) {
-            param = dftd3_new_mzero_damping(m_error, m_d3_s6, m_d3_s8, m_d3_s9, m_d3_a1, m_d3_a2, m_d3_alp, m_bet);
-        } else if (m_damping.compare("op")) {
-            param = dftd3_new_optimizedpower_damping(m_error, m_d3_s6, m_d3_s8, m_d3_s9, m_d3_a1, m_d3_a2, m_d3_alp, m_bet);
-        }
-    } else {
-        char* cstr = new char[m_functional.length() + 1];
-        strcpy(cstr, m_functional.c_str());
-        if (m_damping.compare("bj") == 0) {
-            param = dftd3_load_rational_damping(m_error, cstr, m_atm);
-        } else if (m_damping.compare("zero") == 0) {
-            param = dftd3_load_zero_damping(m_error, cstr, m_atm);
-        } else if (m_damping.compare("bjm") == 0) {
-            param = dftd3_load_mrational_damping(m_error, cstr, m_atm);
-        } else if (m_damping.compare("zerom") == 0) {
-            param = dftd3_load_mzero_damping(m_error, cstr, m_atm);
-        } else if (m_damping.compare("op") == 0) {
-            param = dftd3_load_optimizedpower_damping(m_error, cstr, m_atm);
-        }
-        delete[] cstr;
-    }
-    dftd3_update_structure(m_error, m_mol, m_coord, NULL);
-    dftd3_get_dispersion(m_error, m_mol, m_disp, param, &energy, grad, sigma);
-
-    dftd3_delete_param(&param);
+    dftd3_update_structure(m_error, m_mol, m_coord.data(), NULL);
+    dftd3_get_dispersion(m_error, m_mol, m_disp, m_param, &energy, grad, sigma);
 
     return energy;
 }
 
 void DFTD3Interface::clear()
 {
-    dftd3_delete_model(&m_disp);
-    dftd3_delete_structure(&m_mol);
-    dftd3_delete_error(&m_error);
+    if (m_disp)
+        dftd3_delete_model(&m_disp);
+    if (m_mol)
+        dftd3_delete_structure(&m_mol);
 }
@@ -38,6 +38,9 @@ static json DFTD3Settings{
     { "d_damping", "bj" }
 };
 
+/*! \brief Grimme D3 through the s-dftd3 C api. Structure, model and damping parameters are created once,
+ * a calculation only updates the coordinates. UpdateGeometry takes contiguous x, y, z in Bohr,
+ * UpdateAtom Angstrom, the gradient of DFTD3Calculation is written to 3 * atoms values of the caller in Eh/Bohr. */
 class DFTD3Interface {
 public:
     DFTD3Interface(const json& controller);
@@ -63,12 +66,14 @@ public:
     inline double ParameterS9() const { return m_d3_s9; }
 
 private:
+    void LoadParameter();
+
     std::string m_damping;
     std::string m_functional;
 
     int m_charge = 0;
-    double* m_coord;
-    int* m_attyp;
+    std::vector<double> m_coord;
+    std::vector<int> m_attyp;
 
     double m_d3_a1 = 1;
     double m_d3_a2 = 1;
@@ -80,7 +85,8 @@ private:
 
     double m_bet = 8;
     bool m_atm = false;
-    dftd3_error m_error;
-    dftd3_structure m_mol;
-    dftd3_model m_disp;
+    dftd3_error m_error = NULL;
+    dftd3_structure m_mol = NULL;
+    dftd3_model m_disp = NULL;
+    dftd3_param m_param = NULL;
 };
@@ -52,7 +52,7 @@ DFTD4Interface::DFTD4Interface(const json& controller)
 
 DFTD4Interface::~DFTD4Interface()
 {
-    m_mol.FreeMemory();
+    clear();
 }
 
 void DFTD4Interface::PrintParameter() const
@@ -79,7 +79,9 @@ void DFTD4Interface::UpdateParameters(const json& controller)
 
 bool DFTD4Interface::InitialiseMolecule(const Molecule& molecule, double factor)
 {
-    m_mol.GetMemory(molecule.AtomCount());
+    clear();
+    m_natoms = molecule.AtomCount();
+    m_mol.GetMemory(m_natoms);
     for (int i = 0; i < molecule.AtomCount(); ++i) {
         std::pair<int, Position> atom = molecule.Atom(i);
         m_mol.UpdateAtom(i, atom.second(0) * factor, atom.second(1) * factor, atom.second(2) * factor, atom.first);
@@ -89,7 +91,9 @@ bool DFTD4Interface::InitialiseMolecule(const Molecule& molecule, double factor)
 
 bool DFTD4Interface::InitialiseMolecule(const std::vector<int>& atomtype)
 {
-    m_mol.GetMemory(atomtype.size());
+    clear();
+    m_natoms = atomtype.size();
+    m_mol.GetMemory(m_natoms);
     for (int i = 0; i < atomtype.size(); ++i) {
         m_mol.UpdateAtom(i, 0, 0, 0, atomtype[i]);
     }
@@ -99,12 +103,13 @@ bool DFTD4Interface::InitialiseMolecule(const std::vector<int>& atomtype)
 double DFTD4Interface::DFTD4Calculation(double* grad)
 {
     double energy = 0;
-    dftd4::TCutoff cutoff;
-    dftd4::TD4Model d4;
-    dftd4::get_dispersion(m_mol, m_charge, d4, m_par, cutoff, energy, grad);
+    dftd4::get_dispersion(m_mol, m_charge, m_model, m_par, m_cutoff, energy, grad);
     return energy;
 }
 
 void DFTD4Interface::clear()
 {
+    if (m_natoms)
+        m_mol.FreeMemory();
+    m_natoms = 0;
 }
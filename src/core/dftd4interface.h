@@ -40,6 +40,8 @@ static json DFTD4Settings{
     { "d4_atm", true }
 };
 
+/*! \brief Grimme D4 through cpp-d4. Molecule, model and cutoffs live as long as the interface,
+ * UpdateGeometry takes contiguous x, y, z in Bohr and the gradient is written to the caller's 3 * atoms values. */
 class DFTD4Interface {
 public:
     DFTD4Interface(const json& controller);
@@ -73,6 +75,8 @@ public:
 private:
     dftd4::dparam m_par;
     dftd4::TMolecule m_mol;
+    dftd4::TD4Model m_model;
+    dftd4::TCutoff m_cutoff;
     int m_charge = 0;
-    int m_natoms;
+    int m_natoms = 0;
 };
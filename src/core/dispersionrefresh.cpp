@@ -0,0 +1,130 @@
+/*
+ * <Lazy refresh of dispersion corrections. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/tools/general.h"
+
+#include <cmath>
+#include <sstream>
+
+#include "dispersionrefresh.h"
+
+DispersionRefresh::DispersionRefresh(const json& controller)
+{
+    json parameter = MergeJson(DispersionRefreshJson, controller);
+    m_displacement = parameter["dispersion_refresh"].get<double>();
+    m_drift = parameter["dispersion_drift"].get<double>();
+}
+
+double DispersionRefresh::Change(const Matrix& geometry, double& squared, double& largest) const
+{
+    double change = 0;
+    squared = 0;
+    largest = 0;
+    for (int i = 0; i < geometry.rows(); ++i) {
+        double norm = 0;
+        for (int c = 0; c < 3; ++c) {
+            const double delta = geometry(i, c) - m_geometry(i, c);
+            change += m_gradient(i, c) * delta;
+            norm += delta * delta;
+        }
+        squared += norm;
+        largest = std::max(largest, norm);
+    }
+    largest = std::sqrt(largest);
+    return change;
+}
+
+bool DispersionRefresh::Extrapolate(const Matrix& geometry, double& energy, Matrix* gradient)
+{
+    ++m_steps;
+    if (!Enabled() || !m_valid || m_geometry.rows() != geometry.rows())
+        return false;
+
+    double squared, largest;
+    const double change = Change(geometry, squared, largest);
+    /* the second order term the extrapolation misses, estimated from the last jump. Without estimate
+     * the first window is closed after one step, its jump calibrates the next ones */
+    if (largest > m_displacement || m_curvature * squared > m_drift || (m_curvature <= 0 && m_extrapolated > 0))
+        return false;
+    ++m_extrapolated;
+
+    energy = m_energy + change;
+    if (gradient)
+        *gradient += m_output_scale * m_gradient;
+    return true;
+}
+
+void DispersionRefresh::Refresh(const Matrix& geometry, double energy, const double* gradient, double scale, double output_scale)
+{
+    ++m_refreshes;
+    if (!Enabled())
+        return;
+
+    if (m_valid && m_geometry.rows() == geometry.rows()) {
+        double squared, largest;
+        const double jump = std::abs(energy - m_energy - Change(geometry, squared, largest));
+        m_max_jump = std::max(m_max_jump, jump);
+        if (squared > 1e-12)
+            m_curvature = jump / squared;
+    }
+    m_geometry = geometry;
+    m_energy = energy;
+    m_extrapolated = 0;
+    m_valid = gradient != nullptr;
+    m_output_scale = output_scale < 0 ? 1 : output_scale / scale;
+    if (m_valid) {
+        m_gradient.resize(geometry.rows(), 3);
+        for (int i = 0; i < geometry.rows(); ++i)
+            for (int c = 0; c < 3; ++c)
+                m_gradient(i, c) = gradient[3 * i + c] * scale;
+    }
+}
+
+void DispersionRefresh::Reset()
+{
+    m_valid = false;
+    m_curvature = 0;
+}
+
+std::string DispersionRefresh::Statistics(const std::string& name) const
+{
+    if (!Enabled() || m_steps == 0)
+        return std::string();
+    std::ostringstream statistics;
+    statistics << name << " refreshed " << m_refreshes << " times in " << m_steps << " evaluations, largest jump " << m_max_jump << " Eh";
+    return statistics.str();
+}
+
+std::string DispersionRefresh::Report(const json& controller)
+{
+    DispersionRefresh refresh(controller);
+    std::ostringstream report;
+    report << "Dispersion:         ";
+#ifdef USE_D3
+    report << "d3 ";
+#endif
+#ifdef USE_D4
+    report << "d4 ";
+#endif
+    if (refresh.Enabled())
+        report << "(lazy refresh after " << refresh.m_displacement << " A or " << refresh.m_drift << " Eh expected error, first order extrapolation in between)";
+    else
+        report << "(full evaluation every step, lazy refresh with -dispersion_refresh A)";
+    return report.str();
+}
@@ -0,0 +1,79 @@
+/*
+ * <Lazy refresh of dispersion corrections. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "src/core/global.h"
+
+#include <string>
+
+#include "json.hpp"
+using json = nlohmann::json;
+
+static json DispersionRefreshJson{
+    { "dispersion_refresh", 0.0 },
+    { "dispersion_drift", 1e-5 }
+};
+
+/*! \brief Displacement triggered refresh of a slowly varying energy contribution (D3, D4).
+ * After a refresh the contribution is extrapolated to first order, E = E_ref + g_ref * (x - x_ref),
+ * with the constant gradient g_ref, until an atom moved more than "dispersion_refresh" Angstrom from x_ref
+ * or the expected error passes "dispersion_drift" Eh. The error is estimated from the jump between
+ * extrapolated and calculated energy at the last refresh, scaled with the squared displacement,
+ * the first window after a Reset is closed after one step to get that estimate.
+ * A refresh distance of 0 disables the extrapolation, every call is a refresh. */
+class DispersionRefresh {
+public:
+    DispersionRefresh() = default;
+    DispersionRefresh(const json& controller);
+
+    inline bool Enabled() const { return m_displacement > 0; }
+
+    /*! \brief True if the contribution at geometry was extrapolated, energy is set and the reference
+     * gradient is added to gradient (if not null). False if the caller has to calculate it and call Refresh */
+    bool Extrapolate(const Matrix& geometry, double& energy, Matrix* gradient);
+
+    /*! \brief New reference, gradient holds 3 * atoms values. scale converts them to Eh per unit of geometry for the
+     * extrapolation, output_scale to the gradient Extrapolate adds (the one the caller adds after a calculation), negative
+     * output_scale means scale */
+    void Refresh(const Matrix& geometry, double energy, const double* gradient, double scale = 1, double output_scale = -1);
+
+    void Reset();
+
+    inline int Steps() const { return m_steps; }
+    inline int Refreshes() const { return m_refreshes; }
+    inline double MaxJump() const { return m_max_jump; }
+
+    /*! \brief Statistics of the run, empty if the mode is disabled or unused */
+    std::string Statistics(const std::string& name) const;
+
+    /*! \brief One line about the mode set in controller, for -info */
+    static std::string Report(const json& controller);
+
+private:
+    /*! \brief First order energy change since the reference, squared norm and largest atomic displacement */
+    double Change(const Matrix& geometry, double& squared, double& largest) const;
+
+    double m_displacement = 0, m_drift = 1e-5, m_curvature = 0;
+    double m_energy = 0, m_max_jump = 0;
+    bool m_valid = false;
+    int m_steps = 0, m_refreshes = 0, m_extrapolated = 0;
+    double m_output_scale = 1;
+    Matrix m_geometry, m_gradient;
+};
@@ -0,0 +1,139 @@
+/*
+ * < Dual numbers for forward-mode automatic differentiation. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <cmath>
+
+/* A dual number carries a value v and its derivatives d with respect to N seeded variables,
+ * every operation applies the chain rule. T is double for first derivatives, Dual<double, 1>
+ * as T gives the directional derivatives of these first derivatives, which are the rows
+ * of a Hessian-vector product. Everything lives on the stack. */
+
+template <typename T, int N>
+struct Dual {
+    T v;
+    T d[N];
+
+    Dual(double value = 0)
+        : v(value)
+    {
+        for (int k = 0; k < N; ++k)
+            d[k] = T(0);
+    }
+
+    /*! \brief Independent variable number index with the given value */
+    static Dual Variable(const T& value, int index)
+    {
+        Dual x;
+        x.v = value;
+        x.d[index] = T(1);
+        return x;
+    }
+
+    Dual operator-() const
+    {
+        Dual r;
+        r.v = -v;
+        for (int k = 0; k < N; ++k)
+            r.d[k] = -d[k];
+        return r;
+    }
+
+    friend Dual operator+(const Dual& a, const Dual& b)
+    {
+        Dual r;
+        r.v = a.v + b.v;
+        for (int k = 0; k < N; ++k)
+            r.d[k] = a.d[k] + b.d[k];
+        return r;
+    }
+
+    friend Dual operator-(const Dual& a, const Dual& b)
+    {
+        Dual r;
+        r.v = a.v - b.v;
+        for (int k = 0; k < N; ++k)
+            r.d[k] = a.d[k] - b.d[k];
+        return r;
+    }
+
+    friend Dual operator*(const Dual& a, const Dual& b)
+    {
+        Dual r;
+        r.v = a.v * b.v;
+        for (int k = 0; k < N; ++k)
+            r.d[k] = a.d[k] * b.v + a.v * b.d[k];
+        return r;
+    }
+
+    friend Dual operator/(const Dual& a, const Dual& b)
+    {
+        Dual r;
+        const T inv = T(1) / b.v;
+        r.v = a.v * inv;
+        for (int k = 0; k < N; ++k)
+            r.d[k] = (a.d[k] - r.v * b.d[k]) * inv;
+        return r;
+    }
+
+    friend Dual operator+(const Dual& a, double s)
+    {
+        Dual r = a;
+        r.v = r.v + s;
+        return r;
+    }
+    friend Dual operator+(double s, const Dual& a) { return a + s; }
+    friend Dual operator-(const Dual& a, double s) { return a + (-s); }
+    friend Dual operator-(double s, const Dual& a) { return -a + s; }
+
+    friend Dual operator*(const Dual& a, double s)
+    {
+        Dual r;
+        r.v = a.v * s;
+        for (int k = 0; k < N; ++k)
+            r.d[k] = a.d[k] * s;
+        return r;
+    }
+    friend Dual operator*(double s, const Dual& a) { return a * s; }
+    friend Dual operator/(const Dual& a, double s) { return a * (1.0 / s); }
+    friend Dual operator/(double s, const Dual& a) { return Dual(s) / a; }
+
+    Dual& operator+=(const Dual& b) { return *this = *this + b; }
+    Dual& operator-=(const Dual& b) { return *this = *this - b; }
+    Dual& operator*=(const Dual& b) { return *this = *this * b; }
+    Dual& operator*=(double s) { return *this = *this * s; }
+
+    friend Dual sqrt(const Dual& a)
+    {
+        using std::sqrt;
+        Dual r;
+        r.v = sqrt(a.v);
+        const T inv = 0.5 / r.v;
+        for (int k = 0; k < N; ++k)
+            r.d[k] = a.d[k] * inv;
+        return r;
+    }
+};
+
+/*! \brief Plain value of a (nested) dual number, branches and masks of the terms are decided on it */
+inline double Value(double x) { return x; }
+
+template <typename T, int N>
+inline double Value(const Dual<T, N>& x) { return Value(x.v); }
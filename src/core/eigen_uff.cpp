@@ -32,27 +32,56 @@
 #include "src/core/dftd4interface.h"
 #endif
 
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <numeric>
+
 #include <Eigen/Dense>
 
 #include "src/core/forcefieldderivaties.h"
+#include "src/core/uff_autodiff.h"
+#include "src/core/uff_kernels.h"
 
 #include "eigen_uff.h"
 
 #include "json.hpp"
 using json = nlohmann::json;
 
+/* lowest and highest atom of a term, the terms are sorted and split between the threads along the lowest one */
+inline int LowestAtom(const UFFBond& bond) { return std::min(bond.i, bond.j); }
+inline int LowestAtom(const UFFAngle& angle) { return std::min({ angle.i, angle.j, angle.k }); }
+inline int LowestAtom(const UFFDihedral& dihedral) { return std::min({ dihedral.i, dihedral.j, dihedral.k, dihedral.l }); }
+inline int LowestAtom(const UFFInversion& inversion) { return std::min({ inversion.i, inversion.j, inversion.k, inversion.l }); }
+inline int LowestAtom(const UFFvdW& vdw) { return std::min(vdw.i, vdw.j); }
+
+inline int HighestAtom(const UFFBond& bond) { return std::max(bond.i, bond.j); }
+inline int HighestAtom(const UFFAngle& angle) { return std::max({ angle.i, angle.j, angle.k }); }
+inline int HighestAtom(const UFFDihedral& dihedral) { return std::max({ dihedral.i, dihedral.j, dihedral.k, dihedral.l }); }
+inline int HighestAtom(const UFFInversion& inversion) { return std::max({ inversion.i, inversion.j, inversion.k, inversion.l }); }
+inline int HighestAtom(const UFFvdW& vdw) { return std::max(vdw.i, vdw.j); }
+
+/* measured work in ns a worker should get at least, below that waking the team costs more than it saves */
+const double WorkerGrain = 2.5e4;
+
 int UFFThread::execute()
 {
     //    m_CalculateGradient = grd;
     m_d4_energy = 0;
     m_d3_energy = 0;
-    m_bond_energy = CalculateBondStretching();
-    m_angle_energy = CalculateAngleBending();
-    m_dihedral_energy = CalculateDihedral();
-    m_inversion_energy = CalculateInversion();
-    m_vdw_energy = CalculateNonBonds();
-    /* + CalculateElectrostatic(); */
-    m_energy = m_bond_energy + m_angle_energy + m_dihedral_energy + m_inversion_energy + m_vdw_energy;
+    const bool fast = m_force_group != SlowForces;
+    const bool slow = m_force_group != FastForces;
+    if (m_single)
+        CalculateSingle(fast, slow);
+    else {
+        m_bond_energy = fast ? CalculateBondStretching() : 0;
+        m_angle_energy = fast ? CalculateAngleBending() : 0;
+        m_dihedral_energy = fast ? CalculateDihedral() : 0;
+        m_inversion_energy = fast ? CalculateInversion() : 0;
+        m_vdw_energy = slow ? CalculateNonBonds() : 0;
+        m_coulomb_energy = slow ? CalculateElectrostatic() : 0;
+    }
+    m_energy = m_bond_energy + m_angle_energy + m_dihedral_energy + m_inversion_energy + m_vdw_energy + m_coulomb_energy;
     return 0;
 }
 
@@ -60,8 +89,6 @@ void UFFThread::readUFF(const json& parameter)
 {
     //  json parameter = MergeJson(UFFParameterJson, parameters);
 
-    m_d = parameter["differential"].get<double>();
-
     m_bond_scaling = parameter["bond_scaling"].get<double>();
     m_angle_scaling = parameter["angle_scaling"].get<double>();
     m_dihedral_scaling = parameter["dihedral_scaling"].get<double>();
@@ -70,497 +97,89 @@ void UFFThread::readUFF(const json& parameter)
     m_rep_scaling = parameter["rep_scaling"].get<double>();
 
     m_coulmob_scaling = parameter["coulomb_scaling"].get<double>();
+    m_coulomb_damping = parameter["coulomb_damping"].get<double>();
 
     m_bond_force = parameter["bond_force"].get<double>();
     m_angle_force = parameter["angle_force"].get<double>();
     m_calc_gradient = parameter["gradient"].get<int>();
-}
 
-double UFFThread::Distance(double x1, double x2, double y1, double y2, double z1, double z2) const
-{
-    return sqrt((((x1 - x2) * (x1 - x2)) + ((y1 - y2) * (y1 - y2)) + ((z1 - z2) * (z1 - z2))));
-}
-
-double UFFThread::BondEnergy(double distance, double r, double kij, double D_ij)
-{
-    double energy = (0.5 * kij * (distance - r) * (distance - r)) * m_final_factor * m_bond_scaling;
-    if (isnan(energy))
-        return 0;
-    else
-        return energy;
+    m_vdw_cutoff = parameter["vdw_cutoff"].get<double>();
+    m_vdw_switch_on = std::max(0.0, m_vdw_cutoff - parameter["vdw_switch"].get<double>());
 }
 
+/* gradient 0 uses the hand vectorised kernels, gradient 1 differentiates the terms of uff_terms.h
+ * with dual numbers, both give the exact gradient of the same energy */
 double UFFThread::CalculateBondStretching()
 {
-    double factor = 1;
-    double energy = 0.0;
-
-    for (int index = 0; index < m_uffbonds.size(); ++index) {
-        const auto& bond = m_uffbonds[index];
-        const int i = bond.i;
-        const int j = bond.j;
-
-        Vector x = Position(i);
-        Vector y = Position(j);
-        Matrix derivate;
-        double r0 = BondStretching(x, y, derivate, m_CalculateGradient);
-
-        energy += (0.5 * bond.kij * (r0 - bond.r0) * (r0 - bond.r0)) * m_final_factor * m_bond_scaling;
-        if (m_CalculateGradient) {
-            if (m_calc_gradient == 0) {
-                double diff = (bond.kij) * (r0 - bond.r0) * m_final_factor * m_bond_scaling;
-                m_gradient.row(i) += diff * derivate.row(0);
-                m_gradient.row(j) += diff * derivate.row(1);
-
-            } else if (m_calc_gradient == 1) {
-                double xi = (*m_geometry)(i, 0) * m_au;
-                double xj = (*m_geometry)(j, 0) * m_au;
-
-                double yi = (*m_geometry)(i, 1) * m_au;
-                double yj = (*m_geometry)(j, 1) * m_au;
-
-                double zi = (*m_geometry)(i, 2) * m_au;
-                double zj = (*m_geometry)(j, 2) * m_au;
-                m_gradient(i, 0) += (BondEnergy(Distance(xi + m_d, xj, yi, yj, zi, zj), bond.r0, bond.kij) - BondEnergy(Distance(xi - m_d, xj, yi, yj, zi, zj), bond.r0, bond.kij)) / (2 * m_d);
-                m_gradient(i, 1) += (BondEnergy(Distance(xi, xj, yi + m_d, yj, zi, zj), bond.r0, bond.kij) - BondEnergy(Distance(xi, xj, yi - m_d, yj, zi, zj), bond.r0, bond.kij)) / (2 * m_d);
-                m_gradient(i, 2) += (BondEnergy(Distance(xi, xj, yi, yj, zi + m_d, zj), bond.r0, bond.kij) - BondEnergy(Distance(xi, xj, yi, yj, zi - m_d, zj), bond.r0, bond.kij)) / (2 * m_d);
-
-                m_gradient(j, 0) += (BondEnergy(Distance(xi, xj + m_d, yi, yj, zi, zj), bond.r0, bond.kij) - BondEnergy(Distance(xi, xj - m_d, yi, yj, zi, zj), bond.r0, bond.kij)) / (2 * m_d);
-                m_gradient(j, 1) += (BondEnergy(Distance(xi, xj, yi, yj + m_d, zi, zj), bond.r0, bond.kij) - BondEnergy(Distance(xi, xj, yi, yj - m_d, zi, zj), bond.r0, bond.kij)) / (2 * m_d);
-                m_gradient(j, 2) += (BondEnergy(Distance(xi, xj, yi, yj, zi, zj + m_d), bond.r0, bond.kij) - BondEnergy(Distance(xi, xj, yi, yj, zi, zj - m_d), bond.r0, bond.kij)) / (2 * m_d);
-            }
-        }
-    }
-
-    return energy;
-}
-
-double UFFThread::AngleBend(const Eigen::Vector3d& i, const Eigen::Vector3d& j, const Eigen::Vector3d& k, double kijk, double C0, double C1, double C2)
-{
-    Eigen::Vector3d vec_1 = j - i;
-    Eigen::Vector3d vec_2 = j - k;
-
-    double costheta = (vec_1.dot(vec_2) / (sqrt(vec_1.dot(vec_1) * vec_2.dot(vec_2))));
-    double energy = (kijk * (C0 + C1 * costheta + C2 * (2 * costheta * costheta - 1))) * m_final_factor * m_angle_scaling;
-    if (isnan(energy))
-        return 0;
-    else
-        return energy;
+    if (m_CalculateGradient && m_calc_gradient == 1)
+        return UFFAutoDiff::Bonds(m_uffbonds, *m_geometry, m_gradient, m_final_factor * m_bond_scaling, m_first_atom, m_cell);
+    return UFFKernels::Bonds(m_uffbonds, *m_geometry, m_gradient, m_final_factor * m_bond_scaling, m_CalculateGradient, m_first_atom, m_cell);
 }
 
 double UFFThread::CalculateAngleBending()
 {
-    double energy = 0.0;
-    Eigen::Vector3d dx = { m_d, 0, 0 };
-    Eigen::Vector3d dy = { 0, m_d, 0 };
-    Eigen::Vector3d dz = { 0, 0, m_d };
-    for (int index = 0; index < m_uffangle.size(); ++index) {
-        const auto& angle = m_uffangle[index];
-        const int i = angle.i;
-        const int j = angle.j;
-        const int k = angle.k;
-
-        auto atom_i = Position(i);
-        auto atom_j = Position(j);
-        auto atom_k = Position(k);
-        Matrix derivate;
-        double costheta = AngleBending(atom_i, atom_j, atom_k, derivate, m_CalculateGradient);
-        double e = (angle.kijk * (angle.C0 + angle.C1 * costheta + angle.C2 * (2 * costheta * costheta - 1))) * m_final_factor * m_angle_scaling;
-
-        if (m_CalculateGradient) {
-            if (m_calc_gradient == 0) {
-                double sintheta = sin(acos(costheta));
-                double dEdtheta = -angle.kijk * sintheta * (angle.C1 + 4 * angle.C2 * costheta) * m_final_factor * m_angle_scaling;
-                m_gradient.row(i) += dEdtheta * derivate.row(0);
-                m_gradient.row(j) += dEdtheta * derivate.row(1);
-                m_gradient.row(k) += dEdtheta * derivate.row(2);
-
-            } else if (m_calc_gradient == 1) {
-                m_gradient(i, 0) += (AngleBend(AddVector(atom_i, dx), atom_j, atom_k, angle.kijk, angle.C0, angle.C1, angle.C2) - AngleBend(SubVector(atom_i, dx), atom_j, atom_k, angle.kijk, angle.C0, angle.C1, angle.C2)) / (2 * m_d);
-                m_gradient(i, 1) += (AngleBend(AddVector(atom_i, dy), atom_j, atom_k, angle.kijk, angle.C0, angle.C1, angle.C2) - AngleBend(SubVector(atom_i, dy), atom_j, atom_k, angle.kijk, angle.C0, angle.C1, angle.C2)) / (2 * m_d);
-                m_gradient(i, 2) += (AngleBend(AddVector(atom_i, dz), atom_j, atom_k, angle.kijk, angle.C0, angle.C1, angle.C2) - AngleBend(SubVector(atom_i, dz), atom_j, atom_k, angle.kijk, angle.C0, angle.C1, angle.C2)) / (2 * m_d);
-
-                m_gradient(j, 0) += (AngleBend(atom_i, AddVector(atom_j, dx), atom_k, angle.kijk, angle.C0, angle.C1, angle.C2) - AngleBend(atom_i, SubVector(atom_j, dx), atom_k, angle.kijk, angle.C0, angle.C1, angle.C2)) / (2 * m_d);
-                m_gradient(j, 1) += (AngleBend(atom_i, AddVector(atom_j, dy), atom_k, angle.kijk, angle.C0, angle.C1, angle.C2) - AngleBend(atom_i, SubVector(atom_j, dy), atom_k, angle.kijk, angle.C0, angle.C1, angle.C2)) / (2 * m_d);
-                m_gradient(j, 2) += (AngleBend(atom_i, AddVector(atom_j, dz), atom_k, angle.kijk, angle.C0, angle.C1, angle.C2) - AngleBend(atom_i, SubVector(atom_j, dz), atom_k, angle.kijk, angle.C0, angle.C1, angle.C2)) / (2 * m_d);
-
-                m_gradient(k, 0) += (AngleBend(atom_i, atom_j, AddVector(atom_k, dx), angle.kijk, angle.C0, angle.C1, angle.C2) - AngleBend(atom_i, atom_j, SubVector(atom_k, dx), angle.kijk, angle.C0, angle.C1, angle.C2)) / (2 * m_d);
-                m_gradient(k, 1) += (AngleBend(atom_i, atom_j, AddVector(atom_k, dy), angle.kijk, angle.C0, angle.C1, angle.C2) - AngleBend(atom_i, atom_j, SubVector(atom_k, dy), angle.kijk, angle.C0, angle.C1, angle.C2)) / (2 * m_d);
-                m_gradient(k, 2) += (AngleBend(atom_i, atom_j, AddVector(atom_k, dz), angle.kijk, angle.C0, angle.C1, angle.C2) - AngleBend(atom_i, atom_j, SubVector(atom_k, dz), angle.kijk, angle.C0, angle.C1, angle.C2)) / (2 * m_d);
-            }
-        }
-    }
-    return energy;
-}
-
-double UFFThread::Dihedral(const Eigen::Vector3d& i, const Eigen::Vector3d& j, const Eigen::Vector3d& k, const Eigen::Vector3d& l, double V, double n, double phi0)
-{
-    Eigen::Vector3d nabc = NormalVector(i, j, k);
-    Eigen::Vector3d nbcd = NormalVector(j, k, l);
-    double n_abc = (nabc).norm();
-    double n_bcd = (nbcd).norm();
-    double dotpr = nabc.dot(nbcd);
-    Eigen::Vector3d rji = j - i;
-    double sign = (-1 * rji).dot(nbcd) < 0 ? -1 : 1;
-    double phi = pi + sign * acos(dotpr / (n_abc * n_bcd));
-    double energy = (1 / 2.0 * V * (1 - cos(n * phi0) * cos(n * phi))) * m_final_factor * m_dihedral_scaling;
-    if (isnan(energy))
-        return 0;
-    else
-        return energy;
+    if (m_CalculateGradient && m_calc_gradient == 1)
+        return UFFAutoDiff::Angles(m_uffangle, *m_geometry, m_gradient, m_final_factor * m_angle_scaling, m_first_atom, m_cell);
+    return UFFKernels::Angles(m_uffangle, *m_geometry, m_gradient, m_final_factor * m_angle_scaling, m_CalculateGradient, m_first_atom, m_cell);
 }
 
 double UFFThread::CalculateDihedral()
 {
-    double energy = 0.0;
-    Eigen::Vector3d dx = { m_d, 0, 0 };
-    Eigen::Vector3d dy = { 0, m_d, 0 };
-    Eigen::Vector3d dz = { 0, 0, m_d };
-    for (int index = 0; index < m_uffdihedral.size(); ++index) {
-        const auto& dihedral = m_uffdihedral[index];
-        const int i = dihedral.i;
-        const int j = dihedral.j;
-        const int k = dihedral.k;
-        const int l = dihedral.l;
-        Eigen::Vector3d atom_i = Position(i);
-        Eigen::Vector3d atom_j = Position(j);
-        Eigen::Vector3d atom_k = Position(k);
-        Eigen::Vector3d atom_l = Position(l);
-        Eigen::Vector3d eins = { 1.0, 1.0, 1.0 };
-        Eigen::Vector3d nabc = NormalVector(atom_i, atom_j, atom_k);
-        Eigen::Vector3d nbcd = NormalVector(atom_j, atom_k, atom_l);
-
-        double n_abc = (nabc).norm();
-        double n_bcd = (nbcd).norm();
-        double dotpr = nabc.dot(nbcd);
-        Eigen::Vector3d m = nabc;
-        Eigen::Vector3d n = nbcd;
-        Eigen::Vector3d rji = atom_j - atom_i;
-
-        double sign = (-1 * rji).dot(n) < 0 ? -1 : 1;
-        double phi = pi + sign * acos(dotpr / (n_abc * n_bcd));
-        double sinphi = sin(phi);
-        double e = Dihedral(atom_i, atom_j, atom_k, atom_l, dihedral.V, dihedral.n, dihedral.phi0);
-        if (isnan(e))
-            continue;
-        energy += e;
-        if (m_CalculateGradient) {
-            if (m_calc_gradient == 0) {
-                Eigen::Vector3d rkj = atom_k - atom_j;
-                Eigen::Vector3d rkl = atom_k - atom_l;
-                double tmp = 0;
-                double dEdphi = (1 / 2.0 * dihedral.V * dihedral.n * (cos(dihedral.n * dihedral.phi0) * sin(dihedral.n * phi))) * m_final_factor * m_dihedral_scaling;
-                if (isnan(dEdphi))
-                    continue;
-                /* some old code stored */
-                //  Eigen::Vector3d dEdi = -1*dEdphi * rkj.norm()*m/(m.norm()*m.norm());
-                //  Eigen::Vector3d dEdi = dEdphi * (rji/rji.norm()).cross(rkj/(rkj.norm()))/(sinphi*sinphi*rji.norm());
-                //  Eigen::Vector3d dEdi = dEdphi * (atom_k - atom_j).norm()/(nabc.norm()*nabc.norm())*nabc;
-
-                //  Eigen::Vector3d dEdl = dEdphi * rkj.norm()*n/(n.norm()*n.norm());
-                //  Eigen::Vector3d dEdl = dEdphi * (-1*rkj/rkj.norm()).cross(rkl/(rkl.norm()))/(sinphi*sinphi*rkl.norm());
-
-                //  Eigen::Vector3d dEdj = -1 * dEdphi * (-1 * (rji.dot(rkj) / (rkj.norm() * rkj.norm()) - 1) * (rkj.norm() / nabc.norm()) * nabc - rkj.dot(rkl) / (rkj.norm() * rkj.norm()) * nbcd / (nbcd.norm() * nbcd.norm()));
-                //  Eigen::Vector3d dEdj = dEdi*-1*rji.norm()/(rkj.norm() * -1*cos(phi)) + dEdl*rkl.norm()/(rkj.norm() * -1*cos(phi));
-
-                //  Eigen::Vector3d dEdk = -1 * dEdphi * ((rkj.dot(rkl) / (rkj.norm() * rkj.norm()) - 1) * (rkj.norm() / nbcd.norm()) * nbcd - rji.dot(rkj) / (rkj.norm() * rkj.norm()) * nabc / (nabc.norm() * nabc.norm()));
-                //  Eigen::Vector3d dEdk = -1*dEdl - ((-1*rji).dot(rkj)/(rkj.norm()*rkj.norm())*dEdi) + (rkl.dot(rkj)/(rkj.norm()*rkj.norm())*dEdl);
-
-                Eigen::Vector3d dEdi = dEdphi * rkj.norm() / (nabc.norm() * nabc.norm()) * nabc;
-                Eigen::Vector3d dEdl = -1 * dEdphi * rkj.norm() / (nbcd.norm() * nbcd.norm()) * nbcd;
-                Eigen::Vector3d dEdj = -1 * dEdi + ((-1 * rji).dot(rkj) / (rkj.norm() * rkj.norm()) * dEdi) - (rkl.dot(rkj) / (rkj.norm() * rkj.norm()) * dEdl);
-                Eigen::Vector3d dEdk = -1 * (dEdi + dEdj + dEdl);
-
-                if (isnan(dEdi.sum()) || isnan(dEdj.sum()) || isnan(dEdk.sum()) || isnan(dEdl.sum()))
-                    continue;
-                m_gradient(i, 0) += dEdi(0);
-                m_gradient(i, 1) += dEdi(1);
-                m_gradient(i, 2) += dEdi(2);
-
-                m_gradient(l, 0) += dEdl(0);
-                m_gradient(l, 1) += dEdl(1);
-                m_gradient(l, 2) += dEdl(2);
-
-                m_gradient(j, 0) += dEdj(0);
-                m_gradient(j, 1) += dEdj(1);
-                m_gradient(j, 2) += dEdj(2);
-
-                m_gradient(k, 0) += dEdk(0);
-                m_gradient(k, 1) += dEdk(1);
-                m_gradient(k, 2) += dEdk(2);
-            } else if (m_calc_gradient == 1) {
-                e *= 1000;
-                double tmp = 0.0;
-
-                tmp = (Dihedral(AddVector(atom_i, dx), atom_j, atom_k, atom_l, dihedral.V, dihedral.n, dihedral.phi0) - Dihedral(SubVector(atom_i, dx), atom_j, atom_k, atom_l, dihedral.V, dihedral.n, dihedral.phi0)) / (2 * m_d);
-                if (std::abs(tmp) > std::abs(e))
-                    m_gradient(i, 0) += 0;
-                else
-                    m_gradient(i, 0) += tmp;
-
-                tmp = (Dihedral(AddVector(atom_i, dy), atom_j, atom_k, atom_l, dihedral.V, dihedral.n, dihedral.phi0) - Dihedral(SubVector(atom_i, dy), atom_j, atom_k, atom_l, dihedral.V, dihedral.n, dihedral.phi0)) / (2 * m_d);
-                if (std::abs(tmp) > std::abs(e))
-                    m_gradient(i, 1) += 0;
-                else
-                    m_gradient(i, 1) += tmp;
-
-                tmp = (Dihedral(AddVector(atom_i, dz), atom_j, atom_k, atom_l, dihedral.V, dihedral.n, dihedral.phi0) - Dihedral(SubVector(atom_i, dz), atom_j, atom_k, atom_l, dihedral.V, dihedral.n, dihedral.phi0)) / (2 * m_d);
-                if (std::abs(tmp) > std::abs(e))
-                    m_gradient(i, 2) += 0;
-                else
-                    m_gradient(i, 2) += tmp;
-
-                tmp = (Dihedral(atom_i, AddVector(atom_j, dx), atom_k, atom_l, dihedral.V, dihedral.n, dihedral.phi0) - Dihedral(atom_i, SubVector(atom_j, dx), atom_k, atom_l, dihedral.V, dihedral.n, dihedral.phi0)) / (2 * m_d);
-                if (std::abs(tmp) > std::abs(e))
-                    m_gradient(j, 0) += 0;
-                else
-                    m_gradient(j, 0) += tmp;
-
-                tmp = (Dihedral(atom_i, AddVector(atom_j, dy), atom_k, atom_l, dihedral.V, dihedral.n, dihedral.phi0) - Dihedral(atom_i, SubVector(atom_j, dy), atom_k, atom_l, dihedral.V, dihedral.n, dihedral.phi0)) / (2 * m_d);
-                if (std::abs(tmp) > std::abs(e))
-                    m_gradient(j, 1) += 0;
-                else
-                    m_gradient(j, 1) += tmp;
-
-                tmp = (Dihedral(atom_i, AddVector(atom_j, dz), atom_k, atom_l, dihedral.V, dihedral.n, dihedral.phi0) - Dihedral(atom_i, SubVector(atom_j, dz), atom_k, atom_l, dihedral.V, dihedral.n, dihedral.phi0)) / (2 * m_d);
-                if (std::abs(tmp) > std::abs(e))
-                    m_gradient(j, 2) += 0;
-                else
-                    m_gradient(j, 2) += tmp;
-
-                tmp = (Dihedral(atom_i, atom_j, AddVector(atom_k, dx), atom_l, dihedral.V, dihedral.n, dihedral.phi0) - Dihedral(atom_i, atom_j, SubVector(atom_k, dx), atom_l, dihedral.V, dihedral.n, dihedral.phi0)) / (2 * m_d);
-                if (std::abs(tmp) > std::abs(e))
-                    m_gradient(k, 0) += 0;
-                else
-                    m_gradient(k, 0) += tmp;
-
-                tmp = (Dihedral(atom_i, atom_j, AddVector(atom_k, dy), atom_l, dihedral.V, dihedral.n, dihedral.phi0) - Dihedral(atom_i, atom_j, SubVector(atom_k, dy), atom_l, dihedral.V, dihedral.n, dihedral.phi0)) / (2 * m_d);
-                if (std::abs(tmp) > std::abs(e))
-                    m_gradient(k, 1) += 0;
-                else
-                    m_gradient(k, 1) += tmp;
-
-                tmp = (Dihedral(atom_i, atom_j, AddVector(atom_k, dz), atom_l, dihedral.V, dihedral.n, dihedral.phi0) - Dihedral(atom_i, atom_j, SubVector(atom_k, dz), atom_l, dihedral.V, dihedral.n, dihedral.phi0)) / (2 * m_d);
-                if (std::abs(tmp) > std::abs(e))
-                    m_gradient(k, 2) += 0;
-                else
-                    m_gradient(k, 2) += tmp;
-
-                tmp = (Dihedral(atom_i, atom_j, atom_k, AddVector(atom_l, dx), dihedral.V, dihedral.n, dihedral.phi0) - Dihedral(atom_i, atom_j, atom_k, SubVector(atom_l, dx), dihedral.V, dihedral.n, dihedral.phi0)) / (2 * m_d);
-                if (std::abs(tmp) > std::abs(e))
-                    m_gradient(l, 0) += 0;
-                else
-                    m_gradient(l, 0) += tmp;
-
-                tmp = (Dihedral(atom_i, atom_j, atom_k, AddVector(atom_l, dy), dihedral.V, dihedral.n, dihedral.phi0) - Dihedral(atom_i, atom_j, atom_k, SubVector(atom_l, dy), dihedral.V, dihedral.n, dihedral.phi0)) / (2 * m_d);
-                if (std::abs(tmp) > std::abs(e))
-                    m_gradient(l, 1) += 0;
-                else
-                    m_gradient(l, 1) += tmp;
-
-                tmp = (Dihedral(atom_i, atom_j, atom_k, AddVector(atom_l, dz), dihedral.V, dihedral.n, dihedral.phi0) - Dihedral(atom_i, atom_j, atom_k, SubVector(atom_l, dz), dihedral.V, dihedral.n, dihedral.phi0)) / (2 * m_d);
-                if (std::abs(tmp) > std::abs(e))
-                    m_gradient(l, 2) += 0;
-                else
-                    m_gradient(l, 2) += tmp;
-            }
-        }
-    }
-    return energy;
-}
-double UFFThread::Inversion(const Eigen::Vector3d& i, const Eigen::Vector3d& j, const Eigen::Vector3d& k, const Eigen::Vector3d& l, double k_ijkl, double C0, double C1, double C2)
-{
-    Eigen::Vector3d ail = SubVector(i, l);
-    Eigen::Vector3d nijk = NormalVector(i, j, k);
-
-    double cosY = (nijk.dot(ail) / ((nijk).norm() * (ail).norm()));
-
-    double sinYSq = 1.0 - cosY * cosY;
-    double sinY = ((sinYSq > 0.0) ? sqrt(sinYSq) : 0.0);
-    double cos2Y = sinY * sinY - 1.0;
-    double energy = (k_ijkl * (C0 + C1 * sinY + C2 * cos2Y)) * m_final_factor * m_inversion_scaling;
-    if (isnan(energy))
-        return 0;
-    else
-        return energy;
-}
-
-double UFFThread::FullInversion(const int& i, const int& j, const int& k, const int& l, double d_forceConstant, double C0, double C1, double C2)
-{
-    double energy;
-    Eigen::Vector3d dx = { m_d, 0, 0 };
-    Eigen::Vector3d dy = { 0, m_d, 0 };
-    Eigen::Vector3d dz = { 0, 0, m_d };
-    Eigen::Vector3d atom_i = Position(i);
-    Eigen::Vector3d atom_j = Position(j);
-    Eigen::Vector3d atom_k = Position(k);
-    Eigen::Vector3d atom_l = Position(l);
-
-    energy += Inversion(atom_i, atom_j, atom_k, atom_l, d_forceConstant, C0, C1, C2);
-    if (m_CalculateGradient) {
-        if (m_calc_gradient == 0) {
-            Eigen::Vector3d rji = (atom_j - atom_i);
-            Eigen::Vector3d rjk = (atom_k - atom_i);
-            Eigen::Vector3d rjl = (atom_l - atom_i);
-
-            if (rji.norm() < 1e-5 || rjk.norm() < 1e-5 || rjl.norm() < 1e-5)
-                return 0;
-
-            double dji = rji.norm();
-            double djk = rjk.norm();
-            double djl = rjl.norm();
-            rji /= dji;
-            rjk /= djk;
-            rjl /= djl;
-
-            Eigen::Vector3d nijk = rji.cross(rjk);
-            nijk /= nijk.norm();
-
-            double cosY = (nijk.dot(rjl));
-            double sinYSq = 1.0 - cosY * cosY;
-            double sinY = ((sinYSq > 0.0) ? sqrt(sinYSq) : 0.0);
-            double cosTheta = (rji.dot(rjk));
-            double sinThetaSq = std::max(1.0 - cosTheta * cosTheta, 1.0e-8);
-            double sinTheta = std::max(((sinThetaSq > 0.0) ? sqrt(sinThetaSq) : 0.0), 1.0e-8);
-
-            double dEdY = -1 * (d_forceConstant * (C1 * cosY - 4 * C2 * cosY * sinY)) * m_final_factor * m_inversion_scaling;
-
-            Eigen::Vector3d p1 = rji.cross(rjk);
-            Eigen::Vector3d p2 = rjk.cross(rjl);
-            Eigen::Vector3d p3 = rjl.cross(rji);
-
-            const double sin_dl = p1.dot(rjl) / sinTheta;
-
-            // the wilson angle:
-            const double dll = asin(sin_dl);
-            const double cos_dl = cos(dll);
-            /*
-                    double term1 = cosY * sinTheta;
-                    double term2 = cosY / (sinY * sinThetaSq);
-
-                    Eigen::Vector3d dYdi = (p1/term1 - (rji-rjk*cosTheta)*term2)/dji;
-                    Eigen::Vector3d dYdk = (p2/term1 - (rjk-rji*cosTheta)*term2)/djk;
-                    Eigen::Vector3d dYdl = (p3/term1 - (rjl*cosY/sinY))/djl;
-
-             */
-            Eigen::Vector3d dYdl = (p1 / sinTheta - (rjl * sin_dl)) / djl;
-            Eigen::Vector3d dYdi = ((p2 + (((-rji + rjk * cosTheta) * sin_dl) / sinTheta)) / dji) / sinTheta;
-            Eigen::Vector3d dYdk = ((p3 + (((-rjk + rji * cosTheta) * sin_dl) / sinTheta)) / djk) / sinTheta;
-            Eigen::Vector3d dYdj = -1 * (dYdi + dYdk + dYdl);
-
-            m_gradient(i, 0) += dEdY * dYdj(0);
-            m_gradient(i, 1) += dEdY * dYdj(1);
-            m_gradient(i, 2) += dEdY * dYdj(2);
-
-            m_gradient(j, 0) += dEdY * dYdi(0);
-            m_gradient(j, 1) += dEdY * dYdi(1);
-            m_gradient(j, 2) += dEdY * dYdi(2);
-
-            m_gradient(k, 0) += dEdY * dYdk(0);
-            m_gradient(k, 1) += dEdY * dYdk(1);
-            m_gradient(k, 2) += dEdY * dYdk(2);
-
-            m_gradient(l, 0) += dEdY * dYdl(0);
-            m_gradient(l, 1) += dEdY * dYdl(1);
-            m_gradient(l, 2) += dEdY * dYdl(2);
-        } else if (m_calc_gradient == 1) {
-            m_gradient(i, 0) += (Inversion(AddVector(atom_i, dx), atom_j, atom_k, atom_l, d_forceConstant, C0, C1, C2) - Inversion(SubVector(atom_i, dx), atom_j, atom_k, atom_l, d_forceConstant, C0, C1, C2)) / (2 * m_d);
-            m_gradient(i, 1) += (Inversion(AddVector(atom_i, dy), atom_j, atom_k, atom_l, d_forceConstant, C0, C1, C2) - Inversion(SubVector(atom_i, dy), atom_j, atom_k, atom_l, d_forceConstant, C0, C1, C2)) / (2 * m_d);
-            m_gradient(i, 2) += (Inversion(AddVector(atom_i, dz), atom_j, atom_k, atom_l, d_forceConstant, C0, C1, C2) - Inversion(SubVector(atom_i, dz), atom_j, atom_k, atom_l, d_forceConstant, C0, C1, C2)) / (2 * m_d);
-
-            m_gradient(j, 0) += (Inversion(atom_i, AddVector(atom_j, dx), atom_k, atom_l, d_forceConstant, C0, C1, C2) - Inversion(atom_i, SubVector(atom_j, dx), atom_k, atom_l, d_forceConstant, C0, C1, C2)) / (2 * m_d);
-            m_gradient(j, 1) += (Inversion(atom_i, AddVector(atom_j, dy), atom_k, atom_l, d_forceConstant, C0, C1, C2) - Inversion(atom_i, SubVector(atom_j, dy), atom_k, atom_l, d_forceConstant, C0, C1, C2)) / (2 * m_d);
-            m_gradient(j, 2) += (Inversion(atom_i, AddVector(atom_j, dz), atom_k, atom_l, d_forceConstant, C0, C1, C2) - Inversion(atom_i, SubVector(atom_j, dz), atom_k, atom_l, d_forceConstant, C0, C1, C2)) / (2 * m_d);
-
-            m_gradient(k, 0) += (Inversion(atom_i, atom_j, AddVector(atom_k, dx), atom_l, d_forceConstant, C0, C1, C2) - Inversion(atom_i, atom_j, SubVector(atom_k, dx), atom_l, d_forceConstant, C0, C1, C2)) / (2 * m_d);
-            m_gradient(k, 1) += (Inversion(atom_i, atom_j, AddVector(atom_k, dy), atom_l, d_forceConstant, C0, C1, C2) - Inversion(atom_i, atom_j, SubVector(atom_k, dy), atom_l, d_forceConstant, C0, C1, C2)) / (2 * m_d);
-            m_gradient(k, 2) += (Inversion(atom_i, atom_j, AddVector(atom_k, dz), atom_l, d_forceConstant, C0, C1, C2) - Inversion(atom_i, atom_j, SubVector(atom_k, dz), atom_l, d_forceConstant, C0, C1, C2)) / (2 * m_d);
-
-            m_gradient(l, 0) += (Inversion(atom_i, atom_j, atom_k, AddVector(atom_l, dx), d_forceConstant, C0, C1, C2) - Inversion(atom_i, atom_j, atom_k, SubVector(atom_l, dx), d_forceConstant, C0, C1, C2)) / (2 * m_d);
-            m_gradient(l, 1) += (Inversion(atom_i, atom_j, atom_k, AddVector(atom_l, dy), d_forceConstant, C0, C1, C2) - Inversion(atom_i, atom_j, atom_k, SubVector(atom_l, dy), d_forceConstant, C0, C1, C2)) / (2 * m_d);
-            m_gradient(l, 2) += (Inversion(atom_i, atom_j, atom_k, AddVector(atom_l, dz), d_forceConstant, C0, C1, C2) - Inversion(atom_i, atom_j, atom_k, SubVector(atom_l, dz), d_forceConstant, C0, C1, C2)) / (2 * m_d);
-        }
-    }
-    return energy;
+    if (m_CalculateGradient && m_calc_gradient == 1)
+        return UFFAutoDiff::Dihedrals(m_uffdihedral, *m_geometry, m_gradient, m_final_factor * m_dihedral_scaling, m_first_atom, m_cell);
+    return UFFKernels::Dihedrals(m_uffdihedral, *m_geometry, m_gradient, m_final_factor * m_dihedral_scaling, m_CalculateGradient, m_first_atom, m_cell);
 }
 
 double UFFThread::CalculateInversion()
 {
-    double energy = 0.0;
-    for (int index = 0; index < m_uffinversion.size(); ++index) {
-        const auto& inversion = m_uffinversion[index];
-        const int i = inversion.i;
-        const int j = inversion.j;
-        const int k = inversion.k;
-        const int l = inversion.l;
-        energy += FullInversion(i, j, k, l, inversion.kijkl, inversion.C0, inversion.C1, inversion.C2);
-    }
-    return energy;
-}
-
-double UFFThread::NonBonds(const Eigen::Vector3d& i, const Eigen::Vector3d& j, double Dij, double xij)
-{
-    double r = (i - j).norm() * m_au;
-    double pow6 = pow((xij / r), 6);
-    double energy = Dij * (-2 * pow6 * m_vdw_scaling + pow6 * pow6 * m_rep_scaling) * m_final_factor;
-    if (isnan(energy))
-        return 0;
-    else
-        return energy;
+    if (m_CalculateGradient && m_calc_gradient == 1)
+        return UFFAutoDiff::Inversions(m_uffinversion, *m_geometry, m_gradient, m_final_factor * m_inversion_scaling, m_first_atom, m_cell);
+    return UFFKernels::Inversions(m_uffinversion, *m_geometry, m_gradient, m_final_factor * m_inversion_scaling, m_CalculateGradient, m_first_atom, m_cell);
 }
 
 double UFFThread::CalculateNonBonds()
 {
-    double energy = 0.0;
-    Eigen::Vector3d dx = { m_d, 0, 0 };
-    Eigen::Vector3d dy = { 0, m_d, 0 };
-    Eigen::Vector3d dz = { 0, 0, m_d };
-    for (int index = 0; index < m_uffvdwaals.size(); ++index) {
-        const auto& vdw = m_uffvdwaals[index];
-        const int i = vdw.i;
-        const int j = vdw.j;
-        Eigen::Vector3d atom_i = Position(i);
-        Eigen::Vector3d atom_j = Position(j);
-        double r = (atom_i - atom_j).norm() * m_au;
-        double pow6 = pow((vdw.xij / r), 6);
-
-        energy += vdw.Dij * (-2 * pow6 * m_vdw_scaling + pow6 * pow6 * m_rep_scaling) * m_final_factor;
-        if (m_CalculateGradient) {
-            if (m_calc_gradient == 0) {
-                double diff = 12 * vdw.Dij * (pow6 * m_vdw_scaling - pow6 * pow6 * m_rep_scaling) / (r * r) * m_final_factor;
-                m_gradient(i, 0) += diff * (atom_i(0) - atom_j(0));
-                m_gradient(i, 1) += diff * (atom_i(1) - atom_j(1));
-                m_gradient(i, 2) += diff * (atom_i(2) - atom_j(2));
-
-                m_gradient(j, 0) -= diff * (atom_i(0) - atom_j(0));
-                m_gradient(j, 1) -= diff * (atom_i(1) - atom_j(1));
-                m_gradient(j, 2) -= diff * (atom_i(2) - atom_j(2));
-            } else if (m_calc_gradient == 1) {
-                m_gradient(i, 0) += (NonBonds(AddVector(atom_i, dx), atom_j, vdw.Dij, vdw.xij) - NonBonds(SubVector(atom_i, dx), atom_j, vdw.Dij, vdw.xij)) / (2 * m_d);
-                m_gradient(i, 1) += (NonBonds(AddVector(atom_i, dy), atom_j, vdw.Dij, vdw.xij) - NonBonds(SubVector(atom_i, dy), atom_j, vdw.Dij, vdw.xij)) / (2 * m_d);
-                m_gradient(i, 2) += (NonBonds(AddVector(atom_i, dz), atom_j, vdw.Dij, vdw.xij) - NonBonds(SubVector(atom_i, dz), atom_j, vdw.Dij, vdw.xij)) / (2 * m_d);
-
-                m_gradient(j, 0) += (NonBonds(atom_i, AddVector(atom_j, dx), vdw.Dij, vdw.xij) - NonBonds(atom_i, SubVector(atom_j, dx), vdw.Dij, vdw.xij)) / (2 * m_d);
-                m_gradient(j, 1) += (NonBonds(atom_i, AddVector(atom_j, dy), vdw.Dij, vdw.xij) - NonBonds(atom_i, SubVector(atom_j, dy), vdw.Dij, vdw.xij)) / (2 * m_d);
-                m_gradient(j, 2) += (NonBonds(atom_i, AddVector(atom_j, dz), vdw.Dij, vdw.xij) - NonBonds(atom_i, SubVector(atom_j, dz), vdw.Dij, vdw.xij)) / (2 * m_d);
-            }
-        }
-    }
-    return energy;
+    if (m_CalculateGradient && m_calc_gradient == 1)
+        return UFFAutoDiff::vdWs(m_uffvdwaals, *m_geometry, m_gradient, m_final_factor, m_vdw_scaling, m_rep_scaling, m_vdw_cutoff, m_vdw_switch_on, m_first_atom, m_cell);
+    return UFFKernels::vdWs(m_uffvdwaals, *m_geometry, m_gradient, m_final_factor, m_vdw_scaling, m_rep_scaling, m_vdw_cutoff, m_vdw_switch_on, m_CalculateGradient, m_first_atom, m_cell);
 }
 
 double UFFThread::CalculateElectrostatic()
 {
-    double energy = 0.0;
+    /* the charges are fixed, so the pair kernel gives the exact gradient, e^2 / Angstrom is converted to Eh */
+    if (m_charges == nullptr || m_charges->size() == 0 || std::abs(m_coulmob_scaling) < 1e-8)
+        return 0;
+    return UFFKernels::Coulombs(m_uffvdwaals, *m_geometry, m_charges->data(), m_gradient, au * m_coulmob_scaling, m_coulomb_damping, m_vdw_cutoff, m_CalculateGradient, m_first_atom, m_cell);
+}
 
-    return energy;
+void UFFThread::CalculateSingle(bool fast, bool slow)
+{
+    if (!m_single_ready) {
+        m_single_bonds = UFFBondBlockT<float>(m_uffbonds);
+        m_single_angles = UFFAngleBlockT<float>(m_uffangle);
+        m_single_dihedrals = UFFDihedralBlockT<float>(m_uffdihedral);
+        m_single_inversions = UFFInversionBlockT<float>(m_uffinversion);
+        m_single_vdws = UFFvdWBlockT<float>(m_uffvdwaals);
+        m_single_ready = true;
+    }
+    const Eigen::MatrixXf& geometry = *m_single_geometry;
+    m_single_gradient.setZero(m_gradient.rows(), 3);
+
+    m_bond_energy = fast ? UFFKernels::Bonds(m_single_bonds, geometry, m_single_gradient, m_final_factor * m_bond_scaling, m_CalculateGradient, m_first_atom, m_cell) : 0;
+    m_angle_energy = fast ? UFFKernels::Angles(m_single_angles, geometry, m_single_gradient, m_final_factor * m_angle_scaling, m_CalculateGradient, m_first_atom, m_cell) : 0;
+    m_dihedral_energy = fast ? UFFKernels::Dihedrals(m_single_dihedrals, geometry, m_single_gradient, m_final_factor * m_dihedral_scaling, m_CalculateGradient, m_first_atom, m_cell) : 0;
+    m_inversion_energy = fast ? UFFKernels::Inversions(m_single_inversions, geometry, m_single_gradient, m_final_factor * m_inversion_scaling, m_CalculateGradient, m_first_atom, m_cell) : 0;
+    m_vdw_energy = slow ? UFFKernels::vdWs(m_single_vdws, geometry, m_single_gradient, m_final_factor, m_vdw_scaling, m_rep_scaling, m_vdw_cutoff, m_vdw_switch_on, m_CalculateGradient, m_first_atom, m_cell) : 0;
+    const bool charges = m_single_charges != nullptr && m_single_charges->size() && std::abs(m_coulmob_scaling) > 1e-8;
+    m_coulomb_energy = slow && charges ? UFFKernels::Coulombs(m_single_vdws, geometry, m_single_charges->data(), m_single_gradient, au * m_coulmob_scaling, m_coulomb_damping, m_vdw_cutoff, m_CalculateGradient, m_first_atom, m_cell) : 0;
+
+    if (m_CalculateGradient)
+        m_gradient += m_single_gradient.cast<double>();
 }
 
 eigenUFF::eigenUFF(const json& controller)
 {
     json parameter = MergeJson(UFFParameterJson, controller);
-    m_threadpool = new CxxThreadPool();
-    m_threadpool->setProgressBar(CxxThreadPool::ProgressBarType::None);
 #ifdef USE_D3
     m_use_d3 = parameter["d3"].get<int>();
     if (m_use_d3)
@@ -584,7 +203,6 @@ eigenUFF::eigenUFF(const json& controller)
     }
 
     m_final_factor = 1 / 2625.15 * 4.19;
-    m_d = parameter["differential"].get<double>();
 
     readUFF(parameter);
 
@@ -592,16 +210,27 @@ eigenUFF::eigenUFF(const json& controller)
     m_writeuff = parameter["writeuff"];
     m_verbose = parameter["verbose"];
     m_rings = parameter["rings"];
-    m_threads = parameter["threads"];
+    m_threads = WorkerTeam::Threads(parameter["threads"]);
     m_scaling = 1.4;
+    m_vdw_skin = parameter["vdw_skin"].get<double>();
+    m_uff_cache = parameter["uff_cache"];
+    m_charge_model = parameter["charges"];
+    m_single_precision = parameter["precision"].get<std::string>().compare("single") == 0;
+    m_d3_refresh = DispersionRefresh(parameter);
+    m_d4_refresh = DispersionRefresh(parameter);
     // m_au = au;
 }
 
 eigenUFF::~eigenUFF()
 {
-    delete m_threadpool;
+    for (const std::string& statistics : { m_d3_refresh.Statistics("D3"), m_d4_refresh.Statistics("D4") })
+        if (!statistics.empty())
+            std::cout << statistics << std::endl;
+    delete m_team;
     for (int i = 0; i < m_stored_threads.size(); ++i)
         delete m_stored_threads[i];
+    for (int i = 0; i < m_reduce_threads.size(); ++i)
+        delete m_reduce_threads[i];
 }
 
 void eigenUFF::Initialise()
@@ -609,59 +238,81 @@ void eigenUFF::Initialise()
     if (m_initialised)
         return;
 
-    m_uff_atom_types = std::vector<int>(m_atom_types.size(), 0);
-    m_coordination = std::vector<int>(m_atom_types.size(), 0);
-    std::vector<std::set<int>> ignored_vdw;
-    m_topo = Eigen::MatrixXd::Zero(m_atom_types.size(), m_atom_types.size());
+    const int atoms = m_atom_types.size();
+    if (m_cell.isPeriodic()) {
+        /* every pair interacts with one image only, cutoff and skin have to fit into half of the cell */
+        const double half = 0.5 * m_cell.Width();
+        const double skin = std::min(m_vdw_skin, 0.25 * half);
+        const double cutoff = std::min(m_vdw_cutoff > 0 ? m_vdw_cutoff : 12.0, half - skin);
+        if (std::abs(cutoff - m_vdw_cutoff) > 1e-8 || std::abs(skin - m_vdw_skin) > 1e-8)
+            std::cout << "Periodic cell: nonbonded cutoff set to " << cutoff << " with a skin of " << skin << std::endl;
+        m_vdw_cutoff = cutoff;
+        m_vdw_skin = skin;
+        if (HasCorrections())
+            std::cout << "Periodic cell: D3, D4 and the hydrogen bond corrections only see the atoms of the cell itself" << std::endl;
+    }
+    m_uff_atom_types = std::vector<int>(atoms, 0);
+    m_coordination = std::vector<int>(atoms, 0);
     TContainer bonds, nonbonds, angles, dihedrals, inversions;
     m_scaling = 1.4;
-    m_gradient = Eigen::MatrixXd::Zero(m_atom_types.size(), 3);
-    for (int i = 0; i < m_atom_types.size(); ++i) {
-        m_stored_bonds.push_back(std::vector<int>());
-        ignored_vdw.push_back(std::set<int>({ i }));
-        for (int j = 0; j < m_atom_types.size() && m_stored_bonds[i].size() < CoordinationNumber[m_atom_types[i]]; ++j) {
-            if (i == j)
-                continue;
-            double x_i = m_geometry(i, 0) * m_au;
-            double x_j = m_geometry(j, 0) * m_au;
-
-            double y_i = m_geometry(i, 1) * m_au;
-            double y_j = m_geometry(j, 1) * m_au;
-
-            double z_i = m_geometry(i, 2) * m_au;
-            double z_j = m_geometry(j, 2) * m_au;
-
-            double r_ij = sqrt((((x_i - x_j) * (x_i - x_j)) + ((y_i - y_j) * (y_i - y_j)) + ((z_i - z_j) * (z_i - z_j))));
-
-            if (r_ij <= (Elements::CovalentRadius[m_atom_types[i]] + Elements::CovalentRadius[m_atom_types[j]]) * m_scaling * m_au) {
-                if (bonds.insert({ std::min(i, j), std::max(i, j) })) {
-                    m_coordination[i]++;
-                    m_stored_bonds[i].push_back(j);
-                    ignored_vdw[i].insert(j);
-                }
-                m_topo(i, j) = 1;
-                m_topo(j, i) = 1;
-            }
+    m_gradient = Eigen::MatrixXd::Zero(atoms, 3);
+
+    m_stored_bonds = PerceiveBonds(m_geometry);
+    std::vector<std::pair<int, int>> excluded;
+    for (int i = 0; i < atoms; ++i) {
+        for (int j : m_stored_bonds[i]) {
+            bonds.insert({ std::min(i, j), std::max(i, j) });
+            m_coordination[i]++;
+            excluded.push_back({ i, j });
+            excluded.push_back({ j, i });
         }
     }
-    AssignUffAtomTypes();
-    if (m_rings)
+
+    /* typing and term generation only depend on the elements and bonds, conformers reuse them */
+    auto entry = std::make_shared<UFFCacheEntry>();
+    entry->elements = m_atom_types;
+    entry->connectivity = m_stored_bonds;
+    entry->bond_force = m_bond_force;
+    entry->angle_force = m_angle_force;
+    entry->ring_typing = m_rings;
+    if (auto cached = UFFParameterCache::Find(*entry, m_uff_cache)) {
+        m_uff_atom_types = cached->uff_atom_types;
+        m_ring_set.Assign(atoms, cached->rings);
+        m_uffbonds = cached->bonds;
+        m_uffangle = cached->angles;
+        m_uffdihedral = cached->dihedrals;
+        m_uffinversion = cached->inversions;
+        setvdWs(cached->ignored_vdw);
+    } else {
         FindRings();
+        AssignUffAtomTypes();
 
-    bonds.clean();
-    setBonds(bonds, ignored_vdw, angles, dihedrals, inversions);
+        bonds.clean();
+        setBonds(bonds, excluded, angles, dihedrals, inversions);
+        AdjacencyList ignored_vdw;
+        ignored_vdw.Build(atoms, excluded);
 
-    angles.clean();
-    setAngles(angles, ignored_vdw);
+        angles.clean();
+        setAngles(angles);
 
-    dihedrals.clean();
-    setDihedrals(dihedrals);
+        dihedrals.clean();
+        setDihedrals(dihedrals);
 
-    inversions.clean();
-    setInversions(inversions);
+        inversions.clean();
+        setInversions(inversions);
 
-    nonbonds.clean();
-    setvdWs(ignored_vdw);
+        nonbonds.clean();
+        setvdWs(ignored_vdw);
+
+        entry->uff_atom_types = m_uff_atom_types;
+        entry->rings = m_ring_set.Rings();
+        entry->bonds = m_uffbonds;
+        entry->angles = m_uffangle;
+        entry->dihedrals = m_uffdihedral;
+        entry->inversions = m_uffinversion;
+        entry->ignored_vdw = ignored_vdw;
+        UFFParameterCache::Store(entry, m_uff_cache);
+    }
 
     m_h4correction.allocate(m_atom_types.size());
 
@@ -674,6 +325,13 @@ void eigenUFF::Initialise()
     if (m_use_d4)
         m_d4->InitialiseMolecule(m_atom_types);
 #endif
+    m_dispersion_coord.assign(3 * m_atom_types.size(), 0.0);
+    m_dispersion_gradient.assign(3 * m_atom_types.size(), 0.0);
+    m_d3_refresh.Reset();
+    m_d4_refresh.Reset();
+
+    if (m_charge_model.compare("qeq") == 0)
+        ChargeEquilibration();
 
     if (m_writeparam.compare("none") != 0)
         writeParameterFile(m_writeparam + ".json");
@@ -682,11 +340,17 @@ void eigenUFF::Initialise()
         writeUFFFile(m_writeuff + ".json");
 
     AutoRanges();
+    m_fragment_tagged = false;
+    m_fragment_rebuilds = -1;
     m_initialised = true;
 }
 
-void eigenUFF::setBonds(const TContainer& bonds, std::vector<std::set<int>>& ignored_vdw, TContainer& angels, TContainer& dihedrals, TContainer& inversions)
+void eigenUFF::setBonds(const TContainer& bonds, std::vector<std::pair<int, int>>& ignored_vdw, TContainer& angels, TContainer& dihedrals, TContainer& inversions)
 {
+    auto exclude = [&ignored_vdw](int a, int b) {
+        ignored_vdw.push_back({ a, b });
+        ignored_vdw.push_back({ b, a });
+    };
     for (const auto& bond : bonds.Storage()) {
         UFFBond b;
 
@@ -718,7 +382,7 @@ void eigenUFF::setBonds(const TContainer& bonds, std::vector<std::set<int>>& ign
             if (t == j)
                 continue;
             angels.insert({ std::min(t, j), i, std::max(j, t) });
-            ignored_vdw[i].insert(t);
+            exclude(i, t);
         }
 
         std::vector<int> l_bodies;
@@ -728,7 +392,7 @@ void eigenUFF::setBonds(const TContainer& bonds, std::vector<std::set<int>>& ign
             if (t == i)
                 continue;
             angels.insert({ std::min(i, t), j, std::max(t, i) });
-            ignored_vdw[j].insert(t);
+            exclude(j, t);
         }
 
         for (int k : k_bodies) {
@@ -736,12 +400,11 @@ void eigenUFF::setBonds(const TContainer& bonds, std::vector<std::set<int>>& ign
                 if (k == i || k == j || k == l || i == j || i == l || j == l)
                     continue;
                 dihedrals.insert({ k, i, j, l });
-                ignored_vdw[i].insert(k);
-                ignored_vdw[i].insert(l);
-                ignored_vdw[j].insert(k);
-                ignored_vdw[j].insert(l);
-                ignored_vdw[k].insert(l);
-                ignored_vdw[l].insert(k);
+                exclude(i, k);
+                exclude(i, l);
+                exclude(j, k);
+                exclude(j, l);
+                exclude(k, l);
             }
         }
         if (m_stored_bonds[i].size() == 3) {
@@ -753,7 +416,7 @@ void eigenUFF::setBonds(const TContainer& bonds, std::vector<std::set<int>>& ign
     }
 }
 
-void eigenUFF::setAngles(const TContainer& angles, const std::vector<std::set<int>>& ignored_vdw)
+void eigenUFF::setAngles(const TContainer& angles)
 {
     for (const auto& angle : angles.Storage()) {
         UFFAngle a;
@@ -891,165 +554,218 @@ void eigenUFF::setInversions(const TContainer& inversions)
     }
 }
 
-void eigenUFF::setvdWs(const std::vector<std::set<int>>& ignored_vdw)
+UFFvdW eigenUFF::vdWPair(int i, int j) const
+{
+    UFFvdW v;
+    v.i = i;
+    v.j = j;
+
+    double cDi = UFFParameters[m_uff_atom_types[v.i]][cD];
+    double cDj = UFFParameters[m_uff_atom_types[v.j]][cD];
+    double cxi = UFFParameters[m_uff_atom_types[v.i]][cx];
+    double cxj = UFFParameters[m_uff_atom_types[v.j]][cx];
+    v.Dij = sqrt(cDi * cDj) * 2;
+
+    v.xij = sqrt(cxi * cxj);
+    return v;
+}
+
+void eigenUFF::setvdWs(const AdjacencyList& ignored_vdw)
 {
+    m_uffvdwaals.clear();
+    m_ignored_vdw = ignored_vdw;
+    m_vdw_candidates.clear();
+    if (m_vdw_cutoff > 0) {
+        /* pairs are collected on the first call of UpdateVdWList */
+        m_vdw_reference.resize(0, 3);
+        return;
+    }
     for (int i = 0; i < m_atom_types.size(); ++i) {
         for (int j = i + 1; j < m_atom_types.size(); ++j) {
-            if (std::find(ignored_vdw[i].begin(), ignored_vdw[i].end(), j) != ignored_vdw[i].end() || std::find(ignored_vdw[j].begin(), ignored_vdw[j].end(), i) != ignored_vdw[j].end())
+            if (ignored_vdw.Contains(i, j))
                 continue;
-            UFFvdW v;
-            v.i = i;
-            v.j = j;
+            m_uffvdwaals.push_back(vdWPair(i, j));
+        }
+    }
+}
 
-            double cDi = UFFParameters[m_uff_atom_types[v.i]][cD];
-            double cDj = UFFParameters[m_uff_atom_types[v.j]][cD];
-            double cxi = UFFParameters[m_uff_atom_types[v.i]][cx];
-            double cxj = UFFParameters[m_uff_atom_types[v.j]][cx];
-            v.Dij = sqrt(cDi * cDj) * 2;
+void eigenUFF::ChargeEquilibration()
+{
+    /* QEq, Rappe and Goddard, J. Phys. Chem. 95, 3358 (1991) - DOI: 10.1021/j100161a070
+     * E(q) = sum chi_i q_i + 1/2 J_i q_i^2 + sum_i<j J_ij q_i q_j with the shielded J_ij = k / sqrt(r^2 + k^2 / (J_i J_j)),
+     * UFF lists J / 2 as hardness. With a cutoff J_ij is shifted to zero there and the matrix stays sparse, so the
+     * conjugate gradient steps are linear in the atoms. The total charge is kept with a Lagrange multiplier */
+    const int atoms = m_atom_types.size();
+    const double k = 14.399645; // e^2 / Angstrom in eV
+    const double cutoff = m_vdw_cutoff * m_au;
+    Vector chi(atoms), hardness(atoms);
+    std::vector<Eigen::Triplet<double>> triplets;
+    for (int i = 0; i < atoms; ++i) {
+        chi(i) = UFFParameters[m_uff_atom_types[i]][cXi];
+        hardness(i) = 2 * UFFParameters[m_uff_atom_types[i]][cHard];
+        triplets.push_back({ i, i, hardness(i) });
+    }
+    auto add = [&](int i, int j, double r2) {
+        const double a2 = k * k / (hardness(i) * hardness(j));
+        double J = k / std::sqrt(r2 + a2);
+        if (cutoff > 0)
+            J -= k / std::sqrt(cutoff * cutoff + a2);
+        triplets.push_back({ i, j, J });
+        triplets.push_back({ j, i, J });
+    };
+    if (cutoff > 0) {
+        CellList cells;
+        cells.Build(m_geometry, cutoff, m_cell);
+        cells.ForEachPair(m_geometry, add);
+    } else {
+        for (int i = 0; i < atoms; ++i)
+            for (int j = i + 1; j < atoms; ++j)
+                add(i, j, (m_geometry.row(i) - m_geometry.row(j)).squaredNorm());
+    }
+    Eigen::SparseMatrix<double> A(atoms, atoms);
+    A.setFromTriplets(triplets.begin(), triplets.end());
+
+    Eigen::ConjugateGradient<Eigen::SparseMatrix<double>, Eigen::Lower | Eigen::Upper> solver;
+    solver.setTolerance(1e-10);
+    solver.compute(A);
+    const Vector s = solver.solve(-chi);
+    const Vector t = solver.solve(Vector::Ones(atoms));
+    if (solver.info() != Eigen::Success)
+        std::cout << "Charge equilibration did not converge, the charges may be inaccurate" << std::endl;
+    m_charges = s - (s.sum() - m_total_charge) / t.sum() * t;
+}
 
-            v.xij = sqrt(cxi * cxj);
+bool eigenUFF::UpdateVdWList()
+{
+    if (m_vdw_cutoff <= 0)
+        return false;
+
+    if (m_vdw_reference.rows() == m_geometry.rows() && m_geometry.rows()) {
+        double max_shift = 0;
+        for (int i = 0; i < m_geometry.rows(); ++i)
+            max_shift = std::max(max_shift, m_cell.MinimumImage((m_geometry.row(i) - m_vdw_reference.row(i)).transpose()).squaredNorm());
+        if (max_shift < 0.25 * m_vdw_skin * m_vdw_skin)
+            return false;
+    }
+    m_vdw_reference = m_geometry;
 
-            m_uffvdwaals.push_back(v);
+    const double list_cutoff = (m_vdw_cutoff + m_vdw_skin) * m_au;
+    m_uffvdwaals.clear();
+    if (m_vdw_candidates.size()) {
+        for (const auto& vdw : m_vdw_candidates) {
+            if (m_cell.MinimumImage((m_geometry.row(vdw.i) - m_geometry.row(vdw.j)).transpose()).squaredNorm() < list_cutoff * list_cutoff)
+                m_uffvdwaals.push_back(vdw);
         }
+    } else {
+        m_vdw_cells.Build(m_geometry, list_cutoff, m_cell);
+        m_vdw_cells.ForEachPair(m_geometry, [this](int i, int j, double) {
+            if (m_ignored_vdw.Contains(i, j))
+                return;
+            m_uffvdwaals.push_back(vdWPair(i, j));
+        });
     }
+    m_vdw_rebuilds++;
+    DistributeTerms();
+    return true;
 }
 
 void eigenUFF::FindRings()
 {
-    std::vector<int> done;
+    /* every atom only stores the partners it has chosen itself, the ring search needs both directions */
+    std::vector<std::pair<int, int>> entries;
+    for (int i = 0; i < m_stored_bonds.Rows(); ++i)
+        for (int j : m_stored_bonds[i]) {
+            entries.push_back({ i, j });
+            entries.push_back({ j, i });
+        }
+    AdjacencyList bonds;
+    bonds.Build(m_atom_types.size(), entries);
+    m_ring_set.Build(bonds);
+
+    if (m_verbose) {
+        for (int r = 0; r < m_ring_set.Count(); ++r) {
+            for (int atom : m_ring_set[r])
+                std::cout << atom << " ";
+            std::cout << std::endl;
+        }
+    }
+}
 
-    for (int i = 0; i < m_atom_types.size(); ++i) {
-        if (std::find(done.begin(), done.end(), i) != done.end())
-            continue;
-        if (m_stored_bonds[i].size() == 1) {
-            done.push_back(i);
-            continue;
+AdjacencyList eigenUFF::PerceiveBonds(const Matrix& geometry) const
+{
+    /* bond candidates are found on a cell grid as wide as the longest possible bond */
+    const int atoms = m_atom_types.size();
+    double max_radius = 0;
+    for (int element : m_atom_types)
+        max_radius = std::max(max_radius, Elements::CovalentRadius[element]);
+    std::vector<std::pair<int, int>> contacts;
+    CellList cells;
+    cells.Build(geometry, 2 * max_radius * m_scaling + 1e-6, m_cell);
+    cells.ForEachPair(geometry, [this, &contacts](int i, int j, double r2) {
+        if (sqrt(r2) * m_au <= (Elements::CovalentRadius[m_atom_types[i]] + Elements::CovalentRadius[m_atom_types[j]]) * m_scaling * m_au) {
+            contacts.push_back({ i, j });
+            contacts.push_back({ j, i });
         }
-        bool loop = true;
-        std::vector<int> bonded = m_stored_bonds[i];
-        std::vector<int> knots, outer;
-        // std::vector< std::pair<int, std::vector<int> > > mknots;
-        /*
-        for (int atom : bonded) {
-            if (m_stored_bonds[atom].size() == 1)
-                done.push_back(atom);
-            knots.push_back(atom);
-            outer.push_back(atom);
-        }*/
-        std::vector<std::vector<int>> stash;
-        stash.push_back(std::vector<int>{ i });
-        // done.push_back(std::vector<int>());
-        int index = -1;
-        while (stash.size()) {
-            for (auto tmp : knots) {
-                auto it = std::find(done.begin(), done.end(), tmp);
-                if (it != done.end())
-                    done.erase(it);
-            }
-            for (int s = 0; s < stash.size(); ++s) {
-                int outeratom = stash[s][stash[s].size() - 1];
-                {
-                    std::vector<int> bonded = m_stored_bonds[outeratom];
-                    std::vector<int> vacant;
-                    bool close_ring = false;
-                    for (int atom : bonded) {
-                        // std::cout << atom << " " << stash[s][stash[s].size() - 2] << std::endl;
-                        if (stash[s][stash[s].size() - 2] == atom)
-                            continue;
-
-                        if (stash[s][0] == atom) {
-                            vacant.push_back(atom);
-                            close_ring = true;
-                            break;
-                        }
-                        if (m_stored_bonds[atom].size() == 1) // ignore atoms with only one bond
-                        {
-                            done.push_back(atom);
-                            continue;
-                        }
-                        int counter = 0;
-                        for (auto a : stash[s]) // check if atom is already in the list
-                            counter += a == atom;
-                        bool isKnot = std::find(knots.begin(), knots.end(), atom) != knots.end(); // check if atom is a knot
-                        if (counter) // if atom is in list
-                        {
-                            if (isKnot) // take care of knot-atoms
-                            {
-                                if (counter >= m_stored_bonds[atom].size()) // if fewer counts than binding partners, except
-                                    continue;
-                            } else
-                                continue;
-                        }
-
-                        if (std::find(done.begin(), done.end(), atom) != done.end()) {
-                            continue;
-                        }
-
-                        vacant.push_back(atom);
-                        if (stash[s].size() == 1)
-                            break;
-                    }
-                    if (vacant.size() == 0 || close_ring) {
-                        loop = false;
-                        if (stash[s].size() < 3) {
-                            stash.erase(stash.begin() + s);
-                            break;
-                        }
-                        int first = stash[s][0];
-                        int last = stash[s][stash[s].size() - 1];
-                        bool connected = false;
-                        for (int a : m_stored_bonds[first]) {
-                            if (a == last) {
-                                connected = true;
-                                break;
-                            }
-                        }
-                        if (connected) {
-                            index = s;
-                            m_identified_rings.push_back(stash[s]);
-                            for (int a : stash[s]) {
-                                if (stash[s].size() < 10)
-                                    done.push_back(a);
-                                // std::cout << a << " ";
-                            }
-                            // std::cout << std::endl;
-                            stash.erase(stash.begin() + s);
-                        } else {
-                            //    for (int a : stash[s])
-                            //        done.push_back(a);
-                            stash.erase(stash.begin() + s);
-                        }
-                    } else if (vacant.size() == 1)
-                        stash[s].push_back(vacant[0]);
-                    else {
-                        auto currentstash = stash[s];
-                        stash.erase(stash.begin() + s);
-                        if (currentstash.size() > 30)
-                            break;
-                        // auto currdone = done[s];
-                        // done.erase(done.begin() + s);
-                        knots.push_back(outeratom);
-                        for (int atom : vacant) {
-                            stash.push_back(currentstash);
-                            stash[stash.size() - 1].push_back(atom);
-                            //  done.push_back(currdone);
-                        }
-                    }
-                }
-            }
+    });
+    AdjacencyList candidates;
+    candidates.Build(atoms, contacts);
+
+    std::vector<std::pair<int, int>> stored;
+    for (int i = 0; i < atoms; ++i) {
+        int coordination = 0;
+        for (int j : candidates[i]) {
+            if (coordination >= CoordinationNumber[m_atom_types[i]])
+                break;
+            stored.push_back({ i, j });
+            ++coordination;
         }
     }
-    for (auto a : m_identified_rings) {
-        if (a.size() < 10) {
-            for (auto i : a)
-                std::cout << i << " ";
-            std::cout << std::endl;
+    AdjacencyList bonds;
+    bonds.Build(atoms, stored);
+    return bonds;
+}
+
+bool eigenUFF::SameBonds(const std::vector<std::array<double, 3>>& geometry) const
+{
+    if (geometry.size() != m_atom_types.size())
+        return false;
+    Matrix positions(geometry.size(), 3);
+    for (int i = 0; i < geometry.size(); ++i)
+        for (int c = 0; c < 3; ++c)
+            positions(i, c) = geometry[i][c];
+    return PerceiveBonds(positions) == m_stored_bonds;
+}
+
+std::vector<char> eigenUFF::AromaticAtoms() const
+{
+    /* five and six membered rings of sp2 carbons and pyridine like nitrogens, five membered ones
+     * take one pyrrole like nitrogen, oxygen or sulfur as well */
+    std::vector<char> aromatic(m_atom_types.size(), 0);
+    for (int r = 0; r < m_ring_set.Count(); ++r) {
+        const auto ring = m_ring_set[r];
+        if (ring.size() != 5 && ring.size() != 6)
+            continue;
+        int planar = 0, donors = 0;
+        for (int atom : ring) {
+            const int element = m_atom_types[atom], coordination = m_coordination[atom];
+            if ((element == 6 && coordination == 3) || (element == 7 && coordination == 2))
+                planar++;
+            else if ((element == 7 && coordination == 3) || ((element == 8 || element == 16) && coordination == 2))
+                donors++;
         }
+        if ((ring.size() == 6 && planar == 6) || (ring.size() == 5 && planar == 4 && donors == 1))
+            for (int atom : ring)
+                aromatic[atom] = 1;
     }
+    return aromatic;
 }
 
 void eigenUFF::AssignUffAtomTypes()
 {
+    /* without ring typing every sp2 carbon and every nitrogen with two partners is taken as resonant */
+    std::vector<char> aromatic(m_atom_types.size(), !m_rings);
+    if (m_rings)
+        aromatic = AromaticAtoms();
     for (int i = 0; i < m_atom_types.size(); ++i) {
         switch (m_atom_types[i]) {
         case 1: // Hydrogen
@@ -1074,15 +790,15 @@ void eigenUFF::AssignUffAtomTypes()
             if (m_coordination[i] == 4)
                 m_uff_atom_types[i] = 9;
             else if (m_coordination[i] == 3)
-                m_uff_atom_types[i] = 10;
+                m_uff_atom_types[i] = aromatic[i] ? 10 : 11;
             else // if (coordination == 2)
                 m_uff_atom_types[i] = 12;
             break;
         case 7: // N
             if (m_coordination[i] == 3)
-                m_uff_atom_types[i] = 13;
+                m_uff_atom_types[i] = m_rings && aromatic[i] ? 14 : 13;
             else if (m_coordination[i] == 2)
-                m_uff_atom_types[i] = 14;
+                m_uff_atom_types[i] = aromatic[i] ? 14 : 15;
             else // if (coordination == 2)
                 m_uff_atom_types[i] = 15;
             break;
@@ -1118,7 +834,7 @@ void eigenUFF::AssignUffAtomTypes()
             break;
         case 16: // S
             if (m_coordination[i] == 2)
-                m_uff_atom_types[i] = 31;
+                m_uff_atom_types[i] = m_rings && aromatic[i] ? 34 : 31;
             else // ok, currently we do not discriminate between SO2 and SO3, just because there is H2SO3 and H2SO4
                 m_uff_atom_types[i] = 32;
 #pragma message("we have to add organic S")
@@ -1347,13 +1063,25 @@ json eigenUFF::Inversions() const
 
 json eigenUFF::vdWs() const
 {
+    /* in cutoff mode the current pair list depends on the geometry, so all pairs are written */
+    std::vector<UFFvdW> pairs;
+    if (m_vdw_cutoff > 0 && m_vdw_candidates.size())
+        pairs = m_vdw_candidates;
+    else if (m_vdw_cutoff > 0) {
+        for (int i = 0; i < m_ignored_vdw.Rows(); ++i)
+            for (int j = i + 1; j < m_ignored_vdw.Rows(); ++j)
+                if (!m_ignored_vdw.Contains(i, j))
+                    pairs.push_back(vdWPair(i, j));
+    }
+    const std::vector<UFFvdW>& list = m_vdw_cutoff > 0 ? pairs : m_uffvdwaals;
+
     json vdws;
-    for (int i = 0; i < m_uffvdwaals.size(); ++i) {
+    for (int i = 0; i < list.size(); ++i) {
         json vdw;
-        vdw["i"] = m_uffvdwaals[i].i;
-        vdw["j"] = m_uffvdwaals[i].j;
-        vdw["Dij"] = m_uffvdwaals[i].Dij;
-        vdw["xij"] = m_uffvdwaals[i].xij;
+        vdw["i"] = list[i].i;
+        vdw["j"] = list[i].j;
+        vdw["Dij"] = list[i].Dij;
+        vdw["xij"] = list[i].xij;
         vdws[i] = vdw;
     }
     return vdws;
@@ -1378,6 +1106,7 @@ json eigenUFF::writeParameter() const
     parameters["gradient"] = m_calc_gradient;
 
     parameters["coulomb_scaling"] = m_coulmob_scaling;
+    parameters["coulomb_damping"] = m_coulomb_damping;
 
     parameters["bond_force"] = m_bond_force;
     parameters["angle_force"] = m_angle_force;
@@ -1423,7 +1152,6 @@ json eigenUFF::writeParameter() const
 json eigenUFF::writeUFF() const
 {
     json parameters;
-    parameters["differential"] = m_d;
     parameters["bond_scaling"] = m_bond_scaling;
     parameters["angle_scaling"] = m_angle_scaling;
     parameters["inversion_scaling"] = m_inversion_scaling;
@@ -1432,7 +1160,12 @@ json eigenUFF::writeUFF() const
     parameters["dihedral_scaling"] = m_dihedral_scaling;
     parameters["gradient"] = m_calc_gradient;
 
+    parameters["vdw_cutoff"] = m_vdw_cutoff;
+    parameters["vdw_skin"] = m_vdw_skin;
+    parameters["vdw_switch"] = m_vdw_switch;
+
     parameters["coulomb_scaling"] = m_coulmob_scaling;
+    parameters["coulomb_damping"] = m_coulomb_damping;
 
     parameters["bond_force"] = m_bond_force;
     parameters["angle_force"] = m_angle_force;
@@ -1487,8 +1220,8 @@ void eigenUFF::readUFF(const json& parameters)
     if (m_use_d4)
         m_d4->UpdateParameters(parameter);
 #endif
-
-    m_d = parameter["differential"].get<double>();
+    m_d3_refresh.Reset();
+    m_d4_refresh.Reset();
 
     m_bond_scaling = parameter["bond_scaling"].get<double>();
     m_angle_scaling = parameter["angle_scaling"].get<double>();
@@ -1498,10 +1231,14 @@ void eigenUFF::readUFF(const json& parameters)
     m_rep_scaling = parameter["rep_scaling"].get<double>();
 
     m_coulmob_scaling = parameter["coulomb_scaling"].get<double>();
+    m_coulomb_damping = parameter["coulomb_damping"].get<double>();
 
     m_bond_force = parameter["bond_force"].get<double>();
     m_angle_force = parameter["angle_force"].get<double>();
     m_calc_gradient = parameter["gradient"].get<int>();
+    m_vdw_cutoff = parameter["vdw_cutoff"].get<double>();
+    m_vdw_skin = parameter["vdw_skin"].get<double>();
+    m_vdw_switch = parameter["vdw_switch"].get<double>();
     m_h4_scaling = parameter["h4_scaling"].get<double>();
     m_hh_scaling = parameter["hh_scaling"].get<double>();
 
@@ -1525,7 +1262,6 @@ void eigenUFF::readParameter(const json& parameters)
     // while (m_gradient.size() < m_atom_types.size())
     //     m_gradient.push_back({ 0, 0, 0 });
 
-    //  m_d = parameters["differential"].get<double>();
     /*
     #ifdef USE_D3
         if (m_use_d3)
@@ -1649,6 +1385,7 @@ void eigenUFF::setInversions(const json& inversions)
 void eigenUFF::setvdWs(const json& vdws)
 {
     m_uffvdwaals.clear();
+    m_vdw_candidates.clear();
     for (int i = 0; i < vdws.size(); ++i) {
         json vdw = vdws[i].get<json>();
         UFFvdW v;
@@ -1660,6 +1397,11 @@ void eigenUFF::setvdWs(const json& vdws)
 
         m_uffvdwaals.push_back(v);
     }
+    if (m_vdw_cutoff > 0) {
+        /* the stored list is only the pool of candidates, the actual pairs are selected by distance */
+        std::swap(m_uffvdwaals, m_vdw_candidates);
+        m_vdw_reference.resize(0, 3);
+    }
 }
 
 void eigenUFF::readUFFFile(const std::string& file)
@@ -1692,37 +1434,128 @@ void eigenUFF::AutoRanges()
         UFFThread* thread = new UFFThread(i, m_threads);
         thread->readUFF(writeUFF());
         thread->setMolecule(m_atom_types, &m_geometry);
-        m_threadpool->addThread(thread);
+        thread->setCell(&m_cell);
+        thread->setCharges(&m_charges);
+        thread->setSingleGeometry(&m_single_geometry, &m_single_charges);
         m_stored_threads.push_back(thread);
-        for (int j = int(i * m_uffbonds.size() / double(m_threads)); j < int((i + 1) * m_uffbonds.size() / double(m_threads)); ++j)
-            thread->AddBond(m_uffbonds[j]);
-
-        for (int j = int(i * m_uffangle.size() / double(m_threads)); j < int((i + 1) * m_uffangle.size() / double(m_threads)); ++j)
-            thread->AddAngle(m_uffangle[j]);
-
-        for (int j = int(i * m_uffdihedral.size() / double(m_threads)); j < int((i + 1) * m_uffdihedral.size() / double(m_threads)); ++j)
-            thread->AddDihedral(m_uffdihedral[j]);
-
-        for (int j = int(i * m_uffinversion.size() / double(m_threads)); j < int((i + 1) * m_uffinversion.size() / double(m_threads)); ++j)
-            thread->AddInversion(m_uffinversion[j]);
-
-        for (int j = int(i * m_uffvdwaals.size() / double(m_threads)); j < int((i + 1) * m_uffvdwaals.size() / double(m_threads)); ++j)
-            thread->AddvdW(m_uffvdwaals[j]);
+        m_reduce_threads.push_back(new UFFReduceThread(&m_stored_threads, &m_gradient));
     }
+    if (m_threads > 1 && m_team == nullptr)
+        m_team = new WorkerTeam(m_threads);
+
+    auto by_lowest = [](const auto& a, const auto& b) { return LowestAtom(a) < LowestAtom(b); };
+    std::stable_sort(m_uffbonds.begin(), m_uffbonds.end(), by_lowest);
+    std::stable_sort(m_uffangle.begin(), m_uffangle.end(), by_lowest);
+    std::stable_sort(m_uffdihedral.begin(), m_uffdihedral.end(), by_lowest);
+    std::stable_sort(m_uffinversion.begin(), m_uffinversion.end(), by_lowest);
+    DistributeTerms();
 
     m_uff_bond_end = m_uffbonds.size();
     m_uff_angle_end = m_uffangle.size();
     m_uff_dihedral_end = m_uffdihedral.size();
     m_uff_inv_end = m_uffinversion.size();
+}
+
+void eigenUFF::MeasureTermCosts()
+{
+    if (m_geometry.rows() == 0)
+        return;
+
+    Matrix gradient = Matrix::Zero(m_geometry.rows(), 3);
+    auto measure = [this, &gradient](double& cost, const auto& terms, auto block, auto kernel) {
+        if (cost > 0 || terms.empty())
+            return;
+        for (const auto& term : terms)
+            block.push_back(term);
+        kernel(block, gradient);
+        auto start = std::chrono::steady_clock::now();
+        kernel(block, gradient);
+        auto end = std::chrono::steady_clock::now();
+        cost = std::max(std::chrono::duration<double, std::nano>(end - start).count() / terms.size(), 1e-3);
+    };
+
+    measure(m_term_cost[0], m_uffbonds, UFFBondBlock(), [this](const UFFBondBlock& block, Matrix& gradient) {
+        UFFKernels::Bonds(block, m_geometry, gradient, 1, true);
+    });
+    measure(m_term_cost[1], m_uffangle, UFFAngleBlock(), [this](const UFFAngleBlock& block, Matrix& gradient) {
+        UFFKernels::Angles(block, m_geometry, gradient, 1, true);
+    });
+    measure(m_term_cost[2], m_uffdihedral, UFFDihedralBlock(), [this](const UFFDihedralBlock& block, Matrix& gradient) {
+        UFFKernels::Dihedrals(block, m_geometry, gradient, 1, true);
+    });
+    measure(m_term_cost[3], m_uffinversion, UFFInversionBlock(), [this](const UFFInversionBlock& block, Matrix& gradient) {
+        UFFKernels::Inversions(block, m_geometry, gradient, 1, true);
+    });
+    measure(m_term_cost[4], m_uffvdwaals, UFFvdWBlock(), [this](const UFFvdWBlock& block, Matrix& gradient) {
+        UFFKernels::vdWs(block, m_geometry, gradient, 1, 1, 1, 0, 0, true);
+    });
+}
+
+void eigenUFF::DistributeTerms()
+{
+    const int atoms = m_atom_types.size();
+    if (m_stored_threads.empty())
+        return;
+
+    std::stable_sort(m_uffvdwaals.begin(), m_uffvdwaals.end(), [](const UFFvdW& a, const UFFvdW& b) { return LowestAtom(a) < LowestAtom(b); });
+
+    /* thread t takes every term whose lowest atom is in [bounds[t], bounds[t + 1]), the bounds split the accumulated cost evenly */
+    int threads = 1;
+    std::vector<int> bounds(m_stored_threads.size() + 1, std::numeric_limits<int>::max());
+    bounds[0] = 0;
+    if (m_stored_threads.size() > 1) {
+        MeasureTermCosts();
+        std::vector<double> profile(atoms + 1, 0.0);
+        auto add = [&profile, atoms](const auto& terms, double cost) {
+            for (const auto& term : terms)
+                profile[std::min(LowestAtom(term), atoms - 1) + 1] += std::max(cost, 0.0);
+        };
+        add(m_uffbonds, m_term_cost[0]);
+        add(m_uffangle, m_term_cost[1]);
+        add(m_uffdihedral, m_term_cost[2]);
+        add(m_uffinversion, m_term_cost[3]);
+        add(m_uffvdwaals, m_term_cost[4]);
+        std::partial_sum(profile.begin(), profile.end(), profile.begin());
+        m_total_cost = profile[atoms];
+        threads = std::max(1, std::min(int(m_stored_threads.size()), int(m_total_cost / WorkerGrain)));
+        for (int t = 1; t < threads; ++t)
+            bounds[t] = std::lower_bound(profile.begin(), profile.end(), profile[atoms] * t / threads) - profile.begin();
+    }
+
+    m_active_threads = threads;
+    for (int t = 0; t < m_stored_threads.size(); ++t) {
+        UFFThread* thread = m_stored_threads[t];
+        thread->ClearTerms();
+        if (t >= threads) {
+            thread->setAtomWindow(0, 0);
+            m_reduce_threads[t]->setRange(0, 0);
+            continue;
+        }
+        int highest = bounds[t] - 1;
+        auto assign = [&bounds, &highest, t](const auto& terms, auto add) {
+            auto term = std::lower_bound(terms.begin(), terms.end(), bounds[t], [](const auto& term, int atom) { return LowestAtom(term) < atom; });
+            for (; term != terms.end() && LowestAtom(*term) < bounds[t + 1]; ++term) {
+                add(*term);
+                highest = std::max(highest, HighestAtom(*term));
+            }
+        };
+        assign(m_uffbonds, [thread](const UFFBond& bond) { thread->AddBond(bond); });
+        assign(m_uffangle, [thread](const UFFAngle& angle) { thread->AddAngle(angle); });
+        assign(m_uffdihedral, [thread](const UFFDihedral& dihedral) { thread->AddDihedral(dihedral); });
+        assign(m_uffinversion, [thread](const UFFInversion& inversion) { thread->AddInversion(inversion); });
+        assign(m_uffvdwaals, [thread](const UFFvdW& vdw) { thread->AddvdW(vdw); });
+        thread->setAtomWindow(std::min(bounds[t], atoms), std::min(highest + 1, atoms));
+
+        m_reduce_threads[t]->setRange(int(t * atoms / double(threads)), int((t + 1) * atoms / double(threads)));
+    }
     m_uff_vdw_end = m_uffvdwaals.size();
 }
 
 void eigenUFF::UpdateGeometry(const double* coord)
 {
-    if (m_gradient.rows() != m_atom_types.size())
+    m_delta_pending = false;
+    if (m_gradient.rows() != m_atom_types.size()) {
         m_gradient = Eigen::MatrixXd::Zero(m_atom_types.size(), 3);
-
-    if (m_gradient.size() != m_atom_types.size()) {
         m_h4correction.allocate(m_atom_types.size());
     }
 
@@ -1739,10 +1572,9 @@ void eigenUFF::UpdateGeometry(const double* coord)
 
 void eigenUFF::UpdateGeometry(const std::vector<std::array<double, 3>>& geometry)
 {
-    if (m_gradient.rows() != m_atom_types.size())
+    m_delta_pending = false;
+    if (m_gradient.rows() != m_atom_types.size()) {
         m_gradient = Eigen::MatrixXd::Zero(m_atom_types.size(), 3);
-
-    if (m_gradient.size() != m_atom_types.size()) {
         m_h4correction.allocate(m_atom_types.size());
     }
     for (int i = 0; i < m_atom_types.size(); ++i) {
@@ -1766,47 +1598,6 @@ void eigenUFF::Gradient(double* grad) const
     }
 }
 
-void eigenUFF::NumGrad(double* grad)
-{
-    double dx = m_d;
-    bool g = m_CalculateGradient;
-    m_CalculateGradient = false;
-    double E1, E2;
-    for (int i = 0; i < m_atom_types.size(); ++i) {
-        for (int j = 0; j < 3; ++j) {
-            m_geometry(i, j) += dx;
-            E1 = Calculate();
-            m_geometry(i, j) -= 2 * dx;
-            E2 = Calculate();
-            grad[3 * i + j] = (E1 - E2) / (2 * dx);
-            m_geometry(i, j) += dx;
-        }
-    }
-    m_CalculateGradient = g;
-}
-
-Eigen::MatrixXd eigenUFF::NumGrad()
-{
-    Eigen::MatrixXd gradient = Eigen::MatrixXd::Zero(m_atom_types.size(), 3);
-
-    double dx = m_d;
-    bool g = m_CalculateGradient;
-    m_CalculateGradient = false;
-    double E1, E2;
-    for (int i = 0; i < m_atom_types.size(); ++i) {
-        for (int j = 0; j < 3; ++j) {
-            m_geometry(i, j) += dx;
-            E1 = Calculate();
-            m_geometry(i, j) -= 2 * dx;
-            E2 = Calculate();
-            gradient(i, j) = (E1 - E2) / (2 * dx);
-            m_geometry(i, j) += dx;
-        }
-    }
-    m_CalculateGradient = g;
-    return gradient;
-}
-
 double eigenUFF::BondRestLength(int i, int j, double n)
 {
     double cRi = UFFParameters[m_uff_atom_types[i]][cR];
@@ -1824,7 +1615,8 @@ double eigenUFF::BondRestLength(int i, int j, double n)
 double eigenUFF::Calculate(bool grd, bool verbose)
 {
     m_CalculateGradient = grd;
-    hbonds4::atom_t geometry[m_atom_types.size()];
+    m_h4_geometry.resize(m_atom_types.size());
+    hbonds4::atom_t* geometry = m_h4_geometry.data();
     for (int i = 0; i < m_atom_types.size(); ++i) {
         geometry[i].x = m_geometry(i,0) * m_au;
         geometry[i].y = m_geometry(i,1) * m_au;
@@ -1838,16 +1630,21 @@ double eigenUFF::Calculate(bool grd, bool verbose)
         m_h4correction.GradientHH()[i].y = 0;
         m_h4correction.GradientHH()[i].z = 0;
 
+        if (m_use_d3 || m_use_d4) {
+            m_dispersion_coord[3 * i + 0] = m_geometry(i, 0) / au;
+            m_dispersion_coord[3 * i + 1] = m_geometry(i, 1) / au;
+            m_dispersion_coord[3 * i + 2] = m_geometry(i, 2) / au;
+        }
+    }
 #ifdef USE_D4
-        if (m_use_d4)
-            m_d4->UpdateAtom(i, m_geometry(i, 0) / au, m_geometry(i, 1) / au, m_geometry(i, 2) / au);
+    if (m_use_d4)
+        m_d4->UpdateGeometry(m_dispersion_coord.data());
 #endif
 
 #ifdef USE_D3
-        if (m_use_d3)
-            m_d3->UpdateAtom(i, m_geometry(i, 0), m_geometry(i, 1), m_geometry(i, 2));
+    if (m_use_d3)
+        m_d3->UpdateGeometry(m_dispersion_coord.data());
 #endif
-    }
     double energy = 0.0;
     double d4_energy = 0;
     double d3_energy = 0;
@@ -1856,37 +1653,54 @@ double eigenUFF::Calculate(bool grd, bool verbose)
     double dihedral_energy = 0.0;
     double inversion_energy = 0.0;
     double vdw_energy = 0.0;
-    m_threadpool->setActiveThreadCount(m_threads);
-
-    for (int i = 0; i < m_stored_threads.size(); ++i) {
+    double coulomb_energy = 0.0;
+    const bool slow = m_force_group != FastForces;
+    if (slow)
+        UpdateVdWList();
+
+    if (m_single_precision) {
+        m_single_geometry = m_geometry.cast<float>();
+        m_single_charges = m_charges.cast<float>();
+    }
+    for (int i = 0; i < m_active_threads; ++i) {
+        m_stored_threads[i]->setForceGroup(m_force_group);
+        m_stored_threads[i]->setSinglePrecision(m_single_precision);
+        m_stored_threads[i]->setCalculateGradient(grd);
         m_stored_threads[i]->UpdateGeometry(&m_geometry);
     }
 
-    m_threadpool->Reset();
-    m_threadpool->StartAndWait();
-    m_threadpool->setWakeUp(m_threadpool->WakeUp() / 2.0);
-    for (int i = 0; i < m_stored_threads.size(); ++i) {
+    /* a single thread runs directly without any synchronisation */
+    if (m_active_threads == 1) {
+        m_stored_threads[0]->execute();
+        if (grd)
+            m_reduce_threads[0]->execute();
+    } else {
+        auto evaluate = [this](int thread) { m_stored_threads[thread]->execute(); };
+        m_team->Run(m_active_threads, evaluate);
+        /* every reduce thread owns a block of atoms and collects it from the overlapping windows */
+        if (grd) {
+            auto reduce = [this](int thread) { m_reduce_threads[thread]->execute(); };
+            m_team->Run(m_active_threads, reduce);
+        }
+    }
+    for (int i = 0; i < m_active_threads; ++i) {
         bond_energy += m_stored_threads[i]->BondEnergy();
         angle_energy += m_stored_threads[i]->AngleEnergy();
         dihedral_energy += m_stored_threads[i]->DihedralEnergy();
         inversion_energy += m_stored_threads[i]->InversionEnergy();
         vdw_energy += m_stored_threads[i]->VdWEnergy();
-        m_gradient += m_stored_threads[i]->Gradient();
+        coulomb_energy += m_stored_threads[i]->CoulombEnergy();
     }
-    /* + CalculateElectrostatic(); */
-    energy = bond_energy + angle_energy + dihedral_energy + inversion_energy + vdw_energy;
-    /*
-    if(m_calc_gradient == 2 && m_CalculateGradient)
-    {
-        m_gradient = NumGrad();
-    }
-    */
+    energy = bond_energy + angle_energy + dihedral_energy + inversion_energy + vdw_energy + coulomb_energy;
 #ifdef USE_D3
-    if (m_use_d3) {
-        if (grd) {
-            double grad[3 * m_atom_types.size()];
+    if (m_use_d3 && slow && !m_d3_refresh.Extrapolate(m_geometry, d3_energy, grd ? &m_gradient : nullptr)) {
+        /* the lazy refresh extrapolates with the gradient, so it is always requested then */
+        if (grd || m_d3_refresh.Enabled()) {
+            double* grad = m_dispersion_gradient.data();
             d3_energy = m_d3->DFTD3Calculation(grad);
-            for (int i = 0; i < m_atom_types.size(); ++i) {
+            /* Eh / Bohr, the extrapolation needs Eh / Angstrom, the gradient is added as below */
+            m_d3_refresh.Refresh(m_geometry, d3_energy, grad, 1.0 / au, au);
+            for (int i = 0; i < m_atom_types.size() && grd; ++i) {
                 m_gradient(i, 0) += grad[3 * i + 0] * au;
                 m_gradient(i, 1) += grad[3 * i + 1] * au;
                 m_gradient(i, 2) += grad[3 * i + 2] * au;
@@ -1897,11 +1711,14 @@ double eigenUFF::Calculate(bool grd, bool verbose)
 #endif
 
 #ifdef USE_D4
-    if (m_use_d4) {
-        if (grd) {
-            double grad[3 * m_atom_types.size()];
+    if (m_use_d4 && slow && !m_d4_refresh.Extrapolate(m_geometry, d4_energy, grd ? &m_gradient : nullptr)) {
+        /* the lazy refresh extrapolates with the gradient, so it is always requested then */
+        if (grd || m_d4_refresh.Enabled()) {
+            double* grad = m_dispersion_gradient.data();
             d4_energy = m_d4->DFTD4Calculation(grad);
-            for (int i = 0; i < m_atom_types.size(); ++i) {
+            /* Eh / Bohr, the extrapolation needs Eh / Angstrom, the gradient is added as below */
+            m_d4_refresh.Refresh(m_geometry, d4_energy, grad, 1.0 / au, au);
+            for (int i = 0; i < m_atom_types.size() && grd; ++i) {
                 m_gradient(i, 0) += grad[3 * i + 0] * au;
                 m_gradient(i, 1) += grad[3 * i + 1] * au;
                 m_gradient(i, 2) += grad[3 * i + 2] * au;
@@ -1912,11 +1729,11 @@ double eigenUFF::Calculate(bool grd, bool verbose)
 #endif
 
     double energy_h4 = 0;
-    if (m_h4_scaling > 1e-8)
+    if (m_h4_scaling > 1e-8 && slow)
         energy_h4 = m_h4correction.energy_corr_h4(m_atom_types.size(), geometry);
     double energy_hh = 0;
-    if (m_hh_scaling > 1e-8)
-        m_h4correction.energy_corr_hh_rep(m_atom_types.size(), geometry);
+    if (m_hh_scaling > 1e-8 && slow)
+        energy_hh = m_h4correction.energy_corr_hh_rep(m_atom_types.size(), geometry);
     energy += m_final_factor * m_h4_scaling * energy_h4 + m_final_factor * m_hh_scaling * energy_hh + d3_energy + d4_energy;
     for (int i = 0; i < m_atom_types.size(); ++i) {
         m_gradient(i, 0) += m_final_factor * m_h4_scaling * m_h4correction.GradientH4()[i].x + m_final_factor * m_hh_scaling * m_h4correction.GradientHH()[i].x;
@@ -1931,6 +1748,7 @@ double eigenUFF::Calculate(bool grd, bool verbose)
                   << "Dihedral Energy " << dihedral_energy << " Eh" << std::endl
                   << "Inversion Energy " << inversion_energy << " Eh" << std::endl
                   << "Nonbonded Energy " << vdw_energy << " Eh" << std::endl
+                  << "Electrostatic Energy " << coulomb_energy << " Eh" << std::endl
                   << "D3 Energy " << d3_energy << " Eh" << std::endl
                   << "D4 Energy " << d4_energy << " Eh" << std::endl
                   << "HBondCorrection " << m_final_factor * m_h4_scaling * energy_h4 << " Eh" << std::endl
@@ -1943,3 +1761,377 @@ double eigenUFF::Calculate(bool grd, bool verbose)
     }
     return energy;
 }
+
+Vector eigenUFF::CalculateBatch(const Matrix& geometries, Matrix* gradients)
+{
+    const int conformers = geometries.rows();
+    const int atoms = m_atom_types.size();
+    Vector energies = Vector::Zero(conformers);
+    if (gradients)
+        *gradients = Matrix::Zero(conformers, 3 * atoms);
+    if (conformers == 0 || atoms == 0)
+        return energies;
+
+    /* dispersion and hydrogen bond corrections, electrostatics and minimum images have no batched form, the conformers go through Calculate one by one */
+    if (HasCorrections() || HasElectrostatics() || m_cell.isPeriodic()) {
+        const Matrix geometry = m_geometry;
+        for (int k = 0; k < conformers; ++k) {
+            for (int i = 0; i < atoms; ++i)
+                m_geometry.row(i) = geometries.block(k, 3 * i, 1, 3);
+            m_gradient.setZero();
+            energies(k) = Calculate(gradients != nullptr);
+            if (gradients)
+                for (int i = 0; i < atoms; ++i)
+                    gradients->block(k, 3 * i, 1, 3) = m_gradient.row(i);
+        }
+        m_geometry = geometry;
+        return energies;
+    }
+
+    SetupBatchBlocks();
+    if (m_vdw_cutoff > 0)
+        BatchVdWList(geometries);
+
+    const bool grd = gradients != nullptr;
+    const double switch_on = std::max(0.0, m_vdw_cutoff - m_vdw_switch);
+    /* every worker takes a contiguous range of conformers, so no gradient has to be reduced afterwards */
+    const int workers = m_team ? std::max(1, std::min({ m_threads, conformers, int(conformers * m_total_cost / WorkerGrain) })) : 1;
+    auto evaluate = [&](int worker) {
+        const int first = conformers * worker / workers;
+        const int last = conformers * (worker + 1) / workers;
+        const UFFKernels::Batch batch{ geometries.data() + first, grd ? gradients->data() + first : nullptr, energies.data() + first, last - first, conformers };
+        UFFKernels::Bonds(m_batch_bonds, batch, m_final_factor * m_bond_scaling, grd);
+        UFFKernels::Angles(m_batch_angles, batch, m_final_factor * m_angle_scaling, grd);
+        UFFKernels::Dihedrals(m_batch_dihedrals, batch, m_final_factor * m_dihedral_scaling, grd);
+        UFFKernels::Inversions(m_batch_inversions, batch, m_final_factor * m_inversion_scaling, grd);
+        UFFKernels::vdWs(m_batch_vdws, batch, m_final_factor, m_vdw_scaling, m_rep_scaling, m_vdw_cutoff, switch_on, grd);
+    };
+    if (workers == 1)
+        evaluate(0);
+    else
+        m_team->Run(workers, evaluate);
+    return energies;
+}
+
+Eigen::SparseMatrix<double> eigenUFF::SparseHessian()
+{
+    const int atoms = m_atom_types.size();
+    SetupBatchBlocks();
+    if (m_vdw_cutoff > 0) {
+        Matrix geometry(1, 3 * atoms);
+        for (int i = 0; i < atoms; ++i)
+            geometry.block(0, 3 * i, 1, 3) = m_geometry.row(i);
+        BatchVdWList(geometry);
+    }
+
+    UFFKernels::HessianTriplets triplets;
+    triplets.reserve(36 * (m_batch_bonds.size() + m_batch_vdws.size()) + 81 * m_batch_angles.size() + 144 * (m_batch_dihedrals.size() + m_batch_inversions.size()));
+    UFFKernels::Bonds(m_batch_bonds, m_geometry, m_final_factor * m_bond_scaling, triplets, &m_cell);
+    UFFKernels::Angles(m_batch_angles, m_geometry, m_final_factor * m_angle_scaling, triplets, &m_cell);
+    UFFKernels::Dihedrals(m_batch_dihedrals, m_geometry, m_final_factor * m_dihedral_scaling, triplets, &m_cell);
+    UFFKernels::Inversions(m_batch_inversions, m_geometry, m_final_factor * m_inversion_scaling, triplets, &m_cell);
+    UFFKernels::vdWs(m_batch_vdws, m_geometry, m_final_factor, m_vdw_scaling, m_rep_scaling, m_vdw_cutoff, std::max(0.0, m_vdw_cutoff - m_vdw_switch), triplets, &m_cell);
+
+    Eigen::SparseMatrix<double> hessian(3 * atoms, 3 * atoms);
+    hessian.setFromTriplets(triplets.begin(), triplets.end());
+    return hessian;
+}
+
+Vector eigenUFF::HessianVectorProduct(const Vector& direction)
+{
+    const int atoms = m_atom_types.size();
+    SetupBatchBlocks();
+    Matrix geometry(1, 3 * atoms), step(atoms, 3);
+    for (int i = 0; i < atoms; ++i) {
+        geometry.block(0, 3 * i, 1, 3) = m_geometry.row(i);
+        step.row(i) = direction.segment(3 * i, 3).transpose();
+    }
+    if (m_vdw_cutoff > 0)
+        BatchVdWList(geometry);
+
+    Matrix product = Matrix::Zero(atoms, 3);
+    UFFAutoDiff::Bonds(m_batch_bonds, m_geometry, step, m_final_factor * m_bond_scaling, product, &m_cell);
+    UFFAutoDiff::Angles(m_batch_angles, m_geometry, step, m_final_factor * m_angle_scaling, product, &m_cell);
+    UFFAutoDiff::Dihedrals(m_batch_dihedrals, m_geometry, step, m_final_factor * m_dihedral_scaling, product, &m_cell);
+    UFFAutoDiff::Inversions(m_batch_inversions, m_geometry, step, m_final_factor * m_inversion_scaling, product, &m_cell);
+    UFFAutoDiff::vdWs(m_batch_vdws, m_geometry, step, m_final_factor, m_vdw_scaling, m_rep_scaling, m_vdw_cutoff, std::max(0.0, m_vdw_cutoff - m_vdw_switch), product, &m_cell);
+
+    Vector result(3 * atoms);
+    for (int i = 0; i < atoms; ++i)
+        result.segment(3 * i, 3) = product.row(i).transpose();
+    return result;
+}
+
+double eigenUFF::DeltaEnergy(const std::vector<int>& moved, const Matrix& positions)
+{
+    Rollback();
+    m_delta_atoms = moved;
+    m_delta_previous.resize(moved.size(), 3);
+    for (int a = 0; a < moved.size(); ++a)
+        m_delta_previous.row(a) = m_geometry.row(moved[a]);
+    m_delta_pending = true;
+    m_delta_rebuilt = false;
+
+    if (HasCorrections() || HasElectrostatics()) {
+        const Matrix gradient = m_gradient;
+        const double before = Calculate(false);
+        for (int a = 0; a < moved.size(); ++a)
+            m_geometry.row(moved[a]) = positions.row(a);
+        const double after = Calculate(false);
+        m_gradient = gradient;
+        return after - before;
+    }
+
+    /* a list left behind by a rejected move was built around positions that are gone */
+    if (m_vdw_cutoff > 0 && m_vdw_reference.rows() != m_geometry.rows())
+        UpdateVdWList();
+    UpdateAtomTerms();
+    CollectDeltaTerms(false);
+    const double before = DeltaTermEnergy();
+
+    bool outside = false;
+    for (int a = 0; a < moved.size(); ++a) {
+        m_geometry.row(moved[a]) = positions.row(a);
+        if (m_vdw_cutoff > 0)
+            outside |= m_cell.MinimumImage((m_geometry.row(moved[a]) - m_vdw_reference.row(moved[a])).transpose()).squaredNorm() >= 0.25 * m_vdw_skin * m_vdw_skin;
+    }
+    /* an atom left the skin, the pairs of the new positions come from a fresh list */
+    if (outside) {
+        m_delta_rebuilt = UpdateVdWList();
+        UpdateAtomTerms();
+        CollectDeltaTerms(true);
+    }
+    return DeltaTermEnergy() - before;
+}
+
+void eigenUFF::Commit()
+{
+    m_delta_pending = false;
+}
+
+void eigenUFF::Rollback()
+{
+    if (!m_delta_pending)
+        return;
+    for (int a = 0; a < m_delta_atoms.size(); ++a)
+        m_geometry.row(m_delta_atoms[a]) = m_delta_previous.row(a);
+    if (m_delta_rebuilt)
+        m_vdw_reference.resize(0, 3);
+    m_delta_pending = false;
+}
+
+void eigenUFF::UpdateAtomTerms()
+{
+    const int atoms = m_atom_types.size();
+    std::vector<std::pair<int, int>> entries;
+    if (m_atom_terms[0].Rows() != atoms) {
+        for (int t = 0; t < m_uffbonds.size(); ++t)
+            for (int atom : { m_uffbonds[t].i, m_uffbonds[t].j })
+                entries.push_back({ atom, t });
+        m_atom_terms[0].Build(atoms, entries);
+
+        entries.clear();
+        for (int t = 0; t < m_uffangle.size(); ++t)
+            for (int atom : { m_uffangle[t].i, m_uffangle[t].j, m_uffangle[t].k })
+                entries.push_back({ atom, t });
+        m_atom_terms[1].Build(atoms, entries);
+
+        entries.clear();
+        for (int t = 0; t < m_uffdihedral.size(); ++t)
+            for (int atom : { m_uffdihedral[t].i, m_uffdihedral[t].j, m_uffdihedral[t].k, m_uffdihedral[t].l })
+                entries.push_back({ atom, t });
+        m_atom_terms[2].Build(atoms, entries);
+
+        entries.clear();
+        for (int t = 0; t < m_uffinversion.size(); ++t)
+            for (int atom : { m_uffinversion[t].i, m_uffinversion[t].j, m_uffinversion[t].k, m_uffinversion[t].l })
+                entries.push_back({ atom, t });
+        m_atom_terms[3].Build(atoms, entries);
+    }
+    if (m_atom_terms_rebuilds != m_vdw_rebuilds || m_atom_terms[4].Rows() != atoms) {
+        entries.clear();
+        for (int t = 0; t < m_uffvdwaals.size(); ++t)
+            for (int atom : { m_uffvdwaals[t].i, m_uffvdwaals[t].j })
+                entries.push_back({ atom, t });
+        m_atom_terms[4].Build(atoms, entries);
+        m_atom_terms_rebuilds = m_vdw_rebuilds;
+    }
+}
+
+void eigenUFF::CollectDeltaTerms(bool vdws_only)
+{
+    /* terms shared by several moved atoms are taken once */
+    auto collect = [this](int type) {
+        m_delta_ids.clear();
+        for (int atom : m_delta_atoms)
+            for (int t : m_atom_terms[type][atom])
+                m_delta_ids.push_back(t);
+        std::sort(m_delta_ids.begin(), m_delta_ids.end());
+        m_delta_ids.erase(std::unique(m_delta_ids.begin(), m_delta_ids.end()), m_delta_ids.end());
+    };
+    if (!vdws_only) {
+        m_delta_bonds.clear();
+        collect(0);
+        for (int t : m_delta_ids)
+            m_delta_bonds.push_back(m_uffbonds[t]);
+
+        m_delta_angles.clear();
+        collect(1);
+        for (int t : m_delta_ids)
+            m_delta_angles.push_back(m_uffangle[t]);
+
+        m_delta_dihedrals.clear();
+        collect(2);
+        for (int t : m_delta_ids)
+            m_delta_dihedrals.push_back(m_uffdihedral[t]);
+
+        m_delta_inversions.clear();
+        collect(3);
+        for (int t : m_delta_ids)
+            m_delta_inversions.push_back(m_uffinversion[t]);
+    }
+    m_delta_vdws.clear();
+    collect(4);
+    for (int t : m_delta_ids)
+        m_delta_vdws.push_back(m_uffvdwaals[t]);
+}
+
+double eigenUFF::DeltaTermEnergy()
+{
+    /* energies only, the gradient is not touched */
+    return UFFKernels::Bonds(m_delta_bonds, m_geometry, m_gradient, m_final_factor * m_bond_scaling, false, 0, &m_cell)
+        + UFFKernels::Angles(m_delta_angles, m_geometry, m_gradient, m_final_factor * m_angle_scaling, false, 0, &m_cell)
+        + UFFKernels::Dihedrals(m_delta_dihedrals, m_geometry, m_gradient, m_final_factor * m_dihedral_scaling, false, 0, &m_cell)
+        + UFFKernels::Inversions(m_delta_inversions, m_geometry, m_gradient, m_final_factor * m_inversion_scaling, false, 0, &m_cell)
+        + UFFKernels::vdWs(m_delta_vdws, m_geometry, m_gradient, m_final_factor, m_vdw_scaling, m_rep_scaling, m_vdw_cutoff, std::max(0.0, m_vdw_cutoff - m_vdw_switch), false, 0, &m_cell);
+}
+
+void eigenUFF::setFragments(const std::vector<std::vector<int>>& fragments)
+{
+    std::vector<int> assignment(m_atom_types.size(), -1);
+    for (int f = 0; f < fragments.size(); ++f)
+        for (int atom : fragments[f])
+            if (atom >= 0 && atom < assignment.size())
+                assignment[atom] = f;
+    if (assignment == m_atom_fragment && int(fragments.size()) == m_fragment_count)
+        return;
+    m_atom_fragment = assignment;
+    m_fragment_count = fragments.size();
+    m_fragment_tagged = false;
+    m_fragment_rebuilds = -1;
+}
+
+void eigenUFF::TagFragmentTerms()
+{
+    /* atoms without fragment make a term intermolecular as well */
+    auto tag = [this](std::initializer_list<int> atoms) {
+        const int fragment = m_atom_fragment[*atoms.begin()];
+        for (int atom : atoms)
+            if (m_atom_fragment[atom] != fragment)
+                return m_fragment_count;
+        return fragment < 0 ? m_fragment_count : fragment;
+    };
+    const int blocks = m_fragment_count + 1;
+    if (!m_fragment_tagged) {
+        m_fragment_bonds.resize(blocks);
+        m_fragment_angles.resize(blocks);
+        m_fragment_dihedrals.resize(blocks);
+        m_fragment_inversions.resize(blocks);
+        for (int f = 0; f < blocks; ++f) {
+            m_fragment_bonds[f].clear();
+            m_fragment_angles[f].clear();
+            m_fragment_dihedrals[f].clear();
+            m_fragment_inversions[f].clear();
+        }
+        for (int t = 0; t < m_uffbonds.size(); ++t)
+            m_fragment_bonds[tag({ m_uffbonds[t].i, m_uffbonds[t].j })].push_back(m_uffbonds[t]);
+        for (int t = 0; t < m_uffangle.size(); ++t)
+            m_fragment_angles[tag({ m_uffangle[t].i, m_uffangle[t].j, m_uffangle[t].k })].push_back(m_uffangle[t]);
+        for (int t = 0; t < m_uffdihedral.size(); ++t)
+            m_fragment_dihedrals[tag({ m_uffdihedral[t].i, m_uffdihedral[t].j, m_uffdihedral[t].k, m_uffdihedral[t].l })].push_back(m_uffdihedral[t]);
+        for (int t = 0; t < m_uffinversion.size(); ++t)
+            m_fragment_inversions[tag({ m_uffinversion[t].i, m_uffinversion[t].j, m_uffinversion[t].k, m_uffinversion[t].l })].push_back(m_uffinversion[t]);
+        m_fragment_tagged = true;
+    }
+    if (m_fragment_rebuilds != m_vdw_rebuilds) {
+        m_fragment_vdws.resize(blocks);
+        for (int f = 0; f < blocks; ++f)
+            m_fragment_vdws[f].clear();
+        for (int t = 0; t < m_uffvdwaals.size(); ++t)
+            m_fragment_vdws[tag({ m_uffvdwaals[t].i, m_uffvdwaals[t].j })].push_back(m_uffvdwaals[t]);
+        m_fragment_rebuilds = m_vdw_rebuilds;
+    }
+}
+
+std::vector<double> eigenUFF::FragmentEnergies()
+{
+    if (m_fragment_count == 0 || m_atom_fragment.size() != m_atom_types.size() || HasCorrections() || m_charge_model.compare("qeq") == 0)
+        return std::vector<double>();
+    UpdateVdWList();
+    TagFragmentTerms();
+
+    /* energies only, the gradient is not touched */
+    const double switch_on = std::max(0.0, m_vdw_cutoff - m_vdw_switch);
+    std::vector<double> energies(m_fragment_count + 1, 0.0);
+    for (int f = 0; f <= m_fragment_count; ++f) {
+        energies[f] = UFFKernels::Bonds(m_fragment_bonds[f], m_geometry, m_gradient, m_final_factor * m_bond_scaling, false, 0, &m_cell)
+            + UFFKernels::Angles(m_fragment_angles[f], m_geometry, m_gradient, m_final_factor * m_angle_scaling, false, 0, &m_cell)
+            + UFFKernels::Dihedrals(m_fragment_dihedrals[f], m_geometry, m_gradient, m_final_factor * m_dihedral_scaling, false, 0, &m_cell)
+            + UFFKernels::Inversions(m_fragment_inversions[f], m_geometry, m_gradient, m_final_factor * m_inversion_scaling, false, 0, &m_cell)
+            + UFFKernels::vdWs(m_fragment_vdws[f], m_geometry, m_gradient, m_final_factor, m_vdw_scaling, m_rep_scaling, m_vdw_cutoff, switch_on, false, 0, &m_cell);
+        if (HasElectrostatics())
+            energies[f] += UFFKernels::Coulombs(m_fragment_vdws[f], m_geometry, m_charges.data(), m_gradient, au * m_coulmob_scaling, m_coulomb_damping, m_vdw_cutoff, false, 0, &m_cell);
+    }
+    return energies;
+}
+
+void eigenUFF::SetupBatchBlocks()
+{
+    if (m_batch_ready)
+        return;
+    for (const auto& bond : m_uffbonds)
+        m_batch_bonds.push_back(bond);
+    for (const auto& angle : m_uffangle)
+        m_batch_angles.push_back(angle);
+    for (const auto& dihedral : m_uffdihedral)
+        m_batch_dihedrals.push_back(dihedral);
+    for (const auto& inversion : m_uffinversion)
+        m_batch_inversions.push_back(inversion);
+    if (m_vdw_cutoff <= 0)
+        for (const auto& vdw : m_uffvdwaals)
+            m_batch_vdws.push_back(vdw);
+    m_batch_ready = true;
+}
+
+void eigenUFF::BatchVdWList(const Matrix& geometries)
+{
+    /* the union of the pairs within the cutoff in any conformer, the switching function masks the others */
+    const int atoms = m_atom_types.size();
+    const double cutoff2 = m_vdw_cutoff * m_au * m_vdw_cutoff * m_au;
+    Matrix geometry(atoms, 3);
+    std::vector<std::pair<int, int>> pairs;
+    std::vector<char> used(m_vdw_candidates.size(), 0);
+    for (int k = 0; k < geometries.rows(); ++k) {
+        for (int i = 0; i < atoms; ++i)
+            geometry.row(i) = geometries.block(k, 3 * i, 1, 3);
+        if (m_vdw_candidates.size()) {
+            for (int c = 0; c < m_vdw_candidates.size(); ++c)
+                used[c] |= m_cell.MinimumImage((geometry.row(m_vdw_candidates[c].i) - geometry.row(m_vdw_candidates[c].j)).transpose()).squaredNorm() < cutoff2;
+        } else {
+            m_vdw_cells.Build(geometry, m_vdw_cutoff * m_au, m_cell);
+            m_vdw_cells.ForEachPair(geometry, [this, &pairs](int i, int j, double) {
+                if (!m_ignored_vdw.Contains(i, j))
+                    pairs.push_back({ i, j });
+            });
+        }
+    }
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+    m_batch_vdws.clear();
+    for (int c = 0; c < m_vdw_candidates.size(); ++c)
+        if (used[c])
+            m_batch_vdws.push_back(m_vdw_candidates[c]);
+    for (const auto& pair : pairs)
+        m_batch_vdws.push_back(vdWPair(pair.first, pair.second));
+}
@@ -26,7 +26,11 @@
  *
  */
 
+#include "src/core/adjacencylist.h"
+#include "src/core/celllist.h"
+#include "src/core/dispersionrefresh.h"
 #include "src/core/global.h"
+#include "src/core/rings.h"
 
 #include "hbonds.h"
 
@@ -41,10 +45,15 @@
 #endif
 
 #include "src/core/uff_par.h"
+#include "src/core/uffcache.h"
+#include "src/core/unitcell.h"
+#include "src/core/workerteam.h"
+#include <array>
 #include <set>
 #include <vector>
 
 #include <Eigen/Dense>
+#include <Eigen/Sparse>
 
 #include "json.hpp"
 using json = nlohmann::json;
@@ -58,8 +67,6 @@ public:
     {
         setAutoDelete(false);
         m_final_factor = 1 / 2625.15 * 4.19;
-        // m_d = parameters["differential"].get<double>();
-        m_d = 1e-7;
     }
     //~UFFThread();
 
@@ -70,45 +77,89 @@ public:
     void UpdateGeometry(Matrix* geometry)
     {
         m_geometry = geometry;
-        m_gradient = Eigen::MatrixXd::Zero(m_atom_types.size(), 3);
+        m_gradient.setZero();
     }
 
-    Matrix Gradient() const { return m_gradient; }
+    /*! \brief Gradient of the atoms FirstAtom() to FirstAtom() + Gradient().rows() - 1 */
+    const Matrix& Gradient() const { return m_gradient; }
+    inline int FirstAtom() const { return m_first_atom; }
+
+    /*! \brief Keep only the gradient rows of the atoms [first, last), all terms of the thread have to lie within */
+    void setAtomWindow(int first, int last)
+    {
+        m_first_atom = first;
+        m_gradient = Eigen::MatrixXd::Zero(std::max(0, last - first), 3);
+    }
 
     void setMolecule(const std::vector<int>& atom_types, Matrix* geometry)
     {
         m_atom_types = atom_types;
         m_geometry = geometry;
-        m_gradient = Eigen::MatrixXd::Zero(m_atom_types.size(), 3);
+        setAtomWindow(0, m_atom_types.size());
     }
     void readUFF(const json& parameters);
 
+    inline void setForceGroup(int group) { m_force_group = group; }
+
+    /*! \brief Periodic cell for the minimum image of all distances, owned by eigenUFF */
+    inline void setCell(const UnitCell* cell) { m_cell = cell; }
+
+    /*! \brief Atomic partial charges for the electrostatics, owned by eigenUFF, empty means no electrostatics */
+    inline void setCharges(const Vector* charges) { m_charges = charges; }
+
+    /*! \brief Float copies of geometry and charges, owned by eigenUFF and only read with single precision */
+    inline void setSingleGeometry(const Eigen::MatrixXf* geometry, const Eigen::VectorXf* charges)
+    {
+        m_single_geometry = geometry;
+        m_single_charges = charges;
+    }
+
+    /*! \brief Evaluate the terms with the float kernels, the analytic kernels are used even with gradient 1 */
+    inline void setSinglePrecision(bool single) { m_single = single; }
+
+    inline void setCalculateGradient(bool gradient) { m_CalculateGradient = gradient; }
+
     inline double Energy() const { return m_energy; }
     inline double BondEnergy() const { return m_bond_energy; }
     inline double AngleEnergy() const { return m_angle_energy; }
     inline double DihedralEnergy() const { return m_dihedral_energy; }
     inline double InversionEnergy() const { return m_inversion_energy; }
     inline double VdWEnergy() const { return m_vdw_energy; }
+    inline double CoulombEnergy() const { return m_coulomb_energy; }
 
     void AddBond(const UFFBond& bond)
     {
         m_uffbonds.push_back(bond);
+        m_single_ready = false;
     }
     void AddAngle(const UFFAngle& angle)
     {
         m_uffangle.push_back(angle);
+        m_single_ready = false;
     }
     void AddDihedral(const UFFDihedral& dihedral)
     {
         m_uffdihedral.push_back(dihedral);
+        m_single_ready = false;
     }
     void AddInversion(const UFFInversion& inversion)
     {
         m_uffinversion.push_back(inversion);
+        m_single_ready = false;
     }
     void AddvdW(const UFFvdW& vdw)
     {
         m_uffvdwaals.push_back(vdw);
+        m_single_ready = false;
+    }
+    void ClearTerms()
+    {
+        m_uffbonds.clear();
+        m_uffangle.clear();
+        m_uffdihedral.clear();
+        m_uffinversion.clear();
+        m_uffvdwaals.clear();
+        m_single_ready = false;
     }
 
 private:
@@ -142,25 +193,15 @@ private:
         return aba.cross(abc);
     }
 
-    double BondEnergy(double distance, double r, double k_ij, double D_ij = 70);
     double CalculateBondStretching();
-
-    double AngleBend(const Eigen::Vector3d& i, const Eigen::Vector3d& j, const Eigen::Vector3d& k, double kijk, double C0, double C1, double C2);
     double CalculateAngleBending();
-
-    double Dihedral(const Eigen::Vector3d& i, const Eigen::Vector3d& j, const Eigen::Vector3d& k, const Eigen::Vector3d& l, double V, double n, double phi0);
     double CalculateDihedral();
-
-    double FullInversion(const int& i, const int& j, const int& k, const int& l, double d_forceConstant, double C0, double C1, double C2);
-    double Inversion(const Eigen::Vector3d& i, const Eigen::Vector3d& j, const Eigen::Vector3d& k, const Eigen::Vector3d& l, double k_ijkl, double C0, double C1, double C2);
     double CalculateInversion();
-
-    double NonBonds(const Eigen::Vector3d& i, const Eigen::Vector3d& j, double Dij, double xij);
     double CalculateNonBonds();
     double CalculateElectrostatic();
 
-    double Distance(double x1, double x2, double y1, double y2, double z1, double z2) const;
-    double DotProduct(double x1, double x2, double y1, double y2, double z1, double z2) const;
+    /*! \brief All terms with the float kernels, the gradient is accumulated in float and added to m_gradient */
+    void CalculateSingle(bool fast, bool slow);
 
     inline Eigen::Vector3d Position(int pos) const { return m_geometry->row(pos); }
     std::vector<int> m_atom_types, m_uff_atom_types, m_coordination;
@@ -168,34 +209,48 @@ private:
     std::vector<std::vector<int>> m_identified_rings;
 
     Matrix *m_geometry, m_gradient;
+    int m_first_atom = 0;
+    int m_force_group = AllForces;
+    const UnitCell* m_cell = nullptr;
+    const Vector* m_charges = nullptr;
 
-    std::vector<UFFBond> m_uffbonds;
+    UFFBondBlock m_uffbonds;
     int m_uff_bond_start = 0, m_uff_bond_end = 0;
 
-    std::vector<UFFAngle> m_uffangle;
+    UFFAngleBlock m_uffangle;
     int m_uff_angle_start = 0, m_uff_angle_end = 0;
 
-    std::vector<UFFDihedral> m_uffdihedral;
+    UFFDihedralBlock m_uffdihedral;
     int m_uff_dihedral_start = 0, m_uff_dihedral_end = 0;
 
-    std::vector<UFFInversion> m_uffinversion;
+    UFFInversionBlock m_uffinversion;
     int m_uff_inv_start = 0, m_uff_inv_end = 0;
 
-    std::vector<UFFvdW> m_uffvdwaals;
+    UFFvdWBlock m_uffvdwaals;
     int m_uff_vdw_start = 0, m_uff_vdw_end = 0;
 
+    /* float copies of the terms, converted on first use after the terms changed */
+    UFFBondBlockT<float> m_single_bonds;
+    UFFAngleBlockT<float> m_single_angles;
+    UFFDihedralBlockT<float> m_single_dihedrals;
+    UFFInversionBlockT<float> m_single_inversions;
+    UFFvdWBlockT<float> m_single_vdws;
+    Eigen::MatrixXf m_single_gradient;
+    const Eigen::MatrixXf* m_single_geometry = nullptr;
+    const Eigen::VectorXf* m_single_charges = nullptr;
+    bool m_single = false, m_single_ready = false;
+
     double m_scaling = 1.15;
     Matrix m_topo;
     bool m_CalculateGradient = true, m_initialised = false;
     std::string m_writeparam = "none", m_writeuff = "none";
-    double m_d = 1e-6;
     double m_au = 1;
     double m_h4_scaling = 1, m_hh_scaling = 1;
     double m_final_factor = 1;
     double m_bond_force = 664.12;
     double m_angle_force = 664.12;
     double m_energy = 0.0;
-    double m_bond_energy = 0.0, m_angle_energy = 0.0, m_dihedral_energy = 0.0, m_inversion_energy = 0.0, m_vdw_energy = 0.0, m_d4_energy = 0.0, m_d3_energy = 0.0, m_energy_h4 = 0.0, m_energy_hh = 0.0;
+    double m_bond_energy = 0.0, m_angle_energy = 0.0, m_dihedral_energy = 0.0, m_inversion_energy = 0.0, m_vdw_energy = 0.0, m_coulomb_energy = 0.0, m_d4_energy = 0.0, m_d3_energy = 0.0, m_energy_h4 = 0.0, m_energy_hh = 0.0;
 
     bool m_use_d3 = false;
     bool m_use_d4 = false;
@@ -204,9 +259,44 @@ private:
     int m_calc_gradient = 0;
 
     double m_bond_scaling = 1, m_angle_scaling = 1, m_dihedral_scaling = 1, m_inversion_scaling = 1, m_vdw_scaling = 1, m_rep_scaling = 1, m_coulmob_scaling = 1;
+    double m_coulomb_damping = 0.2;
+    double m_vdw_cutoff = 0, m_vdw_switch_on = 0;
     int m_thread = 0, m_threads = 0;
 };
 
+/*! \brief Sums the gradient windows of all UFFThreads into the rows [first, last) of the total gradient */
+class UFFReduceThread : public CxxThread {
+public:
+    UFFReduceThread(const std::vector<UFFThread*>* threads, Matrix* gradient)
+        : m_threads(threads)
+        , m_gradient(gradient)
+    {
+        setAutoDelete(false);
+    }
+
+    inline void setRange(int first, int last)
+    {
+        m_first = first;
+        m_last = last;
+    }
+
+    virtual int execute() override
+    {
+        for (const UFFThread* thread : *m_threads) {
+            const int first = std::max(m_first, thread->FirstAtom());
+            const int last = std::min(m_last, thread->FirstAtom() + int(thread->Gradient().rows()));
+            if (first < last)
+                m_gradient->middleRows(first, last - first) += thread->Gradient().middleRows(first - thread->FirstAtom(), last - first);
+        }
+        return 0;
+    }
+
+private:
+    const std::vector<UFFThread*>* m_threads;
+    Matrix* m_gradient;
+    int m_first = 0, m_last = 0;
+};
+
 class eigenUFF {
 public:
     eigenUFF(const json& controller);
@@ -230,11 +320,75 @@ public:
 
     double Calculate(bool gradient = true, bool verbose = false);
 
-    Matrix Gradient() const { return m_gradient; }
-    void Gradient(double* gradient) const;
+    /*! \brief Energies of many conformers of the current molecule in one pass, one conformer per row with the
+     * coordinates of atom a in the columns 3a, 3a + 1 and 3a + 2. Gradients are returned in the same layout. */
+    Vector CalculateBatch(const Matrix& geometries, Matrix* gradients = nullptr);
+
+    /*! \brief Fixed partial charges in e for the damped shifted force electrostatics, one per atom. With "charges": "qeq"
+     * they are equilibrated once in Initialise, charges from other methods (e.g. EnergyCalculator::Charges of xtb or tblite)
+     * can be set at any time. The electrostatics use the nonbonded pair list and are scaled by coulomb_scaling */
+    void setCharges(const std::vector<double>& charges) { m_charges = Eigen::Map<const Vector>(charges.data(), charges.size()); }
+    inline const Vector& Charges() const { return m_charges; }
+
+    /*! \brief Total charge of the molecule, the equilibrated charges add up to it */
+    inline void setTotalCharge(double charge) { m_total_charge = charge; }
+
+    /*! \brief UFF atom types (rows of UFFParameters) and the rings they were assigned with, both are known after Initialise */
+    inline const std::vector<int>& UFFAtomTypes() const { return m_uff_atom_types; }
+    inline const RingSet& Rings() const { return m_ring_set; }
+
+    /*! \brief True if geometry has the bonds the terms were set up with, other bonds need setMolecule and Initialise again */
+    bool SameBonds(const std::vector<std::array<double, 3>>& geometry) const;
+
+    /*! \brief Orthorhombic or triclinic cell, has to be set before Initialise. All distances become minimum images,
+     * so the nonbonded cutoff is enforced and limited to half of the cell width */
+    void setCell(const UnitCell& cell) { m_cell = cell; }
+    inline const UnitCell& Cell() const { return m_cell; }
+
+    /*! \brief False if D3, D4, the hydrogen bond corrections or the electrostatics are active, they have no analytic second derivatives.
+     * In a periodic cell the terms take the minimum images of their atoms, as in Calculate */
+    bool HasAnalyticHessian() const { return !HasCorrections() && !HasElectrostatics(); }
+
+    /*! \brief Analytic second derivatives of the energy at the current geometry in Eh / Angstrom^2,
+     * rows and columns 3a, 3a + 1 and 3a + 2 belong to atom a */
+    Eigen::SparseMatrix<double> SparseHessian();
+
+    /*! \brief Hessian times direction without building the Hessian, both in the layout of SparseHessian.
+     * The terms are differentiated twice with nested dual numbers, the corrections and the electrostatics are not included either */
+    Vector HessianVectorProduct(const Vector& direction);
+
+    /*! \brief Restrict Calculate to the FastForces (bonds, angles, dihedrals, inversions) or the SlowForces
+     * (vdW, H4/HH, D3 and D4), AllForces evaluates everything */
+    inline void setForceGroup(int group) { m_force_group = group; }
+
+    /*! \brief Evaluate the terms of Calculate in float ("precision": "single"), meant for screening. Energies are still summed up
+     * in double, D3, D4, the hydrogen bond corrections, CalculateBatch, DeltaEnergy and the Hessian stay in double precision */
+    inline void setSinglePrecision(bool single) { m_single_precision = single; }
+    inline bool SinglePrecision() const { return m_single_precision; }
+
+    /*! \brief Energy change in Eh if the atoms in moved are placed at the rows of positions. Only the terms that touch
+     * these atoms are evaluated, the new positions are kept pending until Commit or Rollback. With D3, D4, the
+     * hydrogen bond corrections or electrostatics the whole energy is calculated twice. Gradients are not updated. */
+    double DeltaEnergy(const std::vector<int>& moved, const Matrix& positions);
+
+    /*! \brief Accept the pending move of DeltaEnergy */
+    void Commit();
+
+    /*! \brief Put the atoms of the pending move back to their previous positions */
+    void Rollback();
 
-    void NumGrad(double* gradient);
-    Eigen::MatrixXd NumGrad();
+    /*! \brief Atoms grouped into fragments, e.g. Molecule::GetFragments. Every term is tagged with the fragment that
+     * holds all of its atoms or as intermolecular, the bonded terms once and the vdW pairs with every new pair list */
+    void setFragments(const std::vector<std::vector<int>>& fragments);
+
+    /*! \brief Energies in Eh of the terms within every fragment, followed by the intermolecular terms, from one evaluation
+     * of all terms at the current geometry. The entries add up to Calculate, the fragment energies are the ones of the
+     * isolated fragments. Empty without fragments or if D3, D4, the hydrogen bond corrections or QEq charges are active,
+     * they depend on all atoms at once and are not split. Gradients are not updated. */
+    std::vector<double> FragmentEnergies();
+
+    const Matrix& Gradient() const { return m_gradient; }
+    void Gradient(double* gradient) const;
 
     void writeParameterFile(const std::string& file) const;
     void writeUFFFile(const std::string& file) const;
@@ -249,10 +403,11 @@ public:
     json vdWs() const;
 
     void setBonds(const json& bonds);
-    void setBonds(const TContainer& bonds, std::vector<std::set<int>>& ignored_vdw, TContainer& angels, TContainer& dihedrals, TContainer& inversions);
+    /*! \brief ignored_vdw collects the excluded nonbonded pairs in both directions */
+    void setBonds(const TContainer& bonds, std::vector<std::pair<int, int>>& ignored_vdw, TContainer& angels, TContainer& dihedrals, TContainer& inversions);
 
     void setAngles(const json& angles);
-    void setAngles(const TContainer& angles, const std::vector<std::set<int>>& ignored_vdw);
+    void setAngles(const TContainer& angles);
 
     void setDihedrals(const json& dihedrals);
     void setDihedrals(const TContainer& dihedrals);
@@ -261,7 +416,11 @@ public:
     void setInversions(const TContainer& inversions);
 
     void setvdWs(const json& vdws);
-    void setvdWs(const std::vector<std::set<int>>& ignored_vdw);
+    void setvdWs(const AdjacencyList& ignored_vdw);
+
+    /*! \brief Rebuild the cutoff based vdW pair list if any atom moved more than half the skin, returns true on rebuild */
+    bool UpdateVdWList();
+    inline int VdWListRebuilds() const { return m_vdw_rebuilds; }
 
     void readParameterFile(const std::string& file);
     void readUFFFile(const std::string& file);
@@ -272,6 +431,10 @@ public:
     void setInitialisation(bool initialised) { m_initialised = initialised; }
 
     void AutoRanges();
+
+    /*! \brief Split all terms into atom slices of equal estimated cost, small systems stay on one thread */
+    void DistributeTerms();
+    inline int ActiveThreads() const { return m_active_threads; }
     void setBondRanges(int start, int end)
     {
         m_uff_bond_start = start;
@@ -303,14 +466,36 @@ public:
     }
 
 private:
+    /* every atom takes the atoms within the scaled covalent radii in ascending order until its coordination number is reached */
+    AdjacencyList PerceiveBonds(const Matrix& geometry) const;
     void AssignUffAtomTypes();
     void FindRings();
+    std::vector<char> AromaticAtoms() const;
 
     double BondRestLength(int i, int j, double order);
+    UFFvdW vdWPair(int i, int j) const;
+
+    /*! \brief Time every kernel once on the current terms, the costs per term weight the thread slices */
+    void MeasureTermCosts();
+
+    bool HasCorrections() const { return m_use_d3 || m_use_d4 || m_h4_scaling > 1e-8 || m_hh_scaling > 1e-8; }
+    bool HasElectrostatics() const { return m_charges.size() && std::abs(m_coulmob_scaling) > 1e-8; }
+
+    /*! \brief QEq charges at the current geometry, the shielded interactions are truncated at the nonbonded cutoff */
+    void ChargeEquilibration();
+
+    void SetupBatchBlocks();
+    void BatchVdWList(const Matrix& geometries);
+
+    void UpdateAtomTerms();
+    void CollectDeltaTerms(bool vdws_only);
+    double DeltaTermEnergy();
+
+    void TagFragmentTerms();
 
     std::vector<int> m_atom_types, m_uff_atom_types, m_coordination;
-    std::vector<std::vector<int>> m_stored_bonds;
-    std::vector<std::vector<int>> m_identified_rings;
+    AdjacencyList m_stored_bonds;
+    RingSet m_ring_set;
 
     Matrix m_geometry, m_gradient;
 
@@ -329,11 +514,24 @@ private:
     std::vector<UFFvdW> m_uffvdwaals;
     int m_uff_vdw_start = 0, m_uff_vdw_end = 0;
 
+    /* cutoff mode for the nonbonded terms, the pair list is rebuilt from either the exclusions or the stored candidates */
+    AdjacencyList m_ignored_vdw;
+    std::vector<UFFvdW> m_vdw_candidates;
+    Matrix m_vdw_reference;
+    CellList m_vdw_cells;
+    UnitCell m_cell;
+    Vector m_charges;
+    Eigen::MatrixXf m_single_geometry;
+    Eigen::VectorXf m_single_charges;
+    bool m_single_precision = false;
+    double m_total_charge = 0;
+    std::string m_charge_model = "none";
+    double m_vdw_cutoff = 0, m_vdw_skin = 2.0, m_vdw_switch = 2.0;
+    int m_vdw_rebuilds = 0;
+
     double m_scaling = 1.15;
-    Matrix m_topo;
     bool m_CalculateGradient = true, m_initialised = false;
-    std::string m_writeparam = "none", m_writeuff = "none";
-    double m_d = 1e-6;
+    std::string m_writeparam = "none", m_writeuff = "none", m_uff_cache = "none";
     double m_au = 1;
     double m_h4_scaling = 1, m_hh_scaling = 1;
     double m_final_factor = 1;
@@ -343,15 +541,60 @@ private:
     bool m_use_d3 = false;
     bool m_use_d4 = false;
     bool m_verbose = false;
-    bool m_rings = false;
+    bool m_rings = true;
     double m_bond_scaling = 1, m_angle_scaling = 1, m_dihedral_scaling = 1, m_inversion_scaling = 1, m_vdw_scaling = 1, m_rep_scaling = 1, m_coulmob_scaling = 1;
+    double m_coulomb_damping = 0.2;
     bool m_numtorsion = false;
     int m_calc_gradient = 0;
 
-    int m_threads = 1;
+    /* m_threads is the upper bound, m_active_threads are those that get terms for the current system */
+    int m_threads = 1, m_active_threads = 1;
+    int m_force_group = AllForces;
     hbonds4::H4Correction m_h4correction;
+    std::vector<hbonds4::atom_t> m_h4_geometry;
     std::vector<UFFThread*> m_stored_threads;
-    CxxThreadPool* m_threadpool;
+    std::vector<UFFReduceThread*> m_reduce_threads;
+    WorkerTeam* m_team = nullptr;
+
+    /* measured time per bond, angle, dihedral, inversion and vdW term, negative if not measured yet */
+    std::array<double, 5> m_term_cost = { { -1, -1, -1, -1, -1 } };
+    double m_total_cost = 0;
+
+    /* all terms in one block each for CalculateBatch and SparseHessian, set up on first use */
+    UFFBondBlock m_batch_bonds;
+    UFFAngleBlock m_batch_angles;
+    UFFDihedralBlock m_batch_dihedrals;
+    UFFInversionBlock m_batch_inversions;
+    UFFvdWBlock m_batch_vdws;
+    bool m_batch_ready = false;
+
+    /* terms of every atom for DeltaEnergy: bonds, angles, dihedrals, inversions and vdW pairs,
+     * the vdW row follows the pair list and is rebuilt together with it */
+    std::array<AdjacencyList, 5> m_atom_terms;
+    int m_atom_terms_rebuilds = -1;
+    std::vector<int> m_delta_atoms, m_delta_ids;
+    Matrix m_delta_previous;
+    UFFBondBlock m_delta_bonds;
+    UFFAngleBlock m_delta_angles;
+    UFFDihedralBlock m_delta_dihedrals;
+    UFFInversionBlock m_delta_inversions;
+    UFFvdWBlock m_delta_vdws;
+    bool m_delta_pending = false, m_delta_rebuilt = false;
+
+    /* terms of every fragment and the intermolecular ones (last block) for FragmentEnergies,
+     * the vdW blocks follow the pair list */
+    std::vector<int> m_atom_fragment;
+    int m_fragment_count = 0, m_fragment_rebuilds = -1;
+    bool m_fragment_tagged = false;
+    std::vector<UFFBondBlock> m_fragment_bonds;
+    std::vector<UFFAngleBlock> m_fragment_angles;
+    std::vector<UFFDihedralBlock> m_fragment_dihedrals;
+    std::vector<UFFInversionBlock> m_fragment_inversions;
+    std::vector<UFFvdWBlock> m_fragment_vdws;
+
+    /* coordinates in Bohr and gradient of the dispersion corrections, sized once per molecule */
+    std::vector<double> m_dispersion_coord, m_dispersion_gradient;
+    DispersionRefresh m_d3_refresh, m_d4_refresh;
 
 #ifdef USE_D3
     DFTD3Interface* m_d3;
@@ -0,0 +1,203 @@
+/*
+ * <Cache of single point energies and gradients. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "energycache.h"
+
+namespace {
+/* two independent 64 bit hashes, FNV-1a and a multiply-xorshift mix, give the 128 bit key */
+struct Hash {
+    std::uint64_t fnv = 14695981039346656037ULL, mix = 0x9E3779B97F4A7C15ULL;
+
+    void Add(std::uint64_t value)
+    {
+        for (int byte = 0; byte < 8; ++byte) {
+            fnv ^= (value >> (8 * byte)) & 0xFF;
+            fnv *= 1099511628211ULL;
+        }
+        mix ^= value + 0x9E3779B97F4A7C15ULL + (mix << 6) + (mix >> 2);
+        mix ^= mix >> 31;
+        mix *= 0xBF58476D1CE4E5B9ULL;
+        mix ^= mix >> 29;
+    }
+};
+}
+
+EnergyCache& EnergyCache::Instance()
+{
+    static EnergyCache cache;
+    return cache;
+}
+
+void EnergyCache::Open(const std::string& filename)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (filename.empty() || !m_filename.empty())
+        return;
+    m_filename = filename;
+    std::ifstream input(filename);
+    for (std::string line; std::getline(input, line);) {
+        std::istringstream fields(line);
+        std::string key;
+        Entry entry;
+        if (!(fields >> key >> entry.energy))
+            continue;
+        std::vector<double> gradient;
+        for (double value; fields >> value;)
+            gradient.push_back(value);
+        if (gradient.size() % 3 == 0 && gradient.size()) {
+            entry.gradient = Matrix(gradient.size() / 3, 3);
+            for (int i = 0; i < entry.gradient.rows(); ++i)
+                for (int c = 0; c < 3; ++c)
+                    entry.gradient(i, c) = gradient[3 * i + c];
+        }
+        m_entries[key] = entry;
+        ++m_loaded;
+    }
+    m_file.open(filename, std::ios_base::app);
+    m_pending << std::setprecision(17);
+}
+
+std::string EnergyCache::Settings(const json& defaults, const json& controller)
+{
+    static const std::vector<std::string> ignored = { "threads", "verbose", "tb_verbose", "writeparam", "writeuff", "uff_cache" };
+    json settings;
+    for (const auto& item : defaults.items()) {
+        std::string key = item.key();
+        std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+        if (std::find(ignored.begin(), ignored.end(), key) != ignored.end())
+            continue;
+        json value = item.value();
+        for (const auto& local : controller.items()) {
+            std::string name = local.key();
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            if (name == key)
+                value = local.value();
+        }
+        /* 1 and 1.0 from different sources are the same setting */
+        settings[key] = value.is_number() ? json(value.get<double>()) : value;
+    }
+    return settings.dump();
+}
+
+std::string EnergyCache::Key(const std::string& method, const std::string& settings, int charge, int spin, const std::vector<int>& atoms, const std::vector<std::array<double, 3>>& geometry, const UnitCell& cell, const std::vector<double>& charges, double precision)
+{
+    Hash hash;
+    for (char c : method)
+        hash.Add(std::uint64_t(c));
+    hash.Add(settings.size());
+    for (char c : settings)
+        hash.Add(std::uint64_t(c));
+    hash.Add(std::uint64_t(std::int64_t(charge)));
+    hash.Add(std::uint64_t(std::int64_t(spin)));
+    hash.Add(atoms.size());
+    for (int atom : atoms)
+        hash.Add(std::uint64_t(atom));
+    for (const auto& position : geometry)
+        for (double x : position)
+            hash.Add(std::uint64_t(std::llround(x / precision)));
+    /* the same coordinates in a cell or with other point charges are another single point */
+    hash.Add(cell.isPeriodic());
+    if (cell.isPeriodic())
+        for (int i = 0; i < 3; ++i)
+            for (int c = 0; c < 3; ++c)
+                hash.Add(std::uint64_t(std::llround(cell.Vectors()(i, c) / precision)));
+    hash.Add(charges.size());
+    for (double q : charges)
+        hash.Add(std::uint64_t(std::llround(q / precision)));
+    char key[33];
+    std::snprintf(key, sizeof(key), "%016llx%016llx", (unsigned long long)hash.fnv, (unsigned long long)hash.mix);
+    return key;
+}
+
+bool EnergyCache::Find(const std::string& key, bool gradient, Entry& entry)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = m_entries.find(key);
+    if (found == m_entries.end() || (gradient && found->second.gradient.size() == 0)) {
+        ++m_misses;
+        return false;
+    }
+    entry = found->second;
+    ++m_hits;
+    return true;
+}
+
+void EnergyCache::Store(const std::string& key, double energy, const Matrix* gradient)
+{
+    if (std::isnan(energy))
+        return;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = m_entries.find(key);
+    /* an entry with gradient is not replaced by one without */
+    if (found != m_entries.end() && (gradient == nullptr || found->second.gradient.size()))
+        return;
+    Entry& entry = m_entries[key];
+    entry.energy = energy;
+    if (gradient)
+        entry.gradient = *gradient;
+    Write(key, entry);
+}
+
+void EnergyCache::Write(const std::string& key, const Entry& entry)
+{
+    if (!m_file.is_open())
+        return;
+    m_pending << key << " " << entry.energy;
+    for (int i = 0; i < entry.gradient.rows(); ++i)
+        for (int c = 0; c < entry.gradient.cols(); ++c)
+            m_pending << " " << entry.gradient(i, c);
+    m_pending << "\n";
+    /* whole lines go to the file in blocks, a run that is killed loses the last block but never leaves half a line */
+    if (m_pending.tellp() > PendingBytes)
+        WritePending();
+}
+
+void EnergyCache::WritePending()
+{
+    if (!m_file.is_open() || m_pending.tellp() <= 0)
+        return;
+    m_file << m_pending.str();
+    m_file.flush();
+    m_pending.str(std::string());
+}
+
+void EnergyCache::Flush()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    WritePending();
+}
+
+void EnergyCache::PrintStatistics()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_hits + m_misses == 0)
+        return;
+    std::cout << "Energy cache: " << m_hits << " hits, " << m_misses << " misses, " << m_entries.size() << " structures";
+    if (!m_filename.empty())
+        std::cout << " (" << m_loaded << " from " << m_filename << ")";
+    std::cout << std::endl;
+}
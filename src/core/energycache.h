@@ -0,0 +1,89 @@
+/*
+ * <Cache of single point energies and gradients. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "src/core/global.h"
+#include "src/core/unitcell.h"
+
+#include <array>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*! \brief Energies (and gradients) of single points, shared by all EnergyCalculators of the process.
+ * The key is a 128 bit hash of method, method settings, charge, spin, the elements, the coordinates and the
+ * lattice vectors of a periodic cell rounded to a grid of precision Angstrom and the externally set partial
+ * charges rounded to the same grid, structures that agree to this precision share one entry.
+ * With a file, the entries of earlier runs are loaded and every new one is appended as a line
+ * "key energy [gradient]", entries of other settings in the same file are never hit. New lines are
+ * written in blocks and with Flush. The instance lives until the process ends and does no I/O when it
+ * is destroyed, capabilities that use it call Flush and PrintStatistics when they finish. */
+class EnergyCache {
+public:
+    struct Entry {
+        double energy = 0;
+        Matrix gradient;
+    };
+
+    static EnergyCache& Instance();
+
+    /*! \brief Load the entries of filename and append new entries to it, the first file stays in use for the whole run */
+    void Open(const std::string& filename);
+
+    /*! \brief Canonical dump of the settings of a method, every key of its defaults with the value from controller
+     * (or the default), numbers as double. Keys that do not change energies (threads, verbosity, output files) are left out */
+    static std::string Settings(const json& defaults, const json& controller);
+
+    /*! \brief Key of a single point, charges are the partial charges set from outside (empty if the method determines them) */
+    static std::string Key(const std::string& method, const std::string& settings, int charge, int spin, const std::vector<int>& atoms, const std::vector<std::array<double, 3>>& geometry, const UnitCell& cell, const std::vector<double>& charges, double precision);
+
+    /*! \brief Entry of key, a hit for a gradient requires an entry that has one */
+    bool Find(const std::string& key, bool gradient, Entry& entry);
+
+    void Store(const std::string& key, double energy, const Matrix* gradient = nullptr);
+
+    /*! \brief Write the pending lines to the file */
+    void Flush();
+
+    /*! \brief Print hits, misses and the number of structures, nothing if the cache was never asked */
+    void PrintStatistics();
+
+    std::size_t Hits() const { return m_hits; }
+    std::size_t Misses() const { return m_misses; }
+
+private:
+    EnergyCache() = default;
+    ~EnergyCache() = default;
+
+    void Write(const std::string& key, const Entry& entry);
+    void WritePending();
+
+    static constexpr std::streamoff PendingBytes = 1 << 16;
+
+    std::unordered_map<std::string, Entry> m_entries;
+    std::mutex m_mutex;
+    std::ofstream m_file;
+    std::ostringstream m_pending;
+    std::string m_filename;
+    std::size_t m_hits = 0, m_misses = 0, m_loaded = 0;
+};
@@ -25,12 +25,18 @@
 #include "src/core/xtbinterface.h"
 #endif
 
+#include <atomic>
 #include <functional>
+#include <numeric>
+
+#include "src/core/energycache.h"
+#include "src/core/energyworkerpool.h"
 
 #include "energycalculator.h"
 
 EnergyCalculator::EnergyCalculator(const std::string& method, const json& controller)
-    : m_method(method)
+    : m_controller(controller)
+    , m_method(method)
 {
     m_charges = []() {
         return std::vector<double>{};
@@ -41,15 +47,45 @@ EnergyCalculator::EnergyCalculator(const std::string& method, const json& contro
     m_bonds = []() {
         return std::vector<std::vector<double>>{ {} };
     };
+    m_batchengine = [this](const Matrix& geometries, Matrix* gradients) {
+        return this->CalculateSequential(geometries, gradients);
+    };
+
+    std::string cache_file;
+    try {
+        m_cache = Json2KeyWord<bool>(controller, "energy_cache");
+    } catch (int error) {
+    }
+    try {
+        cache_file = Json2KeyWord<std::string>(controller, "energy_cache_file");
+    } catch (int error) {
+    }
+    try {
+        m_cache_precision = Json2KeyWord<double>(controller, "energy_cache_precision");
+    } catch (int error) {
+    }
+    if (!cache_file.empty()) {
+        m_cache = true;
+        EnergyCache::Instance().Open(cache_file);
+    }
 
     if (std::find(m_uff_methods.begin(), m_uff_methods.end(), m_method) != m_uff_methods.end()) { // UFF energy calculator requested
         m_uff = new eigenUFF(controller);
+        m_cache_settings = EnergyCache::Settings(UFFParameterJson, controller);
         m_ecengine = [this](bool gradient, bool verbose) {
             this->CalculateUFF(gradient, verbose);
         };
+        m_batchengine = [this](const Matrix& geometries, Matrix* gradients) {
+            return this->m_uff->CalculateBatch(geometries, gradients);
+        };
+        m_charges = [this]() {
+            const Vector& charges = this->m_uff->Charges();
+            return std::vector<double>(charges.data(), charges.data() + charges.size());
+        };
     } else if (std::find(m_tblite_methods.begin(), m_tblite_methods.end(), m_method) != m_tblite_methods.end()) { // TBLite energy calculator requested
 #ifdef USE_TBLITE
         m_tblite = new TBLiteInterface(controller);
+        m_cache_settings = EnergyCache::Settings(TBLiteSettings, controller);
         m_ecengine = [this](bool gradient, bool verbose) {
             this->CalculateTBlite(gradient, verbose);
         };
@@ -70,6 +106,7 @@ EnergyCalculator::EnergyCalculator(const std::string& method, const json& contro
     } else if (std::find(m_xtb_methods.begin(), m_xtb_methods.end(), m_method) != m_xtb_methods.end()) { // XTB energy calculator requested
 #ifdef USE_XTB
         m_xtb = new XTBInterface(controller);
+        m_cache_settings = EnergyCache::Settings(XTBSettings, controller);
         m_ecengine = [this](bool gradient, bool verbose) {
             this->CalculateXTB(gradient, verbose);
         };
@@ -89,6 +126,7 @@ EnergyCalculator::EnergyCalculator(const std::string& method, const json& contro
     } else if (std::find(m_d3_methods.begin(), m_d3_methods.end(), m_method) != m_d3_methods.end()) { // Just D4 energy calculator requested
 #ifdef USE_D3
         m_d3 = new DFTD3Interface(controller);
+        m_cache_settings = EnergyCache::Settings(DFTD3Settings, controller);
         m_ecengine = [this](bool gradient, bool verbose) {
             this->CalculateD3(gradient, verbose);
         };
@@ -99,6 +137,7 @@ EnergyCalculator::EnergyCalculator(const std::string& method, const json& contro
     } else if (std::find(m_d4_methods.begin(), m_d4_methods.end(), m_method) != m_d4_methods.end()) { // Just D4 energy calculator requested
 #ifdef USE_D4
         m_d4 = new DFTD4Interface(controller);
+        m_cache_settings = EnergyCache::Settings(DFTD4Settings, controller);
         m_ecengine = [this](bool gradient, bool verbose) {
             this->CalculateD4(gradient, verbose);
         };
@@ -108,10 +147,15 @@ EnergyCalculator::EnergyCalculator(const std::string& method, const json& contro
 #endif
     } else { // Fall back to UFF?
         m_uff = new eigenUFF(controller);
+        m_cache_settings = EnergyCache::Settings(UFFParameterJson, controller);
     }
 }
 EnergyCalculator::~EnergyCalculator()
 {
+    for (PoolCalculator& pool : m_pool)
+        delete pool.calculator;
+    delete m_team;
+    delete m_processes;
     if (std::find(m_uff_methods.begin(), m_uff_methods.end(), m_method) != m_uff_methods.end()) { // UFF energy calculator requested
         delete m_uff;
     } else if (std::find(m_tblite_methods.begin(), m_tblite_methods.end(), m_method) != m_tblite_methods.end()) { // TBLite energy calculator requested
@@ -142,8 +186,13 @@ void EnergyCalculator::setMolecule(const Molecule& molecule)
 
     // m_atom_type[m_atoms];
     std::vector<int> atoms = molecule.Atoms();
-    m_coord = new double[3 * m_atoms];
-    m_grad = new double[3 * m_atoms];
+    m_elements = atoms;
+    m_charge = molecule.Charge();
+    m_spin = molecule.Spin();
+    m_cell = molecule.Cell();
+    m_coord.assign(3 * m_atoms, 0.0);
+    m_grad.assign(3 * m_atoms, 0.0);
+    m_gradient.assign(m_atoms, { 0, 0, 0 });
     std::vector<std::array<double, 3>> geom(m_atoms);
     m_eigen_gradient = Eigen::MatrixXd::Zero(m_atoms, 3);
 
@@ -152,11 +201,12 @@ void EnergyCalculator::setMolecule(const Molecule& molecule)
         geom[i][0] = atom.second(0);
         geom[i][1] = atom.second(1);
         geom[i][2] = atom.second(2);
-        m_gradient.push_back({ 0, 0, 0 });
     }
     m_geometry = geom;
     if (std::find(m_uff_methods.begin(), m_uff_methods.end(), m_method) != m_uff_methods.end()) { // UFF energy calculator requested
         m_uff->setMolecule(atoms, geom);
+        m_uff->setCell(molecule.Cell());
+        m_uff->setTotalCharge(molecule.Charge());
         m_uff->Initialise();
     } else if (std::find(m_tblite_methods.begin(), m_tblite_methods.end(), m_method) != m_tblite_methods.end()) { // TBLite energy calculator requested
 #ifdef USE_TBLITE
@@ -228,10 +278,241 @@ void EnergyCalculator::updateGeometry(const std::vector<std::array<double, 3>>&
 
 double EnergyCalculator::CalculateEnergy(bool gradient, bool verbose)
 {
+    m_cached = false;
+    /* force groups and single precision give other energies than the ones in the cache */
+    if (!m_cache_single || m_force_group != AllForces || (m_uff && m_uff->SinglePrecision()) || m_containsNaN) {
+        m_ecengine(gradient, verbose);
+        return m_energy;
+    }
+    const std::string key = EnergyCache::Key(m_method, m_cache_settings, m_charge, m_spin, m_elements, m_geometry, m_cell, m_external_charges, m_cache_precision);
+    EnergyCache::Entry entry;
+    if (EnergyCache::Instance().Find(key, gradient, entry)) {
+        m_energy = entry.energy;
+        if (gradient)
+            m_eigen_gradient = entry.gradient;
+        m_cached = true;
+        return m_energy;
+    }
     m_ecengine(gradient, verbose);
+    EnergyCache::Instance().Store(key, m_energy, gradient ? &m_eigen_gradient : nullptr);
     return m_energy;
 }
 
+void EnergyCalculator::CacheEnergy(const Molecule& molecule, double energy) const
+{
+    if (m_cache)
+        EnergyCache::Instance().Store(EnergyCache::Key(m_method, m_cache_settings, molecule.Charge(), molecule.Spin(), molecule.Atoms(), molecule.Coords(), molecule.Cell(), m_external_charges, m_cache_precision), energy);
+}
+
+void EnergyCalculator::setCharges(const std::vector<double>& charges)
+{
+    if (m_uff) {
+        m_uff->setCharges(charges);
+        m_external_charges = charges;
+    }
+}
+
+void EnergyCalculator::setForceGroup(int group)
+{
+    m_force_group = group;
+    if (m_uff)
+        m_uff->setForceGroup(group);
+}
+
+void EnergyCalculator::setSinglePrecision(bool single)
+{
+    if (m_uff)
+        m_uff->setSinglePrecision(single);
+}
+
+bool EnergyCalculator::Compatible(const Molecule& molecule) const
+{
+    if (m_elements != molecule.Atoms() || m_charge != molecule.Charge() || m_spin != molecule.Spin())
+        return false;
+    if (m_cell.isPeriodic() != molecule.Cell().isPeriodic() || (m_cell.isPeriodic() && m_cell.Vectors() != molecule.Cell().Vectors()))
+        return false;
+    /* the UFF terms follow the bonds found in setMolecule */
+    return m_uff == nullptr || m_uff->SameBonds(molecule.Coords());
+}
+
+std::vector<double> EnergyCalculator::ExternalCharges(const Molecule& molecule) const
+{
+    return m_external_charges.size() == molecule.AtomCount() ? m_external_charges : std::vector<double>();
+}
+
+Vector EnergyCalculator::CalculateEnergies(const Matrix& geometries, Matrix* gradients)
+{
+    return m_batchengine(geometries, gradients);
+}
+
+bool EnergyCalculator::ThreadSafe(const std::string& method)
+{
+    /* xtb keeps its setup in module variables of the fortran library, tblite and ulysses are not known to be reentrant
+     * either. Only the backends whose calculators share no state are allowed, every other method runs on one thread */
+    StringList reentrant = { "uff", "d3", "d4" };
+    return std::find(reentrant.begin(), reentrant.end(), method) != reentrant.end();
+}
+
+std::vector<double> EnergyCalculator::CalculateEnergies(const std::vector<Molecule>& molecules, int threads)
+{
+    if (m_cache) {
+        /* only the structures the cache does not know are calculated, in one batch */
+        std::vector<double> energies(molecules.size(), 0.0);
+        std::vector<std::string> keys;
+        std::vector<Molecule> missing;
+        std::vector<int> index;
+        for (int i = 0; i < molecules.size(); ++i) {
+            const Molecule& molecule = molecules[i];
+            if (molecule.AtomCount() == 0)
+                continue;
+            const std::string key = EnergyCache::Key(m_method, m_cache_settings, molecule.Charge(), molecule.Spin(), molecule.Atoms(), molecule.Coords(), molecule.Cell(), ExternalCharges(molecule), m_cache_precision);
+            EnergyCache::Entry entry;
+            if (EnergyCache::Instance().Find(key, false, entry))
+                energies[i] = entry.energy;
+            else {
+                keys.push_back(key);
+                missing.push_back(molecule);
+                index.push_back(i);
+            }
+        }
+        if (missing.size()) {
+            m_cache = false;
+            const std::vector<double> calculated = CalculateEnergies(missing, threads);
+            m_cache = true;
+            for (int i = 0; i < index.size(); ++i) {
+                energies[index[i]] = calculated[i];
+                EnergyCache::Instance().Store(keys[i], calculated[i]);
+            }
+            EnergyCache::Instance().Flush();
+        }
+        return energies;
+    }
+
+    int processes = 0;
+    try {
+        processes = Json2KeyWord<int>(m_controller, "processes");
+    } catch (int error) {
+    }
+    /* the worker processes do not get the charges set with setCharges, such batches stay in this process */
+    if (processes > 0 && m_external_charges.empty() && EnergyWorkerPool::Available()) {
+        if (m_processes == nullptr || m_processes->Workers() != processes) {
+            delete m_processes;
+            json controller = m_controller;
+            controller["threads"] = 1;
+            controller["processes"] = 0;
+            controller["energy_cache"] = false;
+            controller["energy_cache_file"] = "";
+            m_processes = new EnergyWorkerPool(m_method, controller, processes);
+        }
+        return m_processes->CalculateEnergies(molecules);
+    }
+
+    std::vector<double> energies(molecules.size(), 0.0);
+    threads = ThreadSafe(m_method) ? std::max(1, std::min(WorkerTeam::Threads(threads), int(molecules.size()))) : 1;
+    if (m_pool.size() < threads)
+        m_pool.resize(threads);
+    if (threads > 1 && (m_team == nullptr || m_team->Size() < threads)) {
+        delete m_team;
+        m_team = new WorkerTeam(threads);
+    }
+
+    /* the structures are handed out one by one, so a few large ones do not stall the other threads.
+     * Every calculator runs single threaded, the parallelism is over the structures */
+    json controller = m_controller;
+    controller["threads"] = 1;
+    controller["energy_cache"] = false;
+    controller["energy_cache_file"] = "";
+    std::atomic<int> next{ 0 };
+    auto job = [&](int worker) {
+        PoolCalculator& pool = m_pool[worker];
+        for (int i = next++; i < int(molecules.size()); i = next++) {
+            const Molecule& molecule = molecules[i];
+            if (molecule.AtomCount() == 0)
+                continue;
+            const std::vector<double> charges = ExternalCharges(molecule);
+            if (pool.calculator == nullptr || !pool.calculator->Compatible(molecule) || pool.charges != charges) {
+                delete pool.calculator;
+                pool.calculator = new EnergyCalculator(m_method, controller);
+                pool.calculator->setMolecule(molecule);
+                if (charges.size())
+                    pool.calculator->setCharges(charges);
+                pool.charges = charges;
+            } else
+                pool.calculator->updateGeometry(molecule.Coords());
+            energies[i] = pool.calculator->CalculateEnergy(false);
+        }
+    };
+    if (threads == 1)
+        job(0);
+    else
+        m_team->Run(threads, job);
+    return energies;
+}
+
+std::vector<double> EnergyCalculator::FragmentEnergies(const std::vector<std::vector<int>>& fragments, const std::vector<int>& charges, const std::vector<int>& spins)
+{
+    if (m_uff) {
+        m_uff->UpdateGeometry(m_geometry);
+        m_uff->setFragments(fragments);
+        const std::vector<double> energies = m_uff->FragmentEnergies();
+        if (energies.size()) {
+            m_energy = std::accumulate(energies.begin(), energies.end(), 0.0);
+            return energies;
+        }
+    }
+
+    /* without charges and spins of the fragments they are only known for a neutral closed shell complex */
+    if ((charges.empty() && spins.empty() && (m_charge != 0 || m_spin != 0))
+        || (charges.size() && charges.size() != fragments.size()) || (spins.size() && spins.size() != fragments.size())
+        || (charges.size() && std::accumulate(charges.begin(), charges.end(), 0) != m_charge)) {
+        std::cerr << "Fragment energies need the charge (and spin) of every fragment, they have to add up to the charge " << m_charge << " of the complex." << std::endl;
+        return std::vector<double>();
+    }
+
+    /* the complex comes first, the fragments follow, all of them in the cell of the complex */
+    std::vector<Molecule> molecules(fragments.size() + 1);
+    molecules[0].setCharge(m_charge);
+    molecules[0].setSpin(m_spin);
+    molecules[0].setCell(m_cell);
+    for (int i = 0; i < m_atoms; ++i)
+        molecules[0].addPair({ m_elements[i], Position{ m_geometry[i][0], m_geometry[i][1], m_geometry[i][2] } });
+    for (int f = 0; f < fragments.size(); ++f) {
+        molecules[f + 1].setCharge(charges.size() ? charges[f] : 0);
+        molecules[f + 1].setSpin(spins.size() ? spins[f] : 0);
+        molecules[f + 1].setCell(m_cell);
+        for (int atom : fragments[f])
+            molecules[f + 1].addPair({ m_elements[atom], Position{ m_geometry[atom][0], m_geometry[atom][1], m_geometry[atom][2] } });
+    }
+
+    int threads = 1;
+    try {
+        threads = Json2KeyWord<int>(m_controller, "threads");
+    } catch (int error) {
+    }
+    const std::vector<double> calculated = CalculateEnergies(molecules, threads);
+    std::vector<double> energies(calculated.begin() + 1, calculated.end());
+    energies.push_back(calculated[0] - std::accumulate(energies.begin(), energies.end(), 0.0));
+    m_energy = calculated[0];
+    return energies;
+}
+
+Vector EnergyCalculator::CalculateSequential(const Matrix& geometries, Matrix* gradients)
+{
+    const std::vector<std::array<double, 3>> geometry = m_geometry;
+    Vector energies = Vector::Zero(geometries.rows());
+    if (gradients)
+        *gradients = Matrix::Zero(geometries.rows(), 3 * m_atoms);
+    for (int k = 0; k < geometries.rows(); ++k) {
+        updateGeometry(Eigen::VectorXd(geometries.row(k).transpose()));
+        energies(k) = CalculateEnergy(gradients != nullptr);
+        if (gradients)
+            for (int i = 0; i < m_atoms; ++i)
+                gradients->block(k, 3 * i, 1, 3) = m_eigen_gradient.row(i);
+    }
+    m_geometry = geometry;
+    return energies;
+}
+
 void EnergyCalculator::CalculateUFF(bool gradient, bool verbose)
 {
     m_uff->UpdateGeometry(m_geometry);
@@ -250,10 +531,10 @@ void EnergyCalculator::CalculateTBlite(bool gradient, bool verbose)
         m_coord[3 * i + 1] = m_geometry[i][1] / au;
         m_coord[3 * i + 2] = m_geometry[i][2] / au;
     }
-    m_tblite->UpdateMolecule(m_coord);
+    m_tblite->UpdateMolecule(m_coord.data());
 
     if (gradient) {
-        m_energy = m_tblite->GFNCalculation(m_gfn, m_grad);
+        m_energy = m_tblite->GFNCalculation(m_gfn, m_grad.data());
         for (int i = 0; i < m_atoms; ++i) {
             m_eigen_gradient(i, 0) = m_grad[3 * i + 0] * au;
             m_eigen_gradient(i, 1) = m_grad[3 * i + 1] * au;
@@ -272,10 +553,10 @@ void EnergyCalculator::CalculateXTB(bool gradient, bool verbose)
         m_coord[3 * i + 1] = m_geometry[i][1] / au;
         m_coord[3 * i + 2] = m_geometry[i][2] / au;
     }
-    m_xtb->UpdateMolecule(m_coord);
+    m_xtb->UpdateMolecule(m_coord.data());
 
     if (gradient) {
-        m_energy = m_xtb->GFNCalculation(m_gfn, m_grad);
+        m_energy = m_xtb->GFNCalculation(m_gfn, m_grad.data());
         for (int i = 0; i < m_atoms; ++i) {
             m_eigen_gradient(i, 0) = m_grad[3 * i + 0] * au;
             m_eigen_gradient(i, 1) = m_grad[3 * i + 1] * au;
@@ -290,10 +571,13 @@ void EnergyCalculator::CalculateD3(bool gradient, bool verbose)
 {
 #ifdef USE_D3
     for (int i = 0; i < m_atoms; ++i) {
-        m_d3->UpdateAtom(i, m_geometry[i][0], m_geometry[i][1], m_geometry[i][2]);
+        m_coord[3 * i + 0] = m_geometry[i][0] / au;
+        m_coord[3 * i + 1] = m_geometry[i][1] / au;
+        m_coord[3 * i + 2] = m_geometry[i][2] / au;
     }
+    m_d3->UpdateGeometry(m_coord.data());
     if (gradient) {
-        m_energy = m_d3->DFTD3Calculation(m_grad);
+        m_energy = m_d3->DFTD3Calculation(m_grad.data());
         for (int i = 0; i < m_atoms; ++i) {
             m_eigen_gradient(i, 0) = m_grad[3 * i + 0] * au;
             m_eigen_gradient(i, 1) = m_grad[3 * i + 1] * au;
@@ -308,10 +592,13 @@ void EnergyCalculator::CalculateD4(bool gradient, bool verbose)
 {
 #ifdef USE_D4
     for (int i = 0; i < m_atoms; ++i) {
-        m_d4->UpdateAtom(i, m_geometry[i][0] / au, m_geometry[i][1] / au, m_geometry[i][2] / au);
+        m_coord[3 * i + 0] = m_geometry[i][0] / au;
+        m_coord[3 * i + 1] = m_geometry[i][1] / au;
+        m_coord[3 * i + 2] = m_geometry[i][2] / au;
     }
+    m_d4->UpdateGeometry(m_coord.data());
     if (gradient) {
-        m_energy = m_d4->DFTD4Calculation(m_grad);
+        m_energy = m_d4->DFTD4Calculation(m_grad.data());
         for (int i = 0; i < m_atoms; ++i) {
             m_eigen_gradient(i, 0) = m_grad[3 * i + 0] * au;
             m_eigen_gradient(i, 1) = m_grad[3 * i + 1] * au;
@@ -338,15 +625,21 @@ Matrix EnergyCalculator::Gradient() const
 
 std::vector<double> EnergyCalculator::Charges() const
 {
+    if (m_cached)
+        return std::vector<double>{};
     return m_charges();
 }
 
 std::vector<double> EnergyCalculator::Dipole() const
 {
+    if (m_cached)
+        return std::vector<double>{};
     return m_dipole();
 }
 
 std::vector<std::vector<double>> EnergyCalculator::BondOrders() const
 {
+    if (m_cached)
+        return std::vector<std::vector<double>>{ {} };
     return m_bonds();
 }
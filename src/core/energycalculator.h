@@ -38,9 +38,12 @@
 #endif
 
 #include "src/core/eigen_uff.h"
+#include "src/core/workerteam.h"
 
 #include <functional>
 
+class EnergyWorkerPool;
+
 class EnergyCalculator {
 public:
     EnergyCalculator(const std::string& method, const json& controller);
@@ -62,8 +65,47 @@ public:
 
     double CalculateEnergy(bool gradient = false, bool verbose = false);
 
+    /*! \brief Energies of many geometries of the current molecule, one geometry per row with the
+     * coordinates of atom a in the columns 3a, 3a + 1 and 3a + 2. Gradients are returned in the same layout. */
+    Vector CalculateEnergies(const Matrix& geometries, Matrix* gradients = nullptr);
+
+    /*! \brief Single point energies of independent structures in the order of molecules, computed by up to threads calculators
+     * of the same method and controller. Every thread keeps its calculator and only updates the geometry as long as the structures
+     * are Compatible with it, the calculators are kept for the next call as well. Charges set with setCharges are passed on to the
+     * structures with as many atoms. Methods that are not ThreadSafe
+     * are evaluated on one thread. With "processes" > 0 in the controller the structures go to that many worker
+     * processes instead (EnergyWorkerPool), which is the way to run xtb in parallel and keeps crashes away from the caller. */
+    std::vector<double> CalculateEnergies(const std::vector<Molecule>& molecules, int threads = 1);
+
+    /*! \brief Energies in Eh of the fragments of the current molecule (e.g. Molecule::GetFragments) and of their interaction:
+     * one entry per fragment, followed by E(complex) - sum E(fragment). UFF splits its terms by fragment and gets all
+     * entries from one evaluation. The other methods, and UFF with D3, D4, hydrogen bond corrections or QEq charges,
+     * calculate the complex and every fragment on its own (CalculateEnergies) in the cell of the molecule, with the given charges and spins of the fragments,
+     * neutral closed shells if there are none. A charged or open shell complex needs them, otherwise (or if the charges do not
+     * add up to the complex) a warning is printed and the result is empty */
+    std::vector<double> FragmentEnergies(const std::vector<std::vector<int>>& fragments, const std::vector<int>& charges = {}, const std::vector<int>& spins = {});
+
+    /*! \brief True only for UFF, D3 and D4. xtb, tblite (gfn1, gfn2, ipea1) and every other backend are not evaluated in several
+     * threads of one process, "processes" runs them in parallel */
+    static bool ThreadSafe(const std::string& method);
+
     bool HasNan() const { return m_containsNaN; }
 
+    /*! \brief Only UFF splits its terms into force groups, the other methods always evaluate AllForces */
+    bool HasForceGroups() const { return m_uff != NULL; }
+    void setForceGroup(int group);
+
+    /*! \brief Only UFF has a single precision path ("precision": "single"), the other methods ignore it */
+    void setSinglePrecision(bool single);
+
+    /*! \brief With "energy_cache" (or "energy_cache_file") in the controller, CalculateEnergies(molecules) looks up and stores
+     * its energies in the EnergyCache. Drivers of independent single points switch it on for CalculateEnergy as well,
+     * Charges, Dipole and BondOrders are empty after CalculateEnergy was answered by the cache. */
+    void setEnergyCache(bool cache) { m_cache_single = cache && m_cache; }
+
+    /*! \brief Record the energy of molecule in the EnergyCache if the controller asks for the cache, e.g. for the final structure of an optimisation */
+    void CacheEnergy(const Molecule& molecule, double energy) const;
+
 #ifdef USE_TBLITE
     TBLiteInterface* getTBLiterInterface() const
     {
@@ -95,6 +137,12 @@ public:
     std::vector<double> Charges() const;
     std::vector<double> Dipole() const;
 
+    /*! \brief True if molecule can follow with updateGeometry: same atoms, charge, spin and cell and, for UFF, the same bonds */
+    bool Compatible(const Molecule& molecule) const;
+
+    /*! \brief Fixed partial charges for the UFF electrostatics, e.g. Charges() of an xtb or tblite calculation */
+    void setCharges(const std::vector<double>& charges);
+
     std::vector<std::vector<double>> BondOrders() const;
 
 private:
@@ -113,8 +161,32 @@ private:
     void InitialiseD3();
     void CalculateD3(bool gradient, bool verbose = false);
 
+    Vector CalculateSequential(const Matrix& geometries, Matrix* gradients);
+
     json m_controller;
 
+    /* cache of single points, the key needs the method settings, elements, charge, spin and cell of the molecule
+     * and the charges set with setCharges */
+    bool m_cache = false, m_cache_single = false, m_cached = false;
+    double m_cache_precision = 1e-5;
+    std::string m_cache_settings;
+    std::vector<int> m_elements;
+    int m_charge = 0, m_spin = 0, m_force_group = AllForces;
+    UnitCell m_cell;
+    std::vector<double> m_external_charges;
+
+    /* charges set with setCharges if they fit the atoms of molecule, empty otherwise */
+    std::vector<double> ExternalCharges(const Molecule& molecule) const;
+
+    /* calculators of CalculateEnergies(molecules), one per worker, with the charges they were given */
+    struct PoolCalculator {
+        EnergyCalculator* calculator = nullptr;
+        std::vector<double> charges;
+    };
+    std::vector<PoolCalculator> m_pool;
+    WorkerTeam* m_team = nullptr;
+    EnergyWorkerPool* m_processes = nullptr;
+
 #ifdef USE_TBLITE
     TBLiteInterface* m_tblite = NULL;
 #endif
@@ -136,6 +208,7 @@ private:
     StringList m_d3_methods = { "d3" };
     StringList m_d4_methods = { "d4" };
     std::function<void(bool, bool)> m_ecengine;
+    std::function<Vector(const Matrix&, Matrix*)> m_batchengine;
     std::function<std::vector<double>()> m_charges, m_dipole;
     std::function<std::vector<std::vector<double>>()> m_bonds;
 
@@ -143,7 +216,7 @@ private:
     std::vector<std::array<double, 3>> m_geometry, m_gradient;
     Matrix m_eigen_geometry, m_eigen_gradient;
     double m_energy;
-    double *m_coord, *m_grad;
+    std::vector<double> m_coord, m_grad;
 
     int m_atoms;
     int m_gfn = 2;
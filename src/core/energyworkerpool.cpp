@@ -0,0 +1,468 @@
+/*
+ * <Out of process single point workers for the energy calculator. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "src/core/energycalculator.h"
+
+#include "energyworkerpool.h"
+
+#ifndef _WIN32
+extern char** environ;
+#endif
+
+namespace {
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "the control words in shared memory need lock free atomics");
+
+const std::uint32_t Magic = 0x43555243;
+const std::size_t Line = 64;
+
+/* Idle: free for the caller, Request: structure posted, Done: energy written, Quit: worker has to leave */
+enum State {
+    Idle = 0,
+    Request = 1,
+    Done = 2,
+    Quit = 3
+};
+
+/* first bytes of the segment, followed by the json text of the controller and the slots */
+struct Header {
+    std::uint32_t magic;
+    int slots, capacity, parent;
+    std::uint64_t controller, slot;
+};
+
+/* first bytes of every slot, followed by capacity atom types, 3 * capacity coordinates (Angstrom)
+ * and 3 * capacity gradient components, each part starts on a cache line of its own */
+struct Control {
+    std::atomic<int> state;
+    int atoms, charge, spin, gradient, nan;
+    double energy;
+};
+
+struct Slot {
+    Control* control;
+    int* types;
+    double *coord, *gradient;
+};
+
+inline std::size_t Align(std::size_t bytes) { return (bytes + Line - 1) / Line * Line; }
+
+inline std::size_t SlotBytes(int capacity)
+{
+    return Align(sizeof(Control)) + Align(sizeof(int) * capacity) + 2 * Align(3 * sizeof(double) * capacity);
+}
+
+inline std::size_t SlotOffset(std::uint64_t controller) { return Align(Align(sizeof(Header)) + controller); }
+
+Slot Map(char* memory, int index)
+{
+    const Header* header = reinterpret_cast<const Header*>(memory);
+    char* base = memory + SlotOffset(header->controller) + index * header->slot;
+    Slot slot;
+    slot.control = reinterpret_cast<Control*>(base);
+    base += Align(sizeof(Control));
+    slot.types = reinterpret_cast<int*>(base);
+    base += Align(sizeof(int) * header->capacity);
+    slot.coord = reinterpret_cast<double*>(base);
+    base += Align(3 * sizeof(double) * header->capacity);
+    slot.gradient = reinterpret_cast<double*>(base);
+    return slot;
+}
+
+/* both sides spin for a few microseconds before they sleep with growing intervals of up to 1 ms,
+ * an answer that comes quickly costs no system call, an idle worker costs almost no cpu time */
+const int SpinRounds = 4096;
+
+inline void Relax(int round)
+{
+    if (round < SpinRounds) {
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+        __builtin_ia32_pause();
+#else
+        std::this_thread::yield();
+#endif
+    } else
+        std::this_thread::sleep_for(std::chrono::microseconds(std::min(1000, 10 * (round - SpinRounds + 1))));
+}
+
+std::atomic<int> Segments{ 0 };
+}
+
+EnergyWorkerPool::EnergyWorkerPool(const std::string& method, const json& controller, int workers)
+    : m_method(method)
+    , m_controller(controller)
+    , m_workers(std::max(1, workers))
+    , m_pids(std::max(1, workers), 0)
+{
+    if (m_controller.contains("worker_executable"))
+        m_executable = m_controller["worker_executable"].get<std::string>();
+#ifndef _WIN32
+    if (m_executable.empty()) {
+        char path[4096] = { 0 };
+        const ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+        m_executable = length > 0 ? std::string(path, length) : "curcuma";
+    }
+#endif
+}
+
+EnergyWorkerPool::~EnergyWorkerPool()
+{
+    Close();
+}
+
+bool EnergyWorkerPool::Available()
+{
+#ifndef _WIN32
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool EnergyWorkerPool::IsWorker(int argc, char** argv)
+{
+    return argc >= 5 && std::strcmp(argv[1], "-energyworker") == 0;
+}
+
+void EnergyWorkerPool::Open(int capacity)
+{
+#ifndef _WIN32
+    Close();
+    const std::string controller = m_controller.dump();
+    m_capacity = capacity;
+    m_size = SlotOffset(controller.size()) + m_workers * SlotBytes(capacity);
+    m_segment = "/curcuma_" + std::to_string(getpid()) + "_" + std::to_string(Segments++);
+
+    const int descriptor = shm_open(m_segment.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (descriptor < 0 || ftruncate(descriptor, m_size) != 0) {
+        std::cerr << "Shared memory segment " << m_segment << " for the energy workers could not be created" << std::endl;
+        if (descriptor >= 0) {
+            close(descriptor);
+            shm_unlink(m_segment.c_str());
+        }
+        m_memory = nullptr;
+        m_capacity = 0;
+        return;
+    }
+    void* memory = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    close(descriptor);
+    if (memory == MAP_FAILED) {
+        shm_unlink(m_segment.c_str());
+        m_memory = nullptr;
+        m_capacity = 0;
+        return;
+    }
+    m_memory = static_cast<char*>(memory);
+
+    Header* header = reinterpret_cast<Header*>(m_memory);
+    header->slots = m_workers;
+    header->capacity = capacity;
+    header->parent = getpid();
+    header->controller = controller.size();
+    header->slot = SlotBytes(capacity);
+    std::memcpy(m_memory + Align(sizeof(Header)), controller.data(), controller.size());
+    for (int i = 0; i < m_workers; ++i)
+        new (Map(m_memory, i).control) Control{};
+    /* workers check the magic number, it is written last */
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = Magic;
+
+    for (int i = 0; i < m_workers; ++i)
+        Start(i);
+#endif
+}
+
+void EnergyWorkerPool::Close()
+{
+#ifndef _WIN32
+    if (m_memory == nullptr)
+        return;
+    for (int i = 0; i < m_workers; ++i)
+        if (m_pids[i])
+            Map(m_memory, i).control->state.store(Quit, std::memory_order_release);
+    /* a worker in the middle of a calculation gets one second to come back, then it is killed */
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    for (int i = 0; i < m_workers; ++i) {
+        while (m_pids[i] && Alive(i) && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        Stop(i, true);
+    }
+    munmap(m_memory, m_size);
+    shm_unlink(m_segment.c_str());
+    m_memory = nullptr;
+    m_capacity = 0;
+#endif
+}
+
+bool EnergyWorkerPool::Start(int slot)
+{
+#ifndef _WIN32
+    Map(m_memory, slot).control->state.store(Idle, std::memory_order_release);
+    const std::string index = std::to_string(slot);
+    std::vector<char*> arguments = { const_cast<char*>(m_executable.c_str()), const_cast<char*>("-energyworker"),
+        const_cast<char*>(m_segment.c_str()), const_cast<char*>(index.c_str()), const_cast<char*>(m_method.c_str()), nullptr };
+
+    /* the calculators print their own output, it would only be interleaved with the one of the caller */
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    pid_t pid = 0;
+    const int error = posix_spawnp(&pid, m_executable.c_str(), &actions, nullptr, arguments.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (error != 0) {
+        std::cerr << "Energy worker " << m_executable << " could not be started: " << std::strerror(error) << std::endl;
+        m_pids[slot] = 0;
+        return false;
+    }
+    m_pids[slot] = pid;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void EnergyWorkerPool::Stop(int slot, bool kill)
+{
+#ifndef _WIN32
+    if (m_pids[slot] == 0)
+        return;
+    if (kill)
+        ::kill(m_pids[slot], SIGKILL);
+    waitpid(m_pids[slot], nullptr, 0);
+    m_pids[slot] = 0;
+#endif
+}
+
+bool EnergyWorkerPool::Alive(int slot)
+{
+#ifndef _WIN32
+    if (m_pids[slot] == 0)
+        return false;
+    int status = 0;
+    if (waitpid(m_pids[slot], &status, WNOHANG) == 0)
+        return true;
+    m_pids[slot] = 0;
+#endif
+    return false;
+}
+
+std::vector<double> EnergyWorkerPool::CalculateEnergies(const std::vector<Molecule>& molecules, std::vector<Matrix>* gradients)
+{
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    std::vector<double> energies(molecules.size(), 0.0);
+    if (gradients)
+        gradients->assign(molecules.size(), Matrix());
+
+    std::deque<int> queue;
+    int capacity = 0;
+    for (int i = 0; i < molecules.size(); ++i) {
+        if (molecules[i].AtomCount() == 0)
+            continue;
+        queue.push_back(i);
+        capacity = std::max(capacity, int(molecules[i].AtomCount()));
+    }
+    if (queue.empty())
+        return energies;
+    if (capacity > m_capacity)
+        Open(std::max(capacity, 2 * m_capacity));
+    if (m_memory == nullptr) {
+        for (int i : queue)
+            energies[i] = nan;
+        return energies;
+    }
+
+    std::vector<int> job(m_workers, -1), attempts(molecules.size(), 0);
+    int pending = queue.size(), crashes = 0;
+    for (int round = 0; pending > 0;) {
+        bool progress = false;
+        for (int w = 0; w < m_workers; ++w) {
+            const Slot slot = Map(m_memory, w);
+            if (job[w] >= 0 && slot.control->state.load(std::memory_order_acquire) == Done) {
+                const int i = job[w];
+                energies[i] = slot.control->nan ? nan : slot.control->energy;
+                if (gradients) {
+                    Matrix& gradient = (*gradients)[i];
+                    gradient = Matrix(molecules[i].AtomCount(), 3);
+                    for (int a = 0; a < gradient.rows(); ++a)
+                        for (int c = 0; c < 3; ++c)
+                            gradient(a, c) = slot.gradient[3 * a + c];
+                }
+                slot.control->state.store(Idle, std::memory_order_relaxed);
+                job[w] = -1;
+                --pending;
+                crashes = 0;
+                progress = true;
+            }
+            if (job[w] < 0 && !queue.empty() && m_pids[w]) {
+                const int i = queue.front();
+                queue.pop_front();
+                const Molecule& molecule = molecules[i];
+                const std::vector<int> atoms = molecule.Atoms();
+                const std::vector<std::array<double, 3>> coords = molecule.Coords();
+                slot.control->atoms = atoms.size();
+                slot.control->charge = molecule.Charge();
+                slot.control->spin = molecule.Spin();
+                slot.control->gradient = gradients != nullptr;
+                std::copy(atoms.begin(), atoms.end(), slot.types);
+                for (int a = 0; a < atoms.size(); ++a)
+                    for (int c = 0; c < 3; ++c)
+                        slot.coord[3 * a + c] = coords[a][c];
+                slot.control->state.store(Request, std::memory_order_release);
+                job[w] = i;
+                progress = true;
+            }
+        }
+        if (progress) {
+            round = 0;
+            continue;
+        }
+        /* nothing came back within the spin phase, look for workers that died meanwhile */
+        if (round >= SpinRounds) {
+            for (int w = 0; w < m_workers; ++w) {
+                if (m_pids[w] && Alive(w))
+                    continue;
+                const int i = job[w];
+                job[w] = -1;
+                if (i >= 0) {
+                    if (++attempts[i] < m_attempts)
+                        queue.push_front(i);
+                    else {
+                        std::cerr << "Structure " << i + 1 << " killed " << m_attempts << " energy workers (" << m_method << "), it gets no energy" << std::endl;
+                        energies[i] = nan;
+                        --pending;
+                    }
+                }
+                ++crashes;
+                ++m_restarts;
+                if (crashes > 2 * m_workers + m_attempts) {
+                    std::cerr << "Energy workers for " << m_method << " keep dying, giving up" << std::endl;
+                    for (int k = 0; k < m_workers; ++k)
+                        if (job[k] >= 0)
+                            energies[job[k]] = nan;
+                    for (int k : queue)
+                        energies[k] = nan;
+                    Close();
+                    return energies;
+                }
+                Start(w);
+            }
+        }
+        Relax(round++);
+    }
+    return energies;
+}
+
+int EnergyWorkerPool::Serve(int argc, char** argv)
+{
+#ifndef _WIN32
+    if (!IsWorker(argc, argv))
+        return EXIT_FAILURE;
+    const int descriptor = shm_open(argv[2], O_RDWR, 0);
+    struct stat info;
+    if (descriptor < 0 || fstat(descriptor, &info) != 0) {
+        std::cerr << "Energy worker can not open " << argv[2] << std::endl;
+        return EXIT_FAILURE;
+    }
+    void* mapped = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    close(descriptor);
+    if (mapped == MAP_FAILED)
+        return EXIT_FAILURE;
+    char* memory = static_cast<char*>(mapped);
+    const Header* header = reinterpret_cast<const Header*>(memory);
+    const int index = std::stoi(argv[3]);
+    if (header->magic != Magic || index < 0 || index >= header->slots) {
+        munmap(mapped, info.st_size);
+        return EXIT_FAILURE;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const json controller = json::parse(std::string(memory + Align(sizeof(Header)), header->controller));
+    const std::string method = argv[4];
+    const Slot slot = Map(memory, index);
+
+    /* the calculator is kept as long as atoms, charge and spin stay the same, like the threads of EnergyCalculator */
+    EnergyCalculator* calculator = nullptr;
+    std::vector<int> atoms;
+    int charge = 0, spin = 0;
+    for (int round = 0;;) {
+        const int state = slot.control->state.load(std::memory_order_acquire);
+        if (state == Quit)
+            break;
+        if (state != Request) {
+            if (round >= SpinRounds && getppid() != header->parent)
+                break;
+            Relax(round++);
+            continue;
+        }
+        round = 0;
+        const std::vector<int> types(slot.types, slot.types + slot.control->atoms);
+        if (calculator == nullptr || types != atoms || charge != slot.control->charge || spin != slot.control->spin) {
+            Molecule molecule;
+            for (int a = 0; a < types.size(); ++a)
+                molecule.addPair({ types[a], Position(slot.coord[3 * a], slot.coord[3 * a + 1], slot.coord[3 * a + 2]) });
+            molecule.setCharge(slot.control->charge);
+            molecule.setSpin(slot.control->spin);
+            delete calculator;
+            calculator = new EnergyCalculator(method, controller);
+            calculator->setMolecule(molecule);
+            atoms = types;
+            charge = slot.control->charge;
+            spin = slot.control->spin;
+        } else
+            calculator->updateGeometry(slot.coord);
+        const bool gradient = slot.control->gradient;
+        slot.control->energy = calculator->CalculateEnergy(gradient);
+        slot.control->nan = calculator->HasNan() || std::isnan(slot.control->energy);
+        if (gradient) {
+            const Matrix result = calculator->Gradient();
+            for (int a = 0; a < result.rows(); ++a)
+                for (int c = 0; c < 3; ++c)
+                    slot.gradient[3 * a + c] = result(a, c);
+        }
+        /* a Quit that came in during the calculation must not be overwritten */
+        int request = Request;
+        slot.control->state.compare_exchange_strong(request, Done, std::memory_order_release);
+    }
+    delete calculator;
+    munmap(mapped, info.st_size);
+    return EXIT_SUCCESS;
+#else
+    return EXIT_FAILURE;
+#endif
+}
@@ -0,0 +1,82 @@
+/*
+ * <Out of process single point workers for the energy calculator. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "src/core/global.h"
+#include "src/core/molecule.h"
+
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+using json = nlohmann::json;
+
+/*! \brief Long lived worker processes for EnergyCalculator::CalculateEnergies(molecules).
+ * xtb and tblite keep global state and may crash or leak, in a process of its own every
+ * calculator is isolated from the others and from the caller. Every worker owns one slot
+ * of a POSIX shared memory segment, the slot holds a small control word, the atoms,
+ * coordinates, energy and gradient of one structure. The caller posts a structure by
+ * setting the control word to Request, the worker answers with Done, neither side makes
+ * a system call as long as the other one answers within a few microseconds.
+ * Workers are started as "executable -energyworker segment slot method", the executable
+ * has to hand these arguments to Serve. A worker that dies is restarted and the structure
+ * it was working on is posted again, a structure that kills its workers twice gets a nan energy. */
+class EnergyWorkerPool {
+public:
+    EnergyWorkerPool(const std::string& method, const json& controller, int workers);
+    ~EnergyWorkerPool();
+
+    EnergyWorkerPool(const EnergyWorkerPool&) = delete;
+    EnergyWorkerPool& operator=(const EnergyWorkerPool&) = delete;
+
+    /*! \brief Energies in the order of molecules, gradients (atoms x 3, as EnergyCalculator::Gradient) if requested */
+    std::vector<double> CalculateEnergies(const std::vector<Molecule>& molecules, std::vector<Matrix>* gradients = nullptr);
+
+    inline int Workers() const { return m_workers; }
+
+    /*! \brief Number of workers that were restarted after they died */
+    inline int Restarts() const { return m_restarts; }
+
+    /*! \brief Process ids of the running workers, 0 for a slot without worker */
+    std::vector<int> Pids() const { return m_pids; }
+
+    /*! \brief False where there is no POSIX shared memory (Windows) */
+    static bool Available();
+
+    /*! \brief True if argv asks this process to serve as worker */
+    static bool IsWorker(int argc, char** argv);
+
+    /*! \brief Main loop of a worker process, returns once the pool is closed or the parent is gone */
+    static int Serve(int argc, char** argv);
+
+private:
+    void Open(int capacity);
+    void Close();
+    bool Start(int slot);
+    void Stop(int slot, bool kill);
+    bool Alive(int slot);
+
+    std::string m_method, m_executable, m_segment;
+    json m_controller;
+    int m_workers = 0, m_capacity = 0, m_restarts = 0, m_attempts = 2;
+    std::size_t m_size = 0;
+    char* m_memory = nullptr;
+    std::vector<int> m_pids;
+};
@@ -20,40 +20,111 @@
 #pragma once
 
 #include "src/core/global.h"
-#include "src/tools/general.h"
+
+#include <cmath>
 
 #include <Eigen/Dense>
 
-inline double BondStretching(const Vector& i, const Vector& j, Matrix& derivate, bool gradient)
+/* All derivates are fixed size and live on the stack, one row per atom in the
+ * order the atoms are passed. They are the scalar counterparts of the term
+ * kernels in uff_kernels.cpp. */
+
+typedef Eigen::Matrix<double, 2, 3> BondDerivate;
+typedef Eigen::Matrix<double, 3, 3> AngleDerivate;
+typedef Eigen::Matrix<double, 4, 3> TorsionDerivate;
+
+/*! \brief Distance between i and j, derivate of the distance */
+inline double BondStretching(const Eigen::Vector3d& i, const Eigen::Vector3d& j, BondDerivate& derivate, bool gradient)
 {
-    Vector ij = i - j;
-    double distance = (ij).norm();
+    const Eigen::Vector3d ij = i - j;
+    const double distance = ij.norm();
     if (!gradient)
         return distance;
-    derivate = Matrix::Zero(2, 3);
     derivate.row(0) = ij / distance;
-    derivate.row(1) = -ij / distance;
+    derivate.row(1) = -derivate.row(0);
     return distance;
 }
 
-inline double AngleBending(const Vector& i, const Vector& j, const Vector& k, Matrix& derivate, bool gradient)
+/*! \brief Cosine of the angle i-j-k, derivate of the cosine */
+inline double AngleBending(const Eigen::Vector3d& i, const Eigen::Vector3d& j, const Eigen::Vector3d& k, AngleDerivate& derivate, bool gradient)
 {
-    Eigen::Vector3d rij = i - j;
-    auto nij = rij / rij.norm();
-    Eigen::Vector3d rkj = k - j;
-    auto nkj = rkj / rkj.norm();
-    double costheta = (rij.dot(rkj) / (sqrt(rij.dot(rij) * rkj.dot(rkj))));
+    const Eigen::Vector3d rij = i - j;
+    const Eigen::Vector3d rkj = k - j;
+    const double lij = rij.norm();
+    const double lkj = rkj.norm();
+    const Eigen::Vector3d nij = rij / lij;
+    const Eigen::Vector3d nkj = rkj / lkj;
+    const double costheta = nij.dot(nkj);
 
     if (!gradient)
         return costheta;
-    derivate = Matrix::Zero(3, 3);
 
-    double sintheta = sin(acos(costheta));
-    double dThetadCosTheta = 1 / sintheta;
-    derivate = Matrix::Zero(3, 3);
-    derivate.row(0) = -dThetadCosTheta * (nkj - nij * costheta) / (rij.norm());
-    derivate.row(2) = -dThetadCosTheta * (nij - nkj * costheta) / (rkj.norm());
+    derivate.row(0) = (nkj - nij * costheta) / lij;
+    derivate.row(2) = (nij - nkj * costheta) / lkj;
     derivate.row(1) = -derivate.row(0) - derivate.row(2);
 
     return costheta;
 }
+
+/*! \brief Cosine of the torsion i-j-k-l, derivate of the cosine
+ * The normals are n1 = (j - i) x (j - k) and n2 = (k - j) x (k - l), a linear
+ * arrangement returns 1 and a zero derivate. */
+inline double Torsion(const Eigen::Vector3d& i, const Eigen::Vector3d& j, const Eigen::Vector3d& k, const Eigen::Vector3d& l, TorsionDerivate& derivate, bool gradient)
+{
+    const Eigen::Vector3d A = j - i;
+    const Eigen::Vector3d B = j - k;
+    const Eigen::Vector3d C = k - j;
+    const Eigen::Vector3d D = k - l;
+    const Eigen::Vector3d n1 = A.cross(B);
+    const Eigen::Vector3d n2 = C.cross(D);
+    const double l1 = n1.norm();
+    const double l2 = n2.norm();
+    if (l1 < 1e-10 || l2 < 1e-10) {
+        if (gradient)
+            derivate.setZero();
+        return 1;
+    }
+    const double cosphi = std::min(1.0, std::max(-1.0, n1.dot(n2) / (l1 * l2)));
+    if (!gradient)
+        return cosphi;
+
+    const Eigen::Vector3d g1 = (n2 / l2 - cosphi * n1 / l1) / l1;
+    const Eigen::Vector3d g2 = (n1 / l1 - cosphi * n2 / l2) / l2;
+    const Eigen::Vector3d bg = B.cross(g1);
+    const Eigen::Vector3d ga = g1.cross(A);
+    const Eigen::Vector3d dg = D.cross(g2);
+    const Eigen::Vector3d gc = g2.cross(C);
+
+    derivate.row(0) = -bg;
+    derivate.row(1) = bg + ga - dg;
+    derivate.row(2) = dg + gc - ga;
+    derivate.row(3) = -derivate.row(0) - derivate.row(1) - derivate.row(2);
+    return cosphi;
+}
+
+/*! \brief Cosine of the angle between the normal of the i-j-k plane and the i-l bond, i is the central atom,
+ * derivate of the cosine */
+inline double OutOfPlane(const Eigen::Vector3d& i, const Eigen::Vector3d& j, const Eigen::Vector3d& k, const Eigen::Vector3d& l, TorsionDerivate& derivate, bool gradient)
+{
+    const Eigen::Vector3d a = j - i;
+    const Eigen::Vector3d b = k - i;
+    const Eigen::Vector3d c = l - i;
+    const Eigen::Vector3d m = a.cross(b);
+    const double lm = m.norm();
+    const double lc = c.norm();
+    if (lm < 1e-10 || lc < 1e-10) {
+        if (gradient)
+            derivate.setZero();
+        return 0;
+    }
+    const double cosY = m.dot(c) / (lm * lc);
+    if (!gradient)
+        return cosY;
+
+    const Eigen::Vector3d gm = c / (lm * lc) - cosY * m / (lm * lm);
+    derivate.row(1) = b.cross(gm);
+    derivate.row(2) = gm.cross(a);
+    derivate.row(3) = m / (lm * lc) - cosY * c / (lc * lc);
+    derivate.row(0) = -derivate.row(1) - derivate.row(2) - derivate.row(3);
+    return cosY;
+}
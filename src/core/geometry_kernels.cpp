@@ -0,0 +1,81 @@
+/*
+ * <Vectorised distance matrix and superposition kernels. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cmath>
+#include <cstddef>
+
+#include "geometry_kernels.h"
+#include "isa.h"
+
+namespace GeometryKernels {
+
+namespace Generic {
+#include "geometry_kernels_impl.h"
+}
+
+#ifdef ISA_DISPATCH
+ISA_TARGET_AVX2
+namespace AVX2 {
+#include "geometry_kernels_impl.h"
+}
+ISA_TARGET_END
+
+ISA_TARGET_AVX512
+namespace AVX512 {
+#include "geometry_kernels_impl.h"
+}
+ISA_TARGET_END
+#endif
+
+void LowerDistances(const double* x, const double* y, const double* z, int atoms, float* distances)
+{
+    ISA_CALL(LowerDistances(x, y, z, atoms, distances))
+}
+
+void DistanceMatrix(const double* x, const double* y, const double* z, const double* radius, double scaling, int atoms, double* distance, double* topo)
+{
+    ISA_CALL(DistanceMatrix(x, y, z, radius, scaling, atoms, distance, topo))
+}
+
+namespace {
+void CovarianceKernel(const double* reference, const double* target, int rows, double* covariance)
+{
+    ISA_CALL(Covariance(reference, target, rows, covariance))
+}
+
+void RotateKernel(const double* geometry, int rows, const double* rotation, double* result)
+{
+    ISA_CALL(Rotate(geometry, rows, rotation, result))
+}
+}
+
+Eigen::Matrix3d Covariance(const Geometry& reference, const Geometry& target)
+{
+    Eigen::Matrix3d covariance;
+    CovarianceKernel(reference.data(), target.data(), reference.rows(), covariance.data());
+    return covariance;
+}
+
+Geometry Rotate(const Geometry& geometry, const Eigen::Matrix3d& rotation)
+{
+    Geometry result(geometry.rows(), 3);
+    RotateKernel(geometry.data(), geometry.rows(), rotation.data(), result.data());
+    return result;
+}
+}
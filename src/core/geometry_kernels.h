@@ -0,0 +1,45 @@
+/*
+ * <Vectorised distance matrix and superposition kernels. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "src/core/global.h"
+
+#include <Eigen/Dense>
+
+/* Kernels behind Molecule::DistanceMatrix, Molecule::LowerDistanceVector and the
+ * Kabsch superposition of the RMSD. Coordinates are passed as separate x, y and z
+ * columns, an N x 3 column major Geometry has exactly this layout. The kernels are
+ * compiled for every instruction set level of isa.h and dispatched at runtime. */
+
+namespace GeometryKernels {
+
+/*! \brief Distances of all pairs j < i in the order (1,0), (2,0), (2,1), (3,0) ..., atoms * (atoms - 1) / 2 values */
+void LowerDistances(const double* x, const double* y, const double* z, int atoms, float* distances);
+
+/*! \brief Symmetric atoms x atoms (column major) distance matrix and bond topology, topo is 1 for
+ * pairs closer than scaling times the sum of the radii and 0 on the diagonal */
+void DistanceMatrix(const double* x, const double* y, const double* z, const double* radius, double scaling, int atoms, double* distance, double* topo);
+
+/*! \brief Covariance reference^T * target of two centered N x 3 geometries */
+Eigen::Matrix3d Covariance(const Geometry& reference, const Geometry& target);
+
+/*! \brief geometry * rotation for an N x 3 geometry */
+Geometry Rotate(const Geometry& geometry, const Eigen::Matrix3d& rotation);
+}
@@ -0,0 +1,90 @@
+/*
+ * <Vectorised distance matrix and superposition kernels, compiled once per instruction set. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* No include guard, geometry_kernels.cpp includes this file once for every instruction set level,
+ * each time inside its own namespace. The kernels only see plain arrays. */
+
+void LowerDistances(const double* x, const double* y, const double* z, int atoms, float* distances)
+{
+    for (int i = 1; i < atoms; ++i) {
+        const double xi = x[i], yi = y[i], zi = z[i];
+        float* row = distances + std::size_t(i) * (i - 1) / 2;
+#pragma omp simd
+        for (int j = 0; j < i; ++j) {
+            const double dx = xi - x[j];
+            const double dy = yi - y[j];
+            const double dz = zi - z[j];
+            row[j] = float(std::sqrt(dx * dx + dy * dy + dz * dz));
+        }
+    }
+}
+
+void DistanceMatrix(const double* x, const double* y, const double* z, const double* radius, double scaling, int atoms, double* distance, double* topo)
+{
+    for (int j = 0; j < atoms; ++j) {
+        const double xj = x[j], yj = y[j], zj = z[j], rj = radius[j];
+        double* column = distance + std::size_t(j) * atoms;
+        double* bonds = topo + std::size_t(j) * atoms;
+#pragma omp simd
+        for (int i = 0; i < atoms; ++i) {
+            const double dx = x[i] - xj;
+            const double dy = y[i] - yj;
+            const double dz = z[i] - zj;
+            const double d = std::sqrt(dx * dx + dy * dy + dz * dz);
+            column[i] = d;
+            bonds[i] = (i != j && d <= (radius[i] + rj) * scaling) ? 1.0 : 0.0;
+        }
+    }
+}
+
+/* covariance is the 3 x 3 column major result */
+void Covariance(const double* reference, const double* target, int rows, double* covariance)
+{
+    const double *rx = reference, *ry = rx + rows, *rz = ry + rows;
+    const double *tx = target, *ty = tx + rows, *tz = ty + rows;
+    double xx = 0, xy = 0, xz = 0, yx = 0, yy = 0, yz = 0, zx = 0, zy = 0, zz = 0;
+#pragma omp simd reduction(+ : xx, xy, xz, yx, yy, yz, zx, zy, zz)
+    for (int k = 0; k < rows; ++k) {
+        xx += rx[k] * tx[k];
+        xy += rx[k] * ty[k];
+        xz += rx[k] * tz[k];
+        yx += ry[k] * tx[k];
+        yy += ry[k] * ty[k];
+        yz += ry[k] * tz[k];
+        zx += rz[k] * tx[k];
+        zy += rz[k] * ty[k];
+        zz += rz[k] * tz[k];
+    }
+    const double result[9] = { xx, yx, zx, xy, yy, zy, xz, yz, zz };
+    for (int i = 0; i < 9; ++i)
+        covariance[i] = result[i];
+}
+
+/* rotation is 3 x 3 column major, geometry and result are rows x 3 column major */
+void Rotate(const double* geometry, int rows, const double* rotation, double* result)
+{
+    const double *x = geometry, *y = x + rows, *z = y + rows;
+    for (int c = 0; c < 3; ++c) {
+        const double r0 = rotation[3 * c], r1 = rotation[3 * c + 1], r2 = rotation[3 * c + 2];
+        double* column = result + std::size_t(c) * rows;
+#pragma omp simd
+        for (int k = 0; k < rows; ++k)
+            column[k] = x[k] * r0 + y[k] * r1 + z[k] * r2;
+    }
+}
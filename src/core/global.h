@@ -47,6 +47,12 @@ typedef Eigen::VectorXd Vector;
 typedef std::pair<int, int> IntPair;
 typedef std::vector<std::string> StringList;
 
+/* terms a calculator evaluates, multiple time step integrators take the fast (bonded) forces
+ * every step and the slow (nonbonded and dispersion) forces less often */
+enum ForceGroup { AllForces = 0,
+    FastForces = 1,
+    SlowForces = 2 };
+
 inline Vector PositionPair2Vector(const std::pair<Position, Position>& pair)
 {
     Vector vector = Vector::Zero(6);
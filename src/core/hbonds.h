@@ -37,6 +37,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "src/core/celllist.h"
+
 namespace hbonds4 {
 
 //==============================================================================
@@ -134,16 +141,10 @@ public:
     {
     }
 
-    ~H4Correction()
-    {
-        delete grd_h4;
-        delete grd_hh;
-    }
-
     void allocate(int atoms)
     {
-        gradient_allocate(atoms, &grd_h4);
-        gradient_allocate(atoms, &grd_hh);
+        grd_h4.assign(atoms, coord_t{ 0.0, 0.0, 0.0 });
+        grd_hh.assign(atoms, coord_t{ 0.0, 0.0, 0.0 });
     };
     inline void set_OH_O(double param) { para_oh_o = param; }
     inline void set_OH_N(double param) { para_oh_n = param; }
@@ -348,7 +349,7 @@ public:
     //------------------------------------------------------------------------------
     // Coordinate vector addition to array of coordinates
     // Used to construct the total gradient from atomic contributions
-    inline void coord_add(coord_t* coord, int i, coord_t add)
+    inline void coord_add(std::vector<coord_t>& coord, int i, coord_t add)
     {
         coord[i].x += add.x;
         coord[i].y += add.y;
@@ -416,363 +417,367 @@ public:
         double rdhs, ravgs;
         double sign;
 
-        // Iterate over donor/acceptor pairs
-        for (i = 0; i < natom; i++) {
-            if (geo[i].e == NITROGEN || geo[i].e == OXYGEN) {
-                for (j = 0; j < i; j++) {
-                    if (geo[j].e == NITROGEN || geo[j].e == OXYGEN) {
-                        // Calculate donor-acceptor distance
-                        rda = distance(geo[i], geo[j]);
-                        // Continue only when in range where correction acts
-                        if (rda > HB_R_0 && rda < HB_R_CUTOFF) {
-                            // Iterate over hydrogens
-                            for (h_i = 0; h_i < natom; h_i++) {
-                                if (geo[h_i].e == HYDROGEN) {
-                                    // Distances to hydrogen
-                                    rih = distance(geo[i], geo[h_i]);
-                                    rjh = distance(geo[j], geo[h_i]);
-
-                                    angle = M_PI - atomangle(geo[i], geo[h_i], geo[j]);
-                                    // if (rih*rih + rjh*rjh < rda*rda) {
-                                    if (angle < M_PI / 2) {
-                                        // Here, we have filterd out everything but corrected H-bonds
-                                        // Determine donor and acceptor - donor is the closer one
-                                        if (rih <= rjh) {
-                                            d_i = i;
-                                            a_i = j;
-                                            rdh = rih;
-                                            rah = rjh;
-                                        } else {
-                                            d_i = j;
-                                            a_i = i;
-                                            rdh = rjh;
-                                            rah = rih;
-                                        }
-
-                                        // Radial term
-                                        e_radial = -0.00303407407407313510 * pow(rda, 7) + 0.07357629629627092382 * pow(rda, 6) + -0.70087111111082800452 * pow(rda, 5) + 3.25309629629461749545 * pow(rda, 4) + -7.20687407406838786983 * pow(rda, 3) + 5.31754666665572184314 * pow(rda, 2) + 3.40736000001102778967 * rda + -4.68512000000450434811;
-
-                                        // Radial [grad]ient
-                                        if (do_grad) {
-                                            // In rDA coordinate
-                                            d_radial = -0.02123851851851194655 * pow(rda, 6) + 0.44145777777762551519 * pow(rda, 5) + -3.50435555555413991158 * pow(rda, 4) + 13.01238518517846998179 * pow(rda, 3) + -21.62062222220516360949 * pow(rda, 2) + 10.63509333331144368628 * rda + 3.40736000001102778967;
-
-                                            // Cartesian gradients on D and A atoms
-                                            d_radial_d.x = (geo[d_i].x - geo[a_i].x) / rda * d_radial;
-                                            d_radial_d.y = (geo[d_i].y - geo[a_i].y) / rda * d_radial;
-                                            d_radial_d.z = (geo[d_i].z - geo[a_i].z) / rda * d_radial;
-
-                                            d_radial_a.x = -d_radial_d.x;
-                                            d_radial_a.y = -d_radial_d.y;
-                                            d_radial_a.z = -d_radial_d.z;
-                                        }
-
-                                        // Angular term
-                                        a = angle / (M_PI / 2.0);
-                                        x = -20.0 * pow(a, 7) + 70.0 * pow(a, 6) - 84.0 * pow(a, 5) + 35.0 * pow(a, 4);
-                                        e_angular = 1.0 - x * x;
-
-                                        // Angular gradient
-                                        if (do_grad) {
-                                            xd = (-140.0 * pow(a, 6) + 420.0 * pow(a, 5) - 420.0 * pow(a, 4) + 140.0 * pow(a, 3)) / (M_PI / 2.0);
-                                            d_angular = -xd * 2.0 * x;
-
-                                            // Dot product of bond vectors
-                                            d = (geo[d_i].x - geo[h_i].x) * (geo[a_i].x - geo[h_i].x) + (geo[d_i].y - geo[h_i].y) * (geo[a_i].y - geo[h_i].y) + (geo[d_i].z - geo[h_i].z) * (geo[a_i].z - geo[h_i].z);
-
-                                            x = -d_angular / sqrt(1.0 - (d * d) / (rdh * rdh) / (rah * rah));
-
-                                            // Donor atom
-                                            d_angular_d.x = x * -((geo[a_i].x - geo[h_i].x) / rdh / rah - (geo[d_i].x - geo[h_i].x) * d / pow(rdh, 3) / rah);
-                                            d_angular_d.y = x * -((geo[a_i].y - geo[h_i].y) / rdh / rah - (geo[d_i].y - geo[h_i].y) * d / pow(rdh, 3) / rah);
-                                            d_angular_d.z = x * -((geo[a_i].z - geo[h_i].z) / rdh / rah - (geo[d_i].z - geo[h_i].z) * d / pow(rdh, 3) / rah);
-                                            // Acceptor atom
-                                            d_angular_a.x = x * -((geo[d_i].x - geo[h_i].x) / rdh / rah - (geo[a_i].x - geo[h_i].x) * d / rdh / pow(rah, 3));
-                                            d_angular_a.y = x * -((geo[d_i].y - geo[h_i].y) / rdh / rah - (geo[a_i].y - geo[h_i].y) * d / rdh / pow(rah, 3));
-                                            d_angular_a.z = x * -((geo[d_i].z - geo[h_i].z) / rdh / rah - (geo[a_i].z - geo[h_i].z) * d / rdh / pow(rah, 3));
-                                            // Hydrogen
-                                            d_angular_h.x = -d_angular_d.x - d_angular_a.x;
-                                            d_angular_h.y = -d_angular_d.y - d_angular_a.y;
-                                            d_angular_h.z = -d_angular_d.z - d_angular_a.z;
-                                        }
-
-                                        // Energy coefficient
-                                        if (geo[d_i].e == OXYGEN && geo[a_i].e == OXYGEN)
-                                            e_para = para_oh_o;
-                                        if (geo[d_i].e == OXYGEN && geo[a_i].e == NITROGEN)
-                                            e_para = para_oh_n;
-                                        if (geo[d_i].e == NITROGEN && geo[a_i].e == OXYGEN)
-                                            e_para = para_nh_o;
-                                        if (geo[d_i].e == NITROGEN && geo[a_i].e == NITROGEN)
-                                            e_para = para_nh_n;
-
-                                        // Bond switching
-                                        if (rdh > 1.15) {
-                                            rdhs = rdh - 1.15;
-                                            ravgs = 0.5 * rdh + 0.5 * rah - 1.15;
-                                            x = rdhs / ravgs;
-                                            e_bond_switch = 1.0 - (-20.0 * pow(x, 7) + 70.0 * pow(x, 6) - 84.0 * pow(x, 5) + 35.0 * pow(x, 4));
-
-                                            // Gradient
-                                            if (do_grad) {
-                                                d_bs = -(-140.0 * pow(x, 6) + 420.0 * pow(x, 5) - 420.0 * pow(x, 4) + 140.0 * pow(x, 3));
-
-                                                xd = d_bs / ravgs;
-                                                xd2 = 0.5 * d_bs * -x / ravgs;
-
-                                                d_bs_d.x = (geo[d_i].x - geo[h_i].x) / rdh * xd + (geo[d_i].x - geo[h_i].x) / rdh * xd2;
-                                                d_bs_d.y = (geo[d_i].y - geo[h_i].y) / rdh * xd + (geo[d_i].y - geo[h_i].y) / rdh * xd2;
-                                                d_bs_d.z = (geo[d_i].z - geo[h_i].z) / rdh * xd + (geo[d_i].z - geo[h_i].z) / rdh * xd2;
-
-                                                d_bs_a.x = (geo[a_i].x - geo[h_i].x) / rah * xd2;
-                                                d_bs_a.y = (geo[a_i].y - geo[h_i].y) / rah * xd2;
-                                                d_bs_a.z = (geo[a_i].z - geo[h_i].z) / rah * xd2;
-
-                                                d_bs_h.x = -d_bs_d.x + -d_bs_a.x;
-                                                d_bs_h.y = -d_bs_d.y + -d_bs_a.y;
-                                                d_bs_h.z = -d_bs_d.z + -d_bs_a.z;
-                                            }
-                                        } else {
-                                            // No switching, no gradient
-                                            e_bond_switch = 1.0;
-                                            if (do_grad) {
-                                                d_bs_d.x = 0.0;
-                                                d_bs_d.y = 0.0;
-                                                d_bs_d.z = 0.0;
-                                                d_bs_a.x = 0.0;
-                                                d_bs_a.y = 0.0;
-                                                d_bs_a.z = 0.0;
-                                                d_bs_h.x = 0.0;
-                                                d_bs_h.y = 0.0;
-                                                d_bs_h.z = 0.0;
-                                            }
-                                        }
-
-                                        // Water scaling
-                                        e_scale_w = 1.0;
-                                        if (geo[d_i].e == OXYGEN && geo[a_i].e == OXYGEN) {
-                                            // Count hydrogens and other atoms in vicinity
-                                            double hydrogens = 0.0;
-                                            double others = 0.0;
-                                            for (k = 0; k < natom; k++) {
-                                                if (geo[k].e == HYDROGEN) {
-                                                    hydrogens += cvalence_contribution(geo[d_i], geo[k]);
-                                                } else {
-                                                    others += cvalence_contribution(geo[d_i], geo[k]);
-                                                }
-                                            }
-
-                                            // If it is water
-                                            if (hydrogens >= 1.0) {
-                                                sign_wat = 1.0;
-                                                slope = multiplier_wh_o - 1.0;
-                                                v = hydrogens;
-                                                fv = 0.0;
-                                                if (v > 1.0 && v <= 2.0) {
-                                                    fv = v - 1.0;
-                                                    sign_wat = 1.0;
-                                                }
-                                                if (v > 2.0 && v < 3.0) {
-                                                    fv = 3.0 - v;
-                                                    sign_wat = -1.0;
-                                                }
-                                                fv2 = 1.0 - others;
-                                                if (fv2 < 0.0)
-                                                    fv2 = 0.0;
-
-                                                e_scale_w = 1.0 + slope * fv * fv2;
-                                            }
-                                        }
-
-                                        // Charged groups
-                                        e_scale_chd = 1.0;
-                                        e_scale_cha = 1.0;
-
-                                        // Scaled groups: NR4+
-                                        if (1 && geo[d_i].e == NITROGEN) {
-                                            slope = multiplier_nh4 - 1.0;
-                                            v = 0.0;
-                                            for (k = 0; k < natom; k++)
-                                                v += cvalence_contribution(geo[d_i], geo[k]);
-                                            if (v > 3.0)
-                                                v = v - 3.0;
-                                            else
-                                                v = 0.0;
-                                            e_scale_chd = 1.0 + slope * v;
-                                        }
-
-                                        // Scaled groups: COO-
-                                        f_o1 = 0.0;
-                                        f_o2 = 0.0;
-                                        f_cc = 0.0;
-
-                                        o1 = a_i;
-                                        o2 = -1;
-                                        cc = -1;
-                                        if (geo[a_i].e == OXYGEN) {
-                                            slope = multiplier_coo - 1.0;
-
-                                            // Search for closest C atom
-                                            double cdist = 9.9e9;
-                                            cv_o1 = 0.0;
-                                            for (k = 0; k < natom; k++) {
-                                                v = cvalence_contribution(geo[o1], geo[k]);
-                                                cv_o1 += v; // Sum O1 valence
-                                                if (v > 0.0 && geo[k].e == CARBON && distance(geo[o1], geo[k]) < cdist) {
-                                                    cdist = distance(geo[o1], geo[k]);
-                                                    cc = k;
-                                                }
-                                            }
-
-                                            // If C found, look for the second O
-                                            if (cc != -1) {
-                                                double odist = 9.9e9;
-                                                cv_cc = 0.0;
-                                                for (k = 0; k < natom; k++) {
-                                                    v = cvalence_contribution(geo[cc], geo[k]);
-                                                    cv_cc += v;
-                                                    if (v > 0.0 && k != o1 && geo[k].e == OXYGEN && distance(geo[cc], geo[k]) < odist) {
-                                                        odist = distance(geo[cc], geo[k]);
-                                                        o2 = k;
-                                                    }
-                                                }
-                                            }
-
-                                            // O1-C-O2 triad:
-                                            if (o2 != -1) {
-                                                // Get O2 valence
-                                                cv_o2 = 0.0;
-                                                for (k = 0; k < natom; k++)
-                                                    cv_o2 += cvalence_contribution(geo[o2], geo[k]);
-
-                                                f_o1 = 1.0 - fabs(1.0 - cv_o1);
-                                                if (f_o1 < 0.0)
-                                                    f_o1 = 0.0;
-
-                                                f_o2 = 1.0 - fabs(1.0 - cv_o2);
-                                                if (f_o2 < 0.0)
-                                                    f_o2 = 0.0;
-
-                                                f_cc = 1.0 - fabs(3.0 - cv_cc);
-                                                if (f_cc < 0.0)
-                                                    f_cc = 0.0;
-
-                                                e_scale_cha = 1.0 + slope * f_o1 * f_o2 * f_cc;
-                                            }
-                                        }
-
-                                        // Final energy
-                                        e_corr = e_para * e_radial * e_angular * e_bond_switch * e_scale_w * e_scale_chd * e_scale_cha;
-                                        e_corr_sum += e_corr;
-
-                                        // Total gradient
-                                        // radial
-                                        coord_add(grd_h4, d_i, coord_scale(d_radial_d, e_para * e_angular * e_bond_switch * e_scale_w * e_scale_chd * e_scale_cha));
-                                        coord_add(grd_h4, a_i, coord_scale(d_radial_a, e_para * e_angular * e_bond_switch * e_scale_w * e_scale_chd * e_scale_cha));
-                                        // angular
-                                        coord_add(grd_h4, d_i, coord_scale(d_angular_d, e_para * e_radial * e_bond_switch * e_scale_w * e_scale_chd * e_scale_cha));
-                                        coord_add(grd_h4, a_i, coord_scale(d_angular_a, e_para * e_radial * e_bond_switch * e_scale_w * e_scale_chd * e_scale_cha));
-                                        coord_add(grd_h4, h_i, coord_scale(d_angular_h, e_para * e_radial * e_bond_switch * e_scale_w * e_scale_chd * e_scale_cha));
-                                        // bond_switch
-                                        coord_add(grd_h4, d_i, coord_scale(d_bs_d, e_para * e_radial * e_angular * e_scale_w * e_scale_chd * e_scale_cha));
-                                        coord_add(grd_h4, a_i, coord_scale(d_bs_a, e_para * e_radial * e_angular * e_scale_w * e_scale_chd * e_scale_cha));
-                                        coord_add(grd_h4, h_i, coord_scale(d_bs_h, e_para * e_radial * e_angular * e_scale_w * e_scale_chd * e_scale_cha));
-                                        // water scaling
-                                        if (do_grad && e_scale_w != 1.0) {
-                                            slope = multiplier_wh_o - 1.0;
-                                            for (k = 0; k < natom; k++) {
-                                                if (k != d_i) {
-                                                    x = distance(geo[d_i], geo[k]);
-                                                    if (geo[k].e == HYDROGEN) {
-                                                        xd = cvalence_contribution_d(geo[d_i], geo[k]) * sign_wat;
-                                                        g.x = (geo[d_i].x - geo[k].x) * -xd / x * slope;
-                                                        g.y = (geo[d_i].y - geo[k].y) * -xd / x * slope;
-                                                        g.z = (geo[d_i].z - geo[k].z) * -xd / x * slope;
-                                                        coord_add(grd_h4, d_i, coord_scale(g, -e_para * e_radial * e_angular * e_bond_switch * e_scale_chd * e_scale_cha));
-                                                        coord_add(grd_h4, k, coord_scale(g, e_para * e_radial * e_angular * e_bond_switch * e_scale_chd * e_scale_cha));
-                                                    } else {
-                                                        xd = cvalence_contribution_d(geo[d_i], geo[k]);
-                                                        g.x = (geo[d_i].x - geo[k].x) * xd / x * slope;
-                                                        g.y = (geo[d_i].y - geo[k].y) * xd / x * slope;
-                                                        g.z = (geo[d_i].z - geo[k].z) * xd / x * slope;
-                                                        coord_add(grd_h4, d_i, coord_scale(g, -e_para * e_radial * e_angular * e_bond_switch * e_scale_chd * e_scale_cha));
-                                                        coord_add(grd_h4, k, coord_scale(g, e_para * e_radial * e_angular * e_bond_switch * e_scale_chd * e_scale_cha));
-                                                    }
-                                                }
-                                            }
-                                        }
-                                        // scaled groups: NR4+
-                                        if (do_grad && e_scale_chd != 1.0) {
-                                            slope = multiplier_nh4 - 1.0;
-                                            for (k = 0; k < natom; k++) {
-                                                if (k != d_i) {
-                                                    x = distance(geo[d_i], geo[k]);
-                                                    xd = cvalence_contribution_d(geo[d_i], geo[k]);
-                                                    g.x = (geo[d_i].x - geo[k].x) * -xd / x * slope;
-                                                    g.y = (geo[d_i].y - geo[k].y) * -xd / x * slope;
-                                                    g.z = (geo[d_i].z - geo[k].z) * -xd / x * slope;
-                                                    coord_add(grd_h4, d_i, coord_scale(g, -e_para * e_radial * e_angular * e_bond_switch * e_scale_cha * e_scale_w));
-                                                    coord_add(grd_h4, k, coord_scale(g, e_para * e_radial * e_angular * e_bond_switch * e_scale_cha * e_scale_w));
-                                                }
-                                            }
-                                        }
-                                        // scaled groups: COO-
-                                        if (do_grad && f_o1 * f_o2 * f_cc != 0.0) {
-                                            slope = multiplier_coo - 1.0;
-                                            // Atoms around O1
-                                            for (k = 0; k < natom; k++) {
-                                                if (k != o1) {
-                                                    xd = cvalence_contribution_d(geo[o1], geo[k]);
-                                                    if (xd != 0.0) {
-                                                        x = distance(geo[o1], geo[k]);
-                                                        if (cv_o1 > 1.0)
-                                                            xd *= -1.0;
-                                                        xd *= f_o2 * f_cc;
-                                                        g.x = (geo[o1].x - geo[k].x) * -xd / x * slope;
-                                                        g.y = (geo[o1].y - geo[k].y) * -xd / x * slope;
-                                                        g.z = (geo[o1].z - geo[k].z) * -xd / x * slope;
-                                                        coord_add(grd_h4, o1, coord_scale(g, -e_para * e_radial * e_angular * e_bond_switch * e_scale_chd * e_scale_w));
-                                                        coord_add(grd_h4, k, coord_scale(g, e_para * e_radial * e_angular * e_bond_switch * e_scale_chd * e_scale_w));
-                                                    }
-                                                }
-                                            }
-                                            slope = multiplier_coo - 1.0;
-                                            // Atoms around O2
-                                            for (k = 0; k < natom; k++) {
-                                                if (k != o2) {
-                                                    xd = cvalence_contribution_d(geo[o2], geo[k]);
-                                                    if (xd != 0.0) {
-                                                        x = distance(geo[o2], geo[k]);
-                                                        if (cv_o2 > 1.0)
-                                                            xd *= -1.0;
-                                                        xd *= f_o1 * f_cc;
-                                                        g.x = (geo[o2].x - geo[k].x) * -xd / x * slope;
-                                                        g.y = (geo[o2].y - geo[k].y) * -xd / x * slope;
-                                                        g.z = (geo[o2].z - geo[k].z) * -xd / x * slope;
-                                                        coord_add(grd_h4, o2, coord_scale(g, -e_para * e_radial * e_angular * e_bond_switch * e_scale_chd * e_scale_w));
-                                                        coord_add(grd_h4, k, coord_scale(g, e_para * e_radial * e_angular * e_bond_switch * e_scale_chd * e_scale_w));
-                                                    }
-                                                }
-                                            }
-                                            slope = multiplier_coo - 1.0;
-                                            for (k = 0; k < natom; k++) {
-                                                if (k != cc) {
-                                                    xd = cvalence_contribution_d(geo[cc], geo[k]);
-                                                    if (xd != 0.0) {
-                                                        x = distance(geo[cc], geo[k]);
-                                                        if (cv_cc > 3.0)
-                                                            xd *= -1.0;
-                                                        xd *= f_o1 * f_o2;
-                                                        g.x = (geo[cc].x - geo[k].x) * -xd / x * slope;
-                                                        g.y = (geo[cc].y - geo[k].y) * -xd / x * slope;
-                                                        g.z = (geo[cc].z - geo[k].z) * -xd / x * slope;
-                                                        coord_add(grd_h4, cc, coord_scale(g, -e_para * e_radial * e_angular * e_bond_switch * e_scale_chd * e_scale_w));
-                                                        coord_add(grd_h4, k, coord_scale(g, e_para * e_radial * e_angular * e_bond_switch * e_scale_chd * e_scale_w));
-                                                    }
-                                                }
-                                            }
-                                        }
-                                    }
+        // Iterate over donor/acceptor pairs within HB_R_CUTOFF and the hydrogens around them, hydrogens
+        // further away than the donor/acceptor distance can not form an angle below 90 degree
+        update_h4_lists(natom, geo);
+        for (int pair = 0; pair < int(m_da_pairs.size()); pair++) {
+            i = m_da_pairs[pair].first;
+            j = m_da_pairs[pair].second;
+            rda = distance(geo[i], geo[j]);
+            for (int n = m_hydrogen_start[i]; n < m_hydrogen_start[i + 1]; n++) {
+                h_i = m_hydrogens[n];
+                // Distances to hydrogen
+                rih = distance(geo[i], geo[h_i]);
+                rjh = distance(geo[j], geo[h_i]);
+
+                angle = M_PI - atomangle(geo[i], geo[h_i], geo[j]);
+                // if (rih*rih + rjh*rjh < rda*rda) {
+                if (angle < M_PI / 2) {
+                    // Here, we have filterd out everything but corrected H-bonds
+                    // Determine donor and acceptor - donor is the closer one
+                    if (rih <= rjh) {
+                        d_i = i;
+                        a_i = j;
+                        rdh = rih;
+                        rah = rjh;
+                    } else {
+                        d_i = j;
+                        a_i = i;
+                        rdh = rjh;
+                        rah = rih;
+                    }
+
+                    // Radial term
+                    e_radial = -0.00303407407407313510 * pow(rda, 7) + 0.07357629629627092382 * pow(rda, 6) + -0.70087111111082800452 * pow(rda, 5) + 3.25309629629461749545 * pow(rda, 4) + -7.20687407406838786983 * pow(rda, 3) + 5.31754666665572184314 * pow(rda, 2) + 3.40736000001102778967 * rda + -4.68512000000450434811;
+
+                    // Radial [grad]ient
+                    if (do_grad) {
+                        // In rDA coordinate
+                        d_radial = -0.02123851851851194655 * pow(rda, 6) + 0.44145777777762551519 * pow(rda, 5) + -3.50435555555413991158 * pow(rda, 4) + 13.01238518517846998179 * pow(rda, 3) + -21.62062222220516360949 * pow(rda, 2) + 10.63509333331144368628 * rda + 3.40736000001102778967;
+
+                        // Cartesian gradients on D and A atoms
+                        d_radial_d.x = (geo[d_i].x - geo[a_i].x) / rda * d_radial;
+                        d_radial_d.y = (geo[d_i].y - geo[a_i].y) / rda * d_radial;
+                        d_radial_d.z = (geo[d_i].z - geo[a_i].z) / rda * d_radial;
+
+                        d_radial_a.x = -d_radial_d.x;
+                        d_radial_a.y = -d_radial_d.y;
+                        d_radial_a.z = -d_radial_d.z;
+                    }
+
+                    // Angular term
+                    a = angle / (M_PI / 2.0);
+                    x = -20.0 * pow(a, 7) + 70.0 * pow(a, 6) - 84.0 * pow(a, 5) + 35.0 * pow(a, 4);
+                    e_angular = 1.0 - x * x;
+
+                    // Angular gradient
+                    if (do_grad) {
+                        xd = (-140.0 * pow(a, 6) + 420.0 * pow(a, 5) - 420.0 * pow(a, 4) + 140.0 * pow(a, 3)) / (M_PI / 2.0);
+                        d_angular = -xd * 2.0 * x;
+
+                        // Dot product of bond vectors
+                        d = (geo[d_i].x - geo[h_i].x) * (geo[a_i].x - geo[h_i].x) + (geo[d_i].y - geo[h_i].y) * (geo[a_i].y - geo[h_i].y) + (geo[d_i].z - geo[h_i].z) * (geo[a_i].z - geo[h_i].z);
+
+                        x = -d_angular / sqrt(1.0 - (d * d) / (rdh * rdh) / (rah * rah));
+
+                        // Donor atom
+                        d_angular_d.x = x * -((geo[a_i].x - geo[h_i].x) / rdh / rah - (geo[d_i].x - geo[h_i].x) * d / pow(rdh, 3) / rah);
+                        d_angular_d.y = x * -((geo[a_i].y - geo[h_i].y) / rdh / rah - (geo[d_i].y - geo[h_i].y) * d / pow(rdh, 3) / rah);
+                        d_angular_d.z = x * -((geo[a_i].z - geo[h_i].z) / rdh / rah - (geo[d_i].z - geo[h_i].z) * d / pow(rdh, 3) / rah);
+                        // Acceptor atom
+                        d_angular_a.x = x * -((geo[d_i].x - geo[h_i].x) / rdh / rah - (geo[a_i].x - geo[h_i].x) * d / rdh / pow(rah, 3));
+                        d_angular_a.y = x * -((geo[d_i].y - geo[h_i].y) / rdh / rah - (geo[a_i].y - geo[h_i].y) * d / rdh / pow(rah, 3));
+                        d_angular_a.z = x * -((geo[d_i].z - geo[h_i].z) / rdh / rah - (geo[a_i].z - geo[h_i].z) * d / rdh / pow(rah, 3));
+                        // Hydrogen
+                        d_angular_h.x = -d_angular_d.x - d_angular_a.x;
+                        d_angular_h.y = -d_angular_d.y - d_angular_a.y;
+                        d_angular_h.z = -d_angular_d.z - d_angular_a.z;
+                    }
+
+                    // Energy coefficient
+                    if (geo[d_i].e == OXYGEN && geo[a_i].e == OXYGEN)
+                        e_para = para_oh_o;
+                    if (geo[d_i].e == OXYGEN && geo[a_i].e == NITROGEN)
+                        e_para = para_oh_n;
+                    if (geo[d_i].e == NITROGEN && geo[a_i].e == OXYGEN)
+                        e_para = para_nh_o;
+                    if (geo[d_i].e == NITROGEN && geo[a_i].e == NITROGEN)
+                        e_para = para_nh_n;
+
+                    // Bond switching
+                    if (rdh > 1.15) {
+                        rdhs = rdh - 1.15;
+                        ravgs = 0.5 * rdh + 0.5 * rah - 1.15;
+                        x = rdhs / ravgs;
+                        e_bond_switch = 1.0 - (-20.0 * pow(x, 7) + 70.0 * pow(x, 6) - 84.0 * pow(x, 5) + 35.0 * pow(x, 4));
+
+                        // Gradient
+                        if (do_grad) {
+                            d_bs = -(-140.0 * pow(x, 6) + 420.0 * pow(x, 5) - 420.0 * pow(x, 4) + 140.0 * pow(x, 3));
+
+                            xd = d_bs / ravgs;
+                            xd2 = 0.5 * d_bs * -x / ravgs;
+
+                            d_bs_d.x = (geo[d_i].x - geo[h_i].x) / rdh * xd + (geo[d_i].x - geo[h_i].x) / rdh * xd2;
+                            d_bs_d.y = (geo[d_i].y - geo[h_i].y) / rdh * xd + (geo[d_i].y - geo[h_i].y) / rdh * xd2;
+                            d_bs_d.z = (geo[d_i].z - geo[h_i].z) / rdh * xd + (geo[d_i].z - geo[h_i].z) / rdh * xd2;
+
+                            d_bs_a.x = (geo[a_i].x - geo[h_i].x) / rah * xd2;
+                            d_bs_a.y = (geo[a_i].y - geo[h_i].y) / rah * xd2;
+                            d_bs_a.z = (geo[a_i].z - geo[h_i].z) / rah * xd2;
+
+                            d_bs_h.x = -d_bs_d.x + -d_bs_a.x;
+                            d_bs_h.y = -d_bs_d.y + -d_bs_a.y;
+                            d_bs_h.z = -d_bs_d.z + -d_bs_a.z;
+                        }
+                    } else {
+                        // No switching, no gradient
+                        e_bond_switch = 1.0;
+                        if (do_grad) {
+                            d_bs_d.x = 0.0;
+                            d_bs_d.y = 0.0;
+                            d_bs_d.z = 0.0;
+                            d_bs_a.x = 0.0;
+                            d_bs_a.y = 0.0;
+                            d_bs_a.z = 0.0;
+                            d_bs_h.x = 0.0;
+                            d_bs_h.y = 0.0;
+                            d_bs_h.z = 0.0;
+                        }
+                    }
+
+                    // Water scaling
+                    e_scale_w = 1.0;
+                    if (geo[d_i].e == OXYGEN && geo[a_i].e == OXYGEN) {
+                        // Count hydrogens and other atoms in vicinity
+                        double hydrogens = 0.0;
+                        double others = 0.0;
+                        for (int kn = m_valence_start[d_i]; kn < m_valence_start[d_i + 1]; kn++) {
+                            k = m_valence[kn];
+                            if (geo[k].e == HYDROGEN) {
+                                hydrogens += cvalence_contribution(geo[d_i], geo[k]);
+                            } else {
+                                others += cvalence_contribution(geo[d_i], geo[k]);
+                            }
+                        }
+
+                        // If it is water
+                        if (hydrogens >= 1.0) {
+                            sign_wat = 1.0;
+                            slope = multiplier_wh_o - 1.0;
+                            v = hydrogens;
+                            fv = 0.0;
+                            if (v > 1.0 && v <= 2.0) {
+                                fv = v - 1.0;
+                                sign_wat = 1.0;
+                            }
+                            if (v > 2.0 && v < 3.0) {
+                                fv = 3.0 - v;
+                                sign_wat = -1.0;
+                            }
+                            fv2 = 1.0 - others;
+                            if (fv2 < 0.0)
+                                fv2 = 0.0;
+
+                            e_scale_w = 1.0 + slope * fv * fv2;
+                        }
+                    }
+
+                    // Charged groups
+                    e_scale_chd = 1.0;
+                    e_scale_cha = 1.0;
+
+                    // Scaled groups: NR4+
+                    if (1 && geo[d_i].e == NITROGEN) {
+                        slope = multiplier_nh4 - 1.0;
+                        v = 0.0;
+                        for (int kn = m_valence_start[d_i]; kn < m_valence_start[d_i + 1]; kn++) {
+                            k = m_valence[kn];
+                            v += cvalence_contribution(geo[d_i], geo[k]);
+                        }
+                        if (v > 3.0)
+                            v = v - 3.0;
+                        else
+                            v = 0.0;
+                        e_scale_chd = 1.0 + slope * v;
+                    }
+
+                    // Scaled groups: COO-
+                    f_o1 = 0.0;
+                    f_o2 = 0.0;
+                    f_cc = 0.0;
+
+                    o1 = a_i;
+                    o2 = -1;
+                    cc = -1;
+                    if (geo[a_i].e == OXYGEN) {
+                        slope = multiplier_coo - 1.0;
+
+                        // Search for closest C atom
+                        double cdist = 9.9e9;
+                        cv_o1 = 0.0;
+                        for (int kn = m_valence_start[o1]; kn < m_valence_start[o1 + 1]; kn++) {
+                            k = m_valence[kn];
+                            v = cvalence_contribution(geo[o1], geo[k]);
+                            cv_o1 += v; // Sum O1 valence
+                            if (v > 0.0 && geo[k].e == CARBON && distance(geo[o1], geo[k]) < cdist) {
+                                cdist = distance(geo[o1], geo[k]);
+                                cc = k;
+                            }
+                        }
+
+                        // If C found, look for the second O
+                        if (cc != -1) {
+                            double odist = 9.9e9;
+                            cv_cc = 0.0;
+                            for (int kn = m_valence_start[cc]; kn < m_valence_start[cc + 1]; kn++) {
+                                k = m_valence[kn];
+                                v = cvalence_contribution(geo[cc], geo[k]);
+                                cv_cc += v;
+                                if (v > 0.0 && k != o1 && geo[k].e == OXYGEN && distance(geo[cc], geo[k]) < odist) {
+                                    odist = distance(geo[cc], geo[k]);
+                                    o2 = k;
+                                }
+                            }
+                        }
+
+                        // O1-C-O2 triad:
+                        if (o2 != -1) {
+                            // Get O2 valence
+                            cv_o2 = 0.0;
+                            for (int kn = m_valence_start[o2]; kn < m_valence_start[o2 + 1]; kn++) {
+                                k = m_valence[kn];
+                                cv_o2 += cvalence_contribution(geo[o2], geo[k]);
+                            }
+
+                            f_o1 = 1.0 - fabs(1.0 - cv_o1);
+                            if (f_o1 < 0.0)
+                                f_o1 = 0.0;
+
+                            f_o2 = 1.0 - fabs(1.0 - cv_o2);
+                            if (f_o2 < 0.0)
+                                f_o2 = 0.0;
+
+                            f_cc = 1.0 - fabs(3.0 - cv_cc);
+                            if (f_cc < 0.0)
+                                f_cc = 0.0;
+
+                            e_scale_cha = 1.0 + slope * f_o1 * f_o2 * f_cc;
+                        }
+                    }
+
+                    // Final energy
+                    e_corr = e_para * e_radial * e_angular * e_bond_switch * e_scale_w * e_scale_chd * e_scale_cha;
+                    e_corr_sum += e_corr;
+
+                    // Total gradient
+                    // radial
+                    coord_add(grd_h4, d_i, coord_scale(d_radial_d, e_para * e_angular * e_bond_switch * e_scale_w * e_scale_chd * e_scale_cha));
+                    coord_add(grd_h4, a_i, coord_scale(d_radial_a, e_para * e_angular * e_bond_switch * e_scale_w * e_scale_chd * e_scale_cha));
+                    // angular
+                    coord_add(grd_h4, d_i, coord_scale(d_angular_d, e_para * e_radial * e_bond_switch * e_scale_w * e_scale_chd * e_scale_cha));
+                    coord_add(grd_h4, a_i, coord_scale(d_angular_a, e_para * e_radial * e_bond_switch * e_scale_w * e_scale_chd * e_scale_cha));
+                    coord_add(grd_h4, h_i, coord_scale(d_angular_h, e_para * e_radial * e_bond_switch * e_scale_w * e_scale_chd * e_scale_cha));
+                    // bond_switch
+                    coord_add(grd_h4, d_i, coord_scale(d_bs_d, e_para * e_radial * e_angular * e_scale_w * e_scale_chd * e_scale_cha));
+                    coord_add(grd_h4, a_i, coord_scale(d_bs_a, e_para * e_radial * e_angular * e_scale_w * e_scale_chd * e_scale_cha));
+                    coord_add(grd_h4, h_i, coord_scale(d_bs_h, e_para * e_radial * e_angular * e_scale_w * e_scale_chd * e_scale_cha));
+                    // water scaling
+                    if (do_grad && e_scale_w != 1.0) {
+                        slope = multiplier_wh_o - 1.0;
+                        for (int kn = m_valence_start[d_i]; kn < m_valence_start[d_i + 1]; kn++) {
+                            k = m_valence[kn];
+                            if (k != d_i) {
+                                x = distance(geo[d_i], geo[k]);
+                                if (geo[k].e == HYDROGEN) {
+                                    xd = cvalence_contribution_d(geo[d_i], geo[k]) * sign_wat;
+                                    g.x = (geo[d_i].x - geo[k].x) * -xd / x * slope;
+                                    g.y = (geo[d_i].y - geo[k].y) * -xd / x * slope;
+                                    g.z = (geo[d_i].z - geo[k].z) * -xd / x * slope;
+                                    coord_add(grd_h4, d_i, coord_scale(g, -e_para * e_radial * e_angular * e_bond_switch * e_scale_chd * e_scale_cha));
+                                    coord_add(grd_h4, k, coord_scale(g, e_para * e_radial * e_angular * e_bond_switch * e_scale_chd * e_scale_cha));
+                                } else {
+                                    xd = cvalence_contribution_d(geo[d_i], geo[k]);
+                                    g.x = (geo[d_i].x - geo[k].x) * xd / x * slope;
+                                    g.y = (geo[d_i].y - geo[k].y) * xd / x * slope;
+                                    g.z = (geo[d_i].z - geo[k].z) * xd / x * slope;
+                                    coord_add(grd_h4, d_i, coord_scale(g, -e_para * e_radial * e_angular * e_bond_switch * e_scale_chd * e_scale_cha));
+                                    coord_add(grd_h4, k, coord_scale(g, e_para * e_radial * e_angular * e_bond_switch * e_scale_chd * e_scale_cha));
+                                }
+                            }
+                        }
+                    }
+                    // scaled groups: NR4+
+                    if (do_grad && e_scale_chd != 1.0) {
+                        slope = multiplier_nh4 - 1.0;
+                        for (int kn = m_valence_start[d_i]; kn < m_valence_start[d_i + 1]; kn++) {
+                            k = m_valence[kn];
+                            if (k != d_i) {
+                                x = distance(geo[d_i], geo[k]);
+                                xd = cvalence_contribution_d(geo[d_i], geo[k]);
+                                g.x = (geo[d_i].x - geo[k].x) * -xd / x * slope;
+                                g.y = (geo[d_i].y - geo[k].y) * -xd / x * slope;
+                                g.z = (geo[d_i].z - geo[k].z) * -xd / x * slope;
+                                coord_add(grd_h4, d_i, coord_scale(g, -e_para * e_radial * e_angular * e_bond_switch * e_scale_cha * e_scale_w));
+                                coord_add(grd_h4, k, coord_scale(g, e_para * e_radial * e_angular * e_bond_switch * e_scale_cha * e_scale_w));
+                            }
+                        }
+                    }
+                    // scaled groups: COO-
+                    if (do_grad && f_o1 * f_o2 * f_cc != 0.0) {
+                        slope = multiplier_coo - 1.0;
+                        // Atoms around O1
+                        for (int kn = m_valence_start[o1]; kn < m_valence_start[o1 + 1]; kn++) {
+                            k = m_valence[kn];
+                            if (k != o1) {
+                                xd = cvalence_contribution_d(geo[o1], geo[k]);
+                                if (xd != 0.0) {
+                                    x = distance(geo[o1], geo[k]);
+                                    if (cv_o1 > 1.0)
+                                        xd *= -1.0;
+                                    xd *= f_o2 * f_cc;
+                                    g.x = (geo[o1].x - geo[k].x) * -xd / x * slope;
+                                    g.y = (geo[o1].y - geo[k].y) * -xd / x * slope;
+                                    g.z = (geo[o1].z - geo[k].z) * -xd / x * slope;
+                                    coord_add(grd_h4, o1, coord_scale(g, -e_para * e_radial * e_angular * e_bond_switch * e_scale_chd * e_scale_w));
+                                    coord_add(grd_h4, k, coord_scale(g, e_para * e_radial * e_angular * e_bond_switch * e_scale_chd * e_scale_w));
+                                }
+                            }
+                        }
+                        slope = multiplier_coo - 1.0;
+                        // Atoms around O2
+                        for (int kn = m_valence_start[o2]; kn < m_valence_start[o2 + 1]; kn++) {
+                            k = m_valence[kn];
+                            if (k != o2) {
+                                xd = cvalence_contribution_d(geo[o2], geo[k]);
+                                if (xd != 0.0) {
+                                    x = distance(geo[o2], geo[k]);
+                                    if (cv_o2 > 1.0)
+                                        xd *= -1.0;
+                                    xd *= f_o1 * f_cc;
+                                    g.x = (geo[o2].x - geo[k].x) * -xd / x * slope;
+                                    g.y = (geo[o2].y - geo[k].y) * -xd / x * slope;
+                                    g.z = (geo[o2].z - geo[k].z) * -xd / x * slope;
+                                    coord_add(grd_h4, o2, coord_scale(g, -e_para * e_radial * e_angular * e_bond_switch * e_scale_chd * e_scale_w));
+                                    coord_add(grd_h4, k, coord_scale(g, e_para * e_radial * e_angular * e_bond_switch * e_scale_chd * e_scale_w));
+                                }
+                            }
+                        }
+                        slope = multiplier_coo - 1.0;
+                        for (int kn = m_valence_start[cc]; kn < m_valence_start[cc + 1]; kn++) {
+                            k = m_valence[kn];
+                            if (k != cc) {
+                                xd = cvalence_contribution_d(geo[cc], geo[k]);
+                                if (xd != 0.0) {
+                                    x = distance(geo[cc], geo[k]);
+                                    if (cv_cc > 3.0)
+                                        xd *= -1.0;
+                                    xd *= f_o1 * f_o2;
+                                    g.x = (geo[cc].x - geo[k].x) * -xd / x * slope;
+                                    g.y = (geo[cc].y - geo[k].y) * -xd / x * slope;
+                                    g.z = (geo[cc].z - geo[k].z) * -xd / x * slope;
+                                    coord_add(grd_h4, cc, coord_scale(g, -e_para * e_radial * e_angular * e_bond_switch * e_scale_chd * e_scale_w));
+                                    coord_add(grd_h4, k, coord_scale(g, e_para * e_radial * e_angular * e_bond_switch * e_scale_chd * e_scale_w));
                                 }
                             }
                         }
@@ -798,45 +803,133 @@ public:
         double d_rad;
         double gx, gy, gz;
 
-        // Iterate over H atoms twice
-        for (i = 0; i < natom; i++) {
-            if (geo[i].e == HYDROGEN) {
-                for (j = 0; j < i; j++) {
-                    if (geo[j].e == HYDROGEN) {
-                        // Calculate distance
-                        r = distance(geo[i], geo[j]);
-                        e_corr_sum += hh_rep_k * (1.0 - 1.0 / (1.0 + exp(-hh_rep_e * (r / hh_rep_r0 - 1.0))));
-
-                        if (do_grad) {
-                            // Gradient in the internal coordinate
-                            d_rad = (1.0 / pow(1.0 + exp(-hh_rep_e * (r / hh_rep_r0 - 1.0)), 2) * hh_rep_e / hh_rep_r0 * exp(-hh_rep_e * (r / hh_rep_r0 - 1.0))) * hh_rep_k;
-
-                            // Cartesian components of the gradient
-                            gx = (geo[i].x - geo[j].x) / r * d_rad;
-                            gy = (geo[i].y - geo[j].y) / r * d_rad;
-                            gz = (geo[i].z - geo[j].z) / r * d_rad;
-
-                            // Add pair contribution to the global gradient
-                            grd_hh[i].x -= gx;
-                            grd_hh[i].y -= gy;
-                            grd_hh[i].z -= gz;
-
-                            grd_hh[j].x += gx;
-                            grd_hh[j].y += gy;
-                            grd_hh[j].z += gz;
-                        }
-                    }
-                }
+        // Iterate over H pairs within the range of the repulsion
+        update_hh_lists(natom, geo);
+        for (int pair = 0; pair < int(m_hh_pairs.size()); pair++) {
+            i = m_hh_pairs[pair].first;
+            j = m_hh_pairs[pair].second;
+            // Calculate distance
+            r = distance(geo[i], geo[j]);
+            e_corr_sum += hh_rep_k * (1.0 - 1.0 / (1.0 + exp(-hh_rep_e * (r / hh_rep_r0 - 1.0))));
+
+            if (do_grad) {
+                // Gradient in the internal coordinate
+                d_rad = (1.0 / pow(1.0 + exp(-hh_rep_e * (r / hh_rep_r0 - 1.0)), 2) * hh_rep_e / hh_rep_r0 * exp(-hh_rep_e * (r / hh_rep_r0 - 1.0))) * hh_rep_k;
+
+                // Cartesian components of the gradient
+                gx = (geo[i].x - geo[j].x) / r * d_rad;
+                gy = (geo[i].y - geo[j].y) / r * d_rad;
+                gz = (geo[i].z - geo[j].z) / r * d_rad;
+
+                // Add pair contribution to the global gradient
+                grd_hh[i].x -= gx;
+                grd_hh[i].y -= gy;
+                grd_hh[i].z -= gz;
+
+                grd_hh[j].x += gx;
+                grd_hh[j].y += gy;
+                grd_hh[j].z += gz;
             }
         }
 
         return e_corr_sum;
     }
 
-    coord_t* GradientH4() { return grd_h4; }
-    coord_t* GradientHH() { return grd_hh; }
+    coord_t* GradientH4() { return grd_h4.data(); }
+    coord_t* GradientHH() { return grd_hh.data(); }
 
 private:
+    //==============================================================================
+    // Neighbour lists
+    //==============================================================================
+
+    //------------------------------------------------------------------------------
+    // Donor/acceptor pairs within HB_R_CUTOFF, the hydrogens around every N and O
+    // and all atoms within the covalent range 1.6 (ri + rj) of every atom, beyond
+    // that cvalence_contribution and its derivative vanish
+    inline void update_h4_lists(int natom, const atom_t* geo)
+    {
+        double radius = 0.0;
+        m_positions.resize(natom, 3);
+        for (int i = 0; i < natom; i++) {
+            m_positions(i, 0) = geo[i].x;
+            m_positions(i, 1) = geo[i].y;
+            m_positions(i, 2) = geo[i].z;
+            radius = std::max(radius, covalent_radii[geo[i].e]);
+        }
+        m_cells.Build(m_positions, std::max(HB_R_CUTOFF, 2.0 * 1.6 * radius));
+
+        m_da_pairs.clear();
+        m_hydrogen_pairs.clear();
+        m_valence_pairs.clear();
+        m_cells.ForEachPair(m_positions, [&](int i, int j, double r2) {
+            const double r = sqrt(r2);
+            if (r < 1.6 * (covalent_radii[geo[i].e] + covalent_radii[geo[j].e]))
+                m_valence_pairs.emplace_back(i, j);
+            if (r >= HB_R_CUTOFF)
+                return;
+            const bool polar_i = geo[i].e == NITROGEN || geo[i].e == OXYGEN;
+            const bool polar_j = geo[j].e == NITROGEN || geo[j].e == OXYGEN;
+            if (polar_i && polar_j && r > HB_R_0)
+                m_da_pairs.emplace_back(std::max(i, j), std::min(i, j));
+            else if (polar_i && geo[j].e == HYDROGEN)
+                m_hydrogen_pairs.emplace_back(i, j);
+            else if (polar_j && geo[i].e == HYDROGEN)
+                m_hydrogen_pairs.emplace_back(j, i);
+        });
+        // Same order as the loops over all atoms
+        std::sort(m_da_pairs.begin(), m_da_pairs.end());
+        build_lists(natom, m_hydrogen_pairs, false, m_hydrogen_start, m_hydrogens);
+        build_lists(natom, m_valence_pairs, true, m_valence_start, m_valence);
+    }
+
+    //------------------------------------------------------------------------------
+    // H-H pairs up to the distance where the repulsion dropped below 1e-14 hh_rep_k
+    inline void update_hh_lists(int natom, const atom_t* geo)
+    {
+        m_hh_index.clear();
+        for (int i = 0; i < natom; i++)
+            if (geo[i].e == HYDROGEN)
+                m_hh_index.push_back(i);
+        m_hh_positions.resize(m_hh_index.size(), 3);
+        for (int h = 0; h < int(m_hh_index.size()); h++) {
+            m_hh_positions(h, 0) = geo[m_hh_index[h]].x;
+            m_hh_positions(h, 1) = geo[m_hh_index[h]].y;
+            m_hh_positions(h, 2) = geo[m_hh_index[h]].z;
+        }
+        const double cutoff = hh_rep_e > 0.0 ? hh_rep_r0 * (1.0 + 14.0 * log(10.0) / hh_rep_e) : 1e6;
+        m_hh_cells.Build(m_hh_positions, cutoff);
+
+        m_hh_pairs.clear();
+        m_hh_cells.ForEachPair(m_hh_positions, [&](int a, int b, double) {
+            m_hh_pairs.emplace_back(std::max(m_hh_index[a], m_hh_index[b]), std::min(m_hh_index[a], m_hh_index[b]));
+        });
+        std::sort(m_hh_pairs.begin(), m_hh_pairs.end());
+    }
+
+    //------------------------------------------------------------------------------
+    // Compressed per atom lists from pairs, each list sorted by atom index
+    inline void build_lists(int natom, const std::vector<std::pair<int, int>>& pairs, bool symmetric, std::vector<int>& start, std::vector<int>& list)
+    {
+        start.assign(natom + 1, 0);
+        for (const auto& pair : pairs) {
+            start[pair.first + 1]++;
+            if (symmetric)
+                start[pair.second + 1]++;
+        }
+        for (int i = 0; i < natom; i++)
+            start[i + 1] += start[i];
+        list.resize(start[natom]);
+        m_fill.assign(start.begin(), start.end() - 1);
+        for (const auto& pair : pairs) {
+            list[m_fill[pair.first]++] = pair.second;
+            if (symmetric)
+                list[m_fill[pair.second]++] = pair.first;
+        }
+        for (int i = 0; i < natom; i++)
+            std::sort(list.begin() + start[i], list.begin() + start[i + 1]);
+    }
+
     // H4 correction
     double para_oh_o = 2.32;
     double para_oh_n = 3.10;
@@ -851,8 +944,14 @@ private:
     double hh_rep_e = 12.7;
     double hh_rep_r0 = 2.3;
 
-    coord_t* grd_h4;
-    coord_t* grd_hh;
+    std::vector<coord_t> grd_h4;
+    std::vector<coord_t> grd_hh;
+
+    // Persistent neighbour search buffers
+    Matrix m_positions, m_hh_positions;
+    CellList m_cells, m_hh_cells;
+    std::vector<std::pair<int, int>> m_da_pairs, m_hydrogen_pairs, m_valence_pairs, m_hh_pairs;
+    std::vector<int> m_hydrogen_start, m_hydrogens, m_valence_start, m_valence, m_hh_index, m_fill;
 };
 //==============================================================================
 // Main
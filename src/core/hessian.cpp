@@ -162,7 +162,9 @@ void Hessian::CalculateHessian(bool fullnumerical)
         std::cout << freqs.transpose() << std::endl;
         std::cout <<std::endl << std::endl;
     */
-    CalculateHessianSemiNumerical();
+    m_analytic = m_method.compare("uff") == 0 && CalculateHessianAnalytic();
+    if (!m_analytic)
+        CalculateHessianSemiNumerical();
     auto freqs = ConvertHessian(m_hessian);
     // std::cout << freqs.transpose() << std::endl;
     // std::cout <<std::endl << std::endl;
@@ -262,11 +264,87 @@ void Hessian::CalculateHessianNumerical()
     delete pool;
 }
 
+bool Hessian::CalculateHessianAnalytic()
+{
+    std::vector<std::array<double, 3>> geometry(m_molecule.AtomCount());
+    for (int i = 0; i < m_molecule.AtomCount(); ++i)
+        geometry[i] = { m_molecule.Atom(i).second(0), m_molecule.Atom(i).second(1), m_molecule.Atom(i).second(2) };
+
+    eigenUFF uff(m_controller);
+    uff.setMolecule(m_molecule.Atoms(), geometry);
+    /* the terms take the minimum images of their atoms, the gas phase Hessian must not be taken instead */
+    uff.setCell(m_molecule.Cell());
+    uff.Initialise();
+    if (!uff.HasAnalyticHessian())
+        return false;
+
+    std::cout << "Starting Analytic Hessian Calculation" << std::endl;
+    /* same units as the finite differences of the gradient below */
+    m_hessian = Matrix(uff.SparseHessian()) / au / au;
+    return true;
+}
+
 void Hessian::CalculateHessianSemiNumerical()
 {
     m_hessian = Eigen::MatrixXd::Ones(3 * m_molecule.AtomCount(), 3 * m_molecule.AtomCount());
 
     std::cout << "Starting Seminumerical Hessian Calculation" << std::endl;
+    if (m_method.compare("uff") == 0)
+        SemiNumericalBatch();
+    else
+        SemiNumericalPool();
+
+    for (int i = 0; i < m_molecule.AtomCount(); ++i) {
+        for (int j = 0; j < m_molecule.AtomCount(); ++j) {
+            double mass = 1 / sqrt(Elements::AtomicMass[m_molecule.Atoms()[i]] * Elements::AtomicMass[m_molecule.Atoms()[j]]);
+            for (int xi = 0; xi < 3; ++xi) {
+                for (int xj = 0; xj < 3; ++xj) {
+                    double value = (m_hessian(3 * i + xi, 3 * j + xj) + m_hessian(3 * j + xj, 3 * i + xi)) / 2.0;
+                    m_hessian(3 * i + xi, 3 * j + xj) = value;
+                    m_hessian(3 * j + xj, 3 * i + xi) = value;
+                }
+            }
+        }
+    }
+    /*
+    std::cout << std::endl
+              << std::endl;
+    std::cout << m_hessian << std::endl;
+    */
+}
+
+void Hessian::SemiNumericalBatch()
+{
+    /* all displaced geometries share the topology, so UFF evaluates them as one batch in chunks of rows */
+    const double d = 5e-3;
+    const int atoms = m_molecule.AtomCount();
+    const int chunk = 32;
+    json controller = m_controller;
+    controller["threads"] = m_threads;
+    EnergyCalculator energy(m_method, controller);
+    energy.setMolecule(m_molecule);
+
+    Vector geometry(3 * atoms);
+    for (int i = 0; i < atoms; ++i)
+        geometry.segment<3>(3 * i) = m_molecule.Atom(i).second;
+
+    Matrix geometries, gradients;
+    for (int first = 0; first < 3 * atoms; first += chunk) {
+        const int rows = std::min(chunk, 3 * atoms - first);
+        /* row 2r is displaced in +, row 2r + 1 in - direction of coordinate first + r */
+        geometries = geometry.transpose().replicate(2 * rows, 1);
+        for (int r = 0; r < rows; ++r) {
+            geometries(2 * r, first + r) += d;
+            geometries(2 * r + 1, first + r) -= d;
+        }
+        energy.CalculateEnergies(geometries, &gradients);
+        for (int r = 0; r < rows; ++r)
+            m_hessian.row(first + r) = (gradients.row(2 * r) - gradients.row(2 * r + 1)) / (2 * d) / au / au;
+    }
+}
+
+void Hessian::SemiNumericalPool()
+{
     CxxThreadPool* pool = new CxxThreadPool;
     pool->setActiveThreadCount(m_threads);
 
@@ -296,24 +374,6 @@ void Hessian::CalculateHessianSemiNumerical()
         }
         //  std::cout <<std::endl << m_hessian << std::endl << std::endl;
     }
-
-    for (int i = 0; i < m_molecule.AtomCount(); ++i) {
-        for (int j = 0; j < m_molecule.AtomCount(); ++j) {
-            double mass = 1 / sqrt(Elements::AtomicMass[m_molecule.Atoms()[i]] * Elements::AtomicMass[m_molecule.Atoms()[j]]);
-            for (int xi = 0; xi < 3; ++xi) {
-                for (int xj = 0; xj < 3; ++xj) {
-                    double value = (m_hessian(3 * i + xi, 3 * j + xj) + m_hessian(3 * j + xj, 3 * i + xi)) / 2.0;
-                    m_hessian(3 * i + xi, 3 * j + xj) = value;
-                    m_hessian(3 * j + xj, 3 * i + xi) = value;
-                }
-            }
-        }
-    }
-    /*
-    std::cout << std::endl
-              << std::endl;
-    std::cout << m_hessian << std::endl;
-    */
     delete pool;
 }
 
@@ -68,9 +68,19 @@ public:
 
     void CalculateHessian(bool fullnumerical = false);
 
+    /*! \brief Mass weighted Hessian of the last CalculateHessian */
+    inline const Matrix& getHessian() const { return m_hessian; }
+
+    /*! \brief True if the last CalculateHessian took the analytic UFF second derivatives */
+    inline bool isAnalytic() const { return m_analytic; }
+
 private:
     void CalculateHessianNumerical();
+    /*! \brief Second derivatives straight from eigenUFF, false if the setup has terms without them */
+    bool CalculateHessianAnalytic();
     void CalculateHessianSemiNumerical();
+    void SemiNumericalBatch();
+    void SemiNumericalPool();
     void FiniteDiffHess();
 
     Vector ConvertHessian(Matrix& hessian);
@@ -80,4 +90,5 @@ private:
     std::string m_method;
     json m_controller;
     int m_threads = 1;
+    bool m_analytic = false;
 };
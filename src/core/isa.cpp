@@ -0,0 +1,147 @@
+/*
+ * <Runtime selection of the instruction set for the hot kernels. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "isa.h"
+
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+#ifdef ISA_DISPATCH
+#include <cpuid.h>
+#endif
+
+namespace ISA {
+
+namespace {
+bool Supports(Level level)
+{
+#ifdef ISA_DISPATCH
+    /* checks the os support of the wider registers as well */
+    __builtin_cpu_init();
+    if (level == AVX512)
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl") && Supports(AVX2);
+    if (level == AVX2)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    return level == Generic;
+}
+
+std::string Brand()
+{
+#ifdef ISA_DISPATCH
+    unsigned int registers[12] = { 0 };
+    if (__get_cpuid_max(0x80000000, nullptr) >= 0x80000004) {
+        for (unsigned int leaf = 0; leaf < 3; ++leaf)
+            __get_cpuid(0x80000002 + leaf, &registers[4 * leaf], &registers[4 * leaf + 1], &registers[4 * leaf + 2], &registers[4 * leaf + 3]);
+        char brand[49] = { 0 };
+        std::memcpy(brand, registers, 48);
+        std::string name(brand);
+        name.erase(0, name.find_first_not_of(' '));
+        return name;
+    }
+#endif
+    return "unknown";
+}
+
+Level& Current()
+{
+    static Level level = Detected();
+    return level;
+}
+
+bool forced = false;
+}
+
+Level Detected()
+{
+    static const Level level = Supports(AVX512) ? AVX512 : (Supports(AVX2) ? AVX2 : Generic);
+    return level;
+}
+
+Level Selected()
+{
+    return Current();
+}
+
+bool Select(const std::string& name)
+{
+    Level level;
+    if (name.compare("auto") == 0) {
+        Current() = Detected();
+        forced = false;
+        return true;
+    } else if (name.compare("generic") == 0)
+        level = Generic;
+    else if (name.compare("avx2") == 0)
+        level = AVX2;
+    else if (name.compare("avx512") == 0)
+        level = AVX512;
+    else
+        return false;
+    if (level > Detected())
+        return false;
+    Current() = level;
+    forced = true;
+    return true;
+}
+
+std::string Name(Level level)
+{
+    if (level == AVX512)
+        return "avx512";
+    else if (level == AVX2)
+        return "avx2";
+    return "generic";
+}
+
+int Width(Level level)
+{
+    if (level == AVX512)
+        return 8;
+    else if (level == AVX2)
+        return 4;
+#if defined(__AVX__)
+    return 4;
+#elif defined(__SSE2__)
+    return 2;
+#else
+    return 1;
+#endif
+}
+
+std::string Report()
+{
+    std::ostringstream report;
+    report << "CPU:                " << Brand() << std::endl;
+    report << "Hardware threads:   " << std::thread::hardware_concurrency() << std::endl;
+    report << "Kernel paths:       generic";
+#ifdef ISA_DISPATCH
+    report << " avx2 avx512";
+#endif
+    report << std::endl;
+    report << "Supported by cpu:   generic";
+    for (Level level : { AVX2, AVX512 })
+        if (level <= Detected())
+            report << " " << Name(level);
+    report << std::endl;
+    report << "Selected:           " << Name(Selected()) << " (" << Width(Selected()) << " doubles per vector, " << (forced ? "set by -isa" : "automatic") << ")" << std::endl;
+    return report.str();
+}
+}
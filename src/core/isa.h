@@ -0,0 +1,80 @@
+/*
+ * <Runtime selection of the instruction set for the hot kernels. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <string>
+
+/* curcuma is built for the baseline of the target, the hot kernels (UFF terms, distance matrices,
+ * covariance and rotation of the RMSD) are compiled a second and third time for AVX2 and AVX-512.
+ * Every copy lives in its own namespace (Generic, AVX2, AVX512) of the same translation unit and is
+ * enclosed in ISA_TARGET_AVX2 / ISA_TARGET_AVX512 ... ISA_TARGET_END, so only the kernel bodies get
+ * the wider instruction set, everything included before stays baseline code.
+ * The level is taken once from cpuid, curcuma -isa overrides it. */
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define ISA_DISPATCH
+#if defined(__clang__)
+#define ISA_TARGET_AVX2 _Pragma("clang attribute push(__attribute__((target(\"avx2,fma\"))), apply_to = function)")
+#define ISA_TARGET_AVX512 _Pragma("clang attribute push(__attribute__((target(\"avx512f,avx512dq,avx512vl,avx2,fma\"))), apply_to = function)")
+#define ISA_TARGET_END _Pragma("clang attribute pop")
+#else
+#define ISA_TARGET_AVX2 _Pragma("GCC push_options") _Pragma("GCC target(\"avx2,fma\")")
+#define ISA_TARGET_AVX512 _Pragma("GCC push_options") _Pragma("GCC target(\"avx512f,avx512dq,avx512vl,avx2,fma,prefer-vector-width=512\")")
+#define ISA_TARGET_END _Pragma("GCC pop_options")
+#endif
+/* forward a call to the copy of the selected level, as return statement of the dispatching function */
+#define ISA_CALL(call)               \
+    switch (ISA::Selected()) {       \
+    case ISA::AVX512:                \
+        return AVX512::call;         \
+    case ISA::AVX2:                  \
+        return AVX2::call;           \
+    default:                         \
+        return Generic::call;        \
+    }
+#else
+#define ISA_CALL(call) return Generic::call;
+#endif
+
+namespace ISA {
+
+enum Level {
+    Generic = 0,
+    AVX2 = 1,
+    AVX512 = 2
+};
+
+/*! \brief Highest level supported by the cpu (and the operating system) that has kernels in this build */
+Level Detected();
+
+/*! \brief Level the kernels dispatch to, Detected() unless it was overridden */
+Level Selected();
+
+/*! \brief Override the level by name (auto, generic, avx2 or avx512), levels above Detected() are refused */
+bool Select(const std::string& name);
+
+std::string Name(Level level);
+
+/*! \brief Doubles per vector register of the level */
+int Width(Level level);
+
+/*! \brief Cpu, supported and selected level for curcuma -info */
+std::string Report();
+}
@@ -18,6 +18,7 @@
  */
 
 #include "elements.h"
+#include "geometry_kernels.h"
 
 #include "src/tools/general.h"
 #include "src/tools/geometry.h"
@@ -57,6 +58,7 @@ Molecule::Molecule(const Molecule& other)
     m_name = other.m_name;
     m_energy = other.m_energy;
     m_spin = other.m_spin;
+    m_cell = other.m_cell;
 }
 /*
 Molecule& Molecule::operator=(const Molecule& other)
@@ -80,6 +82,7 @@ Molecule::Molecule(const Molecule* other)
     m_name = other->m_name;
     m_energy = other->m_energy;
     m_spin = other->m_spin;
+    m_cell = other->m_cell;
 }
 /*
 Molecule& Molecule::operator=(const Molecule* other)
@@ -263,8 +266,28 @@ double Molecule::CalculateMass()
     return mass;
 }
 
-void Molecule::setXYZComment(const std::string& comment)
+void Molecule::setXYZComment(const std::string& input)
 {
+    /* extended XYZ: Lattice="ax ay az bx by bz cx cy cz" carries the cell, the rest is parsed as usual */
+    std::string comment = input;
+    const std::size_t lattice = comment.find("Lattice=\"");
+    if (lattice != std::string::npos) {
+        const std::size_t first = lattice + 9;
+        const std::size_t last = comment.find('"', first);
+        if (last != std::string::npos) {
+            StringList values = Tools::SplitString(comment.substr(first, last - first));
+            if (values.size() == 9) {
+                try {
+                    Eigen::Matrix3d vectors;
+                    for (int i = 0; i < 9; ++i)
+                        vectors(i / 3, i % 3) = std::stod(values[i]);
+                    m_cell.setVectors(vectors);
+                } catch (const std::invalid_argument& arg) {
+                }
+            }
+            comment.erase(lattice, last + 1 - lattice);
+        }
+    }
     StringList list = Tools::SplitString(comment);
     if (comment.find("Curcuma") != std::string::npos && list.size() >= 8) {
         try {
@@ -456,7 +479,10 @@ double Molecule::CalculateDistance(int i, int j) const
     double z_i = m_geometry[i][2];
     double z_j = m_geometry[j][2];
 
-    return sqrt((((x_i - x_j) * (x_i - x_j)) + ((y_i - y_j) * (y_i - y_j)) + ((z_i - z_j) * (z_i - z_j))));
+    double dx = x_i - x_j, dy = y_i - y_j, dz = z_i - z_j;
+    if (m_cell.isPeriodic())
+        m_cell.MinimumImage(dx, dy, dz);
+    return sqrt(dx * dx + dy * dy + dz * dz);
 }
 
 double Molecule::DotProduct(std::array<double, 3> pos1, std::array<double, 3> pos2) const
@@ -558,6 +584,7 @@ void Molecule::clear()
 {
     m_atoms.clear();
     m_geometry.clear();
+    m_cell = UnitCell();
     m_dirty = true;
 }
 
@@ -567,6 +594,7 @@ void Molecule::LoadMolecule(const Molecule& molecule)
     m_charge = molecule.Charge();
     m_atoms = molecule.Atoms();
     m_energy = molecule.Energy();
+    m_cell = molecule.Cell();
     InitialiseEmptyGeometry(molecule.AtomCount());
     setGeometry(molecule.getGeometry());
 }
@@ -576,6 +604,7 @@ void Molecule::LoadMolecule(const Molecule* molecule)
     clear();
     m_charge = molecule->Charge();
     m_atoms = molecule->Atoms();
+    m_cell = molecule->Cell();
     InitialiseEmptyGeometry(molecule->AtomCount());
     setGeometry(molecule->getGeometry());
 }
@@ -768,12 +797,10 @@ std::string Molecule::LowerDistanceMatrix() const
 
 std::vector<float> Molecule::LowerDistanceVector() const
 {
-    std::vector<float> vector;
-    for (int i = 0; i < AtomCount(); ++i) {
-        for (int j = 0; j < i; ++j) {
-            vector.push_back((CalculateDistance(i, j)));
-        }
-    }
+    const int atoms = AtomCount();
+    const Geometry geometry = getGeometry();
+    std::vector<float> vector(std::size_t(atoms) * (atoms > 0 ? atoms - 1 : 0) / 2);
+    GeometryKernels::LowerDistances(geometry.col(0).data(), geometry.col(1).data(), geometry.col(2).data(), atoms, vector.data());
     return vector;
 }
 
@@ -845,10 +872,11 @@ void Molecule::writeXYZFile(const std::string& filename, const  std::vector<int>
 
 std::string Molecule::Header() const
 {
+    const std::string lattice = m_cell.isPeriodic() ? " " + m_cell.toString() : std::string();
 #ifdef GCC
-    return fmt::format("{} ** Energy = {:10f} Eh ** Charge = {} ** Spin = {} ** Curcuma {} ({})\n", m_name, Energy(), Charge(), Spin(), qint_version, git_tag);
+    return fmt::format("{} ** Energy = {:10f} Eh ** Charge = {} ** Spin = {} ** Curcuma {} ({}){}\n", m_name, Energy(), Charge(), Spin(), qint_version, git_tag, lattice);
 #else
-    return fmt::format("{} ** Energy = {:} Eh ** Charge = {} ** Spin = {} ** Curcuma {} ({})\n", m_name, Energy(), Charge(), Spin(), qint_version, git_tag);
+    return fmt::format("{} ** Energy = {:} Eh ** Charge = {} ** Spin = {} ** Curcuma {} ({}){}\n", m_name, Energy(), Charge(), Spin(), qint_version, git_tag, lattice);
 #endif
 }
 
@@ -1236,15 +1264,12 @@ void Molecule::Center()
 
 std::pair<Matrix, Matrix> Molecule::DistanceMatrix() const
 {
-    Matrix distance = Eigen::MatrixXd::Zero(AtomCount(), AtomCount());
-    Matrix topo = distance;
-    for (int i = 0; i < AtomCount(); ++i) {
-        for (int j = 0; j < i; ++j) {
-            distance(i, j) = CalculateDistance(i, j);
-            distance(j, i) = distance(i, j);
-            topo(i, j) = distance(i, j) <= (Elements::CovalentRadius[Atom(i).first] + Elements::CovalentRadius[Atom(j).first]) * m_scaling;
-            topo(j, i) = topo(i, j);
-        }
-    }
+    const int atoms = AtomCount();
+    const Geometry geometry = getGeometry();
+    std::vector<double> radius(atoms);
+    for (int i = 0; i < atoms; ++i)
+        radius[i] = Elements::CovalentRadius[m_atoms[i]];
+    Matrix distance(atoms, atoms), topo(atoms, atoms);
+    GeometryKernels::DistanceMatrix(geometry.col(0).data(), geometry.col(1).data(), geometry.col(2).data(), radius.data(), m_scaling, atoms, distance.data(), topo.data());
     return std::pair<Matrix, Matrix>(distance, topo);
 }
@@ -28,15 +28,16 @@
 #include <Eigen/Dense>
 
 #include "src/core/global.h"
+#include "src/core/unitcell.h"
 
 typedef std::pair<int, Position> AtomDef;
 
 struct Mol {
-    double m_energy;
-    double m_spin;
+    double m_energy = 0;
+    double m_spin = 0;
 
-    int m_number_atoms;
-    int m_charge;
+    int m_number_atoms = 0;
+    int m_charge = 0;
 
     std::string m_commentline;
 
@@ -146,6 +147,11 @@ class Molecule
 
     inline std::string Name() const { return m_name; }
 
+    /*! \brief Lattice vectors of a periodic system, read from and written to the extended XYZ comment as Lattice="..." */
+    inline void setCell(const UnitCell& cell) { m_cell = cell; }
+    inline const UnitCell& Cell() const { return m_cell; }
+    inline bool isPeriodic() const { return m_cell.isPeriodic(); }
+
     std::string Atom2String(int i) const;
     std::string Header() const;
 
@@ -225,6 +231,7 @@ private:
     mutable std::vector<double> m_mass_fragments;
     mutable bool m_dirty = true;
     std::string m_name;
+    UnitCell m_cell;
     double m_energy = 0, m_Ia = 0, m_Ib = 0, m_Ic = 0, m_mass = 0, m_hbond_cutoff = 3;
     mutable double m_scaling = 1.5;
 };
@@ -0,0 +1,202 @@
+/*
+ * <Ring perception on the bond graph. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "src/core/adjacencylist.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+/*! \brief All smallest rings of every ring bond, the rows of Rings() hold the atoms in the order along the ring.
+ * Ring bonds are all bonds that are no bridges, they are found with a single depth first search. For every ring bond
+ * a breadth first search over the ring bonds gives the shortest ways back, each of them closes a relevant cycle.
+ * Taking all of them keeps the result independent of the atom order (both hexagons of an inner bond of a
+ * polyaromatic, all six faces of cubane) and contains a smallest set of smallest rings for fused and bridged systems,
+ * only a large ring around a cavity of fused smaller rings (kekulene) is not found, as it is no smallest ring of any bond.
+ * Every search stops at the first way back, the cost grows with the number of bonds times the ring size. */
+class RingSet {
+public:
+    RingSet() = default;
+
+    /*! \brief Perceive the rings of a symmetric bond graph, rings with more than max_size atoms are skipped */
+    void Build(const AdjacencyList& bonds, int max_size = 24)
+    {
+        const int atoms = bonds.Rows();
+        const std::vector<char> ring_bond = RingBonds(bonds);
+
+        std::vector<std::vector<int>> rings;
+        m_visited.assign(atoms, -1);
+        m_depth.assign(atoms, 0);
+        std::vector<int> front, next;
+        int search = 0;
+        for (int i = 0; i < atoms; ++i) {
+            for (int n = 0; n < bonds[i].size(); ++n) {
+                const int j = bonds[i][n];
+                if (j < i || !ring_bond[bonds.Offsets()[i] + n])
+                    continue;
+                /* shortest path from i to j over ring bonds without the bond i-j itself */
+                m_visited[i] = ++search;
+                m_depth[i] = 0;
+                front.assign(1, i);
+                bool found = false;
+                for (int depth = 1; depth < max_size && !found && !front.empty(); ++depth) {
+                    next.clear();
+                    for (int atom : front) {
+                        for (int k = 0; k < bonds[atom].size() && !found; ++k) {
+                            const int neighbour = bonds[atom][k];
+                            if (!ring_bond[bonds.Offsets()[atom] + k] || m_visited[neighbour] == search || (atom == i && neighbour == j))
+                                continue;
+                            m_visited[neighbour] = search;
+                            m_depth[neighbour] = depth;
+                            next.push_back(neighbour);
+                            found = neighbour == j;
+                        }
+                        if (found)
+                            break;
+                    }
+                    front.swap(next);
+                }
+                if (!found)
+                    continue;
+                /* every way back from j to i through atoms one step closer to i, the levels below j are complete */
+                std::vector<int> path(1, j), position(1, 0);
+                int paths = 0;
+                while (!path.empty() && paths < MaxPaths) {
+                    const int atom = path.back();
+                    if (atom == i) {
+                        rings.push_back(Canonical(path));
+                        paths++;
+                        path.pop_back();
+                        position.pop_back();
+                        continue;
+                    }
+                    int step = -1;
+                    while (position.back() < bonds[atom].size() && step == -1) {
+                        const int k = position.back()++;
+                        const int neighbour = bonds[atom][k];
+                        if (ring_bond[bonds.Offsets()[atom] + k] && m_visited[neighbour] == search && m_depth[neighbour] == m_depth[atom] - 1)
+                            step = neighbour;
+                    }
+                    if (step == -1) {
+                        path.pop_back();
+                        position.pop_back();
+                    } else {
+                        path.push_back(step);
+                        position.push_back(0);
+                    }
+                }
+            }
+        }
+        std::sort(rings.begin(), rings.end(), [](const std::vector<int>& a, const std::vector<int>& b) {
+            return a.size() != b.size() ? a.size() < b.size() : a < b;
+        });
+        rings.erase(std::unique(rings.begin(), rings.end()), rings.end());
+
+        std::vector<int> offset(1, 0), index;
+        for (const auto& ring : rings) {
+            index.insert(index.end(), ring.begin(), ring.end());
+            offset.push_back(index.size());
+        }
+        AdjacencyList stored;
+        stored.Assign(std::move(offset), std::move(index));
+        Assign(atoms, stored);
+    }
+
+    /*! \brief Take over rings that were perceived before, for example from the parameter cache */
+    void Assign(int atoms, const AdjacencyList& rings)
+    {
+        m_rings = rings;
+        std::vector<std::pair<int, int>> membership;
+        for (int r = 0; r < m_rings.Rows(); ++r)
+            for (int atom : m_rings[r])
+                membership.push_back({ atom, r });
+        m_membership.Build(atoms, membership);
+    }
+
+    inline int Count() const { return m_rings.Rows(); }
+    inline AdjacencyList::Row operator[](int ring) const { return m_rings[ring]; }
+    inline const AdjacencyList& Rings() const { return m_rings; }
+
+    /*! \brief Rings the atom is part of, smallest first */
+    inline AdjacencyList::Row RingsOf(int atom) const { return m_membership[atom]; }
+
+    /*! \brief Size of the smallest ring of the atom, 0 for atoms outside of rings */
+    inline int SmallestRing(int atom) const { return m_membership[atom].empty() ? 0 : m_rings[m_membership[atom][0]].size(); }
+
+private:
+    /* Tarjan's bridge search without recursion, flags every entry of the adjacency list that is a ring bond */
+    static std::vector<char> RingBonds(const AdjacencyList& bonds)
+    {
+        const int atoms = bonds.Rows();
+        std::vector<int> order(atoms, -1), low(atoms, 0), parent(atoms, -1), position(atoms, 0), stack;
+        std::vector<char> bridge(atoms, 0);
+        int time = 0;
+        for (int root = 0; root < atoms; ++root) {
+            if (order[root] != -1)
+                continue;
+            order[root] = low[root] = time++;
+            stack.push_back(root);
+            while (!stack.empty()) {
+                const int atom = stack.back();
+                if (position[atom] < bonds[atom].size()) {
+                    const int neighbour = bonds[atom][position[atom]++];
+                    if (order[neighbour] == -1) {
+                        parent[neighbour] = atom;
+                        order[neighbour] = low[neighbour] = time++;
+                        stack.push_back(neighbour);
+                    } else if (neighbour != parent[atom])
+                        low[atom] = std::min(low[atom], order[neighbour]);
+                    continue;
+                }
+                stack.pop_back();
+                if (parent[atom] != -1) {
+                    low[parent[atom]] = std::min(low[parent[atom]], low[atom]);
+                    bridge[atom] = low[atom] > order[parent[atom]];
+                }
+            }
+        }
+        std::vector<char> ring_bond(bonds.Entries(), 0);
+        for (int i = 0; i < atoms; ++i)
+            for (int n = 0; n < bonds[i].size(); ++n) {
+                const int j = bonds[i][n];
+                ring_bond[bonds.Offsets()[i] + n] = !((parent[j] == i && bridge[j]) || (parent[i] == j && bridge[i]));
+            }
+        return ring_bond;
+    }
+
+    /* lowest atom first, continued towards its lower neighbour in the ring */
+    static std::vector<int> Canonical(const std::vector<int>& ring)
+    {
+        const int size = ring.size();
+        const int start = std::min_element(ring.begin(), ring.end()) - ring.begin();
+        const int direction = ring[(start + 1) % size] < ring[(start + size - 1) % size] ? 1 : -1;
+        std::vector<int> canonical(size);
+        for (int i = 0; i < size; ++i)
+            canonical[i] = ring[((start + direction * i) % size + size) % size];
+        return canonical;
+    }
+
+    AdjacencyList m_rings, m_membership;
+    /* smallest rings of one bond that are taken at most, only reached by highly symmetric cages */
+    static constexpr int MaxPaths = 64;
+
+    std::vector<int> m_visited, m_depth;
+};
@@ -26,6 +26,8 @@
 
 #include "src/core/molecule.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <math.h>
 #include <stdio.h>
@@ -48,6 +50,8 @@ TBLiteInterface::TBLiteInterface(const json& tblitesettings)
         m_guess = 1;
     else
         std::cout << "Dont know, ignoring ..." << std::endl;
+    m_warm_start = m_tblitesettings["tb_warm_start"];
+    m_reset_displacement = m_tblitesettings["tb_warm_start_reset"].get<double>() / au;
 
     m_error = tblite_new_error();
     m_ctx = tblite_new_context();
@@ -56,6 +60,13 @@ TBLiteInterface::TBLiteInterface(const json& tblitesettings)
     tblite_set_context_verbosity(m_ctx, m_verbose);
 }
 
+void TBLiteInterface::ResetWavefunction()
+{
+    tblite_delete_result(&m_tblite_res);
+    m_tblite_res = tblite_new_result();
+    m_restart = false;
+}
+
 TBLiteInterface::~TBLiteInterface()
 {
     delete m_error;
@@ -116,6 +127,13 @@ bool TBLiteInterface::InitialiseMolecule(const int* attyp, const double* coord,
         UpdateMolecule(coord);
 
     m_tblite_mol = tblite_new_structure(m_error, natoms, attyp, coord, &charge, &spin, NULL, NULL);
+    m_geometry.assign(coord, coord + 3 * natoms);
+
+    /* calculator and wavefunction belong to the previous molecule */
+    if (m_tblite_calc != NULL)
+        tblite_delete_calculator(&m_tblite_calc);
+    m_parameter = -1;
+    ResetWavefunction();
 
     m_initialised = true;
     return true;
@@ -136,31 +154,65 @@ bool TBLiteInterface::UpdateMolecule(const Molecule& molecule)
 bool TBLiteInterface::UpdateMolecule(const double* coord)
 {
     tblite_update_structure_geometry(m_error, m_tblite_mol, coord, NULL);
+    m_geometry.assign(coord, coord + m_geometry.size());
     return true;
 }
 
 double TBLiteInterface::GFNCalculation(int parameter, double* grad)
 {
     double energy = 0;
-    if (parameter == 0) {
-        m_tblite_calc = tblite_new_ipea1_calculator(m_ctx, m_tblite_mol);
-    } else if (parameter == 1) {
-        m_tblite_calc = tblite_new_gfn1_calculator(m_ctx, m_tblite_mol);
-    } else if (parameter == 2) {
-        m_tblite_calc = tblite_new_gfn2_calculator(m_ctx, m_tblite_mol);
+    /* the calculator only depends on the elements, it is set up once per molecule and method */
+    if (m_tblite_calc == NULL || parameter != m_parameter) {
+        if (m_tblite_calc != NULL)
+            tblite_delete_calculator(&m_tblite_calc);
+        if (parameter == 0) {
+            m_tblite_calc = tblite_new_ipea1_calculator(m_ctx, m_tblite_mol);
+        } else if (parameter == 1) {
+            m_tblite_calc = tblite_new_gfn1_calculator(m_ctx, m_tblite_mol);
+        } else if (parameter == 2) {
+            m_tblite_calc = tblite_new_gfn2_calculator(m_ctx, m_tblite_mol);
+        }
+        if (m_guess == 0)
+            tblite_set_calculator_guess(m_ctx, m_tblite_calc, TBLITE_GUESS_SAD);
+        else
+            tblite_set_calculator_guess(m_ctx, m_tblite_calc, TBLITE_GUESS_EEQ);
+
+        tblite_set_calculator_accuracy(m_ctx, m_tblite_calc, 0.01);
+        tblite_set_calculator_max_iter(m_ctx, m_tblite_calc, m_maxiter);
+        tblite_set_calculator_mixer_damping(m_ctx, m_tblite_calc, m_damping);
+        tblite_set_calculator_temperature(m_ctx, m_tblite_calc, m_temp);
+        tblite_set_calculator_save_integrals(m_ctx, m_tblite_calc, 0);
+        m_parameter = parameter;
+        ResetWavefunction();
     }
-    if (m_guess == 0)
-        tblite_set_calculator_guess(m_ctx, m_tblite_calc, TBLITE_GUESS_SAD);
-    else
-        tblite_set_calculator_guess(m_ctx, m_tblite_calc, TBLITE_GUESS_EEQ);
 
-    tblite_set_calculator_accuracy(m_ctx, m_tblite_calc, 0.01);
-    tblite_set_calculator_max_iter(m_ctx, m_tblite_calc, m_maxiter);
-    tblite_set_calculator_mixer_damping(m_ctx, m_tblite_calc, m_damping);
-    tblite_set_calculator_temperature(m_ctx, m_tblite_calc, m_temp);
-    tblite_set_calculator_save_integrals(m_ctx, m_tblite_calc, 0);
+    /* tblite only applies the guess to an empty result, a result of the previous step is refined instead */
+    double displacement = 0;
+    for (int i = 0; i + 2 < m_reference.size(); i += 3) {
+        const double dx = m_geometry[i] - m_reference[i];
+        const double dy = m_geometry[i + 1] - m_reference[i + 1];
+        const double dz = m_geometry[i + 2] - m_reference[i + 2];
+        displacement = std::max(displacement, std::sqrt(dx * dx + dy * dy + dz * dz));
+    }
+    if (m_restart && (!m_warm_start || displacement > m_reset_displacement))
+        ResetWavefunction();
+
+    m_warm_started = m_restart;
     tblite_get_singlepoint(m_ctx, m_tblite_mol, m_tblite_calc, m_tblite_res);
+    if (m_warm_started && tblite_check_context(m_ctx)) {
+        /* a failed refinement is repeated once from the guess */
+        char message[512];
+        const int size = sizeof(message);
+        tblite_get_context_error(m_ctx, message, &size);
+        if (m_verbose)
+            std::cout << "SCF from the previous wavefunction failed (" << message << "), restarting from the guess" << std::endl;
+        ResetWavefunction();
+        m_warm_started = false;
+        tblite_get_singlepoint(m_ctx, m_tblite_mol, m_tblite_calc, m_tblite_res);
+    }
     tblite_get_result_energy(m_error, m_tblite_res, &energy);
+    m_reference = m_geometry;
+    m_restart = true;
 
     if (grad != NULL)
         tblite_get_result_gradient(m_error, m_tblite_res, grad);
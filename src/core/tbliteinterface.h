@@ -33,7 +33,9 @@ static json TBLiteSettings{
     { "tb_damping", 0.4 },
     { "tb_temp", 9.500e-4 },
     { "tb_verbose", 0 },
-    { "tb_guess", "SAD" }
+    { "tb_guess", "SAD" },
+    { "tb_warm_start", false },
+    { "tb_warm_start_reset", 0.3 }
 };
 
 class UFF;
@@ -65,7 +67,13 @@ public:
 
     std::vector<std::vector<double>> BondOrders() const;
 
+    /*! \brief True if the last GFNCalculation started from the previous wavefunction */
+    inline bool WarmStarted() const { return m_warm_started; }
+
 private:
+    /* the next calculation starts from the guess of tb_guess again */
+    void ResetWavefunction();
+
     double* m_coord;
     int* m_attyp;
 
@@ -78,6 +86,13 @@ private:
     double m_damping = 0.5;
     double m_temp = 1000;
 
+    /* the wavefunction in m_tblite_res is the guess of the next scf unless an atom moved further than
+     * m_reset_displacement (Bohr) from m_reference, the geometry it was converged for */
+    bool m_warm_start = false, m_restart = false, m_warm_started = false;
+    double m_reset_displacement = 0.3 / au;
+    std::vector<double> m_geometry, m_reference;
+    int m_parameter = -1;
+
     tblite_error m_error = NULL;
     tblite_structure m_tblite_mol = NULL;
     tblite_result m_tblite_res = NULL;
@@ -0,0 +1,176 @@
+/*
+ * < UFF gradients and Hessian-vector products by automatic differentiation. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/core/dualnumber.h"
+#include "src/core/uff_terms.h"
+
+#include "uff_autodiff.h"
+
+namespace UFFAutoDiff {
+
+namespace {
+
+/* energy of one term, its gradient is added to the rows atom - first_atom */
+template <int Atoms, typename Term>
+inline double Gradient(const Matrix& geometry, const int (&atoms)[Atoms], const Term& term, double factor, Matrix& gradient, int first_atom, const UnitCell* cell)
+{
+    typedef Dual<double, 3 * Atoms> Scalar;
+    double position[Atoms][3];
+    Positions(geometry, atoms, cell, position);
+    Scalar r[3 * Atoms];
+    for (int a = 0; a < Atoms; ++a)
+        for (int c = 0; c < 3; ++c)
+            r[3 * a + c] = Scalar::Variable(position[a][c], 3 * a + c);
+    const Scalar energy = term(r);
+    for (int a = 0; a < Atoms; ++a)
+        for (int c = 0; c < 3; ++c)
+            gradient(atoms[a] - first_atom, c) += factor * energy.d[3 * a + c];
+    return factor * energy.v;
+}
+
+/* the inner dual carries the direction, so the derivative of every gradient entry along it is a row of H * direction */
+template <int Atoms, typename Term>
+inline void HessianVector(const Matrix& geometry, const Matrix& direction, const int (&atoms)[Atoms], const Term& term, double factor, Matrix& product, const UnitCell* cell)
+{
+    typedef Dual<double, 1> Directional;
+    typedef Dual<Directional, 3 * Atoms> Scalar;
+    double position[Atoms][3];
+    Positions(geometry, atoms, cell, position);
+    Scalar r[3 * Atoms];
+    for (int a = 0; a < Atoms; ++a)
+        for (int c = 0; c < 3; ++c) {
+            Directional x(position[a][c]);
+            x.d[0] = direction(atoms[a], c);
+            r[3 * a + c] = Scalar::Variable(x, 3 * a + c);
+        }
+    const Scalar energy = term(r);
+    for (int a = 0; a < Atoms; ++a)
+        for (int c = 0; c < 3; ++c)
+            product(atoms[a], c) += factor * energy.d[3 * a + c].d[0];
+}
+}
+
+double Bonds(const UFFBondBlock& bonds, const Matrix& geometry, Matrix& gradient, double factor, int first_atom, const UnitCell* cell)
+{
+    double energy = 0;
+    for (int t = 0; t < bonds.size(); ++t) {
+        const int atoms[2] = { bonds.i[t], bonds.j[t] };
+        energy += Gradient(
+            geometry, atoms, [&](const auto* r) { return UFFTerms::Bond(r, r + 3, bonds.r0[t], bonds.kij[t]); }, factor, gradient, first_atom, cell);
+    }
+    return energy;
+}
+
+double Angles(const UFFAngleBlock& angles, const Matrix& geometry, Matrix& gradient, double factor, int first_atom, const UnitCell* cell)
+{
+    double energy = 0;
+    for (int t = 0; t < angles.size(); ++t) {
+        const int atoms[3] = { angles.i[t], angles.j[t], angles.k[t] };
+        energy += Gradient(
+            geometry, atoms, [&](const auto* r) { return UFFTerms::Angle(r, r + 3, r + 6, angles.kijk[t], angles.C0[t], angles.C1[t], angles.C2[t]); }, factor, gradient, first_atom, cell);
+    }
+    return energy;
+}
+
+double Dihedrals(const UFFDihedralBlock& dihedrals, const Matrix& geometry, Matrix& gradient, double factor, int first_atom, const UnitCell* cell)
+{
+    double energy = 0;
+    for (int t = 0; t < dihedrals.size(); ++t) {
+        const int atoms[4] = { dihedrals.i[t], dihedrals.j[t], dihedrals.k[t], dihedrals.l[t] };
+        double p[7];
+        for (int c = 0; c < 7; ++c)
+            p[c] = dihedrals.p[c][t];
+        energy += Gradient(
+            geometry, atoms, [&](const auto* r) { return UFFTerms::Dihedral(r, r + 3, r + 6, r + 9, p); }, factor, gradient, first_atom, cell);
+    }
+    return energy;
+}
+
+double Inversions(const UFFInversionBlock& inversions, const Matrix& geometry, Matrix& gradient, double factor, int first_atom, const UnitCell* cell)
+{
+    double energy = 0;
+    for (int t = 0; t < inversions.size(); ++t) {
+        const int atoms[4] = { inversions.i[t], inversions.j[t], inversions.k[t], inversions.l[t] };
+        energy += Gradient(
+            geometry, atoms, [&](const auto* r) { return UFFTerms::Inversion(r, r + 3, r + 6, r + 9, inversions.kijkl[t], inversions.C0[t], inversions.C1[t], inversions.C2[t]); }, factor, gradient, first_atom, cell);
+    }
+    return energy;
+}
+
+double vdWs(const UFFvdWBlock& vdws, const Matrix& geometry, Matrix& gradient, double factor, double vdw_scaling, double rep_scaling, double cutoff, double switch_on, int first_atom, const UnitCell* cell)
+{
+    double energy = 0;
+    for (int t = 0; t < vdws.size(); ++t) {
+        const int atoms[2] = { vdws.i[t], vdws.j[t] };
+        const double Dij = vdws.Dij[vdws.type[t]], xij = vdws.xij[vdws.type[t]];
+        energy += Gradient(
+            geometry, atoms, [&](const auto* r) { return UFFTerms::vdW(r, r + 3, Dij, xij, vdw_scaling, rep_scaling, cutoff, switch_on); }, factor, gradient, first_atom, cell);
+    }
+    return energy;
+}
+
+void Bonds(const UFFBondBlock& bonds, const Matrix& geometry, const Matrix& direction, double factor, Matrix& product, const UnitCell* cell)
+{
+    for (int t = 0; t < bonds.size(); ++t) {
+        const int atoms[2] = { bonds.i[t], bonds.j[t] };
+        HessianVector(
+            geometry, direction, atoms, [&](const auto* r) { return UFFTerms::Bond(r, r + 3, bonds.r0[t], bonds.kij[t]); }, factor, product, cell);
+    }
+}
+
+void Angles(const UFFAngleBlock& angles, const Matrix& geometry, const Matrix& direction, double factor, Matrix& product, const UnitCell* cell)
+{
+    for (int t = 0; t < angles.size(); ++t) {
+        const int atoms[3] = { angles.i[t], angles.j[t], angles.k[t] };
+        HessianVector(
+            geometry, direction, atoms, [&](const auto* r) { return UFFTerms::Angle(r, r + 3, r + 6, angles.kijk[t], angles.C0[t], angles.C1[t], angles.C2[t]); }, factor, product, cell);
+    }
+}
+
+void Dihedrals(const UFFDihedralBlock& dihedrals, const Matrix& geometry, const Matrix& direction, double factor, Matrix& product, const UnitCell* cell)
+{
+    for (int t = 0; t < dihedrals.size(); ++t) {
+        const int atoms[4] = { dihedrals.i[t], dihedrals.j[t], dihedrals.k[t], dihedrals.l[t] };
+        double p[7];
+        for (int c = 0; c < 7; ++c)
+            p[c] = dihedrals.p[c][t];
+        HessianVector(
+            geometry, direction, atoms, [&](const auto* r) { return UFFTerms::Dihedral(r, r + 3, r + 6, r + 9, p); }, factor, product, cell);
+    }
+}
+
+void Inversions(const UFFInversionBlock& inversions, const Matrix& geometry, const Matrix& direction, double factor, Matrix& product, const UnitCell* cell)
+{
+    for (int t = 0; t < inversions.size(); ++t) {
+        const int atoms[4] = { inversions.i[t], inversions.j[t], inversions.k[t], inversions.l[t] };
+        HessianVector(
+            geometry, direction, atoms, [&](const auto* r) { return UFFTerms::Inversion(r, r + 3, r + 6, r + 9, inversions.kijkl[t], inversions.C0[t], inversions.C1[t], inversions.C2[t]); }, factor, product, cell);
+    }
+}
+
+void vdWs(const UFFvdWBlock& vdws, const Matrix& geometry, const Matrix& direction, double factor, double vdw_scaling, double rep_scaling, double cutoff, double switch_on, Matrix& product, const UnitCell* cell)
+{
+    for (int t = 0; t < vdws.size(); ++t) {
+        const int atoms[2] = { vdws.i[t], vdws.j[t] };
+        const double Dij = vdws.Dij[vdws.type[t]], xij = vdws.xij[vdws.type[t]];
+        HessianVector(
+            geometry, direction, atoms, [&](const auto* r) { return UFFTerms::vdW(r, r + 3, Dij, xij, vdw_scaling, rep_scaling, cutoff, switch_on); }, factor, product, cell);
+    }
+}
+}
@@ -0,0 +1,72 @@
+/*
+ * < UFF gradients and Hessian-vector products by automatic differentiation. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "src/core/global.h"
+#include "src/core/uff_par.h"
+#include "src/core/unitcell.h"
+
+/* The terms of uff_terms.h evaluated with dual numbers. Every term seeds the coordinates of its
+ * atoms, so one pass gives the energy and its exact gradient. Nesting the duals once more gives
+ * the derivative of that gradient along a direction, which is one term's share of H * v.
+ * Geometry, gradient, direction and product are N x 3 matrices like in uff_kernels.h, the
+ * gradient may hold only a window of the atoms starting at first_atom. With a periodic cell
+ * the atoms of a term are taken as the images closest to its first atom. */
+
+namespace UFFAutoDiff {
+
+/* positions of the atoms of one term, with a periodic cell every atom is taken as the image closest to the first one */
+template <int Atoms>
+inline void Positions(const Matrix& geometry, const int (&atoms)[Atoms], const UnitCell* cell, double (&position)[Atoms][3])
+{
+    for (int a = 0; a < Atoms; ++a)
+        for (int c = 0; c < 3; ++c)
+            position[a][c] = geometry(atoms[a], c);
+    if (!cell || !cell->isPeriodic())
+        return;
+    for (int a = 1; a < Atoms; ++a) {
+        double d[3] = { position[a][0] - position[0][0], position[a][1] - position[0][1], position[a][2] - position[0][2] };
+        cell->MinimumImage(d[0], d[1], d[2]);
+        for (int c = 0; c < 3; ++c)
+            position[a][c] = position[0][c] + d[c];
+    }
+}
+
+double Bonds(const UFFBondBlock& bonds, const Matrix& geometry, Matrix& gradient, double factor, int first_atom = 0, const UnitCell* cell = nullptr);
+
+double Angles(const UFFAngleBlock& angles, const Matrix& geometry, Matrix& gradient, double factor, int first_atom = 0, const UnitCell* cell = nullptr);
+
+double Dihedrals(const UFFDihedralBlock& dihedrals, const Matrix& geometry, Matrix& gradient, double factor, int first_atom = 0, const UnitCell* cell = nullptr);
+
+double Inversions(const UFFInversionBlock& inversions, const Matrix& geometry, Matrix& gradient, double factor, int first_atom = 0, const UnitCell* cell = nullptr);
+
+double vdWs(const UFFvdWBlock& vdws, const Matrix& geometry, Matrix& gradient, double factor, double vdw_scaling, double rep_scaling, double cutoff, double switch_on, int first_atom = 0, const UnitCell* cell = nullptr);
+
+/* product += factor * H * direction */
+void Bonds(const UFFBondBlock& bonds, const Matrix& geometry, const Matrix& direction, double factor, Matrix& product, const UnitCell* cell = nullptr);
+
+void Angles(const UFFAngleBlock& angles, const Matrix& geometry, const Matrix& direction, double factor, Matrix& product, const UnitCell* cell = nullptr);
+
+void Dihedrals(const UFFDihedralBlock& dihedrals, const Matrix& geometry, const Matrix& direction, double factor, Matrix& product, const UnitCell* cell = nullptr);
+
+void Inversions(const UFFInversionBlock& inversions, const Matrix& geometry, const Matrix& direction, double factor, Matrix& product, const UnitCell* cell = nullptr);
+
+void vdWs(const UFFvdWBlock& vdws, const Matrix& geometry, const Matrix& direction, double factor, double vdw_scaling, double rep_scaling, double cutoff, double switch_on, Matrix& product, const UnitCell* cell = nullptr);
+}
@@ -0,0 +1,102 @@
+/*
+ * <Analytic second derivatives of the UFF terms. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/core/dualnumber.h"
+#include "src/core/uff_autodiff.h"
+#include "src/core/uff_terms.h"
+
+#include "uff_kernels.h"
+
+/* Every term of uff_terms.h is evaluated once with nested dual numbers, both levels seed the
+ * coordinates of its atoms. The inner derivatives of the outer derivatives are the dense
+ * second derivative block of the term, which is added as triplets. Energy, gradient and
+ * Hessian thereby come from the same expressions. With a periodic cell the atoms of a term are the images
+ * closest to its first atom, as in uff_autodiff.cpp. */
+
+namespace UFFKernels {
+
+namespace {
+
+template <int Atoms, typename Term>
+inline void Block(const Matrix& geometry, const int (&atoms)[Atoms], const Term& term, double factor, HessianTriplets& hessian, const UnitCell* cell)
+{
+    typedef Dual<double, 3 * Atoms> Inner;
+    typedef Dual<Inner, 3 * Atoms> Scalar;
+    double position[Atoms][3];
+    UFFAutoDiff::Positions(geometry, atoms, cell, position);
+    Scalar r[3 * Atoms];
+    for (int a = 0; a < Atoms; ++a)
+        for (int c = 0; c < 3; ++c)
+            r[3 * a + c] = Scalar::Variable(Inner::Variable(position[a][c], 3 * a + c), 3 * a + c);
+    const Scalar energy = term(r);
+    for (int p = 0; p < 3 * Atoms; ++p)
+        for (int q = 0; q < 3 * Atoms; ++q)
+            hessian.emplace_back(3 * atoms[p / 3] + p % 3, 3 * atoms[q / 3] + q % 3, factor * energy.d[p].d[q]);
+}
+}
+
+void Bonds(const UFFBondBlock& bonds, const Matrix& geometry, double factor, HessianTriplets& hessian, const UnitCell* cell)
+{
+    for (int t = 0; t < bonds.size(); ++t) {
+        const int atoms[2] = { bonds.i[t], bonds.j[t] };
+        Block(
+            geometry, atoms, [&](const auto* r) { return UFFTerms::Bond(r, r + 3, bonds.r0[t], bonds.kij[t]); }, factor, hessian, cell);
+    }
+}
+
+void Angles(const UFFAngleBlock& angles, const Matrix& geometry, double factor, HessianTriplets& hessian, const UnitCell* cell)
+{
+    for (int t = 0; t < angles.size(); ++t) {
+        const int atoms[3] = { angles.i[t], angles.j[t], angles.k[t] };
+        Block(
+            geometry, atoms, [&](const auto* r) { return UFFTerms::Angle(r, r + 3, r + 6, angles.kijk[t], angles.C0[t], angles.C1[t], angles.C2[t]); }, factor, hessian, cell);
+    }
+}
+
+void Dihedrals(const UFFDihedralBlock& dihedrals, const Matrix& geometry, double factor, HessianTriplets& hessian, const UnitCell* cell)
+{
+    for (int t = 0; t < dihedrals.size(); ++t) {
+        const int atoms[4] = { dihedrals.i[t], dihedrals.j[t], dihedrals.k[t], dihedrals.l[t] };
+        double p[7];
+        for (int c = 0; c < 7; ++c)
+            p[c] = dihedrals.p[c][t];
+        Block(
+            geometry, atoms, [&](const auto* r) { return UFFTerms::Dihedral(r, r + 3, r + 6, r + 9, p); }, factor, hessian, cell);
+    }
+}
+
+void Inversions(const UFFInversionBlock& inversions, const Matrix& geometry, double factor, HessianTriplets& hessian, const UnitCell* cell)
+{
+    for (int t = 0; t < inversions.size(); ++t) {
+        const int atoms[4] = { inversions.i[t], inversions.j[t], inversions.k[t], inversions.l[t] };
+        Block(
+            geometry, atoms, [&](const auto* r) { return UFFTerms::Inversion(r, r + 3, r + 6, r + 9, inversions.kijkl[t], inversions.C0[t], inversions.C1[t], inversions.C2[t]); }, factor, hessian, cell);
+    }
+}
+
+void vdWs(const UFFvdWBlock& vdws, const Matrix& geometry, double factor, double vdw_scaling, double rep_scaling, double cutoff, double switch_on, HessianTriplets& hessian, const UnitCell* cell)
+{
+    for (int t = 0; t < vdws.size(); ++t) {
+        const int atoms[2] = { vdws.i[t], vdws.j[t] };
+        const double Dij = vdws.Dij[vdws.type[t]], xij = vdws.xij[vdws.type[t]];
+        Block(
+            geometry, atoms, [&](const auto* r) { return UFFTerms::vdW(r, r + 3, Dij, xij, vdw_scaling, rep_scaling, cutoff, switch_on); }, factor, hessian, cell);
+    }
+}
+}
@@ -0,0 +1,127 @@
+/*
+ * <Vectorised UFF term kernels. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "isa.h"
+#include "uff_kernels.h"
+
+namespace UFFKernels {
+
+namespace Generic {
+#include "uff_kernels_impl.h"
+}
+
+#ifdef ISA_DISPATCH
+ISA_TARGET_AVX2
+namespace AVX2 {
+#include "uff_kernels_impl.h"
+}
+ISA_TARGET_END
+
+ISA_TARGET_AVX512
+namespace AVX512 {
+#include "uff_kernels_impl.h"
+}
+ISA_TARGET_END
+#endif
+
+int SimdWidth()
+{
+    return ISA::Width(ISA::Selected());
+}
+
+template <typename Scalar>
+double Bonds(const UFFBondBlockT<Scalar>& bonds, const MatrixX<Scalar>& geometry, MatrixX<Scalar>& gradient, double factor, bool calc_gradient, int first_atom, const UnitCell* cell)
+{
+    ISA_CALL(Bonds(bonds, geometry, gradient, factor, calc_gradient, first_atom, cell))
+}
+
+template <typename Scalar>
+double Angles(const UFFAngleBlockT<Scalar>& angles, const MatrixX<Scalar>& geometry, MatrixX<Scalar>& gradient, double factor, bool calc_gradient, int first_atom, const UnitCell* cell)
+{
+    ISA_CALL(Angles(angles, geometry, gradient, factor, calc_gradient, first_atom, cell))
+}
+
+template <typename Scalar>
+double Dihedrals(const UFFDihedralBlockT<Scalar>& dihedrals, const MatrixX<Scalar>& geometry, MatrixX<Scalar>& gradient, double factor, bool calc_gradient, int first_atom, const UnitCell* cell)
+{
+    ISA_CALL(Dihedrals(dihedrals, geometry, gradient, factor, calc_gradient, first_atom, cell))
+}
+
+template <typename Scalar>
+double Inversions(const UFFInversionBlockT<Scalar>& inversions, const MatrixX<Scalar>& geometry, MatrixX<Scalar>& gradient, double factor, bool calc_gradient, int first_atom, const UnitCell* cell)
+{
+    ISA_CALL(Inversions(inversions, geometry, gradient, factor, calc_gradient, first_atom, cell))
+}
+
+template <typename Scalar>
+double vdWs(const UFFvdWBlockT<Scalar>& vdws, const MatrixX<Scalar>& geometry, MatrixX<Scalar>& gradient, double factor, double vdw_scaling, double rep_scaling, double cutoff, double switch_on, bool calc_gradient, int first_atom, const UnitCell* cell)
+{
+    ISA_CALL(vdWs(vdws, geometry, gradient, factor, vdw_scaling, rep_scaling, cutoff, switch_on, calc_gradient, first_atom, cell))
+}
+
+template <typename Scalar>
+double Coulombs(const UFFvdWBlockT<Scalar>& pairs, const MatrixX<Scalar>& geometry, const Scalar* charges, MatrixX<Scalar>& gradient, double factor, double damping, double cutoff, bool calc_gradient, int first_atom, const UnitCell* cell)
+{
+    ISA_CALL(Coulombs(pairs, geometry, charges, gradient, factor, damping, cutoff, calc_gradient, first_atom, cell))
+}
+
+/* screening runs the same kernels in single precision */
+template double Bonds(const UFFBondBlockT<double>&, const MatrixX<double>&, MatrixX<double>&, double, bool, int, const UnitCell*);
+template double Angles(const UFFAngleBlockT<double>&, const MatrixX<double>&, MatrixX<double>&, double, bool, int, const UnitCell*);
+template double Dihedrals(const UFFDihedralBlockT<double>&, const MatrixX<double>&, MatrixX<double>&, double, bool, int, const UnitCell*);
+template double Inversions(const UFFInversionBlockT<double>&, const MatrixX<double>&, MatrixX<double>&, double, bool, int, const UnitCell*);
+template double vdWs(const UFFvdWBlockT<double>&, const MatrixX<double>&, MatrixX<double>&, double, double, double, double, double, bool, int, const UnitCell*);
+template double Coulombs(const UFFvdWBlockT<double>&, const MatrixX<double>&, const double*, MatrixX<double>&, double, double, double, bool, int, const UnitCell*);
+
+template double Bonds(const UFFBondBlockT<float>&, const MatrixX<float>&, MatrixX<float>&, double, bool, int, const UnitCell*);
+template double Angles(const UFFAngleBlockT<float>&, const MatrixX<float>&, MatrixX<float>&, double, bool, int, const UnitCell*);
+template double Dihedrals(const UFFDihedralBlockT<float>&, const MatrixX<float>&, MatrixX<float>&, double, bool, int, const UnitCell*);
+template double Inversions(const UFFInversionBlockT<float>&, const MatrixX<float>&, MatrixX<float>&, double, bool, int, const UnitCell*);
+template double vdWs(const UFFvdWBlockT<float>&, const MatrixX<float>&, MatrixX<float>&, double, double, double, double, double, bool, int, const UnitCell*);
+template double Coulombs(const UFFvdWBlockT<float>&, const MatrixX<float>&, const float*, MatrixX<float>&, double, double, double, bool, int, const UnitCell*);
+
+void Bonds(const UFFBondBlock& bonds, const Batch& batch, double factor, bool calc_gradient)
+{
+    ISA_CALL(Bonds(bonds, batch, factor, calc_gradient))
+}
+
+void Angles(const UFFAngleBlock& angles, const Batch& batch, double factor, bool calc_gradient)
+{
+    ISA_CALL(Angles(angles, batch, factor, calc_gradient))
+}
+
+void Dihedrals(const UFFDihedralBlock& dihedrals, const Batch& batch, double factor, bool calc_gradient)
+{
+    ISA_CALL(Dihedrals(dihedrals, batch, factor, calc_gradient))
+}
+
+void Inversions(const UFFInversionBlock& inversions, const Batch& batch, double factor, bool calc_gradient)
+{
+    ISA_CALL(Inversions(inversions, batch, factor, calc_gradient))
+}
+
+void vdWs(const UFFvdWBlock& vdws, const Batch& batch, double factor, double vdw_scaling, double rep_scaling, double cutoff, double switch_on, bool calc_gradient)
+{
+    ISA_CALL(vdWs(vdws, batch, factor, vdw_scaling, rep_scaling, cutoff, switch_on, calc_gradient))
+}
+}
@@ -0,0 +1,111 @@
+/*
+ * <Vectorised UFF term kernels. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "src/core/global.h"
+#include "src/core/uff_par.h"
+#include "src/core/unitcell.h"
+
+#include <Eigen/Sparse>
+
+/* Every kernel runs in blocks: the terms of one block are evaluated in a
+ * vectorisable loop (4 doubles per instruction with AVX2, 8 with AVX-512,
+ * the baseline of the build otherwise, see isa.h for the runtime selection),
+ * the forces are kept in a small buffer and scattered to the gradient afterwards.
+ * Geometry and gradient are N x 3 column major matrices, so x, y and z are
+ * contiguous columns. The gradient may hold only a window of the atoms,
+ * its first row belongs to first_atom. The returned energies are scaled by
+ * factor, gradients are only touched if calc_gradient is true. With a periodic
+ * cell every distance vector is taken as its minimum image.
+ * The single term kernels are instantiated for double and float, the float
+ * version packs twice as many terms into a vector and is meant for screening,
+ * the energy of every block is summed up in double. */
+
+namespace UFFKernels {
+
+/*! \brief Doubles per vector of the kernels selected at runtime */
+int SimdWidth();
+
+const int BlockSize = 64;
+
+template <typename Scalar>
+using MatrixX = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+
+template <typename Scalar>
+double Bonds(const UFFBondBlockT<Scalar>& bonds, const MatrixX<Scalar>& geometry, MatrixX<Scalar>& gradient, double factor, bool calc_gradient, int first_atom = 0, const UnitCell* cell = nullptr);
+
+template <typename Scalar>
+double Angles(const UFFAngleBlockT<Scalar>& angles, const MatrixX<Scalar>& geometry, MatrixX<Scalar>& gradient, double factor, bool calc_gradient, int first_atom = 0, const UnitCell* cell = nullptr);
+
+template <typename Scalar>
+double Dihedrals(const UFFDihedralBlockT<Scalar>& dihedrals, const MatrixX<Scalar>& geometry, MatrixX<Scalar>& gradient, double factor, bool calc_gradient, int first_atom = 0, const UnitCell* cell = nullptr);
+
+template <typename Scalar>
+double Inversions(const UFFInversionBlockT<Scalar>& inversions, const MatrixX<Scalar>& geometry, MatrixX<Scalar>& gradient, double factor, bool calc_gradient, int first_atom = 0, const UnitCell* cell = nullptr);
+
+/*! \brief Lennard-Jones type UFF nonbonds, for cutoff > 0 pairs beyond cutoff are skipped and the energy is switched off between switch_on and cutoff */
+template <typename Scalar>
+double vdWs(const UFFvdWBlockT<Scalar>& vdws, const MatrixX<Scalar>& geometry, MatrixX<Scalar>& gradient, double factor, double vdw_scaling, double rep_scaling, double cutoff, double switch_on, bool calc_gradient, int first_atom = 0, const UnitCell* cell = nullptr);
+
+/*! \brief Coulomb energy of fixed point charges (in e) over the nonbonded pairs, for cutoff > 0 as damped shifted force
+ * with the damping parameter alpha in 1 / Angstrom, pairs beyond cutoff are skipped. factor converts e^2 / Angstrom to Eh */
+template <typename Scalar>
+double Coulombs(const UFFvdWBlockT<Scalar>& pairs, const MatrixX<Scalar>& geometry, const Scalar* charges, MatrixX<Scalar>& gradient, double factor, double damping, double cutoff, bool calc_gradient, int first_atom = 0, const UnitCell* cell = nullptr);
+
+/* The batched kernels evaluate the same terms for many conformers of one molecule.
+ * The inner loops run over the conformers, so the parameters of a term are loaded
+ * once per batch and coordinates, gradients and energies are contiguous streams. */
+
+/*! \brief Conformers of one molecule, coordinate c of atom a in conformer k is at [(3 * a + c) * stride + k].
+ * A K x 3N column major matrix with one conformer per row has exactly this layout with stride = K.
+ * The energies of all terms are added to energy[k], gradient is only used if calc_gradient is true. */
+struct Batch {
+    const double* geometry;
+    double* gradient;
+    double* energy;
+    int conformers;
+    int stride;
+};
+
+void Bonds(const UFFBondBlock& bonds, const Batch& batch, double factor, bool calc_gradient);
+
+void Angles(const UFFAngleBlock& angles, const Batch& batch, double factor, bool calc_gradient);
+
+void Dihedrals(const UFFDihedralBlock& dihedrals, const Batch& batch, double factor, bool calc_gradient);
+
+void Inversions(const UFFInversionBlock& inversions, const Batch& batch, double factor, bool calc_gradient);
+
+void vdWs(const UFFvdWBlock& vdws, const Batch& batch, double factor, double vdw_scaling, double rep_scaling, double cutoff, double switch_on, bool calc_gradient);
+
+/* Analytic second derivatives of the same terms, uff_hessian.cpp differentiates the expressions of uff_terms.h twice
+ * with nested dual numbers. Every term adds its entries at rows and columns 3 * atom + coordinate, entries of one position
+ * are summed when the sparse matrix is built. With a periodic cell the terms take the minimum images of their atoms. */
+typedef std::vector<Eigen::Triplet<double>> HessianTriplets;
+
+void Bonds(const UFFBondBlock& bonds, const Matrix& geometry, double factor, HessianTriplets& hessian, const UnitCell* cell = nullptr);
+
+void Angles(const UFFAngleBlock& angles, const Matrix& geometry, double factor, HessianTriplets& hessian, const UnitCell* cell = nullptr);
+
+void Dihedrals(const UFFDihedralBlock& dihedrals, const Matrix& geometry, double factor, HessianTriplets& hessian, const UnitCell* cell = nullptr);
+
+void Inversions(const UFFInversionBlock& inversions, const Matrix& geometry, double factor, HessianTriplets& hessian, const UnitCell* cell = nullptr);
+
+void vdWs(const UFFvdWBlock& vdws, const Matrix& geometry, double factor, double vdw_scaling, double rep_scaling, double cutoff, double switch_on, HessianTriplets& hessian, const UnitCell* cell = nullptr);
+}
@@ -0,0 +1,780 @@
+/*
+ * <Vectorised UFF term kernels, compiled once per instruction set. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* No include guard, uff_kernels.cpp includes this file once for every instruction set level,
+ * each time inside its own namespace. Only the kernel bodies belong here. */
+
+/* forces of the first atoms of a term, the last one follows from translational invariance */
+template <typename Scalar>
+struct ForceBuffer {
+    alignas(64) Scalar x[4][BlockSize];
+    alignas(64) Scalar y[4][BlockSize];
+    alignas(64) Scalar z[4][BlockSize];
+};
+
+template <typename Scalar>
+inline void Scatter(MatrixX<Scalar>& gradient, int first_atom, const int* const* index, int bodies, int start, int count, const ForceBuffer<Scalar>& f)
+{
+    const int atoms = gradient.rows();
+    Scalar* gx = gradient.data();
+    Scalar* gy = gx + atoms;
+    Scalar* gz = gy + atoms;
+    for (int t = 0; t < count; ++t) {
+        Scalar sx = 0, sy = 0, sz = 0;
+        for (int b = 0; b < bodies - 1; ++b) {
+            const int atom = index[b][start + t] - first_atom;
+            gx[atom] += f.x[b][t];
+            gy[atom] += f.y[b][t];
+            gz[atom] += f.z[b][t];
+            sx += f.x[b][t];
+            sy += f.y[b][t];
+            sz += f.z[b][t];
+        }
+        const int last = index[bodies - 1][start + t] - first_atom;
+        gx[last] -= sx;
+        gy[last] -= sy;
+        gz[last] -= sz;
+    }
+}
+
+template <typename Scalar>
+double Bonds(const UFFBondBlockT<Scalar>& bonds, const MatrixX<Scalar>& geometry, MatrixX<Scalar>& gradient, double factor, bool calc_gradient, int first_atom, const UnitCell* cell)
+{
+    const int atoms = geometry.rows();
+    const bool periodic = cell && cell->isPeriodic();
+    const Scalar* x = geometry.data();
+    const Scalar* y = x + atoms;
+    const Scalar* z = y + atoms;
+
+    const int* bi = bonds.i.data();
+    const int* bj = bonds.j.data();
+    const Scalar* r0 = bonds.r0.data();
+    const Scalar* kij = bonds.kij.data();
+    const int* index[2] = { bi, bj };
+
+    const Scalar scale = Scalar(factor);
+    ForceBuffer<Scalar> f;
+    double energy = 0.0;
+    const int size = bonds.size();
+    for (int start = 0; start < size; start += BlockSize) {
+        const int count = std::min(BlockSize, size - start);
+        Scalar block = 0;
+#pragma omp simd reduction(+ : block)
+        for (int t = 0; t < count; ++t) {
+            const int i = bi[start + t];
+            const int j = bj[start + t];
+            Scalar dx = x[i] - x[j];
+            Scalar dy = y[i] - y[j];
+            Scalar dz = z[i] - z[j];
+            if (periodic)
+                cell->MinimumImage(dx, dy, dz);
+            const Scalar r = std::sqrt(dx * dx + dy * dy + dz * dz);
+            const Scalar d = r - r0[start + t];
+            block += Scalar(0.5) * kij[start + t] * d * d;
+
+            const Scalar diff = kij[start + t] * d / r * scale;
+            f.x[0][t] = diff * dx;
+            f.y[0][t] = diff * dy;
+            f.z[0][t] = diff * dz;
+        }
+        energy += block;
+        if (calc_gradient)
+            Scatter(gradient, first_atom, index, 2, start, count, f);
+    }
+    return energy * factor;
+}
+
+template <typename Scalar>
+double Angles(const UFFAngleBlockT<Scalar>& angles, const MatrixX<Scalar>& geometry, MatrixX<Scalar>& gradient, double factor, bool calc_gradient, int first_atom, const UnitCell* cell)
+{
+    const int atoms = geometry.rows();
+    const bool periodic = cell && cell->isPeriodic();
+    const Scalar* x = geometry.data();
+    const Scalar* y = x + atoms;
+    const Scalar* z = y + atoms;
+
+    const int* ai = angles.i.data();
+    const int* aj = angles.j.data();
+    const int* ak = angles.k.data();
+    const Scalar* kijk = angles.kijk.data();
+    const Scalar* C0 = angles.C0.data();
+    const Scalar* C1 = angles.C1.data();
+    const Scalar* C2 = angles.C2.data();
+    const int* index[3] = { ai, ak, aj };
+
+    const Scalar scale = Scalar(factor);
+    ForceBuffer<Scalar> f;
+    double energy = 0.0;
+    const int size = angles.size();
+    for (int start = 0; start < size; start += BlockSize) {
+        const int count = std::min(BlockSize, size - start);
+        Scalar block = 0;
+#pragma omp simd reduction(+ : block)
+        for (int t = 0; t < count; ++t) {
+            const int i = ai[start + t];
+            const int j = aj[start + t];
+            const int k = ak[start + t];
+            Scalar ax = x[i] - x[j], ay = y[i] - y[j], az = z[i] - z[j];
+            Scalar bx = x[k] - x[j], by = y[k] - y[j], bz = z[k] - z[j];
+            if (periodic) {
+                cell->MinimumImage(ax, ay, az);
+                cell->MinimumImage(bx, by, bz);
+            }
+            const Scalar a2 = ax * ax + ay * ay + az * az;
+            const Scalar b2 = bx * bx + by * by + bz * bz;
+            const Scalar inv_ab = Scalar(1) / std::sqrt(a2 * b2);
+            const Scalar costheta = (ax * bx + ay * by + az * bz) * inv_ab;
+            const Scalar K = kijk[start + t];
+
+            block += K * (C0[start + t] + C1[start + t] * costheta + C2[start + t] * (2 * costheta * costheta - 1));
+
+            const Scalar dEdcos = K * (C1[start + t] + 4 * C2[start + t] * costheta) * scale;
+            f.x[0][t] = dEdcos * (bx * inv_ab - costheta * ax / a2);
+            f.y[0][t] = dEdcos * (by * inv_ab - costheta * ay / a2);
+            f.z[0][t] = dEdcos * (bz * inv_ab - costheta * az / a2);
+
+            f.x[1][t] = dEdcos * (ax * inv_ab - costheta * bx / b2);
+            f.y[1][t] = dEdcos * (ay * inv_ab - costheta * by / b2);
+            f.z[1][t] = dEdcos * (az * inv_ab - costheta * bz / b2);
+        }
+        energy += block;
+        if (calc_gradient)
+            Scatter(gradient, first_atom, index, 3, start, count, f);
+    }
+    return energy * factor;
+}
+
+template <typename Scalar>
+double Dihedrals(const UFFDihedralBlockT<Scalar>& dihedrals, const MatrixX<Scalar>& geometry, MatrixX<Scalar>& gradient, double factor, bool calc_gradient, int first_atom, const UnitCell* cell)
+{
+    const int atoms = geometry.rows();
+    const bool periodic = cell && cell->isPeriodic();
+    const Scalar* x = geometry.data();
+    const Scalar* y = x + atoms;
+    const Scalar* z = y + atoms;
+
+    const int* di = dihedrals.i.data();
+    const int* dj = dihedrals.j.data();
+    const int* dk = dihedrals.k.data();
+    const int* dl = dihedrals.l.data();
+    const Scalar* p0 = dihedrals.p[0].data();
+    const Scalar* p1 = dihedrals.p[1].data();
+    const Scalar* p2 = dihedrals.p[2].data();
+    const Scalar* p3 = dihedrals.p[3].data();
+    const Scalar* p4 = dihedrals.p[4].data();
+    const Scalar* p5 = dihedrals.p[5].data();
+    const Scalar* p6 = dihedrals.p[6].data();
+    const int* index[4] = { di, dj, dk, dl };
+
+    const Scalar scale = Scalar(factor);
+    ForceBuffer<Scalar> f;
+    double energy = 0.0;
+    const int size = dihedrals.size();
+    for (int start = 0; start < size; start += BlockSize) {
+        const int count = std::min(BlockSize, size - start);
+        Scalar block = 0;
+#pragma omp simd reduction(+ : block)
+        for (int t = 0; t < count; ++t) {
+            const int i = di[start + t];
+            const int j = dj[start + t];
+            const int k = dk[start + t];
+            const int l = dl[start + t];
+
+            /* n1 = (j - i) x (j - k), n2 = (k - j) x (k - l) */
+            Scalar Ax = x[j] - x[i], Ay = y[j] - y[i], Az = z[j] - z[i];
+            Scalar Bx = x[j] - x[k], By = y[j] - y[k], Bz = z[j] - z[k];
+            Scalar Dx = x[k] - x[l], Dy = y[k] - y[l], Dz = z[k] - z[l];
+            if (periodic) {
+                cell->MinimumImage(Ax, Ay, Az);
+                cell->MinimumImage(Bx, By, Bz);
+                cell->MinimumImage(Dx, Dy, Dz);
+            }
+            const Scalar Cx = -Bx, Cy = -By, Cz = -Bz;
+
+            const Scalar n1x = Ay * Bz - Az * By, n1y = Az * Bx - Ax * Bz, n1z = Ax * By - Ay * Bx;
+            const Scalar n2x = Cy * Dz - Cz * Dy, n2y = Cz * Dx - Cx * Dz, n2z = Cx * Dy - Cy * Dx;
+
+            const Scalar l1 = std::sqrt(n1x * n1x + n1y * n1y + n1z * n1z);
+            const Scalar l2 = std::sqrt(n2x * n2x + n2y * n2y + n2z * n2z);
+            /* linear arrangements have no defined torsion, these terms are masked out */
+            const Scalar valid = (l1 > Scalar(1e-10)) & (l2 > Scalar(1e-10)) ? Scalar(1) : Scalar(0);
+            const Scalar inv1 = valid / std::max(l1, Scalar(1e-10));
+            const Scalar inv2 = valid / std::max(l2, Scalar(1e-10));
+
+            const Scalar cosphi = (n1x * n2x + n1y * n2y + n1z * n2z) * inv1 * inv2;
+            const Scalar c = cosphi > 1 ? Scalar(1) : (cosphi < -1 ? Scalar(-1) : cosphi);
+
+            const Scalar e = p0[start + t] + c * (p1[start + t] + c * (p2[start + t] + c * (p3[start + t] + c * (p4[start + t] + c * (p5[start + t] + c * p6[start + t])))));
+            block += valid * e;
+
+            const Scalar dEdc = (p1[start + t] + c * (2 * p2[start + t] + c * (3 * p3[start + t] + c * (4 * p4[start + t] + c * (5 * p5[start + t] + c * 6 * p6[start + t]))))) * scale;
+
+            /* derivatives of c with respect to the normal vectors */
+            const Scalar g1x = (n2x * inv2 - c * n1x * inv1) * inv1;
+            const Scalar g1y = (n2y * inv2 - c * n1y * inv1) * inv1;
+            const Scalar g1z = (n2z * inv2 - c * n1z * inv1) * inv1;
+            const Scalar g2x = (n1x * inv1 - c * n2x * inv2) * inv2;
+            const Scalar g2y = (n1y * inv1 - c * n2y * inv2) * inv2;
+            const Scalar g2z = (n1z * inv1 - c * n2z * inv2) * inv2;
+
+            /* B x g1, g1 x A, D x g2, g2 x C */
+            const Scalar bgx = By * g1z - Bz * g1y, bgy = Bz * g1x - Bx * g1z, bgz = Bx * g1y - By * g1x;
+            const Scalar gax = g1y * Az - g1z * Ay, gay = g1z * Ax - g1x * Az, gaz = g1x * Ay - g1y * Ax;
+            const Scalar dgx = Dy * g2z - Dz * g2y, dgy = Dz * g2x - Dx * g2z, dgz = Dx * g2y - Dy * g2x;
+            const Scalar gcx = g2y * Cz - g2z * Cy, gcy = g2z * Cx - g2x * Cz, gcz = g2x * Cy - g2y * Cx;
+
+            f.x[0][t] = -dEdc * bgx;
+            f.y[0][t] = -dEdc * bgy;
+            f.z[0][t] = -dEdc * bgz;
+
+            f.x[1][t] = dEdc * (bgx + gax - dgx);
+            f.y[1][t] = dEdc * (bgy + gay - dgy);
+            f.z[1][t] = dEdc * (bgz + gaz - dgz);
+
+            f.x[2][t] = dEdc * (dgx + gcx - gax);
+            f.y[2][t] = dEdc * (dgy + gcy - gay);
+            f.z[2][t] = dEdc * (dgz + gcz - gaz);
+        }
+        energy += block;
+        if (calc_gradient)
+            Scatter(gradient, first_atom, index, 4, start, count, f);
+    }
+    return energy * factor;
+}
+
+template <typename Scalar>
+double Inversions(const UFFInversionBlockT<Scalar>& inversions, const MatrixX<Scalar>& geometry, MatrixX<Scalar>& gradient, double factor, bool calc_gradient, int first_atom, const UnitCell* cell)
+{
+    const int atoms = geometry.rows();
+    const bool periodic = cell && cell->isPeriodic();
+    const Scalar* x = geometry.data();
+    const Scalar* y = x + atoms;
+    const Scalar* z = y + atoms;
+
+    const int* ii = inversions.i.data();
+    const int* ij = inversions.j.data();
+    const int* ik = inversions.k.data();
+    const int* il = inversions.l.data();
+    const Scalar* kijkl = inversions.kijkl.data();
+    const Scalar* C0 = inversions.C0.data();
+    const Scalar* C1 = inversions.C1.data();
+    const Scalar* C2 = inversions.C2.data();
+    const int* index[4] = { ij, ik, il, ii };
+
+    const Scalar scale = Scalar(factor);
+    ForceBuffer<Scalar> f;
+    double energy = 0.0;
+    const int size = inversions.size();
+    for (int start = 0; start < size; start += BlockSize) {
+        const int count = std::min(BlockSize, size - start);
+        Scalar block = 0;
+#pragma omp simd reduction(+ : block)
+        for (int t = 0; t < count; ++t) {
+            const int i = ii[start + t];
+            const int j = ij[start + t];
+            const int k = ik[start + t];
+            const int l = il[start + t];
+
+            /* i is the central atom, Y is the angle between the normal of the i-j-k plane and the i-l bond */
+            Scalar ax = x[j] - x[i], ay = y[j] - y[i], az = z[j] - z[i];
+            Scalar bx = x[k] - x[i], by = y[k] - y[i], bz = z[k] - z[i];
+            Scalar cx = x[l] - x[i], cy = y[l] - y[i], cz = z[l] - z[i];
+            if (periodic) {
+                cell->MinimumImage(ax, ay, az);
+                cell->MinimumImage(bx, by, bz);
+                cell->MinimumImage(cx, cy, cz);
+            }
+
+            const Scalar mx = ay * bz - az * by, my = az * bx - ax * bz, mz = ax * by - ay * bx;
+            const Scalar lm = std::sqrt(mx * mx + my * my + mz * mz);
+            const Scalar lc = std::sqrt(cx * cx + cy * cy + cz * cz);
+            const Scalar valid = (lm > Scalar(1e-10)) & (lc > Scalar(1e-10)) ? Scalar(1) : Scalar(0);
+            const Scalar inv_m = valid / std::max(lm, Scalar(1e-10));
+            const Scalar inv_c = valid / std::max(lc, Scalar(1e-10));
+
+            const Scalar cosY = (mx * cx + my * cy + mz * cz) * inv_m * inv_c;
+            const Scalar sin2 = 1 - cosY * cosY;
+            const Scalar sin2Y = sin2 > 0 ? sin2 : Scalar(0);
+            const Scalar sinY = std::sqrt(sin2Y);
+            const Scalar K = kijkl[start + t];
+
+            const Scalar e = K * (C0[start + t] + C1[start + t] * sinY + C2[start + t] * (sin2Y - 1));
+            block += valid * e;
+
+            const Scalar dEdcos = -K * cosY * (C1[start + t] / (sinY > Scalar(1e-8) ? sinY : Scalar(1e-8)) + 2 * C2[start + t]) * scale;
+
+            const Scalar gmx = cx * inv_m * inv_c - cosY * mx * inv_m * inv_m;
+            const Scalar gmy = cy * inv_m * inv_c - cosY * my * inv_m * inv_m;
+            const Scalar gmz = cz * inv_m * inv_c - cosY * mz * inv_m * inv_m;
+
+            /* j: b x gm, k: gm x a, l: dcos/dc */
+            f.x[0][t] = dEdcos * (by * gmz - bz * gmy);
+            f.y[0][t] = dEdcos * (bz * gmx - bx * gmz);
+            f.z[0][t] = dEdcos * (bx * gmy - by * gmx);
+
+            f.x[1][t] = dEdcos * (gmy * az - gmz * ay);
+            f.y[1][t] = dEdcos * (gmz * ax - gmx * az);
+            f.z[1][t] = dEdcos * (gmx * ay - gmy * ax);
+
+            f.x[2][t] = dEdcos * (mx * inv_m * inv_c - cosY * cx * inv_c * inv_c);
+            f.y[2][t] = dEdcos * (my * inv_m * inv_c - cosY * cy * inv_c * inv_c);
+            f.z[2][t] = dEdcos * (mz * inv_m * inv_c - cosY * cz * inv_c * inv_c);
+        }
+        energy += block;
+        if (calc_gradient)
+            Scatter(gradient, first_atom, index, 4, start, count, f);
+    }
+    return energy * factor;
+}
+
+template <typename Scalar>
+double vdWs(const UFFvdWBlockT<Scalar>& vdws, const MatrixX<Scalar>& geometry, MatrixX<Scalar>& gradient, double factor, double vdw_scaling, double rep_scaling, double cutoff, double switch_on, bool calc_gradient, int first_atom, const UnitCell* cell)
+{
+    const int atoms = geometry.rows();
+    const bool periodic = cell && cell->isPeriodic();
+    const Scalar* x = geometry.data();
+    const Scalar* y = x + atoms;
+    const Scalar* z = y + atoms;
+
+    const int* vi = vdws.i.data();
+    const int* vj = vdws.j.data();
+    const int* type = vdws.type.data();
+    const Scalar* Dij = vdws.Dij.data();
+    const Scalar* xij = vdws.xij.data();
+    const int* index[2] = { vi, vj };
+
+    /* without cutoff both radii are pushed to infinity, so the switching below is a no-op.
+     * Both branches of the switch are evaluated and selected afterwards, which keeps the loop vectorisable */
+    const bool switching = cutoff > 0;
+    const double cut2 = switching ? cutoff * cutoff : std::numeric_limits<double>::infinity();
+    const double on2 = switching ? switch_on * switch_on : std::numeric_limits<double>::infinity();
+    const Scalar rc2 = Scalar(cut2), ron2 = Scalar(on2);
+    const Scalar inv_denom = Scalar(switching && cut2 > on2 ? 1.0 / ((cut2 - on2) * (cut2 - on2) * (cut2 - on2)) : 0.0);
+    const Scalar vdw = Scalar(vdw_scaling), rep = Scalar(rep_scaling);
+
+    const Scalar scale = Scalar(factor);
+    ForceBuffer<Scalar> f;
+    double energy = 0.0;
+    const int size = vdws.size();
+    for (int start = 0; start < size; start += BlockSize) {
+        const int count = std::min(BlockSize, size - start);
+        Scalar block = 0;
+#pragma omp simd reduction(+ : block)
+        for (int t = 0; t < count; ++t) {
+            const int i = vi[start + t];
+            const int j = vj[start + t];
+            const Scalar D = Dij[type[start + t]];
+            const Scalar X = xij[type[start + t]];
+            Scalar dx = x[i] - x[j];
+            Scalar dy = y[i] - y[j];
+            Scalar dz = z[i] - z[j];
+            if (periodic)
+                cell->MinimumImage(dx, dy, dz);
+            const Scalar r2 = dx * dx + dy * dy + dz * dz;
+            const Scalar s2 = X * X / r2;
+            const Scalar pow6 = s2 * s2 * s2;
+
+            const Scalar e = D * (-2 * pow6 * vdw + pow6 * pow6 * rep) * scale;
+            const Scalar diff = 12 * D * (pow6 * vdw - pow6 * pow6 * rep) / r2 * scale;
+
+            const bool inside = r2 < rc2;
+            const bool in_switch = r2 > ron2;
+            const Scalar sw = (rc2 - r2) * (rc2 - r2) * (rc2 + 2 * r2 - 3 * ron2) * inv_denom;
+            const Scalar dsw = 12 * (rc2 - r2) * (ron2 - r2) * inv_denom;
+            const Scalar S = inside ? (in_switch ? sw : Scalar(1)) : Scalar(0);
+            const Scalar dSdr_r = inside & in_switch ? dsw : Scalar(0);
+
+            block += e * S;
+            const Scalar force = diff * S + e * dSdr_r;
+            f.x[0][t] = force * dx;
+            f.y[0][t] = force * dy;
+            f.z[0][t] = force * dz;
+        }
+        energy += block;
+        if (calc_gradient)
+            Scatter(gradient, first_atom, index, 2, start, count, f);
+    }
+    return energy;
+}
+
+template <typename Scalar>
+double Coulombs(const UFFvdWBlockT<Scalar>& pairs, const MatrixX<Scalar>& geometry, const Scalar* charges, MatrixX<Scalar>& gradient, double factor, double damping, double cutoff, bool calc_gradient, int first_atom, const UnitCell* cell)
+{
+    const int atoms = geometry.rows();
+    const bool periodic = cell && cell->isPeriodic();
+    const Scalar* x = geometry.data();
+    const Scalar* y = x + atoms;
+    const Scalar* z = y + atoms;
+
+    const int* vi = pairs.i.data();
+    const int* vj = pairs.j.data();
+    const int* index[2] = { vi, vj };
+
+    /* damped shifted force, Fennell and Gezelter, J. Chem. Phys. 124, 234104 (2006) - DOI: 10.1063/1.2206581
+     * energy and force go to zero at the cutoff, without cutoff alpha = 0 and the shifts vanish, which is plain Coulomb */
+    const bool shifted = cutoff > 0;
+    const double a = shifted ? damping : 0.0;
+    const Scalar alpha = Scalar(a);
+    const Scalar rc = Scalar(cutoff);
+    const Scalar rc2 = Scalar(shifted ? cutoff * cutoff : std::numeric_limits<double>::infinity());
+    const Scalar two_alpha_pi = Scalar(2 * a / std::sqrt(pi));
+    const Scalar shift_energy = Scalar(shifted ? std::erfc(a * cutoff) / cutoff : 0.0);
+    const Scalar shift_force = Scalar(shifted ? std::erfc(a * cutoff) / (cutoff * cutoff) + 2 * a / std::sqrt(pi) * std::exp(-a * a * cutoff * cutoff) / cutoff : 0.0);
+
+    const Scalar scale = Scalar(factor);
+    ForceBuffer<Scalar> f;
+    double energy = 0.0;
+    const int size = pairs.size();
+    for (int start = 0; start < size; start += BlockSize) {
+        const int count = std::min(BlockSize, size - start);
+        Scalar block = 0;
+#pragma omp simd reduction(+ : block)
+        for (int t = 0; t < count; ++t) {
+            const int i = vi[start + t];
+            const int j = vj[start + t];
+            Scalar dx = x[i] - x[j];
+            Scalar dy = y[i] - y[j];
+            Scalar dz = z[i] - z[j];
+            if (periodic)
+                cell->MinimumImage(dx, dy, dz);
+            const Scalar r2 = dx * dx + dy * dy + dz * dz;
+            const Scalar r = std::sqrt(r2);
+            const Scalar qq = r2 < rc2 ? charges[i] * charges[j] * scale : Scalar(0);
+            const Scalar erfc_r = std::erfc(alpha * r);
+
+            block += qq * (erfc_r / r - shift_energy + shift_force * (r - rc));
+            const Scalar dEdr = qq * (shift_force - erfc_r / r2 - two_alpha_pi * std::exp(-alpha * alpha * r2) / r);
+            f.x[0][t] = dEdr / r * dx;
+            f.y[0][t] = dEdr / r * dy;
+            f.z[0][t] = dEdr / r * dz;
+        }
+        energy += block;
+        if (calc_gradient)
+            Scatter(gradient, first_atom, index, 2, start, count, f);
+    }
+    return energy;
+}
+
+/* columns of one atom in a batch, the gradient columns are only set up if a gradient is requested */
+struct BatchAtom {
+    BatchAtom(const Batch& batch, int atom)
+        : x(batch.geometry + 3 * atom * batch.stride)
+        , y(x + batch.stride)
+        , z(y + batch.stride)
+    {
+    }
+    const double *x, *y, *z;
+};
+
+struct BatchForce {
+    BatchForce() = default;
+    BatchForce(const Batch& batch, int atom)
+        : x(batch.gradient + 3 * atom * batch.stride)
+        , y(x + batch.stride)
+        , z(y + batch.stride)
+    {
+    }
+    double *x = nullptr, *y = nullptr, *z = nullptr;
+};
+
+template <bool Gradient>
+void BatchBonds(const UFFBondBlock& bonds, const Batch& batch, double factor)
+{
+    double* energy = batch.energy;
+    for (int t = 0; t < bonds.size(); ++t) {
+        const BatchAtom ai(batch, bonds.i[t]), aj(batch, bonds.j[t]);
+        const BatchForce fi = Gradient ? BatchForce(batch, bonds.i[t]) : BatchForce();
+        const BatchForce fj = Gradient ? BatchForce(batch, bonds.j[t]) : BatchForce();
+        const double r0 = bonds.r0[t];
+        const double kij = bonds.kij[t] * factor;
+#pragma omp simd
+        for (int k = 0; k < batch.conformers; ++k) {
+            const double dx = ai.x[k] - aj.x[k];
+            const double dy = ai.y[k] - aj.y[k];
+            const double dz = ai.z[k] - aj.z[k];
+            const double r = std::sqrt(dx * dx + dy * dy + dz * dz);
+            const double d = r - r0;
+            energy[k] += 0.5 * kij * d * d;
+            if (Gradient) {
+                const double diff = kij * d / r;
+                fi.x[k] += diff * dx;
+                fi.y[k] += diff * dy;
+                fi.z[k] += diff * dz;
+                fj.x[k] -= diff * dx;
+                fj.y[k] -= diff * dy;
+                fj.z[k] -= diff * dz;
+            }
+        }
+    }
+}
+
+void Bonds(const UFFBondBlock& bonds, const Batch& batch, double factor, bool calc_gradient)
+{
+    if (calc_gradient)
+        BatchBonds<true>(bonds, batch, factor);
+    else
+        BatchBonds<false>(bonds, batch, factor);
+}
+
+template <bool Gradient>
+void BatchAngles(const UFFAngleBlock& angles, const Batch& batch, double factor)
+{
+    double* energy = batch.energy;
+    for (int t = 0; t < angles.size(); ++t) {
+        const BatchAtom ai(batch, angles.i[t]), aj(batch, angles.j[t]), ak(batch, angles.k[t]);
+        const BatchForce fi = Gradient ? BatchForce(batch, angles.i[t]) : BatchForce();
+        const BatchForce fj = Gradient ? BatchForce(batch, angles.j[t]) : BatchForce();
+        const BatchForce fk = Gradient ? BatchForce(batch, angles.k[t]) : BatchForce();
+        const double K = angles.kijk[t] * factor;
+        const double C0 = angles.C0[t], C1 = angles.C1[t], C2 = angles.C2[t];
+#pragma omp simd
+        for (int k = 0; k < batch.conformers; ++k) {
+            const double ax = ai.x[k] - aj.x[k], ay = ai.y[k] - aj.y[k], az = ai.z[k] - aj.z[k];
+            const double bx = ak.x[k] - aj.x[k], by = ak.y[k] - aj.y[k], bz = ak.z[k] - aj.z[k];
+            const double a2 = ax * ax + ay * ay + az * az;
+            const double b2 = bx * bx + by * by + bz * bz;
+            const double inv_ab = 1.0 / std::sqrt(a2 * b2);
+            const double costheta = (ax * bx + ay * by + az * bz) * inv_ab;
+            energy[k] += K * (C0 + C1 * costheta + C2 * (2 * costheta * costheta - 1));
+            if (Gradient) {
+                const double dEdcos = K * (C1 + 4 * C2 * costheta);
+                const double ix = dEdcos * (bx * inv_ab - costheta * ax / a2);
+                const double iy = dEdcos * (by * inv_ab - costheta * ay / a2);
+                const double iz = dEdcos * (bz * inv_ab - costheta * az / a2);
+                const double kx = dEdcos * (ax * inv_ab - costheta * bx / b2);
+                const double ky = dEdcos * (ay * inv_ab - costheta * by / b2);
+                const double kz = dEdcos * (az * inv_ab - costheta * bz / b2);
+                fi.x[k] += ix;
+                fi.y[k] += iy;
+                fi.z[k] += iz;
+                fk.x[k] += kx;
+                fk.y[k] += ky;
+                fk.z[k] += kz;
+                fj.x[k] -= ix + kx;
+                fj.y[k] -= iy + ky;
+                fj.z[k] -= iz + kz;
+            }
+        }
+    }
+}
+
+void Angles(const UFFAngleBlock& angles, const Batch& batch, double factor, bool calc_gradient)
+{
+    if (calc_gradient)
+        BatchAngles<true>(angles, batch, factor);
+    else
+        BatchAngles<false>(angles, batch, factor);
+}
+
+template <bool Gradient>
+void BatchDihedrals(const UFFDihedralBlock& dihedrals, const Batch& batch, double factor)
+{
+    double* energy = batch.energy;
+    for (int t = 0; t < dihedrals.size(); ++t) {
+        const BatchAtom ai(batch, dihedrals.i[t]), aj(batch, dihedrals.j[t]), ak(batch, dihedrals.k[t]), al(batch, dihedrals.l[t]);
+        const BatchForce fi = Gradient ? BatchForce(batch, dihedrals.i[t]) : BatchForce();
+        const BatchForce fj = Gradient ? BatchForce(batch, dihedrals.j[t]) : BatchForce();
+        const BatchForce fk = Gradient ? BatchForce(batch, dihedrals.k[t]) : BatchForce();
+        const BatchForce fl = Gradient ? BatchForce(batch, dihedrals.l[t]) : BatchForce();
+        const double p0 = dihedrals.p[0][t] * factor, p1 = dihedrals.p[1][t] * factor, p2 = dihedrals.p[2][t] * factor, p3 = dihedrals.p[3][t] * factor;
+        const double p4 = dihedrals.p[4][t] * factor, p5 = dihedrals.p[5][t] * factor, p6 = dihedrals.p[6][t] * factor;
+#pragma omp simd
+        for (int k = 0; k < batch.conformers; ++k) {
+            const double Ax = aj.x[k] - ai.x[k], Ay = aj.y[k] - ai.y[k], Az = aj.z[k] - ai.z[k];
+            const double Bx = aj.x[k] - ak.x[k], By = aj.y[k] - ak.y[k], Bz = aj.z[k] - ak.z[k];
+            const double Cx = -Bx, Cy = -By, Cz = -Bz;
+            const double Dx = ak.x[k] - al.x[k], Dy = ak.y[k] - al.y[k], Dz = ak.z[k] - al.z[k];
+
+            const double n1x = Ay * Bz - Az * By, n1y = Az * Bx - Ax * Bz, n1z = Ax * By - Ay * Bx;
+            const double n2x = Cy * Dz - Cz * Dy, n2y = Cz * Dx - Cx * Dz, n2z = Cx * Dy - Cy * Dx;
+
+            const double l1 = std::sqrt(n1x * n1x + n1y * n1y + n1z * n1z);
+            const double l2 = std::sqrt(n2x * n2x + n2y * n2y + n2z * n2z);
+            const double valid = (l1 > 1e-10) & (l2 > 1e-10) ? 1.0 : 0.0;
+            const double inv1 = valid / std::max(l1, 1e-10);
+            const double inv2 = valid / std::max(l2, 1e-10);
+
+            const double cosphi = (n1x * n2x + n1y * n2y + n1z * n2z) * inv1 * inv2;
+            const double c = cosphi > 1.0 ? 1.0 : (cosphi < -1.0 ? -1.0 : cosphi);
+
+            energy[k] += valid * (p0 + c * (p1 + c * (p2 + c * (p3 + c * (p4 + c * (p5 + c * p6))))));
+            if (Gradient) {
+                const double dEdc = p1 + c * (2 * p2 + c * (3 * p3 + c * (4 * p4 + c * (5 * p5 + c * 6 * p6))));
+
+                const double g1x = (n2x * inv2 - c * n1x * inv1) * inv1;
+                const double g1y = (n2y * inv2 - c * n1y * inv1) * inv1;
+                const double g1z = (n2z * inv2 - c * n1z * inv1) * inv1;
+                const double g2x = (n1x * inv1 - c * n2x * inv2) * inv2;
+                const double g2y = (n1y * inv1 - c * n2y * inv2) * inv2;
+                const double g2z = (n1z * inv1 - c * n2z * inv2) * inv2;
+
+                const double bgx = By * g1z - Bz * g1y, bgy = Bz * g1x - Bx * g1z, bgz = Bx * g1y - By * g1x;
+                const double gax = g1y * Az - g1z * Ay, gay = g1z * Ax - g1x * Az, gaz = g1x * Ay - g1y * Ax;
+                const double dgx = Dy * g2z - Dz * g2y, dgy = Dz * g2x - Dx * g2z, dgz = Dx * g2y - Dy * g2x;
+                const double gcx = g2y * Cz - g2z * Cy, gcy = g2z * Cx - g2x * Cz, gcz = g2x * Cy - g2y * Cx;
+
+                const double ix = -dEdc * bgx, iy = -dEdc * bgy, iz = -dEdc * bgz;
+                const double jx = dEdc * (bgx + gax - dgx), jy = dEdc * (bgy + gay - dgy), jz = dEdc * (bgz + gaz - dgz);
+                const double kx = dEdc * (dgx + gcx - gax), ky = dEdc * (dgy + gcy - gay), kz = dEdc * (dgz + gcz - gaz);
+                fi.x[k] += ix;
+                fi.y[k] += iy;
+                fi.z[k] += iz;
+                fj.x[k] += jx;
+                fj.y[k] += jy;
+                fj.z[k] += jz;
+                fk.x[k] += kx;
+                fk.y[k] += ky;
+                fk.z[k] += kz;
+                fl.x[k] -= ix + jx + kx;
+                fl.y[k] -= iy + jy + ky;
+                fl.z[k] -= iz + jz + kz;
+            }
+        }
+    }
+}
+
+void Dihedrals(const UFFDihedralBlock& dihedrals, const Batch& batch, double factor, bool calc_gradient)
+{
+    if (calc_gradient)
+        BatchDihedrals<true>(dihedrals, batch, factor);
+    else
+        BatchDihedrals<false>(dihedrals, batch, factor);
+}
+
+template <bool Gradient>
+void BatchInversions(const UFFInversionBlock& inversions, const Batch& batch, double factor)
+{
+    double* energy = batch.energy;
+    for (int t = 0; t < inversions.size(); ++t) {
+        const BatchAtom ai(batch, inversions.i[t]), aj(batch, inversions.j[t]), ak(batch, inversions.k[t]), al(batch, inversions.l[t]);
+        const BatchForce fi = Gradient ? BatchForce(batch, inversions.i[t]) : BatchForce();
+        const BatchForce fj = Gradient ? BatchForce(batch, inversions.j[t]) : BatchForce();
+        const BatchForce fk = Gradient ? BatchForce(batch, inversions.k[t]) : BatchForce();
+        const BatchForce fl = Gradient ? BatchForce(batch, inversions.l[t]) : BatchForce();
+        const double K = inversions.kijkl[t] * factor;
+        const double C0 = inversions.C0[t], C1 = inversions.C1[t], C2 = inversions.C2[t];
+#pragma omp simd
+        for (int k = 0; k < batch.conformers; ++k) {
+            const double ax = aj.x[k] - ai.x[k], ay = aj.y[k] - ai.y[k], az = aj.z[k] - ai.z[k];
+            const double bx = ak.x[k] - ai.x[k], by = ak.y[k] - ai.y[k], bz = ak.z[k] - ai.z[k];
+            const double cx = al.x[k] - ai.x[k], cy = al.y[k] - ai.y[k], cz = al.z[k] - ai.z[k];
+
+            const double mx = ay * bz - az * by, my = az * bx - ax * bz, mz = ax * by - ay * bx;
+            const double lm = std::sqrt(mx * mx + my * my + mz * mz);
+            const double lc = std::sqrt(cx * cx + cy * cy + cz * cz);
+            const double valid = (lm > 1e-10) & (lc > 1e-10) ? 1.0 : 0.0;
+            const double inv_m = valid / std::max(lm, 1e-10);
+            const double inv_c = valid / std::max(lc, 1e-10);
+
+            const double cosY = (mx * cx + my * cy + mz * cz) * inv_m * inv_c;
+            const double sin2 = 1.0 - cosY * cosY;
+            const double sin2Y = sin2 > 0.0 ? sin2 : 0.0;
+            const double sinY = std::sqrt(sin2Y);
+
+            energy[k] += valid * K * (C0 + C1 * sinY + C2 * (sin2Y - 1.0));
+            if (Gradient) {
+                const double dEdcos = -K * cosY * (C1 / (sinY > 1e-8 ? sinY : 1e-8) + 2 * C2);
+
+                const double gmx = cx * inv_m * inv_c - cosY * mx * inv_m * inv_m;
+                const double gmy = cy * inv_m * inv_c - cosY * my * inv_m * inv_m;
+                const double gmz = cz * inv_m * inv_c - cosY * mz * inv_m * inv_m;
+
+                const double jx = dEdcos * (by * gmz - bz * gmy), jy = dEdcos * (bz * gmx - bx * gmz), jz = dEdcos * (bx * gmy - by * gmx);
+                const double kx = dEdcos * (gmy * az - gmz * ay), ky = dEdcos * (gmz * ax - gmx * az), kz = dEdcos * (gmx * ay - gmy * ax);
+                const double lx = dEdcos * (mx * inv_m * inv_c - cosY * cx * inv_c * inv_c);
+                const double ly = dEdcos * (my * inv_m * inv_c - cosY * cy * inv_c * inv_c);
+                const double lz = dEdcos * (mz * inv_m * inv_c - cosY * cz * inv_c * inv_c);
+                fj.x[k] += jx;
+                fj.y[k] += jy;
+                fj.z[k] += jz;
+                fk.x[k] += kx;
+                fk.y[k] += ky;
+                fk.z[k] += kz;
+                fl.x[k] += lx;
+                fl.y[k] += ly;
+                fl.z[k] += lz;
+                fi.x[k] -= jx + kx + lx;
+                fi.y[k] -= jy + ky + ly;
+                fi.z[k] -= jz + kz + lz;
+            }
+        }
+    }
+}
+
+void Inversions(const UFFInversionBlock& inversions, const Batch& batch, double factor, bool calc_gradient)
+{
+    if (calc_gradient)
+        BatchInversions<true>(inversions, batch, factor);
+    else
+        BatchInversions<false>(inversions, batch, factor);
+}
+
+template <bool Gradient>
+void BatchvdWs(const UFFvdWBlock& vdws, const Batch& batch, double factor, double vdw_scaling, double rep_scaling, double cutoff, double switch_on)
+{
+    const bool switching = cutoff > 0;
+    const double rc2 = switching ? cutoff * cutoff : std::numeric_limits<double>::infinity();
+    const double ron2 = switching ? switch_on * switch_on : std::numeric_limits<double>::infinity();
+    const double inv_denom = switching && rc2 > ron2 ? 1.0 / ((rc2 - ron2) * (rc2 - ron2) * (rc2 - ron2)) : 0.0;
+
+    double* energy = batch.energy;
+    for (int t = 0; t < vdws.size(); ++t) {
+        const BatchAtom ai(batch, vdws.i[t]), aj(batch, vdws.j[t]);
+        const BatchForce fi = Gradient ? BatchForce(batch, vdws.i[t]) : BatchForce();
+        const BatchForce fj = Gradient ? BatchForce(batch, vdws.j[t]) : BatchForce();
+        const double D = vdws.Dij[vdws.type[t]] * factor;
+        const double X2 = vdws.xij[vdws.type[t]] * vdws.xij[vdws.type[t]];
+#pragma omp simd
+        for (int k = 0; k < batch.conformers; ++k) {
+            const double dx = ai.x[k] - aj.x[k];
+            const double dy = ai.y[k] - aj.y[k];
+            const double dz = ai.z[k] - aj.z[k];
+            const double r2 = dx * dx + dy * dy + dz * dz;
+            const double s2 = X2 / r2;
+            const double pow6 = s2 * s2 * s2;
+            const double e = D * (-2 * pow6 * vdw_scaling + pow6 * pow6 * rep_scaling);
+
+            const bool inside = r2 < rc2;
+            const bool in_switch = r2 > ron2;
+            const double sw = (rc2 - r2) * (rc2 - r2) * (rc2 + 2 * r2 - 3 * ron2) * inv_denom;
+            const double S = inside ? (in_switch ? sw : 1.0) : 0.0;
+            energy[k] += e * S;
+            if (Gradient) {
+                const double diff = 12 * D * (pow6 * vdw_scaling - pow6 * pow6 * rep_scaling) / r2;
+                const double dsw = 12 * (rc2 - r2) * (ron2 - r2) * inv_denom;
+                const double dSdr_r = inside & in_switch ? dsw : 0.0;
+                const double force = diff * S + e * dSdr_r;
+                fi.x[k] += force * dx;
+                fi.y[k] += force * dy;
+                fi.z[k] += force * dz;
+                fj.x[k] -= force * dx;
+                fj.y[k] -= force * dy;
+                fj.z[k] -= force * dz;
+            }
+        }
+    }
+}
+
+void vdWs(const UFFvdWBlock& vdws, const Batch& batch, double factor, double vdw_scaling, double rep_scaling, double cutoff, double switch_on, bool calc_gradient)
+{
+    if (calc_gradient)
+        BatchvdWs<true>(vdws, batch, factor, vdw_scaling, rep_scaling, cutoff, switch_on);
+    else
+        BatchvdWs<false>(vdws, batch, factor, vdw_scaling, rep_scaling, cutoff, switch_on);
+}
@@ -26,6 +26,11 @@
 
 #include "json.hpp"
 #include <Eigen/Dense>
+#include <array>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <set>
 #include <vector>
 using json = nlohmann::json;
 
@@ -290,6 +295,255 @@ struct UFFvdW {
     double Dij, xij;
 };
 
+/* Structure of arrays storage of the terms above, the hot loops in uff_kernels.cpp
+ * read the indices and parameters as contiguous streams. The parameters are set up in
+ * double precision, a block of another Scalar is converted from the double block. */
+template <typename Scalar>
+struct UFFBondBlockT {
+    std::vector<int> i, j;
+    std::vector<Scalar> r0, kij;
+
+    UFFBondBlockT() = default;
+    template <typename Other>
+    explicit UFFBondBlockT(const UFFBondBlockT<Other>& other)
+        : i(other.i)
+        , j(other.j)
+        , r0(other.r0.begin(), other.r0.end())
+        , kij(other.kij.begin(), other.kij.end())
+    {
+    }
+
+    inline int size() const { return i.size(); }
+    inline void clear()
+    {
+        i.clear();
+        j.clear();
+        r0.clear();
+        kij.clear();
+    }
+    inline void push_back(const UFFBond& bond)
+    {
+        i.push_back(bond.i);
+        j.push_back(bond.j);
+        r0.push_back(bond.r0);
+        kij.push_back(bond.kij);
+    }
+    inline UFFBond operator[](int index) const { return UFFBond{ i[index], j[index], r0[index], kij[index] }; }
+};
+typedef UFFBondBlockT<double> UFFBondBlock;
+
+template <typename Scalar>
+struct UFFAngleBlockT {
+    std::vector<int> i, j, k;
+    std::vector<Scalar> kijk, C0, C1, C2;
+
+    UFFAngleBlockT() = default;
+    template <typename Other>
+    explicit UFFAngleBlockT(const UFFAngleBlockT<Other>& other)
+        : i(other.i)
+        , j(other.j)
+        , k(other.k)
+        , kijk(other.kijk.begin(), other.kijk.end())
+        , C0(other.C0.begin(), other.C0.end())
+        , C1(other.C1.begin(), other.C1.end())
+        , C2(other.C2.begin(), other.C2.end())
+    {
+    }
+
+    inline int size() const { return i.size(); }
+    inline void clear()
+    {
+        i.clear();
+        j.clear();
+        k.clear();
+        kijk.clear();
+        C0.clear();
+        C1.clear();
+        C2.clear();
+    }
+    inline void push_back(const UFFAngle& angle)
+    {
+        i.push_back(angle.i);
+        j.push_back(angle.j);
+        k.push_back(angle.k);
+        kijk.push_back(angle.kijk);
+        C0.push_back(angle.C0);
+        C1.push_back(angle.C1);
+        C2.push_back(angle.C2);
+    }
+    inline UFFAngle operator[](int index) const { return UFFAngle{ i[index], j[index], k[index], kijk[index], C0[index], C1[index], C2[index] }; }
+};
+typedef UFFAngleBlockT<double> UFFAngleBlock;
+
+/* For integer multiplicities cos(n phi) is the Chebyshev polynomial T_n(cos phi), so the torsion
+ * energy is stored as polynomial in cos phi (up to 6th order) and no trigonometric function
+ * has to be evaluated in the kernel */
+template <typename Scalar>
+struct UFFDihedralBlockT {
+    std::vector<int> i, j, k, l;
+    std::vector<Scalar> V, n, phi0;
+    std::array<std::vector<Scalar>, 7> p;
+
+    UFFDihedralBlockT() = default;
+    template <typename Other>
+    explicit UFFDihedralBlockT(const UFFDihedralBlockT<Other>& other)
+        : i(other.i)
+        , j(other.j)
+        , k(other.k)
+        , l(other.l)
+        , V(other.V.begin(), other.V.end())
+        , n(other.n.begin(), other.n.end())
+        , phi0(other.phi0.begin(), other.phi0.end())
+    {
+        for (int c = 0; c < 7; ++c)
+            p[c].assign(other.p[c].begin(), other.p[c].end());
+    }
+
+    inline int size() const { return i.size(); }
+    inline void clear()
+    {
+        i.clear();
+        j.clear();
+        k.clear();
+        l.clear();
+        V.clear();
+        n.clear();
+        phi0.clear();
+        for (auto& c : p)
+            c.clear();
+    }
+    inline void push_back(const UFFDihedral& dihedral)
+    {
+        i.push_back(dihedral.i);
+        j.push_back(dihedral.j);
+        k.push_back(dihedral.k);
+        l.push_back(dihedral.l);
+        V.push_back(dihedral.V);
+        n.push_back(dihedral.n);
+        phi0.push_back(dihedral.phi0);
+
+        int order = std::lround(dihedral.n);
+        if (order < 0 || order > 6 || std::abs(order - dihedral.n) > 1e-8) {
+            std::cout << "Torsion multiplicity " << dihedral.n << " is not supported, using " << std::min(std::max(order, 0), 6) << std::endl;
+            order = std::min(std::max(order, 0), 6);
+        }
+        std::array<double, 7> t_prev{ 1, 0, 0, 0, 0, 0, 0 }, t_curr{ 0, 1, 0, 0, 0, 0, 0 };
+        if (order == 0)
+            t_curr = t_prev;
+        for (int m = 1; m < order; ++m) {
+            std::array<double, 7> t_next{ 0, 0, 0, 0, 0, 0, 0 };
+            for (int c = 0; c < 6; ++c)
+                t_next[c + 1] += 2 * t_curr[c];
+            for (int c = 0; c < 7; ++c)
+                t_next[c] -= t_prev[c];
+            t_prev = t_curr;
+            t_curr = t_next;
+        }
+        /* E = V/2 (1 - cos(n phi0) cos(n phi)), phi = pi +- acos(cos phi) */
+        const double prefactor = -0.5 * dihedral.V * cos(dihedral.n * dihedral.phi0) * (order % 2 ? -1 : 1);
+        for (int c = 0; c < 7; ++c)
+            p[c].push_back(prefactor * t_curr[c] + (c == 0 ? 0.5 * dihedral.V : 0));
+    }
+    inline UFFDihedral operator[](int index) const { return UFFDihedral{ i[index], j[index], k[index], l[index], V[index], n[index], phi0[index] }; }
+};
+typedef UFFDihedralBlockT<double> UFFDihedralBlock;
+
+template <typename Scalar>
+struct UFFInversionBlockT {
+    std::vector<int> i, j, k, l;
+    std::vector<Scalar> kijkl, C0, C1, C2;
+
+    UFFInversionBlockT() = default;
+    template <typename Other>
+    explicit UFFInversionBlockT(const UFFInversionBlockT<Other>& other)
+        : i(other.i)
+        , j(other.j)
+        , k(other.k)
+        , l(other.l)
+        , kijkl(other.kijkl.begin(), other.kijkl.end())
+        , C0(other.C0.begin(), other.C0.end())
+        , C1(other.C1.begin(), other.C1.end())
+        , C2(other.C2.begin(), other.C2.end())
+    {
+    }
+
+    inline int size() const { return i.size(); }
+    inline void clear()
+    {
+        i.clear();
+        j.clear();
+        k.clear();
+        l.clear();
+        kijkl.clear();
+        C0.clear();
+        C1.clear();
+        C2.clear();
+    }
+    inline void push_back(const UFFInversion& inversion)
+    {
+        i.push_back(inversion.i);
+        j.push_back(inversion.j);
+        k.push_back(inversion.k);
+        l.push_back(inversion.l);
+        kijkl.push_back(inversion.kijkl);
+        C0.push_back(inversion.C0);
+        C1.push_back(inversion.C1);
+        C2.push_back(inversion.C2);
+    }
+    inline UFFInversion operator[](int index) const { return UFFInversion{ i[index], j[index], k[index], l[index], kijkl[index], C0[index], C1[index], C2[index] }; }
+};
+typedef UFFInversionBlockT<double> UFFInversionBlock;
+
+/* vdW pairs only keep an index into the table of distinct (Dij, xij) combinations,
+ * there are only as many as there are pairs of atom types in the molecule */
+template <typename Scalar>
+struct UFFvdWBlockT {
+    std::vector<int> i, j, type;
+    std::vector<Scalar> Dij, xij;
+
+    UFFvdWBlockT() = default;
+    /* converted blocks are only read, new pairs are added to the double block */
+    template <typename Other>
+    explicit UFFvdWBlockT(const UFFvdWBlockT<Other>& other)
+        : i(other.i)
+        , j(other.j)
+        , type(other.type)
+        , Dij(other.Dij.begin(), other.Dij.end())
+        , xij(other.xij.begin(), other.xij.end())
+    {
+    }
+
+    inline int size() const { return i.size(); }
+    inline void clear()
+    {
+        i.clear();
+        j.clear();
+        type.clear();
+    }
+    inline int Type(double D, double x)
+    {
+        auto it = m_types.find({ D, x });
+        if (it != m_types.end())
+            return it->second;
+        int index = Dij.size();
+        Dij.push_back(D);
+        xij.push_back(x);
+        m_types.insert({ { D, x }, index });
+        return index;
+    }
+    inline void push_back(const UFFvdW& vdw)
+    {
+        i.push_back(vdw.i);
+        j.push_back(vdw.j);
+        type.push_back(Type(vdw.Dij, vdw.xij));
+    }
+    inline UFFvdW operator[](int index) const { return UFFvdW{ i[index], j[index], Dij[type[index]], xij[type[index]] }; }
+
+private:
+    std::map<std::pair<double, double>, int> m_types;
+};
+typedef UFFvdWBlockT<double> UFFvdWBlock;
+
 typedef std::array<double, 3> v;
 
 inline std::array<double, 3> AddVector(const v& x, const v& y)
@@ -341,9 +595,10 @@ const json UFFParameterJson{
     { "vdw_scaling", 1 },
     { "rep_scaling", 1 },
     { "coulomb_scaling", 1 },
+    { "coulomb_damping", 0.2 },
+    { "charges", "none" },
     { "bond_force", 664.12 },
     { "angle_force", 664.12 },
-    { "differential", 1e-7 },
     { "h4_scaling", 0 },
     { "hh_scaling", 0 },
     { "h4_oh_o", 2.32 },
@@ -367,12 +622,19 @@ const json UFFParameterJson{
     { "d_alp", 16 },
     { "d_func", "pbe0" },
     { "d_atm", true },
+    { "dispersion_refresh", 0.0 },
+    { "dispersion_drift", 1e-5 },
     { "param_file", "none" },
     { "uff_file", "none" },
     { "writeparam", "none" },
     { "writeuff", "none" },
+    { "uff_cache", "none" },
     { "verbose", false },
     { "rings", false },
     { "threads", 1 },
-    { "gradient", 0 }
+    { "gradient", 0 },
+    { "precision", "double" },
+    { "vdw_cutoff", 0 },
+    { "vdw_skin", 2.0 },
+    { "vdw_switch", 2.0 }
 };
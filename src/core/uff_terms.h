@@ -0,0 +1,141 @@
+/*
+ * < Scalar templated UFF term energies. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <cmath>
+
+#include "src/core/dualnumber.h"
+
+/* Energy of a single UFF term as function of the positions of its atoms, each atom is a pointer
+ * to its x, y and z. Scalar is double for plain energies or a Dual for exact derivatives, the
+ * expressions are the same as in the vectorised kernels of uff_kernels.cpp. Degenerate
+ * geometries (linear torsions, collapsed planes) give zero, as the kernels mask them out. */
+
+namespace UFFTerms {
+
+template <typename Scalar>
+inline Scalar Dot(const Scalar* a, const Scalar* b)
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+template <typename Scalar>
+inline void Difference(const Scalar* a, const Scalar* b, Scalar* ab)
+{
+    for (int c = 0; c < 3; ++c)
+        ab[c] = a[c] - b[c];
+}
+
+template <typename Scalar>
+inline void Cross(const Scalar* a, const Scalar* b, Scalar* ab)
+{
+    ab[0] = a[1] * b[2] - a[2] * b[1];
+    ab[1] = a[2] * b[0] - a[0] * b[2];
+    ab[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+/*! \brief E = 1/2 kij (r - r0)^2 */
+template <typename Scalar>
+Scalar Bond(const Scalar* i, const Scalar* j, double r0, double kij)
+{
+    using std::sqrt;
+    Scalar ij[3];
+    Difference(i, j, ij);
+    const Scalar d = sqrt(Dot(ij, ij)) - r0;
+    return 0.5 * kij * d * d;
+}
+
+/*! \brief E = K (C0 + C1 cos theta + C2 cos 2 theta), j is the central atom */
+template <typename Scalar>
+Scalar Angle(const Scalar* i, const Scalar* j, const Scalar* k, double K, double C0, double C1, double C2)
+{
+    using std::sqrt;
+    Scalar a[3], b[3];
+    Difference(i, j, a);
+    Difference(k, j, b);
+    const Scalar costheta = Dot(a, b) / sqrt(Dot(a, a) * Dot(b, b));
+    return K * (C0 + C1 * costheta + C2 * (2 * costheta * costheta - 1));
+}
+
+/*! \brief Torsion i-j-k-l as polynomial p in cos phi, see UFFDihedralBlock */
+template <typename Scalar>
+Scalar Dihedral(const Scalar* i, const Scalar* j, const Scalar* k, const Scalar* l, const double* p)
+{
+    using std::sqrt;
+    Scalar A[3], B[3], C[3], D[3], n1[3], n2[3];
+    Difference(j, i, A);
+    Difference(j, k, B);
+    Difference(k, j, C);
+    Difference(k, l, D);
+    Cross(A, B, n1);
+    Cross(C, D, n2);
+    const Scalar l1 = sqrt(Dot(n1, n1));
+    const Scalar l2 = sqrt(Dot(n2, n2));
+    if (Value(l1) <= 1e-10 || Value(l2) <= 1e-10)
+        return Scalar(0);
+    Scalar c = Dot(n1, n2) / (l1 * l2);
+    /* rounding may push the cosine slightly beyond +-1, only the value is clamped */
+    if (Value(c) > 1)
+        c = c - (Value(c) - 1);
+    else if (Value(c) < -1)
+        c = c - (Value(c) + 1);
+    return p[0] + c * (p[1] + c * (p[2] + c * (p[3] + c * (p[4] + c * (p[5] + c * p[6])))));
+}
+
+/*! \brief E = K (C0 + C1 sin Y + C2 cos 2Y), Y is the angle between the normal of the i-j-k plane and the i-l bond */
+template <typename Scalar>
+Scalar Inversion(const Scalar* i, const Scalar* j, const Scalar* k, const Scalar* l, double K, double C0, double C1, double C2)
+{
+    using std::sqrt;
+    Scalar a[3], b[3], c[3], m[3];
+    Difference(j, i, a);
+    Difference(k, i, b);
+    Difference(l, i, c);
+    Cross(a, b, m);
+    const Scalar lm = sqrt(Dot(m, m));
+    const Scalar lc = sqrt(Dot(c, c));
+    if (Value(lm) <= 1e-10 || Value(lc) <= 1e-10)
+        return Scalar(0);
+    const Scalar cosY = Dot(m, c) / (lm * lc);
+    const Scalar sin2Y = 1 - cosY * cosY;
+    const Scalar sinY = Value(sin2Y) > 1e-16 ? sqrt(sin2Y) : Scalar(0);
+    return K * (C0 + C1 * sinY + C2 * (sinY * sinY - 1));
+}
+
+/*! \brief Lennard-Jones type nonbond, for cutoff > 0 switched off between switch_on and cutoff */
+template <typename Scalar>
+Scalar vdW(const Scalar* i, const Scalar* j, double Dij, double xij, double vdw_scaling, double rep_scaling, double cutoff, double switch_on)
+{
+    Scalar ij[3];
+    Difference(i, j, ij);
+    const Scalar r2 = Dot(ij, ij);
+    const double rc2 = cutoff * cutoff;
+    if (cutoff > 0 && Value(r2) >= rc2)
+        return Scalar(0);
+    const Scalar s2 = xij * xij / r2;
+    const Scalar pow6 = s2 * s2 * s2;
+    const Scalar energy = Dij * (-2 * vdw_scaling * pow6 + rep_scaling * pow6 * pow6);
+    const double ron2 = switch_on * switch_on;
+    if (cutoff <= 0 || Value(r2) <= ron2 || rc2 <= ron2)
+        return energy;
+    const double denom = (rc2 - ron2) * (rc2 - ron2) * (rc2 - ron2);
+    return energy * ((rc2 - r2) * (rc2 - r2) * (rc2 + 2 * r2 - 3 * ron2) / denom);
+}
+}
@@ -0,0 +1,192 @@
+/*
+ * <Cache of typed UFF terms shared between conformers. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+
+#include "uffcache.h"
+
+namespace {
+/* the header stores the sizes of the raw term structs, files from a different build are ignored */
+const char Magic[8] = { 'C', 'U', 'R', 'C', 'U', 'F', 'F', '2' };
+const std::uint64_t Layout[5] = { sizeof(UFFBond), sizeof(UFFAngle), sizeof(UFFDihedral), sizeof(UFFInversion), sizeof(int) };
+
+std::mutex mutex;
+std::multimap<std::uint64_t, std::shared_ptr<const UFFCacheEntry>> entries;
+std::set<std::string> loaded, unusable;
+
+inline void Mix(std::uint64_t& hash, const void* data, std::size_t size)
+{
+    /* FNV-1a */
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+}
+
+template <class T>
+void Write(std::ofstream& file, const std::vector<T>& vector)
+{
+    const std::uint64_t size = vector.size();
+    file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    file.write(reinterpret_cast<const char*>(vector.data()), size * sizeof(T));
+}
+
+template <class T>
+bool Read(std::ifstream& file, std::vector<T>& vector)
+{
+    std::uint64_t size = 0;
+    if (!file.read(reinterpret_cast<char*>(&size), sizeof(size)))
+        return false;
+    vector.resize(size);
+    return bool(file.read(reinterpret_cast<char*>(vector.data()), size * sizeof(T)));
+}
+
+bool Read(std::ifstream& file, AdjacencyList& list)
+{
+    std::vector<int> offset, index;
+    if (!Read(file, offset) || !Read(file, index))
+        return false;
+    list.Assign(std::move(offset), std::move(index));
+    return true;
+}
+
+void Write(std::ofstream& file, const UFFCacheEntry& entry)
+{
+    Write(file, entry.elements);
+    Write(file, entry.connectivity.Offsets());
+    Write(file, entry.connectivity.Indices());
+    file.write(reinterpret_cast<const char*>(&entry.bond_force), sizeof(double));
+    file.write(reinterpret_cast<const char*>(&entry.angle_force), sizeof(double));
+    file.write(reinterpret_cast<const char*>(&entry.ring_typing), sizeof(int));
+    Write(file, entry.uff_atom_types);
+    Write(file, entry.rings.Offsets());
+    Write(file, entry.rings.Indices());
+    Write(file, entry.bonds);
+    Write(file, entry.angles);
+    Write(file, entry.dihedrals);
+    Write(file, entry.inversions);
+    Write(file, entry.ignored_vdw.Offsets());
+    Write(file, entry.ignored_vdw.Indices());
+}
+
+bool Read(std::ifstream& file, UFFCacheEntry& entry)
+{
+    return Read(file, entry.elements)
+        && Read(file, entry.connectivity)
+        && file.read(reinterpret_cast<char*>(&entry.bond_force), sizeof(double))
+        && file.read(reinterpret_cast<char*>(&entry.angle_force), sizeof(double))
+        && file.read(reinterpret_cast<char*>(&entry.ring_typing), sizeof(int))
+        && Read(file, entry.uff_atom_types)
+        && Read(file, entry.rings)
+        && Read(file, entry.bonds)
+        && Read(file, entry.angles)
+        && Read(file, entry.dihedrals)
+        && Read(file, entry.inversions)
+        && Read(file, entry.ignored_vdw);
+}
+
+bool SameKey(const UFFCacheEntry& a, const UFFCacheEntry& b)
+{
+    return a.elements == b.elements && a.connectivity == b.connectivity && a.bond_force == b.bond_force && a.angle_force == b.angle_force && a.ring_typing == b.ring_typing;
+}
+
+/* called with the mutex held, a missing file is fine and will be created by the first Store */
+void Load(const std::string& filename)
+{
+    if (!loaded.insert(filename).second)
+        return;
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+        return;
+
+    char magic[sizeof(Magic)];
+    std::uint64_t layout[5];
+    if (!file.read(magic, sizeof(magic)) || !file.read(reinterpret_cast<char*>(layout), sizeof(layout))
+        || std::memcmp(magic, Magic, sizeof(Magic)) != 0 || std::memcmp(layout, Layout, sizeof(Layout)) != 0) {
+        unusable.insert(filename);
+        return;
+    }
+    /* a truncated last record, for example from an interrupted run, is skipped */
+    while (true) {
+        auto entry = std::make_shared<UFFCacheEntry>();
+        if (!Read(file, *entry))
+            break;
+        entries.emplace(UFFParameterCache::Hash(*entry), entry);
+    }
+}
+}
+
+std::uint64_t UFFParameterCache::Hash(const UFFCacheEntry& key)
+{
+    std::uint64_t hash = 14695981039346656037ULL;
+    Mix(hash, key.elements.data(), key.elements.size() * sizeof(int));
+    Mix(hash, key.connectivity.Offsets().data(), key.connectivity.Offsets().size() * sizeof(int));
+    Mix(hash, key.connectivity.Indices().data(), key.connectivity.Indices().size() * sizeof(int));
+    Mix(hash, &key.bond_force, sizeof(double));
+    Mix(hash, &key.angle_force, sizeof(double));
+    Mix(hash, &key.ring_typing, sizeof(int));
+    return hash;
+}
+
+std::shared_ptr<const UFFCacheEntry> UFFParameterCache::Find(const UFFCacheEntry& key, const std::string& file)
+{
+    const std::uint64_t hash = Hash(key);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (file.compare("none") != 0)
+        Load(file);
+    auto range = entries.equal_range(hash);
+    for (auto entry = range.first; entry != range.second; ++entry)
+        if (SameKey(*entry->second, key))
+            return entry->second;
+    return nullptr;
+}
+
+void UFFParameterCache::Store(const std::shared_ptr<const UFFCacheEntry>& entry, const std::string& filename)
+{
+    const std::uint64_t hash = Hash(*entry);
+    std::lock_guard<std::mutex> lock(mutex);
+    auto range = entries.equal_range(hash);
+    for (auto stored = range.first; stored != range.second; ++stored)
+        if (SameKey(*stored->second, *entry))
+            return;
+    entries.emplace(hash, entry);
+
+    if (filename.compare("none") == 0 || unusable.count(filename))
+        return;
+    const bool fresh = !std::ifstream(filename).good();
+    std::ofstream file(filename, std::ios::binary | std::ios::app);
+    if (fresh) {
+        file.write(Magic, sizeof(Magic));
+        file.write(reinterpret_cast<const char*>(Layout), sizeof(Layout));
+    }
+    Write(file, *entry);
+}
+
+void UFFParameterCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    loaded.clear();
+    unusable.clear();
+}
@@ -0,0 +1,61 @@
+/*
+ * <Cache of typed UFF terms shared between conformers. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "src/core/adjacencylist.h"
+#include "src/core/uff_par.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*! \brief Everything eigenUFF derives from the topology of a molecule.
+ * The first block is the key, conformers with the same elements and bonds share the rest. */
+struct UFFCacheEntry {
+    std::vector<int> elements;
+    AdjacencyList connectivity;
+    double bond_force = 0, angle_force = 0;
+    int ring_typing = 1;
+
+    std::vector<int> uff_atom_types;
+    AdjacencyList rings;
+    std::vector<UFFBond> bonds;
+    std::vector<UFFAngle> angles;
+    std::vector<UFFDihedral> dihedrals;
+    std::vector<UFFInversion> inversions;
+    AdjacencyList ignored_vdw;
+};
+
+/*! \brief Process wide store of UFFCacheEntry, optionally backed by a binary file.
+ * The file is read completely on the first lookup and every new entry is appended,
+ * it is meant as a cache on one machine and not as a portable parameter format. */
+class UFFParameterCache {
+public:
+    /*! \brief Entry with the same key as the given one, nullptr if the topology is unknown */
+    static std::shared_ptr<const UFFCacheEntry> Find(const UFFCacheEntry& key, const std::string& file = "none");
+
+    static void Store(const std::shared_ptr<const UFFCacheEntry>& entry, const std::string& file = "none");
+
+    /*! \brief Forget all entries held in memory, files are read again on the next lookup */
+    static void Clear();
+
+    static std::uint64_t Hash(const UFFCacheEntry& key);
+};
@@ -0,0 +1,137 @@
+/*
+ * < Periodic unit cell with minimum image convention. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "src/core/global.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include <Eigen/Dense>
+
+#include <fmt/core.h>
+
+/*! \brief Orthorhombic or triclinic cell spanned by the lattice vectors a, b and c (rows of Vectors()),
+ * a default constructed cell is not periodic and all its operations are no-ops.
+ * The minimum image is taken in fractional coordinates, which is exact for orthorhombic cells and for
+ * triclinic ones as long as the distances stay below half of Width(). */
+class UnitCell {
+public:
+    UnitCell() = default;
+
+    explicit UnitCell(const Eigen::Matrix3d& vectors)
+    {
+        setVectors(vectors);
+    }
+
+    void setVectors(const Eigen::Matrix3d& vectors)
+    {
+        m_vectors = vectors;
+        m_periodic = std::abs(vectors.determinant()) > 1e-8;
+        if (!m_periodic)
+            return;
+        /* r = H s with the lattice vectors as columns of H */
+        const Eigen::Matrix3d H = vectors.transpose();
+        const Eigen::Matrix3d inverse = H.inverse();
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 3; ++j) {
+                m_h[3 * i + j] = H(i, j);
+                m_inverse[3 * i + j] = inverse(i, j);
+            }
+        m_orthorhombic = std::abs(H(0, 1)) + std::abs(H(0, 2)) + std::abs(H(1, 0)) + std::abs(H(1, 2)) + std::abs(H(2, 0)) + std::abs(H(2, 1)) < 1e-10;
+    }
+
+    inline bool isPeriodic() const { return m_periodic; }
+    inline bool isOrthorhombic() const { return m_orthorhombic; }
+    inline const Eigen::Matrix3d& Vectors() const { return m_vectors; }
+
+    inline double Volume() const { return std::abs(m_vectors.determinant()); }
+
+    /*! \brief Shortest distance between two opposite faces of the cell */
+    double Width() const
+    {
+        if (!m_periodic)
+            return 0;
+        const Eigen::Vector3d a = m_vectors.row(0), b = m_vectors.row(1), c = m_vectors.row(2);
+        return Volume() / std::max({ b.cross(c).norm(), c.cross(a).norm(), a.cross(b).norm() });
+    }
+
+    /*! \brief Width of the cell along lattice vector i, the distance between the faces spanned by the other two */
+    double Width(int i) const
+    {
+        const Eigen::Vector3d u = m_vectors.row((i + 1) % 3), v = m_vectors.row((i + 2) % 3);
+        return Volume() / u.cross(v).norm();
+    }
+
+    inline Eigen::Vector3d Fractional(const Eigen::Vector3d& r) const
+    {
+        return Eigen::Vector3d(m_inverse[0] * r(0) + m_inverse[1] * r(1) + m_inverse[2] * r(2),
+            m_inverse[3] * r(0) + m_inverse[4] * r(1) + m_inverse[5] * r(2),
+            m_inverse[6] * r(0) + m_inverse[7] * r(1) + m_inverse[8] * r(2));
+    }
+
+    /*! \brief Replace the distance vector (x, y, z) by its shortest image, kept branch free for the term kernels.
+     * The image is taken in the precision of the distance vector, so single precision kernels stay in float */
+    template <typename Scalar>
+    inline void MinimumImage(Scalar& x, Scalar& y, Scalar& z) const
+    {
+        Scalar a = Scalar(m_inverse[0]) * x + Scalar(m_inverse[1]) * y + Scalar(m_inverse[2]) * z;
+        Scalar b = Scalar(m_inverse[3]) * x + Scalar(m_inverse[4]) * y + Scalar(m_inverse[5]) * z;
+        Scalar c = Scalar(m_inverse[6]) * x + Scalar(m_inverse[7]) * y + Scalar(m_inverse[8]) * z;
+        a -= std::floor(a + Scalar(0.5));
+        b -= std::floor(b + Scalar(0.5));
+        c -= std::floor(c + Scalar(0.5));
+        x = Scalar(m_h[0]) * a + Scalar(m_h[1]) * b + Scalar(m_h[2]) * c;
+        y = Scalar(m_h[3]) * a + Scalar(m_h[4]) * b + Scalar(m_h[5]) * c;
+        z = Scalar(m_h[6]) * a + Scalar(m_h[7]) * b + Scalar(m_h[8]) * c;
+    }
+
+    inline Eigen::Vector3d MinimumImage(const Eigen::Vector3d& distance) const
+    {
+        Eigen::Vector3d d = distance;
+        if (m_periodic)
+            MinimumImage(d(0), d(1), d(2));
+        return d;
+    }
+
+    /*! \brief Position shifted by whole lattice vectors into the cell at the origin */
+    inline Eigen::Vector3d Wrap(const Eigen::Vector3d& r) const
+    {
+        if (!m_periodic)
+            return r;
+        Eigen::Vector3d s = Fractional(r);
+        for (int i = 0; i < 3; ++i)
+            s(i) -= std::floor(s(i));
+        return m_vectors.transpose() * s;
+    }
+
+    /*! \brief Lattice vectors in the extended XYZ notation Lattice="ax ay az bx by bz cx cy cz" */
+    std::string toString() const
+    {
+        return fmt::format("Lattice=\"{} {} {} {} {} {} {} {} {}\"", m_vectors(0, 0), m_vectors(0, 1), m_vectors(0, 2), m_vectors(1, 0), m_vectors(1, 1), m_vectors(1, 2), m_vectors(2, 0), m_vectors(2, 1), m_vectors(2, 2));
+    }
+
+private:
+    Eigen::Matrix3d m_vectors = Eigen::Matrix3d::Zero();
+    double m_h[9] = { 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    double m_inverse[9] = { 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    bool m_periodic = false, m_orthorhombic = false;
+};
@@ -0,0 +1,118 @@
+/*
+ * <Persistent team of worker threads for short parallel sections. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+
+#include "workerteam.h"
+
+namespace {
+/* time a worker keeps spinning for new work before it sleeps */
+const auto SpinTime = std::chrono::microseconds(100);
+
+inline void Relax()
+{
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_ia32_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+inline std::uint64_t Generation(std::uint64_t state) { return state >> 16; }
+inline int Workers(std::uint64_t state) { return int(state & 0xFFFF); }
+}
+
+WorkerTeam::WorkerTeam(int size)
+{
+    for (int i = 1; i < std::min(size, 0xFFFF); ++i)
+        m_threads.emplace_back(&WorkerTeam::Work, this, i);
+}
+
+WorkerTeam::~WorkerTeam()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto& thread : m_threads)
+        thread.join();
+}
+
+int WorkerTeam::Threads(int requested)
+{
+    const int hardware = std::max(1, int(std::thread::hardware_concurrency()));
+    if (requested <= 0)
+        return hardware;
+    /* more spinning workers than cores only steal time from each other */
+    return std::min(requested, hardware);
+}
+
+void WorkerTeam::Dispatch(int workers, Function function, void* data)
+{
+    workers = std::min(workers, Size());
+    if (workers <= 1) {
+        function(data, 0);
+        return;
+    }
+
+    m_function = function;
+    m_data = data;
+    m_pending.store(workers - 1, std::memory_order_relaxed);
+    const std::uint64_t state = m_state.load(std::memory_order_relaxed);
+    m_state.store(((Generation(state) + 1) << 16) | std::uint64_t(workers));
+
+    if (m_sleeping.load() > 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_wake.notify_all();
+    }
+
+    function(data, 0);
+    while (m_pending.load(std::memory_order_acquire) > 0)
+        Relax();
+}
+
+void WorkerTeam::Work(int worker)
+{
+    std::uint64_t seen = 0;
+    while (true) {
+        std::uint64_t state = m_state.load(std::memory_order_acquire);
+        auto start = std::chrono::steady_clock::now();
+        for (int spin = 0; Generation(state) == Generation(seen) && !m_stop; ++spin) {
+            if ((spin & 63) == 63 && std::chrono::steady_clock::now() - start > SpinTime) {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_sleeping++;
+                m_wake.wait(lock, [this, seen]() { return Generation(m_state.load()) != Generation(seen) || m_stop; });
+                m_sleeping--;
+                start = std::chrono::steady_clock::now();
+            } else
+                Relax();
+            state = m_state.load(std::memory_order_acquire);
+        }
+        if (m_stop)
+            return;
+
+        seen = state;
+        if (worker < Workers(state)) {
+            m_function(m_data, worker);
+            m_pending.fetch_sub(1, std::memory_order_release);
+        }
+    }
+}
@@ -0,0 +1,73 @@
+/*
+ * <Persistent team of worker threads for short parallel sections. >
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*! \brief Threads are started once and wait for work between the calls of Run.
+ * A waiting worker spins for a short time before it goes to sleep, so calls that
+ * follow each other quickly (optimisation or md steps) are dispatched without a
+ * system call. The calling thread always takes part as worker 0, a team of one
+ * starts no threads at all and Run is a plain function call. */
+class WorkerTeam {
+public:
+    explicit WorkerTeam(int size = 1);
+    ~WorkerTeam();
+
+    WorkerTeam(const WorkerTeam&) = delete;
+    WorkerTeam& operator=(const WorkerTeam&) = delete;
+
+    inline int Size() const { return m_threads.size() + 1; }
+
+    /*! \brief Call job(worker) for worker = 0 ... workers - 1 and return once all of them are done */
+    template <class Job>
+    void Run(int workers, Job& job)
+    {
+        Dispatch(workers, [](void* data, int worker) { (*static_cast<Job*>(data))(worker); }, &job);
+    }
+
+    /*! \brief Number of threads that should be used on this machine, 0 requests all of them */
+    static int Threads(int requested);
+
+private:
+    typedef void (*Function)(void*, int);
+
+    void Dispatch(int workers, Function function, void* data);
+    void Work(int worker);
+
+    std::vector<std::thread> m_threads;
+
+    /* generation of the current job in the upper bits, number of workers in the lower 16 bits */
+    std::atomic<std::uint64_t> m_state{ 0 };
+    std::atomic<int> m_pending{ 0 };
+    std::atomic<int> m_sleeping{ 0 };
+    std::atomic<bool> m_stop{ false };
+
+    Function m_function = nullptr;
+    void* m_data = nullptr;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+};
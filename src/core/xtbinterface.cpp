@@ -24,6 +24,7 @@
 
 #include "src/core/molecule.h"
 
+#include <algorithm>
 #include <iostream>
 #include <math.h>
 #include <stdio.h>
@@ -36,6 +37,7 @@ XTBInterface::XTBInterface(const json& xtbsettings)
     m_env = xtb_newEnvironment();
     m_xtb_calc = xtb_newCalculator();
     m_xtb_res = xtb_newResults();
+    xtb_setVerbosity(m_env, XTB_VERBOSITY_MUTED);
 }
 
 XTBInterface::~XTBInterface()
@@ -44,57 +46,44 @@ XTBInterface::~XTBInterface()
     xtb_delCalculator(&m_xtb_calc);
     xtb_delMolecule(&m_xtb_mol);
     xtb_delEnvironment(&m_env);
-    delete[] m_coord;
-    delete[] m_attyp;
 }
 
 bool XTBInterface::InitialiseMolecule(const Molecule& molecule)
 {
-    if (m_initialised)
-        UpdateMolecule(molecule);
-    m_atomcount = molecule.AtomCount();
-
-    m_attyp = new int[m_atomcount];
-    std::vector<int> atoms = molecule.Atoms();
-    m_coord = new double[3 * m_atomcount];
-
-    for (int i = 0; i < m_atomcount; ++i) {
-        std::pair<int, Position> atom = molecule.Atom(i);
-        m_coord[3 * i + 0] = atom.second(0) / au;
-        m_coord[3 * i + 1] = atom.second(1) / au;
-        m_coord[3 * i + 2] = atom.second(2) / au;
-        m_attyp[i] = atoms[i];
-    }
-    return InitialiseMolecule(m_attyp, m_coord, m_atomcount, molecule.Charge(), molecule.Spin());
+    return InitialiseMolecule(&molecule);
 }
 
 bool XTBInterface::InitialiseMolecule(const Molecule* molecule)
 {
-    if (m_initialised)
-        UpdateMolecule(molecule);
-    m_atomcount = molecule->AtomCount();
-
-    m_attyp = new int[m_atomcount];
-    std::vector<int> atoms = molecule->Atoms();
-    m_coord = new double[3 * m_atomcount];
-
-    for (int i = 0; i < m_atomcount; ++i) {
+    const int atoms = molecule->AtomCount();
+    std::vector<int> attyp = molecule->Atoms();
+    std::vector<double> coord(3 * atoms);
+    for (int i = 0; i < atoms; ++i) {
         std::pair<int, Position> atom = molecule->Atom(i);
-        m_coord[3 * i + 0] = atom.second(0) / au;
-        m_coord[3 * i + 1] = atom.second(1) / au;
-        m_coord[3 * i + 2] = atom.second(2) / au;
-        m_attyp[i] = atoms[i];
+        coord[3 * i + 0] = atom.second(0) / au;
+        coord[3 * i + 1] = atom.second(1) / au;
+        coord[3 * i + 2] = atom.second(2) / au;
     }
-    return InitialiseMolecule(m_attyp, m_coord, m_atomcount, molecule->Charge(), molecule->Spin());
+    return InitialiseMolecule(attyp.data(), coord.data(), atoms, molecule->Charge(), molecule->Spin());
 }
 
 bool XTBInterface::InitialiseMolecule(const int* attyp, const double* coord, const int natoms, const double charge, const int spin)
 {
-    if (m_initialised)
-        UpdateMolecule(coord);
-    m_atomcount = natoms;
+    /* the same system only gets the new geometry, the handles stay */
+    if (m_initialised && natoms == m_atomcount && charge == m_charge && spin == m_spin && std::equal(m_attyp.begin(), m_attyp.end(), attyp))
+        return UpdateMolecule(coord);
 
+    m_atomcount = natoms;
+    m_charge = charge;
+    m_spin = spin;
+    m_attyp.assign(attyp, attyp + natoms);
+    m_coord.assign(coord, coord + 3 * natoms);
+    m_bonds.resize(std::size_t(natoms) * natoms);
+
+    if (m_xtb_mol)
+        xtb_delMolecule(&m_xtb_mol);
     m_xtb_mol = xtb_newMolecule(m_env, &natoms, attyp, coord, &charge, &spin, NULL, NULL);
+    m_parameter = -1;
 
     m_initialised = true;
     return true;
@@ -108,7 +97,7 @@ bool XTBInterface::UpdateMolecule(const Molecule& molecule)
         m_coord[3 * i + 1] = atom.second(1) / au;
         m_coord[3 * i + 2] = atom.second(2) / au;
     }
-    return UpdateMolecule(m_coord);
+    return UpdateMolecule(m_coord.data());
 }
 
 bool XTBInterface::UpdateMolecule(const double* coord)
@@ -120,19 +109,23 @@ bool XTBInterface::UpdateMolecule(const double* coord)
 double XTBInterface::GFNCalculation(int parameter, double* grad)
 {
     double energy = 0;
-    xtb_setVerbosity(m_env, XTB_VERBOSITY_MUTED);
-    if (parameter == 0) {
-        xtb_loadGFN0xTB(m_env, m_xtb_mol, m_xtb_calc, NULL);
-    } else if (parameter == 1) {
-        xtb_loadGFN1xTB(m_env, m_xtb_mol, m_xtb_calc, NULL);
-    } else if (parameter == 2) {
-        xtb_loadGFN2xTB(m_env, m_xtb_mol, m_xtb_calc, NULL);
-    } else if (parameter == 66) {
-        xtb_loadGFNFF(m_env, m_xtb_mol, m_xtb_calc, NULL);
+    if (parameter != m_parameter) {
+        if (parameter == 0) {
+            xtb_loadGFN0xTB(m_env, m_xtb_mol, m_xtb_calc, NULL);
+        } else if (parameter == 1) {
+            xtb_loadGFN1xTB(m_env, m_xtb_mol, m_xtb_calc, NULL);
+        } else if (parameter == 2) {
+            xtb_loadGFN2xTB(m_env, m_xtb_mol, m_xtb_calc, NULL);
+        } else if (parameter == 66) {
+            xtb_loadGFNFF(m_env, m_xtb_mol, m_xtb_calc, NULL);
+        }
+        m_parameter = parameter;
     }
     xtb_singlepoint(m_env, m_xtb_mol, m_xtb_calc, m_xtb_res);
     if (xtb_checkEnvironment(m_env)) {
         xtb_showEnvironment(m_env, NULL);
+        /* the next call starts again from a freshly loaded calculator */
+        m_parameter = -1;
         return 4;
     }
 
@@ -145,37 +138,24 @@ double XTBInterface::GFNCalculation(int parameter, double* grad)
 std::vector<double> XTBInterface::Charges() const
 {
     std::vector<double> charges(m_atomcount);
-    double* c = new double[m_atomcount];
-    xtb_getCharges(m_env, m_xtb_res, c);
-    for (int i = 0; i < m_atomcount; ++i)
-        charges[i] = c[i];
-    delete[] c;
+    xtb_getCharges(m_env, m_xtb_res, charges.data());
     return charges;
 }
 
 std::vector<double> XTBInterface::Dipole() const
 {
     std::vector<double> dipole(3);
-    double* c = new double[3];
-    xtb_getDipole(m_env, m_xtb_res, c);
-    for (int i = 0; i < 3; ++i)
-        dipole[i] = c[i];
-    delete[] c;
+    xtb_getDipole(m_env, m_xtb_res, dipole.data());
     return dipole;
 }
 
 std::vector<std::vector<double>> XTBInterface::BondOrders() const
 {
-    std::vector<std::vector<double>> bond_orders(m_atomcount);
-    double* bonds = new double[m_atomcount * m_atomcount];
-    xtb_getBondOrders(m_env, m_xtb_res, bonds);
-    for (int i = 0; i < m_atomcount; ++i) {
-        std::vector<double> b(m_atomcount);
+    std::vector<std::vector<double>> bond_orders(m_atomcount, std::vector<double>(m_atomcount));
+    xtb_getBondOrders(m_env, m_xtb_res, m_bonds.data());
+    for (int i = 0; i < m_atomcount; ++i)
         for (int j = 0; j < m_atomcount; ++j)
-            b[j] = bonds[i * j];
-        bond_orders[i] = b;
-    }
-    delete[] bonds;
+            bond_orders[i][j] = m_bonds[i * m_atomcount + j];
     return bond_orders;
 }
 
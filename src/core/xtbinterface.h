@@ -32,6 +32,9 @@ static json XTBSettings{
 
 class UFF;
 
+/*! \brief xtb single points through the C api. Molecule and calculator handles live as long as atoms,
+ * charge and spin stay the same, after InitialiseMolecule a geometry update and a calculation allocate
+ * nothing on our side. Coordinates and gradients are contiguous x, y, z arrays in Bohr and Eh/Bohr. */
 class XTBInterface {
 public:
     XTBInterface(const json& xtbsettings = XTBSettings);
@@ -49,6 +52,7 @@ public:
      * 0 = xtb GFN 0
      * 1 = xtb GFN 1
      * 2 = xtb GFN 2
+     * grad has to hold 3 * atoms values
      * */
     double GFNCalculation(int parameter = 2, double* grad = 0);
 
@@ -59,10 +63,14 @@ public:
     std::vector<std::vector<double>> BondOrders() const;
 
 private:
-    int m_atomcount = 0;
+    int m_atomcount = 0, m_spin = 0;
+    double m_charge = 0;
     double m_thr = 1.0e-10;
-    double* m_coord;
-    int* m_attyp;
+    std::vector<double> m_coord;
+    std::vector<int> m_attyp;
+    /* the xtb calculator is loaded once per parametrisation and molecule handle */
+    int m_parameter = -1;
+    mutable std::vector<double> m_bonds;
     xtb_TEnvironment m_env = NULL;
     xtb_TMolecule m_xtb_mol = NULL;
     xtb_TCalculator m_xtb_calc = NULL;
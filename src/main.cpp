@@ -17,8 +17,12 @@
  *
  */
 
+#include "src/core/dispersionrefresh.h"
+#include "src/core/energycalculator.h"
+#include "src/core/energyworkerpool.h"
 #include "src/core/fileiterator.h"
 #include "src/core/hessian.h"
+#include "src/core/isa.h"
 #include "src/core/molecule.h"
 
 #include "src/capabilities/analysenciplot.h"
@@ -37,7 +41,9 @@
 #include "src/tools/general.h"
 #include "src/tools/info.h"
 
+#include <iomanip>
 #include <iostream>
+#include <numeric>
 #include <string>
 #include <cstring>
 #include <fstream>
@@ -134,6 +140,10 @@ double DotProduct(const Vector& pos1, const Vector& pos2)
 }
 
 int main(int argc, char **argv) {
+    /* worker process of an EnergyWorkerPool, started by curcuma itself */
+    if (EnergyWorkerPool::IsWorker(argc, argv))
+        return EnergyWorkerPool::Serve(argc, argv);
+
 #ifndef _WIN32
 #if __GNUC__
     signal(SIGINT, ctrl_c_handler);
@@ -169,13 +179,19 @@ int main(int argc, char **argv) {
                   << "-rmsdtraj    * Find unique structures                                     *" << std::endl
                   << "-distance    * Calculate distance matrix                                  *" << std::endl
                   << "-reorder     * Write molecule file with randomly reordered indices        *" << std::endl
-                  << "-centroid    * Calculate centroid of specific atoms/fragments             *" << std::endl;
+                  << "-centroid    * Calculate centroid of specific atoms/fragments             *" << std::endl
+                  << "-info        * Print cpu, kernel instruction set and dispersion mode      *" << std::endl;
         exit(1);
     }
     if(argc >= 2)
     {
         json controller = CLI2Json(argc, argv);
 
+        for (int i = 2; i < argc - 1; ++i) {
+            if (strcmp(argv[i], "-isa") == 0 && !ISA::Select(argv[i + 1]))
+                std::cerr << "Instruction set " << argv[i + 1] << " is unknown or not supported by this cpu, staying with " << ISA::Name(ISA::Selected()) << std::endl;
+        }
+
         if(strcmp(argv[1], "-rmsd") == 0)
         {
             if (argc < 4) {
@@ -281,12 +297,39 @@ int main(int argc, char **argv) {
         } else if (strcmp(argv[1], "-led") == 0) {
             if (argc < 2) {
                 std::cerr << "Please use curcuma for fragment assignment as follows:\ncurcuma -led input.xyz" << std::endl;
+                std::cerr << "-method uff **** Energies of the fragments and their interaction energy." << std::endl;
+                std::cerr << "-fragment_charges \"1|0\" -fragment_spins \"0|0\" **** Charges and spins of the fragments, needed for charged or open shell complexes." << std::endl;
                 return 0;
             }
 
             Molecule mol1 = Files::LoadFile(argv[2]);
-            if (mol1.Atoms().size())
+            if (mol1.Atoms().size()) {
                 mol1.printFragmente();
+                /* with -method the energies of the fragments and their interaction follow */
+                json led = controller["led"];
+                if (led.contains("method")) {
+                    const std::vector<std::vector<int>> fragments = mol1.GetFragments();
+                    /* "1|0" or a single number, the complex gets the sum of the fragment charges */
+                    auto states = [&led](const std::string& key) {
+                        if (!led.contains(key))
+                            return std::vector<int>();
+                        if (led[key].is_number())
+                            return std::vector<int>{ int(led[key].get<double>()) };
+                        return Tools::String2Vector(led[key].get<std::string>());
+                    };
+                    const std::vector<int> charges = states("fragment_charges"), spins = states("fragment_spins");
+                    if (charges.size())
+                        mol1.setCharge(std::accumulate(charges.begin(), charges.end(), 0));
+                    EnergyCalculator calculator(led["method"].get<std::string>(), led);
+                    calculator.setMolecule(mol1);
+                    const std::vector<double> energies = calculator.FragmentEnergies(fragments, charges, spins);
+                    if (energies.size()) {
+                        for (int i = 0; i < fragments.size(); ++i)
+                            std::cout << "Fragment " << i + 1 << " (" << fragments[i].size() << " atoms): " << std::setprecision(10) << energies[i] << " Eh" << std::endl;
+                        std::cout << "Interaction energy: " << energies.back() << " Eh (" << energies.back() * 2625.5 << " kJ/mol)" << std::endl;
+                    }
+                }
+            }
         } else if (strcmp(argv[1], "-hmap") == 0) {
             if (argc < 2) {
                 std::cerr << "Please use curcuma for hydrogen bond mapping as follows:\ncurcuma -hmap trajectory.xyz" << std::endl;
@@ -819,6 +862,9 @@ int main(int argc, char **argv) {
                 Molecule mol = file.Next();
                 mol.writeXYZFile(outfile, Tools::RandomVector(0, mol.AtomCount()));
             }
+        } else if (strcmp(argv[1], "-info") == 0) {
+            std::cout << ISA::Report();
+            std::cout << DispersionRefresh::Report(controller.contains("info") ? controller["info"] : json()) << std::endl;
         } else if (strcmp(argv[1], "-gyration") == 0) {
             FileIterator file(argv[2]);
             int count = 1;
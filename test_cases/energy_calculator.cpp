@@ -0,0 +1,481 @@
+/*
+ * <EnergyCalculator ensemble, dispersion refresh and fragment tests within curcuma.>
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/core/dispersionrefresh.h"
+#include "src/core/eigen_uff.h"
+#include "src/core/energycache.h"
+#include "src/core/energycalculator.h"
+#include "src/core/energyworkerpool.h"
+#include "src/core/molecule.h"
+
+#include "testcases.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <signal.h>
+
+#include "json.hpp"
+using json = nlohmann::json;
+
+using namespace TestCases;
+
+std::vector<Molecule> Ensemble()
+{
+    std::vector<Molecule> molecules;
+    for (int k = 0; k < 24; ++k) {
+        Molecule molecule(k % 3 == 2 ? "B.xyz" : "A.xyz");
+        Geometry geometry = molecule.getGeometry();
+        for (int i = 0; i < geometry.rows(); ++i)
+            for (int c = 0; c < 3; ++c)
+                geometry(i, c) += 0.02 * std::sin(1.3 * k + 3.0 * i + c);
+        molecule.setGeometry(geometry);
+        molecules.push_back(molecule);
+    }
+    return molecules;
+}
+
+double Energy(const Molecule& molecule, const json& controller)
+{
+    EnergyCalculator interface("uff", controller);
+    interface.setMolecule(molecule);
+    return interface.CalculateEnergy(false);
+}
+
+std::vector<double> Reference(const std::vector<Molecule>& molecules, const json& controller, std::vector<Matrix>* gradients = nullptr)
+{
+    std::vector<double> reference;
+    for (const Molecule& molecule : molecules) {
+        EnergyCalculator interface("uff", controller);
+        interface.setMolecule(molecule);
+        reference.push_back(interface.CalculateEnergy(gradients != nullptr));
+        if (gradients)
+            gradients->push_back(interface.Gradient());
+    }
+    return reference;
+}
+
+/* an ensemble of displaced A.xyz and B.xyz structures in mixed order has to give the energies of one
+ * calculator per structure, in the same order and for every thread count, also on a second call with the kept calculators */
+int Pool()
+{
+    const std::vector<Molecule> molecules = Ensemble();
+    const json controller = UFFParameterJson;
+    const std::vector<double> reference = Reference(molecules, controller);
+
+    double deviation = 0;
+    for (int threads : { 1, 4 }) {
+        EnergyCalculator interface("uff", controller);
+        for (int call = 0; call < 2; ++call) {
+            const std::vector<double> energies = interface.CalculateEnergies(molecules, threads);
+            if (energies.size() != reference.size())
+                deviation = 1;
+            for (int k = 0; k < std::min(energies.size(), reference.size()); ++k)
+                deviation = std::max(deviation, std::abs(energies[k] - reference[k]));
+        }
+    }
+    if (!EnergyCalculator::ThreadSafe("uff") || EnergyCalculator::ThreadSafe("xtb-gfn2") || EnergyCalculator::ThreadSafe("gfn2") || EnergyCalculator::ThreadSafe("ipea1"))
+        deviation = 1;
+    return Report("Parallel single points", deviation, 1e-10);
+}
+
+/* the kept calculator of a thread may only follow with new coordinates if bonds, cell and charges stay the same:
+ * A.xyz with a hydrogen pulled off, in a cell and with partial charges has to give the energies of fresh calculators */
+int Compatible()
+{
+    const json controller = UFFParameterJson;
+    const Molecule molecule("A.xyz");
+    Molecule broken(molecule), periodic(molecule);
+    for (int i = 0; i < molecule.AtomCount(); ++i) {
+        if (molecule.Atom(i).first != 1)
+            continue;
+        Geometry geometry = molecule.getGeometry();
+        geometry.row(i) += 1.5 * (geometry.row(i) - geometry.colwise().mean()).normalized();
+        broken.setGeometry(geometry);
+        break;
+    }
+    periodic.setCell(UnitCell(60.0 * Eigen::Matrix3d::Identity()));
+    const std::vector<Molecule> molecules = { molecule, broken, molecule, periodic, molecule };
+    const std::vector<double> reference = Reference(molecules, controller);
+
+    double deviation = 0;
+    EnergyCalculator interface("uff", controller);
+    std::vector<double> energies = interface.CalculateEnergies(molecules, 1);
+    for (int k = 0; k < reference.size(); ++k)
+        deviation = std::max(deviation, std::abs(energies[k] - reference[k]));
+
+    for (double scaling : { 0.1, -0.2 }) {
+        std::vector<double> charges(molecule.AtomCount());
+        for (int i = 0; i < charges.size(); ++i)
+            charges[i] = scaling * std::sin(0.9 * i);
+        EnergyCalculator charged("uff", controller);
+        charged.setMolecule(molecule);
+        charged.setCharges(charges);
+        interface.setCharges(charges);
+        energies = interface.CalculateEnergies({ molecule }, 1);
+        deviation = std::max(deviation, std::abs(energies[0] - charged.CalculateEnergy(false)));
+    }
+    return Report("Kept calculators of other bonds, cells and charges", deviation, 1e-10);
+}
+
+/* the same ensemble in worker processes, with gradients, and once more after one of the workers was killed */
+int Processes()
+{
+    const std::vector<Molecule> molecules = Ensemble();
+    json controller = UFFParameterJson;
+    std::vector<Matrix> reference_gradients;
+    const std::vector<double> reference = Reference(molecules, controller, &reference_gradients);
+
+    double deviation = 0;
+    EnergyWorkerPool pool("uff", controller, 3);
+    for (int call = 0; call < 3; ++call) {
+        if (call == 2)
+            kill(pool.Pids()[1], SIGKILL);
+        std::vector<Matrix> gradients;
+        const std::vector<double> energies = pool.CalculateEnergies(molecules, &gradients);
+        if (energies.size() != reference.size() || gradients.size() != reference.size())
+            return EXIT_FAILURE;
+        for (int k = 0; k < reference.size(); ++k) {
+            deviation = std::max(deviation, std::abs(energies[k] - reference[k]));
+            deviation = std::max(deviation, (gradients[k] - reference_gradients[k]).cwiseAbs().maxCoeff());
+        }
+    }
+    if (pool.Restarts() != 1)
+        deviation = 1;
+
+    /* the same through the controller of EnergyCalculator */
+    controller["processes"] = 2;
+    EnergyCalculator interface("uff", controller);
+    const std::vector<double> energies = interface.CalculateEnergies(molecules, 1);
+    for (int k = 0; k < reference.size(); ++k)
+        deviation = std::max(deviation, std::abs(energies[k] - reference[k]));
+    return Report("Single points in worker processes", deviation, 1e-10);
+}
+
+/* the second pass over the ensemble and the repeated single point come from the cache, the file gets one line per new entry,
+ * other method settings get their own entries */
+int Cache()
+{
+    const std::vector<Molecule> molecules = Ensemble();
+    const json plain = UFFParameterJson;
+    std::vector<Matrix> reference_gradients;
+    const std::vector<double> reference = Reference(molecules, plain, &reference_gradients);
+
+    std::remove("energy_cache.dat");
+    const json controller = MergeJson(UFFParameterJson, json{ { "energy_cache_file", "energy_cache.dat" } });
+    EnergyCache& cache = EnergyCache::Instance();
+
+    double deviation = 0;
+    EnergyCalculator interface("uff", controller);
+    for (int call = 0; call < 2; ++call) {
+        const std::vector<double> energies = interface.CalculateEnergies(molecules, 2);
+        for (int k = 0; k < reference.size(); ++k)
+            deviation = std::max(deviation, std::abs(energies[k] - reference[k]));
+    }
+    const bool batch = cache.Misses() == molecules.size() && cache.Hits() == molecules.size();
+
+    /* the stored entry has no gradient, the first single point with gradient is a miss and replaces it */
+    EnergyCalculator single("uff", controller);
+    single.setMolecule(molecules[0]);
+    single.setEnergyCache(true);
+    for (int call = 0; call < 2; ++call) {
+        deviation = std::max(deviation, std::abs(single.CalculateEnergy(true) - reference[0]));
+        deviation = std::max(deviation, (single.Gradient() - reference_gradients[0]).cwiseAbs().maxCoeff());
+    }
+    const bool gradient = cache.Misses() == molecules.size() + 1 && cache.Hits() == molecules.size() + 1;
+
+    /* other force field settings miss all entries, threads and cache keys do not count as settings */
+    EnergyCalculator scaled("uff", MergeJson(controller, json{ { "vdw_scaling", 0.5 } }));
+    const std::vector<double> energies = scaled.CalculateEnergies(molecules, 2);
+    const bool settings = cache.Misses() == 2 * molecules.size() + 1 && std::abs(energies[0] - reference[0]) > 1e-6;
+
+    /* the same structure with partial charges set from outside is another single point */
+    EnergyCalculator charged("uff", controller);
+    charged.setMolecule(molecules[0]);
+    charged.setCharges(std::vector<double>(molecules[0].AtomCount(), 0.1));
+    charged.setEnergyCache(true);
+    charged.CalculateEnergy(true);
+    const bool charges = cache.Misses() == 2 * molecules.size() + 2;
+
+    const std::string uff = EnergyCache::Settings(UFFParameterJson, controller);
+    const UnitCell none, box(Eigen::Matrix3d::Identity() * 40.0), larger(Eigen::Matrix3d::Identity() * 41.0);
+    const std::vector<double> neutral, partial(molecules[0].AtomCount(), 0.1);
+    const auto Key = [&](const Molecule& molecule, const UnitCell& cell, const std::vector<double>& charges) {
+        return EnergyCache::Key("uff", uff, molecule.Charge(), molecule.Spin(), molecule.Atoms(), molecule.Coords(), cell, charges, 1e-5);
+    };
+    Molecule other(molecules[0]);
+    other.setSpin(2);
+    const bool key = Key(molecules[0], none, neutral) != Key(other, none, neutral)
+        && Key(molecules[0], none, neutral) != Key(molecules[0], box, neutral) && Key(molecules[0], box, neutral) != Key(molecules[0], larger, neutral)
+        && Key(molecules[0], none, neutral) != Key(molecules[0], none, partial)
+        && uff == EnergyCache::Settings(UFFParameterJson, MergeJson(plain, json{ { "threads", 4 }, { "vdw_scaling", 1.0 } }))
+        && uff != EnergyCache::Settings(UFFParameterJson, MergeJson(plain, json{ { "d3", 1 } }));
+
+    const auto Lines = [] {
+        int lines = 0;
+        std::ifstream file("energy_cache.dat");
+        for (std::string line; std::getline(file, line);)
+            ++lines;
+        return lines;
+    };
+    /* a batch writes everything pending, the single point after the last batch waits for Flush */
+    const bool pending = Lines() == 2 * molecules.size() + 1;
+    cache.Flush();
+    const int lines = Lines();
+    std::remove("energy_cache.dat");
+
+    const bool passed = deviation < 1e-10 && batch && gradient && settings && charges && key && pending && lines == 2 * molecules.size() + 2;
+    return Report("Energy cache", passed, std::to_string(deviation) + ", " + std::to_string(cache.Hits()) + " hits, " + std::to_string(cache.Misses()) + " misses, " + std::to_string(lines) + " lines");
+}
+
+/* damped pair dispersion -c6 / (r^6 + a^6), smooth like D3 and D4 and cheap to evaluate exactly.
+ * Like them it works in Bohr, geometry is given in Angstrom and the gradient returned in Eh / Bohr */
+double Pairs(const Matrix& geometry, std::vector<double>& gradient)
+{
+    const double c6 = 5e-2 / std::pow(au, 6), a6 = std::pow(3.0 / au, 6);
+    double energy = 0;
+    std::fill(gradient.begin(), gradient.end(), 0.0);
+    for (int i = 0; i < geometry.rows(); ++i)
+        for (int j = 0; j < i; ++j) {
+            const Eigen::Vector3d d = (geometry.row(i) - geometry.row(j)) / au;
+            const double r2 = d.squaredNorm(), r6 = r2 * r2 * r2;
+            energy -= c6 / (r6 + a6);
+            const double factor = 6 * c6 * r2 * r2 / ((r6 + a6) * (r6 + a6));
+            for (int c = 0; c < 3; ++c) {
+                gradient[3 * i + c] += factor * d(c);
+                gradient[3 * j + c] -= factor * d(c);
+            }
+        }
+    return energy;
+}
+
+/* every atom oscillates around its position, the lazy contribution is compared to the exact one in every step */
+int Trajectory(const json& controller, double energy_tolerance, double gradient_tolerance, double refreshes)
+{
+    Molecule molecule("A.xyz");
+    const Matrix start = molecule.getGeometry();
+    const int atoms = start.rows();
+    std::vector<double> exact_gradient(3 * atoms);
+    DispersionRefresh refresh(controller);
+
+    double energy_deviation = 0, gradient_deviation = 0;
+    const int steps = 400;
+    Matrix geometry = start, gradient(atoms, 3);
+    for (int step = 0; step < steps; ++step) {
+        for (int i = 0; i < atoms; ++i)
+            for (int c = 0; c < 3; ++c)
+                geometry(i, c) = start(i, c) + 0.15 * std::sin(0.02 * step * (1 + 0.37 * (i % 5) + 0.11 * c) + i);
+        const double exact = Pairs(geometry, exact_gradient);
+
+        double energy = 0;
+        gradient.setZero();
+        if (!refresh.Extrapolate(geometry, energy, &gradient)) {
+            std::vector<double> calculated(3 * atoms);
+            energy = Pairs(geometry, calculated);
+            refresh.Refresh(geometry, energy, calculated.data(), 1.0 / au);
+            for (int i = 0; i < atoms; ++i)
+                for (int c = 0; c < 3; ++c)
+                    gradient(i, c) += calculated[3 * i + c] / au;
+        }
+        energy_deviation = std::max(energy_deviation, std::abs(energy - exact));
+        for (int i = 0; i < atoms; ++i)
+            for (int c = 0; c < 3; ++c)
+                gradient_deviation = std::max(gradient_deviation, std::abs(gradient(i, c) - exact_gradient[3 * i + c] / au));
+    }
+    const double ratio = refresh.Refreshes() / double(steps);
+    std::cout << refresh.Statistics("Pair dispersion") << std::endl;
+    std::cout << "Maximal deviation, energy " << energy_deviation << " gradient " << gradient_deviation << std::endl;
+    const bool passed = energy_deviation <= energy_tolerance && gradient_deviation <= gradient_tolerance && ratio <= refreshes;
+    return Report("Lazy dispersion refresh", passed, std::to_string(energy_deviation) + ", " + std::to_string(gradient_deviation) + ", " + std::to_string(ratio));
+}
+
+#if defined(USE_D3) || defined(USE_D4)
+/* UFF with D3 or D4 along a short oscillation of A.xyz, once with the full dispersion in every step and once lazily */
+int UFFDispersion(const json& dispersion)
+{
+    Molecule molecule("A.xyz");
+    const Matrix start = molecule.getGeometry();
+    const int atoms = start.rows();
+    const json lazy_controller = MergeJson(dispersion, json{ { "dispersion_refresh", 0.1 }, { "dispersion_drift", 1e-5 } });
+    eigenUFF full(MergeJson(UFFParameterJson, dispersion));
+    eigenUFF lazy(MergeJson(UFFParameterJson, lazy_controller));
+    for (eigenUFF* uff : { &full, &lazy }) {
+        uff->setMolecule(molecule.Atoms(), molecule.Coords());
+        uff->Initialise();
+    }
+
+    double energy_deviation = 0, gradient_deviation = 0;
+    std::vector<std::array<double, 3>> geometry(atoms);
+    for (int step = 0; step < 100; ++step) {
+        for (int i = 0; i < atoms; ++i)
+            for (int c = 0; c < 3; ++c)
+                geometry[i][c] = start(i, c) + 0.15 * std::sin(0.02 * step * (1 + 0.37 * (i % 5) + 0.11 * c) + i);
+        full.UpdateGeometry(geometry);
+        lazy.UpdateGeometry(geometry);
+        energy_deviation = std::max(energy_deviation, std::abs(full.Calculate(true) - lazy.Calculate(true)));
+        gradient_deviation = std::max(gradient_deviation, (full.Gradient() - lazy.Gradient()).cwiseAbs().maxCoeff());
+    }
+    std::cout << "Maximal deviation of lazy UFF dispersion, energy " << energy_deviation << " gradient " << gradient_deviation << std::endl;
+    return Report("Lazy UFF dispersion", energy_deviation < 5e-5 && gradient_deviation < 1e-3, std::to_string(energy_deviation) + ", " + std::to_string(gradient_deviation));
+}
+#endif
+
+/* A.xyz is a host guest complex, the guest (second fragment) is moved a little per pose */
+Molecule Complex(int pose)
+{
+    Molecule complex("A.xyz");
+    const std::vector<std::vector<int>> fragments = complex.GetFragments();
+    Geometry geometry = complex.getGeometry();
+    for (int atom : fragments[1]) {
+        geometry(atom, 0) += 0.1 * std::sin(0.7 * pose);
+        geometry(atom, 1) += 0.1 * std::cos(0.3 * pose);
+    }
+    complex.setGeometry(geometry);
+    return complex;
+}
+
+Molecule Fragment(const Molecule& complex, const std::vector<int>& atoms)
+{
+    Molecule fragment;
+    for (int atom : atoms)
+        fragment.addPair(complex.Atom(atom));
+    fragment.setCell(complex.Cell());
+    return fragment;
+}
+
+/* the fragment entries have to be the energies of the isolated fragments and all entries have to add up to the complex,
+ * for the split terms (one evaluation) as well as for the separate calculations the corrections fall back to.
+ * With a margin the complex sits in a cubic cell that much wider than itself, the fragments keep the cell */
+int Fragments(const json& parameter, double margin = 0)
+{
+    const json controller = MergeJson(UFFParameterJson, parameter);
+    double deviation = 0;
+    std::size_t count = 0;
+    for (int pose = 0; pose < 3; ++pose) {
+        Molecule complex = Complex(pose);
+        const std::vector<std::vector<int>> fragments = complex.GetFragments();
+        count = fragments.size();
+        if (margin > 0) {
+            const Geometry geometry = complex.getGeometry();
+            const Eigen::Vector3d extent = geometry.colwise().maxCoeff() - geometry.colwise().minCoeff();
+            complex.setCell(UnitCell(Eigen::Matrix3d::Identity() * (extent.maxCoeff() + margin)));
+        }
+
+        EnergyCalculator interface("uff", controller);
+        interface.setMolecule(complex);
+        const std::vector<double> energies = interface.FragmentEnergies(fragments);
+        if (energies.size() != fragments.size() + 1)
+            return EXIT_FAILURE;
+
+        double sum = 0;
+        for (int f = 0; f < fragments.size(); ++f) {
+            deviation = std::max(deviation, std::abs(energies[f] - Energy(Fragment(complex, fragments[f]), controller)));
+            sum += energies[f];
+        }
+        deviation = std::max(deviation, std::abs(sum + energies.back() - Energy(complex, controller)));
+        if (pose == 0)
+            std::cout << "Interaction energy " << energies.back() * 2625.5 << " kJ/mol" << std::endl;
+    }
+    std::cout << "Maximal deviation from separate calculations " << deviation << " Eh" << std::endl;
+    return Report("UFF fragment energies", count == 2 && deviation < 1e-10, std::to_string(deviation) + ", " + std::to_string(count) + " fragments");
+}
+
+/* the separate calculations of a charged complex need the charges of the fragments, without them the result is empty */
+int Charged()
+{
+    const json controller = MergeJson(UFFParameterJson, json{ { "h4_scaling", 1.0 }, { "hh_scaling", 1.0 } });
+    Molecule complex = Complex(0);
+    complex.setCharge(1);
+    const std::vector<std::vector<int>> fragments = complex.GetFragments();
+
+    EnergyCalculator interface("uff", controller);
+    interface.setMolecule(complex);
+    const bool refused = interface.FragmentEnergies(fragments).empty() && interface.FragmentEnergies(fragments, { 0, 0 }).empty();
+    const std::vector<double> energies = interface.FragmentEnergies(fragments, { 1, 0 });
+    const double deviation = energies.size() == 3 ? std::abs(energies[0] + energies[1] + energies[2] - Energy(complex, controller)) : 1;
+    return Report("Charged fragment energies", refused && deviation < 1e-10, deviation);
+}
+
+/* ranking of poses: one FragmentEnergies against host, guest and complex calculators that only update their geometries */
+int Ranking()
+{
+    const json controller = UFFParameterJson;
+    const int poses = 50;
+    std::vector<Molecule> complexes;
+    for (int pose = 0; pose < poses; ++pose)
+        complexes.push_back(Complex(pose));
+    const std::vector<std::vector<int>> fragments = complexes[0].GetFragments();
+
+    EnergyCalculator split("uff", controller), complex("uff", controller), host("uff", controller), guest("uff", controller);
+    split.setMolecule(complexes[0]);
+    complex.setMolecule(complexes[0]);
+    host.setMolecule(Fragment(complexes[0], fragments[0]));
+    guest.setMolecule(Fragment(complexes[0], fragments[1]));
+
+    double deviation = 0;
+    std::chrono::duration<double> separate_time(0), split_time(0);
+    for (const Molecule& pose : complexes) {
+        auto start = std::chrono::high_resolution_clock::now();
+        complex.updateGeometry(pose.Coords());
+        host.updateGeometry(Fragment(pose, fragments[0]).Coords());
+        guest.updateGeometry(Fragment(pose, fragments[1]).Coords());
+        const double interaction = complex.CalculateEnergy(false) - host.CalculateEnergy(false) - guest.CalculateEnergy(false);
+        separate_time += std::chrono::high_resolution_clock::now() - start;
+
+        start = std::chrono::high_resolution_clock::now();
+        split.updateGeometry(pose.Coords());
+        const double energy = split.FragmentEnergies(fragments).back();
+        split_time += std::chrono::high_resolution_clock::now() - start;
+        deviation = std::max(deviation, std::abs(energy - interaction));
+    }
+    std::cout << "Separate calculations " << separate_time.count() << " s, one evaluation " << split_time.count() << " s" << std::endl;
+    return Report("UFF fragment ranking", deviation, 1e-10);
+}
+
+int main(int argc, char** argv)
+{
+    if (EnergyWorkerPool::IsWorker(argc, argv))
+        return EnergyWorkerPool::Serve(argc, argv);
+
+    Cases cases = { { "pool_uff", Pool },
+        { "pool_compatible", Compatible },
+        { "pool_processes", Processes },
+        { "pool_cache", Cache },
+        { "dispersion_lazy", [] { return Trajectory(json{ { "dispersion_refresh", 0.1 }, { "dispersion_drift", 1e-5 } }, 5e-5, 1e-4, 0.25); } },
+        { "dispersion_full", [] { return Trajectory(json{}, 0, 0, 1); } },
+        { "fragments_exact", [] { return Fragments(json{}); } },
+        { "fragments_cutoff", [] { return Fragments(json{ { "vdw_cutoff", 8.0 } }); } },
+        { "fragments_corrections", [] { return Fragments(json{ { "h4_scaling", 1.0 }, { "hh_scaling", 1.0 } }); } },
+        { "fragments_periodic", [] { return Fragments(json{ { "h4_scaling", 1.0 }, { "hh_scaling", 1.0 } }, 3.0); } },
+        { "fragments_charged", Charged },
+        { "fragments_ranking", Ranking } };
+#ifdef USE_D3
+    cases["dispersion_d3"] = [] { return UFFDispersion(json{ { "d3", 1 } }); };
+#endif
+#ifdef USE_D4
+    cases["dispersion_d4"] = [] { return UFFDispersion(json{ { "d4", 1 } }); };
+#endif
+    return Run(argc, argv, cases);
+}
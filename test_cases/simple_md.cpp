@@ -0,0 +1,211 @@
+/*
+ * <SimpleMD tests within curcuma.>
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/core/elements.h"
+#include "src/core/energycalculator.h"
+#include "src/core/global.h"
+#include "src/core/molecule.h"
+
+#include "src/capabilities/simplemd.h"
+
+#include "src/tools/general.h"
+
+#include "testcases.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+using json = nlohmann::json;
+
+using namespace TestCases;
+
+/* coordinates and velocities of a run, as SimpleMD reads them back from a restart file */
+struct Start {
+    Molecule molecule;
+    std::vector<double> geometry, velocities;
+};
+
+/* A.xyz is no UFF minimum, steepest descent removes most of the strain that would heat a start from it */
+Molecule Relaxed(const std::string& file)
+{
+    Molecule molecule(file);
+    EnergyCalculator descent("uff", UFFParameterJson);
+    descent.setMolecule(molecule);
+    Matrix geometry = molecule.getGeometry();
+    double energy = descent.CalculateEnergy(true), step = 0.02;
+    for (int i = 0; i < 300; ++i) {
+        const Matrix gradient = descent.Gradient();
+        const Matrix trial = geometry - step / gradient.cwiseAbs().maxCoeff() * gradient;
+        descent.updateGeometry(Positions(trial));
+        const double lower = descent.CalculateEnergy(true);
+        if (lower < energy) {
+            geometry = trial;
+            energy = lower;
+            step *= 1.2;
+        } else {
+            descent.updateGeometry(Positions(geometry));
+            descent.CalculateEnergy(true);
+            step *= 0.5;
+        }
+    }
+    molecule.setGeometry(geometry);
+    return molecule;
+}
+
+/* the atoms of molecule moved by up to distortion Angstrom, the heavy atoms with about their thermal velocity at 298 K.
+ * The hydrogens rest, as SimpleMD runs them with a scaled mass. */
+Start Distorted(const Molecule& molecule, double distortion)
+{
+    Start start{ molecule, {}, {} };
+    for (int i = 0; i < start.molecule.AtomCount(); ++i) {
+        const int element = start.molecule.Atom(i).first;
+        const double v0 = element == 1 ? 0.0 : std::sqrt(kb * 298.15 * amu2au / Elements::AtomicMass[element]) / fs2amu;
+        for (int c = 0; c < 3; ++c) {
+            start.geometry.push_back(start.molecule.Atom(i).second(c) + distortion * std::sin(1.3 * i + 2.1 * c));
+            start.velocities.push_back(v0 * std::cos(0.7 * i + 1.1 * c));
+        }
+    }
+    /* the restart file keeps six digits, the references start from what is read back */
+    start.geometry = Tools::String2DoubleVec(Tools::DoubleVector2String(start.geometry), "|");
+    start.velocities = Tools::String2DoubleVec(Tools::DoubleVector2String(start.velocities), "|");
+    return start;
+}
+
+/* restart state of steps time steps of dT without thermostat, LoadRestartInformation reads every key */
+json State(const Start& start, double dT, int steps, int respa = 1)
+{
+    return json{ { "method", "uff" }, { "thermostat", "none" }, { "dT", dT }, { "MaxTime", (steps - 0.5) * dT }, { "T", 298.15 }, { "centered", 0 }, { "currentStep", 0 },
+        { "average_T", 0 }, { "average_Epot", 0 }, { "average_Ekin", 0 }, { "average_Etot", 0 }, { "coupling", 10 }, { "respa", respa },
+        { "geometry", Tools::DoubleVector2String(start.geometry) }, { "velocities", Tools::DoubleVector2String(start.velocities) } };
+}
+
+/* energies after the last step and number of dumped frames */
+struct Trajectory {
+    double epot, ekin;
+    int frames;
+};
+
+/* runs SimpleMD on the molecule of start from state, the state is read like a restart file */
+Trajectory Dynamics(const Start& start, const json& state, const json& md = json{})
+{
+    std::ofstream("md_start.json") << state;
+    const json controller = { { "md", MergeJson(json{ { "method", "uff" }, { "dump", 1000 }, { "print", 1000 }, { "initfile", "md_start.json" }, { "norestart", true }, { "writerestart", -1 } }, md) } };
+    SimpleMD dynamics(controller, true);
+    dynamics.setMolecule(start.molecule);
+    dynamics.setBaseName("md_test");
+    dynamics.Initialise();
+    dynamics.start();
+
+    int lines = 0;
+    std::ifstream trajectory("md_test.trj.xyz");
+    for (std::string line; std::getline(trajectory, line);)
+        ++lines;
+    std::remove("md_start.json");
+    std::remove("md_test.trj.xyz");
+    std::remove("curcuma_final.json");
+    return { dynamics.Epot(), dynamics.Ekin(), lines / (start.molecule.AtomCount() + 2) };
+}
+
+double Epot(const Start& start)
+{
+    Matrix positions(start.molecule.AtomCount(), 3);
+    for (int i = 0; i < start.molecule.AtomCount(); ++i)
+        for (int c = 0; c < 3; ++c)
+            positions(i, c) = start.geometry[3 * i + c];
+    Molecule molecule(start.molecule);
+    molecule.setGeometry(positions);
+    EnergyCalculator calculator("uff", UFFParameterJson);
+    calculator.setMolecule(molecule);
+    return calculator.CalculateEnergy();
+}
+
+/* restart files write coordinates and velocities separated by '|', a run without steps has to start from the coordinates of the file
+ * and not from those of the molecule */
+int RestartGeometry()
+{
+    const Start start = Distorted(Molecule("A.xyz"), 0.05);
+    const double reference = Epot(start);
+    const double epot = Dynamics(start, State(start, 0.5, 0)).epot;
+    return Report("MD restart geometry", std::abs(epot - reference), 1e-8);
+}
+
+/* the masses are stored per coordinate, the kinetic energy has to take the one of the atom for each of its velocities */
+int KineticEnergy()
+{
+    const Start start = Distorted(Molecule("A.xyz"), 0.0);
+    double reference = 0;
+    for (int i = 0; i < start.molecule.AtomCount(); ++i)
+        for (int c = 0; c < 3; ++c)
+            reference += 0.5 * Elements::AtomicMass[start.molecule.Atom(i).first] * start.velocities[3 * i + c] * start.velocities[3 * i + c];
+    const double ekin = Dynamics(start, State(start, 0.5, 0)).ekin;
+    return Report("MD kinetic energy", std::abs(ekin - reference) / reference, 1e-10);
+}
+
+/* without thermostat the velocities are left alone, velocity Verlet has to keep the total energy */
+int NoThermostat()
+{
+    const Start start = Distorted(Relaxed("A.xyz"), 0.01);
+    const double reference = Epot(start) + Dynamics(start, State(start, 0.5, 0)).ekin;
+    const Trajectory run = Dynamics(start, State(start, 0.5, 100), json{ { "dT", 0.5 } });
+    return Report("MD without thermostat", std::abs(run.epot + run.ekin - reference), 1e-3);
+}
+
+/* the time step of a restart file replaces the one of the controller, the run has to follow it as if it was given directly */
+int RestartTimestep()
+{
+    const Start start = Distorted(Relaxed("A.xyz"), 0.01);
+    const double reference = Dynamics(start, State(start, 0.5, 20), json{ { "dT", 0.5 } }).epot;
+    const double epot = Dynamics(start, State(start, 0.5, 20), json{ { "dT", 2.0 } }).epot;
+    return Report("MD restart time step", std::abs(epot - reference), 1e-10);
+}
+
+/* r-RESPA with the nonbonded forces every third step has to keep the total energy about as well as velocity Verlet with the same
+ * inner step and has to dump the same frames */
+int Respa()
+{
+    const Start start = Distorted(Relaxed("A.xyz"), 0.01);
+    const double energy = Epot(start) + Dynamics(start, State(start, 0.5, 0)).ekin;
+
+    double drift[2];
+    int frames[2];
+    for (int respa : { 1, 3 }) {
+        const Trajectory run = Dynamics(start, State(start, 0.5, 600, respa), json{ { "dump", 10 } });
+        drift[respa > 1] = std::abs(run.epot + run.ekin - energy);
+        frames[respa > 1] = run.frames;
+    }
+    /* the end points fluctuate by about 1e-4 Eh for both integrators, an outer step that is off drifts by far more */
+    const bool passed = frames[0] == frames[1] && frames[0] > 1 && drift[1] < 10 * std::max(drift[0], 1e-4);
+    return Report("MD r-RESPA", passed, "drift " + std::to_string(drift[1]) + " Eh, Verlet " + std::to_string(drift[0]) + " Eh, " + std::to_string(frames[1]) + " and " + std::to_string(frames[0]) + " frames");
+}
+
+int main(int argc, char** argv)
+{
+    return Run(argc, argv,
+        { { "restart_geometry", RestartGeometry },
+            { "restart_timestep", RestartTimestep },
+            { "kinetic_energy", KineticEnergy },
+            { "no_thermostat", NoThermostat },
+            { "respa", Respa } });
+}
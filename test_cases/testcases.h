@@ -0,0 +1,88 @@
+/*
+ * <Shared helpers of the test applications within curcuma.>
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "src/core/molecule.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace TestCases {
+
+/* exit code of a case that can not measure anything on this platform, the tests register it as SKIP_RETURN_CODE */
+const int Skipped = 77;
+
+/* A.xyz and B.xyz are two conformers of the same host guest complex */
+const std::vector<std::string> Structures = { "A.xyz", "B.xyz" };
+
+inline std::vector<std::array<double, 3>> Positions(const Matrix& geometry)
+{
+    std::vector<std::array<double, 3>> positions(geometry.rows());
+    for (int i = 0; i < geometry.rows(); ++i)
+        positions[i] = { geometry(i, 0), geometry(i, 1), geometry(i, 2) };
+    return positions;
+}
+
+/* largest deviation test returns for any of the Structures */
+inline double ForEachStructure(const std::function<double(const Molecule&)>& test)
+{
+    double deviation = 0;
+    for (const std::string& file : Structures)
+        deviation = std::max(deviation, test(Molecule(file)));
+    return deviation;
+}
+
+/* prints "<name> passed (<detail>)." or "<name> failed (<detail>)." and returns the exit code */
+template <typename Detail>
+int Report(const std::string& name, bool passed, const Detail& detail)
+{
+    std::ostringstream text;
+    text << detail;
+    std::cout << name << (passed ? " passed (" : " failed (") << text.str() << ")." << std::endl;
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+inline int Report(const std::string& name, double deviation, double tolerance)
+{
+    return Report(name, deviation < tolerance, deviation);
+}
+
+typedef std::map<std::string, std::function<int()>> Cases;
+
+/* runs the case named by the first argument, the executable itself only lists its cases */
+inline int Run(int argc, char** argv, const Cases& cases)
+{
+    if (argc < 2)
+        return EXIT_FAILURE;
+    const auto test = cases.find(argv[1]);
+    if (test == cases.end()) {
+        std::cerr << "Unknown test case " << argv[1] << std::endl;
+        return EXIT_FAILURE;
+    }
+    return test->second();
+}
+}
@@ -0,0 +1,102 @@
+/*
+ * <UFF allocation test within curcuma.>
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/core/energycalculator.h"
+#include "src/core/molecule.h"
+
+#include "testcases.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "json.hpp"
+using json = nlohmann::json;
+
+using namespace TestCases;
+
+/* Eigen and operator new both end up in malloc, so the allocator itself is wrapped.
+ * This relies on glibc, where the original functions are still reachable as __libc_* */
+static std::atomic<long> allocations(0);
+
+#ifdef __GLIBC__
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size)
+{
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+}
+const bool Counting = true;
+#else
+const bool Counting = false;
+#endif
+
+int UFFGradient(const json& parameter)
+{
+    /* without the wrapped malloc nothing would be counted */
+    if (!Counting) {
+        std::cout << "UFF gradient without heap allocations skipped (malloc is only wrapped on glibc)." << std::endl;
+        return Skipped;
+    }
+
+    Molecule m1("A.xyz");
+
+    json controller = MergeJson(UFFParameterJson, parameter);
+    controller["threads"] = 1;
+    EnergyCalculator calculator("uff", controller);
+    calculator.setMolecule(m1);
+
+    /* the first call may still set up buffers */
+    calculator.CalculateEnergy(true);
+
+    const long before = allocations;
+    double energy = 0;
+    for (int i = 0; i < 10; ++i)
+        energy = calculator.CalculateEnergy(true);
+    const long count = allocations - before;
+
+    if (count == 0)
+        return Report("UFF gradient without heap allocations", true, energy);
+    return Report("UFF gradient without heap allocations", false, std::to_string(count) + " allocations in 10 calls");
+}
+
+int main(int argc, char** argv)
+{
+    return Run(argc, argv,
+        { { "gradient", [] { return UFFGradient(json{}); } },
+            { "cutoff", [] { return UFFGradient(json{ { "vdw_cutoff", 12.0 } }); } } });
+}
@@ -0,0 +1,303 @@
+/*
+ * <UFF setup and evaluation mode tests within curcuma.>
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/core/eigen_uff.h"
+#include "src/core/energycalculator.h"
+#include "src/core/molecule.h"
+#include "src/core/rings.h"
+#include "src/core/uffcache.h"
+
+#include "testcases.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "json.hpp"
+using json = nlohmann::json;
+
+using namespace TestCases;
+
+/* A.xyz and B.xyz and two distorted copies of them are evaluated in one batch and one by one */
+int Batch(const json& parameter)
+{
+    Molecule A("A.xyz"), B("B.xyz");
+    const int atoms = A.AtomCount();
+    Matrix geometries(4, 3 * atoms);
+    for (int i = 0; i < atoms; ++i) {
+        geometries.block(0, 3 * i, 1, 3) = A.Atom(i).second.transpose();
+        geometries.block(1, 3 * i, 1, 3) = B.Atom(i).second.transpose();
+        geometries.block(2, 3 * i, 1, 3) = A.Atom(i).second.transpose() * 1.01;
+        geometries.block(3, 3 * i, 1, 3) = B.Atom(i).second.transpose() + Position{ 0.02 * std::sin(i), 0.02 * std::cos(i), 0.0 }.transpose();
+    }
+
+    EnergyCalculator calculator("uff", MergeJson(UFFParameterJson, parameter));
+    calculator.setMolecule(A);
+    Matrix gradients;
+    Vector energies = calculator.CalculateEnergies(geometries, &gradients);
+
+    double deviation = 0;
+    for (int k = 0; k < geometries.rows(); ++k) {
+        calculator.updateGeometry(Eigen::VectorXd(geometries.row(k).transpose()));
+        deviation = std::max(deviation, std::abs(calculator.CalculateEnergy(true) - energies(k)));
+        Matrix gradient = calculator.Gradient();
+        for (int i = 0; i < atoms; ++i)
+            deviation = std::max(deviation, (gradients.block(k, 3 * i, 1, 3) - gradient.row(i)).cwiseAbs().maxCoeff());
+    }
+    std::cout << "Batch energies " << energies.transpose() << std::endl;
+    return Report("UFF batch evaluation", deviation, 1e-9);
+}
+
+/* random moves of one or two atoms of A.xyz, every second one is rolled back,
+ * the summed energy changes have to agree with the energy of the final geometry */
+int Moves(const json& parameter, double step)
+{
+    Molecule molecule("A.xyz");
+    const int atoms = molecule.AtomCount();
+
+    eigenUFF uff(MergeJson(UFFParameterJson, parameter));
+    uff.setMolecule(molecule.Atoms(), molecule.Coords());
+    uff.Initialise();
+    double energy = uff.Calculate(false);
+    Matrix geometry = molecule.getGeometry();
+
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> pick(0, atoms - 1);
+    std::normal_distribution<double> shift(0, step);
+    double deviation = 0;
+    for (int move = 0; move < 500; ++move) {
+        std::vector<int> moved = { pick(rng) };
+        const int second = pick(rng);
+        if (move % 2 && second != moved[0])
+            moved.push_back(second);
+        Matrix positions(moved.size(), 3);
+        for (int a = 0; a < moved.size(); ++a)
+            positions.row(a) = geometry.row(moved[a]) + Eigen::RowVector3d(shift(rng), shift(rng), shift(rng));
+
+        const double delta = uff.DeltaEnergy(moved, positions);
+        if (move % 50 == 0)
+            deviation = std::max(deviation, std::abs(uff.Calculate(false) - energy - delta));
+        if (move % 2) {
+            uff.Rollback();
+            continue;
+        }
+        uff.Commit();
+        energy += delta;
+        for (int a = 0; a < moved.size(); ++a)
+            geometry.row(moved[a]) = positions.row(a);
+    }
+    deviation = std::max(deviation, std::abs(uff.Calculate(false) - energy));
+    return Report("UFF delta energy", deviation < 1e-9, deviation < 1e-9 ? energy : deviation);
+}
+
+/* the fast and the slow forces have to add up to the full energy and gradient */
+int Split(const json& parameter)
+{
+    const double deviation = ForEachStructure([&parameter](const Molecule& molecule) {
+        EnergyCalculator calculator("uff", MergeJson(UFFParameterJson, parameter));
+        calculator.setMolecule(molecule);
+
+        calculator.setForceGroup(FastForces);
+        const double fast = calculator.CalculateEnergy(true);
+        Matrix gradient = calculator.Gradient();
+        calculator.setForceGroup(SlowForces);
+        const double slow = calculator.CalculateEnergy(true);
+        gradient += calculator.Gradient();
+        calculator.setForceGroup(AllForces);
+        const double energy = calculator.CalculateEnergy(true);
+
+        if (std::abs(fast) < 1e-8 || std::abs(slow) < 1e-8)
+            return 1.0;
+        return std::max(std::abs(fast + slow - energy), (gradient - calculator.Gradient()).cwiseAbs().maxCoeff());
+    });
+    return Report("UFF force groups", deviation, 1e-9);
+}
+
+std::pair<double, Matrix> Energy(const std::string& file, const json& parameter)
+{
+    Molecule molecule(file);
+    EnergyCalculator calculator("uff", MergeJson(UFFParameterJson, parameter));
+    calculator.setMolecule(molecule);
+    double energy = calculator.CalculateEnergy(true);
+    return { energy, calculator.Gradient() };
+}
+
+long FileSize(const std::string& file)
+{
+    std::ifstream stream(file, std::ios::binary | std::ios::ate);
+    return stream.good() ? long(stream.tellg()) : -1;
+}
+
+/* B.xyz is a conformer of A.xyz, its terms are taken from the entry stored for A.xyz */
+int CachedConformer(const json& parameter)
+{
+    UFFParameterCache::Clear();
+    auto reference = Energy("B.xyz", parameter);
+
+    UFFParameterCache::Clear();
+    Energy("A.xyz", parameter);
+    auto cached = Energy("B.xyz", parameter);
+
+    const double deviation = std::abs(reference.first - cached.first) + (reference.second - cached.second).cwiseAbs().maxCoeff();
+    return Report("UFF parameter cache", deviation < 1e-10, deviation < 1e-10 ? cached.first : deviation);
+}
+
+/* a second process is imitated by clearing the memory, the entry has to come from the file and is not appended again */
+int CacheFile()
+{
+    const std::string file = "uff_cache_test.bin";
+    std::remove(file.c_str());
+
+    UFFParameterCache::Clear();
+    auto reference = Energy("A.xyz", json{ { "uff_cache", file } });
+    const long size = FileSize(file);
+
+    UFFParameterCache::Clear();
+    auto cached = Energy("A.xyz", json{ { "uff_cache", file } });
+    const long reread = FileSize(file);
+    std::remove(file.c_str());
+
+    const double deviation = std::abs(reference.first - cached.first) + (reference.second - cached.second).cwiseAbs().maxCoeff();
+    return Report("UFF parameter cache file", size > 0 && size == reread && deviation < 1e-10, std::to_string(size) + " bytes, deviation " + std::to_string(deviation));
+}
+
+std::vector<int> RingSizes(int atoms, const std::vector<std::pair<int, int>>& bonds)
+{
+    std::vector<std::pair<int, int>> entries;
+    for (const auto& bond : bonds) {
+        entries.push_back(bond);
+        entries.push_back({ bond.second, bond.first });
+    }
+    AdjacencyList graph;
+    graph.Build(atoms, entries);
+    RingSet rings;
+    rings.Build(graph);
+    std::vector<int> sizes;
+    for (int r = 0; r < rings.Count(); ++r) {
+        sizes.push_back(rings[r].size());
+        /* consecutive ring atoms have to be bonded */
+        for (int i = 0; i < rings[r].size(); ++i)
+            if (!graph.Contains(rings[r][i], rings[r][(i + 1) % rings[r].size()]))
+                sizes.push_back(-1);
+    }
+    return sizes;
+}
+
+/* ring systems with known smallest rings: naphthalene, cubane, norbornane, spiro[4.4]nonane, biphenyl and hexane */
+int Graphs()
+{
+    const std::vector<std::pair<int, int>> naphthalene = { { 0, 1 }, { 1, 2 }, { 2, 3 }, { 3, 4 }, { 4, 5 }, { 5, 0 }, { 4, 6 }, { 6, 7 }, { 7, 8 }, { 8, 9 }, { 9, 3 } };
+    const std::vector<std::pair<int, int>> cubane = { { 0, 1 }, { 1, 2 }, { 2, 3 }, { 3, 0 }, { 4, 5 }, { 5, 6 }, { 6, 7 }, { 7, 4 }, { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 } };
+    const std::vector<std::pair<int, int>> norbornane = { { 0, 1 }, { 1, 2 }, { 2, 3 }, { 3, 4 }, { 4, 5 }, { 5, 0 }, { 0, 6 }, { 6, 3 } };
+    const std::vector<std::pair<int, int>> spiro = { { 0, 1 }, { 1, 2 }, { 2, 3 }, { 3, 4 }, { 4, 0 }, { 4, 5 }, { 5, 6 }, { 6, 7 }, { 7, 8 }, { 8, 4 } };
+    const std::vector<std::pair<int, int>> biphenyl = { { 0, 1 }, { 1, 2 }, { 2, 3 }, { 3, 4 }, { 4, 5 }, { 5, 0 }, { 0, 6 }, { 6, 7 }, { 7, 8 }, { 8, 9 }, { 9, 10 }, { 10, 11 }, { 11, 6 } };
+    const std::vector<std::pair<int, int>> hexane = { { 0, 1 }, { 1, 2 }, { 2, 3 }, { 3, 4 }, { 4, 5 } };
+
+    bool passed = RingSizes(10, naphthalene) == std::vector<int>{ 6, 6 };
+    passed = passed && RingSizes(8, cubane) == std::vector<int>{ 4, 4, 4, 4, 4, 4 };
+    passed = passed && RingSizes(7, norbornane) == std::vector<int>{ 5, 5 };
+    passed = passed && RingSizes(9, spiro) == std::vector<int>{ 5, 5 };
+    passed = passed && RingSizes(12, biphenyl) == std::vector<int>{ 6, 6 };
+    passed = passed && RingSizes(6, hexane).empty();
+    return Report("Ring perception", passed, "6 graphs");
+}
+
+/* hydrogen terminated graphene flake with some thousand atoms: every hexagon is found, their number is the cycle rank
+ * of the carbon skeleton, every carbon is typed C_R and an isolated ethene next to it stays C_2 */
+int Polyaromatic()
+{
+    const double d = 1.42;
+    std::vector<Eigen::Vector3d> carbons;
+    for (int i = 0; i < 44; ++i)
+        for (int j = 0; j < 50; ++j) {
+            const Eigen::Vector3d site(1.5 * d * i, std::sqrt(3.0) * d * (j + 0.5 * (i % 2)), 0.0);
+            carbons.push_back(site);
+            carbons.push_back(site + Eigen::Vector3d(d, 0, 0));
+        }
+    /* drop dangling atoms until every carbon has two or three partners */
+    auto partners = [&carbons, d](int atom) {
+        std::vector<int> list;
+        for (int other = 0; other < carbons.size(); ++other)
+            if (other != atom && (carbons[atom] - carbons[other]).norm() < 1.1 * d)
+                list.push_back(other);
+        return list;
+    };
+    for (bool pruned = true; pruned;) {
+        pruned = false;
+        for (int atom = 0; atom < carbons.size(); ++atom)
+            if (partners(atom).size() < 2) {
+                carbons.erase(carbons.begin() + atom--);
+                pruned = true;
+            }
+    }
+    std::vector<int> elements;
+    std::vector<std::array<double, 3>> geometry;
+    int bonds = 0;
+    for (int atom = 0; atom < carbons.size(); ++atom) {
+        geometry.push_back({ carbons[atom](0), carbons[atom](1), carbons[atom](2) });
+        elements.push_back(6);
+        const std::vector<int> list = partners(atom);
+        bonds += list.size();
+        if (list.size() == 2) {
+            const Eigen::Vector3d direction = (2 * carbons[atom] - carbons[list[0]] - carbons[list[1]]).normalized();
+            const Eigen::Vector3d hydrogen = carbons[atom] + 1.09 * direction;
+            geometry.push_back({ hydrogen(0), hydrogen(1), hydrogen(2) });
+            elements.push_back(1);
+        }
+    }
+    const int rank = bonds / 2 - int(carbons.size()) + 1;
+    const int flake = elements.size();
+    for (const auto& position : std::vector<std::array<double, 3>>{ { -20, 0, 0 }, { -21.33, 0, 0 }, { -19.43, 0.92, 0 }, { -19.43, -0.92, 0 }, { -21.9, 0.92, 0 }, { -21.9, -0.92, 0 } }) {
+        geometry.push_back(position);
+        elements.push_back(geometry.size() - flake < 3 ? 6 : 1);
+    }
+
+    eigenUFF uff(MergeJson(UFFParameterJson, json{ { "vdw_cutoff", 8.0 }, { "rings", true } }));
+    uff.setMolecule(elements, geometry);
+    uff.Initialise();
+
+    bool passed = uff.Rings().Count() == rank;
+    for (int r = 0; r < uff.Rings().Count(); ++r)
+        passed = passed && uff.Rings()[r].size() == 6;
+    for (int atom = 0; atom < flake; ++atom)
+        passed = passed && (elements[atom] == 1 || uff.UFFAtomTypes()[atom] == 10);
+    passed = passed && uff.UFFAtomTypes()[flake] == 11 && uff.UFFAtomTypes()[flake + 1] == 11;
+    return Report("Polyaromatic ring typing", passed, std::to_string(elements.size()) + " atoms, " + std::to_string(uff.Rings().Count()) + " of " + std::to_string(rank) + " rings");
+}
+
+int main(int argc, char** argv)
+{
+    return Run(argc, argv,
+        { { "batch_conformer", [] { return Batch(json{}); } },
+            { "batch_cutoff", [] { return Batch(json{ { "vdw_cutoff", 12.0 } }); } },
+            { "delta_moves", [] { return Moves(json{}, 0.1); } },
+            /* steps beyond the skin force new pair lists */
+            { "delta_cutoff", [] { return Moves(json{ { "vdw_cutoff", 5.0 } }, 0.7); } },
+            { "forcegroups_split", [] { return Split(json{}); } },
+            { "forcegroups_cutoff", [] { return Split(json{ { "vdw_cutoff", 12.0 } }); } },
+            { "cache_conformer", [] { return CachedConformer(json{}); } },
+            { "cache_cutoff", [] { return CachedConformer(json{ { "vdw_cutoff", 12.0 } }); } },
+            { "cache_file", CacheFile },
+            { "rings_graphs", Graphs },
+            { "rings_polyaromatic", Polyaromatic } });
+}
@@ -0,0 +1,242 @@
+/*
+ * <UFF periodic, electrostatic and hydrogen bond correction tests within curcuma.>
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/core/celllist.h"
+#include "src/core/eigen_uff.h"
+#include "src/core/molecule.h"
+#include "src/core/unitcell.h"
+
+#include "testcases.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "json.hpp"
+using json = nlohmann::json;
+
+using namespace TestCases;
+
+/* largest deviation of the first atoms of gradient from central differences of the energy of uff */
+double NumericalGradient(eigenUFF& uff, const std::vector<std::array<double, 3>>& geometry, Matrix gradient, int atoms)
+{
+    double deviation = 0;
+    const double h = 1e-5;
+    for (int i = 0; i < std::min(int(geometry.size()), atoms); ++i)
+        for (int c = 0; c < 3; ++c) {
+            std::vector<std::array<double, 3>> displaced = geometry;
+            displaced[i][c] += h;
+            uff.UpdateGeometry(displaced);
+            const double plus = uff.Calculate(false);
+            displaced[i][c] -= 2 * h;
+            uff.UpdateGeometry(displaced);
+            const double minus = uff.Calculate(false);
+            deviation = std::max(deviation, std::abs((plus - minus) / (2 * h) - gradient(i, c)));
+        }
+    return deviation;
+}
+
+/* the structures in a cell wider than the molecule plus twice the cutoff: the isolated molecule with the same cutoff
+ * has to give the same energy, also after every atom was wrapped into the cell and after the atoms were shifted by lattice vectors */
+int Periodic(const Eigen::Matrix3d& shape)
+{
+    const json parameter = MergeJson(UFFParameterJson, json{ { "vdw_cutoff", 8.0 } });
+    const double deviation = ForEachStructure([&](const Molecule& molecule) {
+        const Matrix geometry = molecule.getGeometry();
+        const Eigen::Vector3d extent = geometry.colwise().maxCoeff() - geometry.colwise().minCoeff();
+        const UnitCell cell(shape * (2 * extent.maxCoeff() + 25.0));
+
+        eigenUFF isolated(parameter);
+        isolated.setMolecule(molecule.Atoms(), molecule.Coords());
+        isolated.Initialise();
+        const double energy = isolated.Calculate(true);
+        const Matrix gradient = isolated.Gradient();
+
+        Matrix wrapped = geometry, shifted = geometry;
+        for (int i = 0; i < geometry.rows(); ++i) {
+            wrapped.row(i) = cell.Wrap(geometry.row(i).transpose()).transpose();
+            shifted.row(i) += ((i % 3) - 1) * cell.Vectors().row(i % 3) + (i % 2) * cell.Vectors().row((i + 1) % 3);
+        }
+        double deviation = 0;
+        for (const Matrix* coordinates : { &wrapped, &shifted }) {
+            for (int gradient_type : { 0, 1 }) {
+                eigenUFF periodic(MergeJson(parameter, json{ { "gradient", gradient_type } }));
+                periodic.setMolecule(molecule.Atoms(), Positions(*coordinates));
+                periodic.setCell(cell);
+                periodic.Initialise();
+                deviation = std::max(deviation, std::abs(periodic.Calculate(true) - energy));
+                deviation = std::max(deviation, (periodic.Gradient() - gradient).cwiseAbs().maxCoeff());
+            }
+        }
+
+        /* the lattice has to survive the extended XYZ comment line */
+        Molecule boxed(molecule);
+        boxed.setCell(cell);
+        Molecule reread;
+        reread.setXYZComment(boxed.Header());
+        if (!reread.isPeriodic())
+            return 1.0;
+        return std::max(deviation, (reread.Cell().Vectors() - cell.Vectors()).cwiseAbs().maxCoeff());
+    });
+    return Report("UFF periodic boundary conditions", deviation, 1e-9);
+}
+
+/* dense points in a small triclinic cell, the periodic cell list has to find exactly the minimum image pairs of the brute force search */
+int PairSearch()
+{
+    Eigen::Matrix3d vectors;
+    vectors << 9.0, 0.0, 0.0, 2.5, 8.0, 0.0, -1.5, 2.0, 10.0;
+    const UnitCell cell(vectors);
+
+    const int atoms = 400;
+    Matrix geometry(atoms, 3);
+    for (int i = 0; i < atoms; ++i)
+        geometry.row(i) = (vectors.transpose() * Eigen::Vector3d(std::sin(1.3 * i) + 0.2, std::cos(2.1 * i), std::sin(0.7 * i + 1.0) * 1.4)).transpose();
+
+    /* three or more grid cells per direction and the folded grid with less than three */
+    int found = 0, expected = 0;
+    double deviation = 0;
+    for (double cutoff : { 0.3 * cell.Width(), 0.45 * cell.Width() }) {
+        double expected_sum = 0;
+        for (int i = 0; i < atoms; ++i)
+            for (int j = i + 1; j < atoms; ++j) {
+                const double r2 = cell.MinimumImage((geometry.row(i) - geometry.row(j)).transpose()).squaredNorm();
+                if (r2 < cutoff * cutoff) {
+                    expected++;
+                    expected_sum += r2;
+                }
+            }
+
+        CellList cells;
+        cells.Build(geometry, cutoff, cell);
+        double found_sum = 0;
+        cells.ForEachPair(geometry, [&](int, int, double r2) {
+            found++;
+            found_sum += r2;
+        });
+        deviation = std::max(deviation, std::abs(found_sum - expected_sum) / expected_sum);
+    }
+    return Report("UFF periodic cell list", found == expected && deviation < 1e-12, std::to_string(found) + " of " + std::to_string(expected) + " pairs");
+}
+
+/* the electrostatic gradient has to match central differences of the energy, the electrostatic energy has to be
+ * linear in coulomb_scaling and the equilibrated charges have to add up to the total charge */
+int Coulomb(const json& parameter, bool qeq)
+{
+    const double deviation = ForEachStructure([&](const Molecule& molecule) {
+        const std::vector<std::array<double, 3>> geometry = molecule.Coords();
+        std::vector<double> charges(molecule.AtomCount());
+        for (int i = 0; i < charges.size(); ++i)
+            charges[i] = 0.3 * std::sin(1.7 * i);
+
+        double deviation = 0, energies[3];
+        for (int scaling : { 0, 1, 2 }) {
+            eigenUFF uff(MergeJson(UFFParameterJson, MergeJson(parameter, json{ { "coulomb_scaling", scaling } })));
+            uff.setMolecule(molecule.Atoms(), geometry);
+            uff.Initialise();
+            if (!qeq)
+                uff.setCharges(charges);
+            else
+                deviation = std::max(deviation, std::abs(uff.Charges().sum()));
+            energies[scaling] = uff.Calculate(true);
+            if (scaling == 1)
+                deviation = std::max(deviation, NumericalGradient(uff, geometry, uff.Gradient(), 12));
+        }
+        const double coulomb = energies[1] - energies[0];
+        if (std::abs(coulomb) < 1e-6)
+            return 1.0;
+        return std::max(deviation, std::abs(energies[2] - energies[0] - 2 * coulomb));
+    });
+    return Report("UFF electrostatics", deviation, 1e-7);
+}
+
+const json Corrections = MergeJson(UFFParameterJson, json{ { "h4_scaling", 1.0 }, { "hh_scaling", 1.0 } });
+
+/* the H4 and HH gradients have to match central differences of the correction energies */
+int H4Gradient()
+{
+    const double deviation = ForEachStructure([](const Molecule& molecule) {
+        double deviation = 0, energies[2];
+        Matrix gradients[2];
+        for (int corrections : { 0, 1 }) {
+            eigenUFF uff(corrections ? Corrections : UFFParameterJson);
+            uff.setMolecule(molecule.Atoms(), molecule.Coords());
+            uff.Initialise();
+            energies[corrections] = uff.Calculate(true);
+            gradients[corrections] = uff.Gradient();
+            if (corrections)
+                deviation = NumericalGradient(uff, molecule.Coords(), gradients[1], 24);
+        }
+        /* both corrections have to contribute */
+        if (std::abs(energies[1] - energies[0]) < 1e-6 || (gradients[1] - gradients[0]).cwiseAbs().maxCoeff() < 1e-6)
+            return 1.0;
+        return deviation;
+    });
+    return Report("UFF H4 and HH gradient", deviation, 1e-7);
+}
+
+/* copies of the structures far apart do not see each other, the corrections only search the neighbourhood
+ * and have to give the sum of the isolated copies */
+int H4Replicas()
+{
+    const int copies = 6;
+    const double deviation = ForEachStructure([copies](const Molecule& molecule) {
+        const int atoms = molecule.AtomCount();
+        std::vector<int> elements;
+        std::vector<std::array<double, 3>> positions;
+        for (int copy = 0; copy < copies; ++copy)
+            for (int i = 0; i < atoms; ++i) {
+                elements.push_back(molecule.Atom(i).first);
+                positions.push_back({ molecule.Atom(i).second(0) + copy * 100.0, molecule.Atom(i).second(1), molecule.Atom(i).second(2) });
+            }
+
+        eigenUFF single(MergeJson(Corrections, json{ { "vdw_cutoff", 12.0 } }));
+        single.setMolecule(molecule.Atoms(), molecule.Coords());
+        single.Initialise();
+        const double energy = single.Calculate(true);
+        const Matrix gradient = single.Gradient();
+
+        eigenUFF replicas(MergeJson(Corrections, json{ { "vdw_cutoff", 12.0 } }));
+        replicas.setMolecule(elements, positions);
+        replicas.Initialise();
+        double deviation = std::abs(replicas.Calculate(true) - copies * energy);
+        const Matrix replica_gradient = replicas.Gradient();
+        for (int copy = 0; copy < copies; ++copy)
+            deviation = std::max(deviation, (replica_gradient.middleRows(copy * atoms, atoms) - gradient).cwiseAbs().maxCoeff());
+        return deviation;
+    });
+    return Report("UFF H4 and HH replicas", deviation, 1e-9);
+}
+
+int main(int argc, char** argv)
+{
+    Eigen::Matrix3d orthorhombic, triclinic;
+    orthorhombic << 1.0, 0.0, 0.0, 0.0, 1.1, 0.0, 0.0, 0.0, 1.2;
+    triclinic << 1.0, 0.0, 0.0, 0.3, 1.1, 0.0, -0.2, 0.25, 1.2;
+    return Run(argc, argv,
+        { { "periodic_orthorhombic", [&orthorhombic] { return Periodic(orthorhombic); } },
+            { "periodic_triclinic", [&triclinic] { return Periodic(triclinic); } },
+            { "periodic_celllist", PairSearch },
+            { "coulomb_exact", [] { return Coulomb(json{}, false); } },
+            { "coulomb_cutoff", [] { return Coulomb(json{ { "vdw_cutoff", 8.0 } }, false); } },
+            { "coulomb_qeq", [] { return Coulomb(json{ { "vdw_cutoff", 8.0 }, { "charges", "qeq" } }, true); } },
+            { "h4_gradient", H4Gradient },
+            { "h4_replicas", H4Replicas } });
+}
@@ -0,0 +1,312 @@
+/*
+ * <UFF term kernel and derivative tests within curcuma.>
+ * Copyright (C) 2023 Conrad Hübler <Conrad.Huebler@gmx.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/capabilities/rmsd_functions.h"
+#include "src/core/eigen_uff.h"
+#include "src/core/elements.h"
+#include "src/core/forcefieldderivaties.h"
+#include "src/core/hessian.h"
+#include "src/core/isa.h"
+#include "src/core/molecule.h"
+#include "src/core/unitcell.h"
+
+#include "testcases.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "json.hpp"
+using json = nlohmann::json;
+
+using namespace TestCases;
+
+/* the dual number gradient, on threads with their atom windows, has to reproduce energy and gradient of the
+ * vectorised kernels, the Hessian-vector product has to agree with the assembled Hessian */
+int AutoDiff(const json& parameter)
+{
+    const double deviation = ForEachStructure([&parameter](const Molecule& molecule) {
+        eigenUFF kernels(MergeJson(UFFParameterJson, parameter));
+        kernels.setMolecule(molecule.Atoms(), molecule.Coords());
+        kernels.Initialise();
+        const double energy = kernels.Calculate(true);
+
+        eigenUFF dual(MergeJson(UFFParameterJson, MergeJson(parameter, json{ { "gradient", 1 }, { "threads", 4 } })));
+        dual.setMolecule(molecule.Atoms(), molecule.Coords());
+        dual.Initialise();
+        double deviation = std::abs(dual.Calculate(true) - energy);
+        deviation = std::max(deviation, (dual.Gradient() - kernels.Gradient()).cwiseAbs().maxCoeff());
+
+        Vector direction(3 * molecule.AtomCount());
+        for (int c = 0; c < direction.size(); ++c)
+            direction(c) = std::sin(c + 1.0);
+        const Vector reference = kernels.SparseHessian() * direction;
+        return std::max(deviation, (dual.HessianVectorProduct(direction) - reference).cwiseAbs().maxCoeff() / reference.cwiseAbs().maxCoeff());
+    });
+    return Report("UFF automatic differentiation", deviation, 1e-9);
+}
+
+/* largest deviation of the derivate of quantity from central differences of its value, x holds the atoms of one term */
+template <int Atoms, typename Quantity>
+double Derivate(Eigen::Vector3d* x, const Quantity& quantity)
+{
+    Eigen::Matrix<double, Atoms, 3> derivate;
+    quantity(x, derivate, true);
+    double deviation = 0;
+    const double d = 1e-6;
+    for (int a = 0; a < Atoms; ++a)
+        for (int c = 0; c < 3; ++c) {
+            Eigen::Matrix<double, Atoms, 3> unused;
+            x[a](c) += d;
+            const double forward = quantity(x, unused, false);
+            x[a](c) -= 2 * d;
+            const double backward = quantity(x, unused, false);
+            x[a](c) += d;
+            deviation = std::max(deviation, std::abs((forward - backward) / (2 * d) - derivate(a, c)));
+        }
+    return deviation;
+}
+
+/* the scalar derivates of forcefieldderivaties.h against central differences, for consecutive atoms of A.xyz */
+int Derivates()
+{
+    Molecule molecule("A.xyz");
+    double deviation = 0;
+    for (int first = 0; first + 3 < molecule.AtomCount(); ++first) {
+        Eigen::Vector3d x[4];
+        for (int a = 0; a < 4; ++a)
+            x[a] = molecule.Atom(first + a).second;
+        deviation = std::max(deviation, Derivate<2>(x, [](const Eigen::Vector3d* r, BondDerivate& derivate, bool gradient) { return BondStretching(r[0], r[1], derivate, gradient); }));
+        deviation = std::max(deviation, Derivate<3>(x, [](const Eigen::Vector3d* r, AngleDerivate& derivate, bool gradient) { return AngleBending(r[0], r[1], r[2], derivate, gradient); }));
+        deviation = std::max(deviation, Derivate<4>(x, [](const Eigen::Vector3d* r, TorsionDerivate& derivate, bool gradient) { return Torsion(r[0], r[1], r[2], r[3], derivate, gradient); }));
+        deviation = std::max(deviation, Derivate<4>(x, [](const Eigen::Vector3d* r, TorsionDerivate& derivate, bool gradient) { return OutOfPlane(r[0], r[1], r[2], r[3], derivate, gradient); }));
+    }
+    return Report("Force field derivates", deviation, 1e-7);
+}
+
+/* the analytic Hessian of molecule against central differences of the analytic gradient */
+int AnalyticHessian(const Molecule& molecule, const json& parameter, const std::string& name)
+{
+    const int atoms = molecule.AtomCount();
+    Matrix displaced(6 * atoms, 3 * atoms);
+    for (int i = 0; i < atoms; ++i)
+        for (int row = 0; row < 6 * atoms; ++row)
+            displaced.block(row, 3 * i, 1, 3) = molecule.Atom(i).second.transpose();
+    const double d = 1e-4;
+    for (int c = 0; c < 3 * atoms; ++c) {
+        displaced(2 * c, c) += d;
+        displaced(2 * c + 1, c) -= d;
+    }
+
+    eigenUFF uff(MergeJson(UFFParameterJson, parameter));
+    uff.setMolecule(molecule.Atoms(), molecule.Coords());
+    uff.setCell(molecule.Cell());
+    uff.Initialise();
+    Matrix hessian = Matrix(uff.SparseHessian());
+
+    Matrix gradients;
+    uff.CalculateBatch(displaced, &gradients);
+    Matrix numerical(3 * atoms, 3 * atoms);
+    for (int c = 0; c < 3 * atoms; ++c)
+        numerical.row(c) = (gradients.row(2 * c) - gradients.row(2 * c + 1)) / (2 * d);
+    numerical = (numerical + numerical.transpose()) / 2;
+
+    const double deviation = (hessian - numerical).cwiseAbs().maxCoeff() / hessian.cwiseAbs().maxCoeff();
+    return Report(name, uff.HasAnalyticHessian() && deviation < 1e-6 && (hessian - hessian.transpose()).cwiseAbs().maxCoeff() < 1e-10, deviation);
+}
+
+/* A.xyz wrapped into a cell that is only a little wider than the molecule: bonds, angles and vdW pairs reach across
+ * the faces of the cell and have to be differentiated at the minimum images of their atoms */
+int WrappedHessian()
+{
+    Molecule molecule("A.xyz");
+    Matrix geometry = molecule.getGeometry();
+    const Eigen::Vector3d extent = geometry.colwise().maxCoeff() - geometry.colwise().minCoeff();
+    const double width = extent.maxCoeff() + 6.0;
+    const Eigen::RowVector3d center = geometry.colwise().mean();
+    for (int i = 0; i < geometry.rows(); ++i)
+        for (int c = 0; c < 3; ++c)
+            geometry(i, c) = geometry(i, c) - center(c) - width * std::floor((geometry(i, c) - center(c)) / width);
+    molecule.setGeometry(geometry);
+    molecule.setCell(UnitCell(Eigen::Matrix3d::Identity() * width));
+    return AnalyticHessian(molecule, json{ { "vdw_cutoff", 0.4 * width } }, "Analytic UFF Hessian in a cell");
+}
+
+/* A.xyz in a cell much wider than the cutoff: the Hessian of the molecule in the cell has to be analytic and has to be
+ * the one of the isolated molecule with the same cutoff */
+int PeriodicHessian()
+{
+    const json controller = MergeJson(UFFParameterJson, json{ { "vdw_cutoff", 8.0 } });
+    Molecule molecule("A.xyz");
+    Hessian isolated("uff", controller, 1);
+    isolated.setMolecule(molecule);
+    isolated.CalculateHessian();
+
+    const Matrix geometry = molecule.getGeometry();
+    const Eigen::Vector3d extent = geometry.colwise().maxCoeff() - geometry.colwise().minCoeff();
+    molecule.setCell(UnitCell(Eigen::Matrix3d::Identity() * (2 * extent.maxCoeff() + 25.0)));
+    Hessian periodic("uff", controller, 1);
+    periodic.setMolecule(molecule);
+    periodic.CalculateHessian();
+
+    const double deviation = (periodic.getHessian() - isolated.getHessian()).cwiseAbs().maxCoeff() / isolated.getHessian().cwiseAbs().maxCoeff();
+    return Report("Periodic UFF Hessian", isolated.isAnalytic() && periodic.isAnalytic() && deviation < 1e-10, deviation);
+}
+
+/* energies and gradients of "precision": "single" have to stay close to the double precision path, relative to the
+ * largest gradient entry. Switching back to double has to reproduce the double precision results exactly */
+int Single(const json& parameter)
+{
+    double energy_deviation = 0, gradient_deviation = 0;
+    const double restored = ForEachStructure([&](const Molecule& molecule) {
+        std::vector<double> charges(molecule.AtomCount());
+        for (int i = 0; i < charges.size(); ++i)
+            charges[i] = 0.3 * std::sin(1.7 * i);
+
+        eigenUFF reference(MergeJson(UFFParameterJson, parameter));
+        reference.setMolecule(molecule.Atoms(), molecule.Coords());
+        reference.Initialise();
+        reference.setCharges(charges);
+        const double energy = reference.Calculate(true);
+        const Matrix gradient = reference.Gradient();
+
+        eigenUFF uff(MergeJson(UFFParameterJson, MergeJson(parameter, json{ { "precision", "single" } })));
+        uff.setMolecule(molecule.Atoms(), molecule.Coords());
+        uff.Initialise();
+        uff.setCharges(charges);
+        double restored = uff.SinglePrecision() ? 0 : 1;
+        energy_deviation = std::max(energy_deviation, std::abs(uff.Calculate(true) - energy) / std::max(1.0, std::abs(energy)));
+        gradient_deviation = std::max(gradient_deviation, (uff.Gradient() - gradient).cwiseAbs().maxCoeff() / gradient.cwiseAbs().maxCoeff());
+        uff.UpdateGeometry(molecule.Coords());
+        energy_deviation = std::max(energy_deviation, std::abs(uff.Calculate(false) - energy) / std::max(1.0, std::abs(energy)));
+
+        uff.setSinglePrecision(false);
+        uff.UpdateGeometry(molecule.Coords());
+        restored = std::max(restored, std::abs(uff.Calculate(true) - energy));
+        return std::max(restored, (uff.Gradient() - gradient).cwiseAbs().maxCoeff());
+    });
+
+    std::cout << "Maximal deviation of single precision, energy " << energy_deviation << " gradient " << gradient_deviation << std::endl;
+    return Report("UFF single precision", energy_deviation < 1e-5 && gradient_deviation < 1e-4 && restored < 1e-12, std::max(energy_deviation, gradient_deviation));
+}
+
+std::vector<ISA::Level> Levels()
+{
+    std::vector<ISA::Level> levels;
+    for (ISA::Level level : { ISA::Generic, ISA::AVX2, ISA::AVX512 })
+        if (level <= ISA::Detected())
+            levels.push_back(level);
+    return levels;
+}
+
+/* every level the cpu supports has to reproduce the energies and gradients of the generic kernels,
+ * single structures as well as a batch of displaced conformers */
+int ISAKernels()
+{
+    const double deviation = ForEachStructure([](const Molecule& molecule) {
+        const int atoms = molecule.AtomCount();
+        Matrix conformers(5, 3 * atoms);
+        for (int k = 0; k < conformers.rows(); ++k)
+            for (int i = 0; i < atoms; ++i)
+                for (int c = 0; c < 3; ++c)
+                    conformers(k, 3 * i + c) = molecule.Atom(i).second(c) + 0.01 * k * std::sin(3.0 * i + c);
+
+        double deviation = 0, reference_energy = 0;
+        Matrix reference_gradient, reference_batch_gradient;
+        Vector reference_batch;
+        for (ISA::Level level : Levels()) {
+            ISA::Select(ISA::Name(level));
+            eigenUFF uff(MergeJson(UFFParameterJson, json{ { "vdw_cutoff", 12.0 } }));
+            uff.setMolecule(molecule.Atoms(), molecule.Coords());
+            uff.Initialise();
+            const double energy = uff.Calculate(true);
+            Matrix batch_gradient;
+            const Vector batch = uff.CalculateBatch(conformers, &batch_gradient);
+            if (level == ISA::Generic) {
+                reference_energy = energy;
+                reference_gradient = uff.Gradient();
+                reference_batch = batch;
+                reference_batch_gradient = batch_gradient;
+                continue;
+            }
+            deviation = std::max(deviation, std::abs(energy - reference_energy));
+            deviation = std::max(deviation, (uff.Gradient() - reference_gradient).cwiseAbs().maxCoeff());
+            deviation = std::max(deviation, (batch - reference_batch).cwiseAbs().maxCoeff());
+            deviation = std::max(deviation, (batch_gradient - reference_batch_gradient).cwiseAbs().maxCoeff());
+        }
+        return deviation;
+    });
+    ISA::Select("auto");
+    return Report("UFF kernels of " + std::to_string(Levels().size()) + " instruction sets", deviation, 1e-9);
+}
+
+/* distance matrices, covariance and rotation of every level have to match the plain Eigen expressions */
+int ISAGeometries()
+{
+    const double deviation = ForEachStructure([](const Molecule& molecule) {
+        const int atoms = molecule.AtomCount();
+        const Geometry geometry = molecule.getGeometry();
+        Geometry target = geometry;
+        target.rowwise() -= target.colwise().mean();
+        Geometry reference = target;
+        const Eigen::Matrix3d turn = Eigen::AngleAxisd(0.7, Eigen::Vector3d(1, 2, 3).normalized()).toRotationMatrix();
+        reference = reference * turn;
+
+        double deviation = 0;
+        for (ISA::Level level : Levels()) {
+            ISA::Select(ISA::Name(level));
+            const auto matrices = molecule.DistanceMatrix();
+            const std::vector<float> lower = molecule.LowerDistanceVector();
+            int index = 0;
+            for (int i = 0; i < atoms; ++i)
+                for (int j = 0; j < atoms; ++j) {
+                    const double distance = (geometry.row(i) - geometry.row(j)).norm();
+                    const bool bond = i != j && distance <= (Elements::CovalentRadius[molecule.Atom(i).first] + Elements::CovalentRadius[molecule.Atom(j).first]) * 1.5;
+                    deviation = std::max(deviation, std::abs(matrices.first(i, j) - distance));
+                    deviation = std::max(deviation, std::abs(matrices.second(i, j) - bond));
+                    if (j < i && std::abs(lower[index++] - distance) > 1e-6 * distance)
+                        deviation = 1;
+                }
+            deviation = std::max(deviation, (GeometryKernels::Covariance(reference, target) - reference.transpose() * target).cwiseAbs().maxCoeff());
+            deviation = std::max(deviation, (RMSDFunctions::applyRotation(target, turn) - target * turn).cwiseAbs().maxCoeff());
+            /* the best fit rotation has to undo the turn */
+            deviation = std::max(deviation, RMSDFunctions::getRMSD(reference, RMSDFunctions::getAligned(reference, target, 1)));
+        }
+        return deviation;
+    });
+    ISA::Select("auto");
+    return Report("Geometry kernels of " + std::to_string(Levels().size()) + " instruction sets", deviation, 1e-9);
+}
+
+int main(int argc, char** argv)
+{
+    return Run(argc, argv,
+        { { "autodiff_exact", [] { return AutoDiff(json{}); } },
+            { "autodiff_cutoff", [] { return AutoDiff(json{ { "vdw_cutoff", 5.0 } }); } },
+            { "autodiff_derivates", Derivates },
+            { "hessian_analytic", [] { return AnalyticHessian(Molecule("A.xyz"), json{}, "Analytic UFF Hessian"); } },
+            { "hessian_cutoff", [] { return AnalyticHessian(Molecule("A.xyz"), json{ { "vdw_cutoff", 5.0 } }, "Analytic UFF Hessian"); } },
+            { "hessian_periodic", PeriodicHessian },
+            { "hessian_wrapped", WrappedHessian },
+            { "single_exact", [] { return Single(json{}); } },
+            { "single_cutoff", [] { return Single(json{ { "vdw_cutoff", 8.0 } }); } },
+            { "isa_uff", ISAKernels },
+            { "isa_geometry", ISAGeometries } });
+}